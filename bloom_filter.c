@@ -0,0 +1,176 @@
+/*
+ * bloom_filter.c
+ *
+ * The dictionary's hash is djb2, whose low bits are weak and which also
+ * selects the dictionary slot, so the hash is run through the integer mixer
+ * once more before choosing the block and counters. That costs a couple of
+ * multiplications, not a second pass over the key.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "bloom_filter.h"
+#include "hash.h"
+
+/* ---------- private declarations ---------- */
+
+/*
+ * Returns the block for a hash value, and fills in the counter positions
+ * within the block
+ */
+unsigned char *
+bloom_filter_probes(bloom_filter_t *filter, unsigned long hash, int *positions);
+
+
+/* ---------- public definitions ---------- */
+
+/*
+ * Allocate a filter sized for expected_entries
+ *
+ * expected_entries - number of entries the filter should hold
+ * counters_per_entry - more counters mean fewer false positives, 8 gives
+ * 		about 3% once expected_entries are added (4 bytes per entry);
+ * 		2.2% for an unblocked filter, a little more here because all
+ * 		of a key's counters share one cache line
+ */
+bloom_filter_t *
+new_bloom_filter(long expected_entries, int counters_per_entry)
+{
+	bloom_filter_t *filter = calloc(1, sizeof(bloom_filter_t));
+
+	if (expected_entries < 1)
+		expected_entries = 1;
+	if (counters_per_entry < 1)
+		counters_per_entry = 1;
+
+	filter->num_blocks = (expected_entries * counters_per_entry + BLOOM_BLOCK_COUNTERS - 1) / BLOOM_BLOCK_COUNTERS;
+
+	// the optimal number of probes is counters per entry * ln 2
+	filter->num_probes = (counters_per_entry * 69 + 50) / 100;
+	if (filter->num_probes < 1)
+		filter->num_probes = 1;
+	if (filter->num_probes > BLOOM_MAX_PROBES)
+		filter->num_probes = BLOOM_MAX_PROBES;
+
+	// align the blocks with cache lines
+	void *counters;
+	if (posix_memalign(&counters, BLOOM_BLOCK_BYTES, filter->num_blocks * BLOOM_BLOCK_BYTES) != 0) {
+		fprintf(stderr, "Unable to allocate %lu blocks for bloom filter\n", filter->num_blocks);
+		free(filter);
+		return NULL;
+	}
+	memset(counters, 0, filter->num_blocks * BLOOM_BLOCK_BYTES);
+	filter->counters = (unsigned char *)counters;
+
+	return filter;
+}
+
+/*
+ * Returns a copy of a filter, or NULL if it could not be allocated
+ */
+bloom_filter_t *
+bloom_filter_clone(bloom_filter_t *filter)
+{
+	bloom_filter_t *copy = calloc(1, sizeof(bloom_filter_t));
+	if (copy == NULL)
+		return NULL;
+
+	void *counters;
+	if (posix_memalign(&counters, BLOOM_BLOCK_BYTES, filter->num_blocks * BLOOM_BLOCK_BYTES) != 0) {
+		fprintf(stderr, "Unable to allocate %lu blocks for bloom filter\n", filter->num_blocks);
+		free(copy);
+		return NULL;
+	}
+	memcpy(counters, filter->counters, filter->num_blocks * BLOOM_BLOCK_BYTES);
+
+	*copy = *filter;
+	copy->counters = (unsigned char *)counters;
+	return copy;
+}
+
+/*
+ * Free a filter created by new_bloom_filter()
+ */
+void
+free_bloom_filter(bloom_filter_t *filter)
+{
+	free(filter->counters);
+	free(filter);
+}
+
+/*
+ * Record an entry with the given hash value
+ */
+void
+bloom_filter_add(bloom_filter_t *filter, unsigned long hash)
+{
+	int positions[BLOOM_MAX_PROBES];
+	unsigned char *block = bloom_filter_probes(filter, hash, positions);
+
+	for (int i=0; i < filter->num_probes; i++) {
+		unsigned char *byte = &block[positions[i] >> 1];
+		int shift = (positions[i] & 1) * 4;
+		if (((*byte >> shift) & 0xf) != 0xf)
+			*byte += (1 << shift);
+	}
+}
+
+/*
+ * Forget an entry previously recorded with bloom_filter_add()
+ */
+void
+bloom_filter_delete(bloom_filter_t *filter, unsigned long hash)
+{
+	int positions[BLOOM_MAX_PROBES];
+	unsigned char *block = bloom_filter_probes(filter, hash, positions);
+
+	for (int i=0; i < filter->num_probes; i++) {
+		unsigned char *byte = &block[positions[i] >> 1];
+		int shift = (positions[i] & 1) * 4;
+		int count = (*byte >> shift) & 0xf;
+		// a saturated counter has lost track of how many entries it holds
+		if ((count != 0) && (count != 0xf))
+			*byte -= (1 << shift);
+	}
+}
+
+/*
+ * Returns 0 if no entry with this hash value was added, 1 if one may have been
+ */
+int
+bloom_filter_may_contain(bloom_filter_t *filter, unsigned long hash)
+{
+	int positions[BLOOM_MAX_PROBES];
+	unsigned char *block = bloom_filter_probes(filter, hash, positions);
+
+	for (int i=0; i < filter->num_probes; i++) {
+		if (((block[positions[i] >> 1] >> ((positions[i] & 1) * 4)) & 0xf) == 0)
+			return 0;
+	}
+	return 1;
+}
+
+/* --- private functions --- */
+
+/*
+ * Returns the block for a hash value, and fills in the counter positions
+ * within the block
+ */
+unsigned char *
+bloom_filter_probes(bloom_filter_t *filter, unsigned long hash, int *positions)
+{
+	unsigned long mixed = hash_int64(hash);
+	long block = mixed % filter->num_blocks;
+
+	// 7 bits select one of the 128 counters in the block, 8 probes use 56 bits
+	// of a second mix so they are independent of the block number
+	unsigned long bits = hash_int64(mixed);
+	for (int i=0; i < filter->num_probes; i++) {
+		positions[i] = bits & (BLOOM_BLOCK_COUNTERS - 1);
+		bits >>= 7;
+	}
+
+	return &filter->counters[block * BLOOM_BLOCK_BYTES];
+}
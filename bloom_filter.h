@@ -0,0 +1,69 @@
+/*
+ * bloom_filter.h - counting Bloom filter over precomputed hash values
+ *
+ * The filter never hashes keys itself, it is fed the full hash value the
+ * dictionary has already computed. Counters are 4 bits wide so that entries
+ * can be deleted, and all the counters probed for one hash fall within a
+ * single 64-byte block, so a query costs one cache miss at most.
+ *
+ * A counter that reaches 15 stays there: deleting can then no longer
+ * clear it, which can only cause false positives, never false negatives.
+ */
+
+#ifndef BLOOM_FILTER
+
+#define BLOOM_FILTER
+
+#define BLOOM_BLOCK_BYTES		64
+#define BLOOM_BLOCK_COUNTERS	(BLOOM_BLOCK_BYTES * 2)
+#define BLOOM_MAX_PROBES		8
+
+typedef struct bloom_filter_t {
+	long num_blocks;
+	int num_probes;
+	unsigned char *counters;	// num_blocks * BLOOM_BLOCK_BYTES, two counters per byte
+} bloom_filter_t;
+
+/*
+ * Allocate a filter sized for expected_entries
+ *
+ * expected_entries - number of entries the filter should hold
+ * counters_per_entry - more counters mean fewer false positives, 8 gives
+ * 		about 3% once expected_entries are added (4 bytes per entry);
+ * 		2.2% for an unblocked filter, a little more here because all
+ * 		of a key's counters share one cache line
+ */
+bloom_filter_t *
+new_bloom_filter(long expected_entries, int counters_per_entry);
+
+/*
+ * Returns a copy of a filter, or NULL if it could not be allocated
+ */
+bloom_filter_t *
+bloom_filter_clone(bloom_filter_t *filter);
+
+/*
+ * Free a filter created by new_bloom_filter()
+ */
+void
+free_bloom_filter(bloom_filter_t *filter);
+
+/*
+ * Record an entry with the given hash value
+ */
+void
+bloom_filter_add(bloom_filter_t *filter, unsigned long hash);
+
+/*
+ * Forget an entry previously recorded with bloom_filter_add()
+ */
+void
+bloom_filter_delete(bloom_filter_t *filter, unsigned long hash);
+
+/*
+ * Returns 0 if no entry with this hash value was added, 1 if one may have been
+ */
+int
+bloom_filter_may_contain(bloom_filter_t *filter, unsigned long hash);
+
+#endif
@@ -0,0 +1,163 @@
+/*
+ * capacity.c - sizing policy shared by the hash tables in this directory
+ *
+ * The table of selected primes was originally part of dictionary.c. Past its
+ * last entry we used to return intValue * 2 + 1, which is not prime and
+ * overflowed an int for large dictionaries.
+ */
+
+#include <stdio.h>
+
+#include "capacity.h"
+#include "dictionary.h"
+
+#define NUM_PRIMES 148
+
+static const long primes[NUM_PRIMES] = {
+	3, 5, 7, 11, 17, 19, 23, 29, 37, 53, 73, 107, 157, 233, 347, 503, 751,
+	1009, 1511, 2003, 3001, 4001, 5003, 6007, 7001, 8009, 9001,
+	10007, 11003, 12007, 13001, 14009, 15013, 16001, 17011, 18013, 19001,
+	20011, 21001, 22003, 23003, 24001, 25013, 26003, 27011, 28001, 29009,
+	30011, 31013, 32003, 33013, 34019, 35023, 36007, 37003, 38011, 39019,
+	40009, 41011, 42013, 43003, 44017, 45007, 46021, 47017, 48017, 49003,
+	50021, 51001, 52009, 53003, 54001, 55001, 56003, 57037, 58013, 59009,
+	60013, 61001, 62003, 63029, 64007, 65003, 66029, 67003, 68023, 69001,
+	70001, 71011, 72019, 73009, 74017, 75011, 76001, 77003, 78007, 79031,
+	80021, 81001, 82003, 83003, 84011, 85009, 86011, 87011, 88001, 89003,
+	90001, 91009, 92003, 93001, 94007, 95003, 96001, 97001, 98009, 99013,
+	100003, 101009, 102001, 103001, 104003, 224737, 350377, 479909,
+	611953, 746773, 882377, 1020379, 1159523, 1299709, 2750159, 4256233,
+	5800079, 7368787, 8960453, 10570841, 12195257, 13834103, 15485863,
+	32452843, 49979687, 67867967, 86028121, 104395301, 122949823,
+	141650939, 160481183 };
+
+/*
+ * Returns 1 if value is prime, 0 otherwise
+ */
+int
+is_prime(long value)
+{
+	if (value < 2)
+		return 0;
+	if (value < 4)
+		return 1;
+	if ((value % 2 == 0) || (value % 3 == 0))
+		return 0;
+
+	// every prime above 3 is 6k - 1 or 6k + 1; capacities stay well below
+	// 2^62, so i * i can't overflow before the loop ends
+	for (long i=5; i * i <= value; i += 6) {
+		if ((value % i == 0) || (value % (i + 2) == 0))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Returns a prime number that is greater than or equal to value.
+ * The prime number is not necessarily the smallest prime number that is
+ * greater than or equal to value while value is within our table of
+ * selected primes, beyond it the smallest prime is returned.
+ */
+long
+select_next_prime(long value)
+{
+	int high = NUM_PRIMES - 1;
+
+	// value greater than highest selected prime, search for the next prime
+	// (the gap between primes near 2^40 averages about 28, and each test
+	// takes at most a few hundred thousand divisions)
+	if (value > primes[high]) {
+		long candidate = value | 1;
+		while (!is_prime(candidate))
+			candidate += 2;
+		return candidate;
+	}
+
+	int low = 0;
+
+	// Binary search for closest selected prime that is >= value
+
+	while (high - low > 1) {
+		int mid = (high + low) / 2;
+		long prime = primes[mid];
+		if (value <= prime)
+			high = mid;
+		else
+			low = mid;
+	}
+
+	return primes[high];
+}
+
+/*
+ * Returns the smallest capacity that holds num_entries without exceeding
+ * the load factor
+ *
+ * num_entries - number of entries the table must hold
+ * load_factor - between 0 and 1.0
+ */
+long
+capacity_for_entries(long num_entries, double load_factor)
+{
+	long capacity = select_next_prime((long)(num_entries / load_factor) + 1);
+
+	if (capacity < DICT_INITIAL_SIZE)
+		capacity = DICT_INITIAL_SIZE;
+
+	return capacity;
+}
+
+/*
+ * Returns 1 if a table of the given capacity holding num_entries has
+ * exceeded its load factor and must grow
+ */
+int
+capacity_needs_growth(long num_entries, long capacity, double load_factor)
+{
+	return num_entries > load_factor * capacity;
+}
+
+/*
+ * Returns the capacity a table should grow to once it holds num_entries,
+ * leaving it about half as full as the load factor allows
+ *
+ * num_entries - number of entries in the table
+ * load_factor - between 0 and 1.0
+ */
+long
+capacity_after_growth(long num_entries, double load_factor)
+{
+	return capacity_for_entries(num_entries * 2, load_factor);
+}
+
+/*
+ * Returns the capacity a table should shrink to, or 0 if it should keep
+ * its current size. Tables only shrink once they are less than
+ * 1/DICT_SHRINK_DIVISOR as full as the load factor allows, to half as full
+ * as it allows, and never below min_capacity.
+ *
+ * num_entries - number of entries in the table
+ * capacity - current capacity of the table
+ * min_capacity - floor for automatic shrinking
+ * load_factor - between 0 and 1.0
+ */
+long
+capacity_after_shrink(long num_entries, long capacity, long min_capacity, double load_factor)
+{
+	if (capacity <= min_capacity)
+		return 0;
+
+	// growing and shrinking both leave the table half as full as the load
+	// factor allows, so it has to double its entries to grow again or lose
+	// half of them to shrink again - put/remove around either threshold
+	// can't make it oscillate
+	if (num_entries * DICT_SHRINK_DIVISOR >= load_factor * capacity)
+		return 0;
+
+	long new_size = capacity_for_entries(num_entries * 2, load_factor);
+	if (new_size < min_capacity)
+		new_size = min_capacity;
+
+	return (new_size < capacity) ? new_size : 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * capacity.h - sizing policy shared by the hash tables in this directory
+ *
+ * Capacities are prime so that the hash modulus spreads keys evenly. Below
+ * 160,481,183 they are taken from a table of selected primes, above that the
+ * next prime is found by trial division, so sizes are valid up to the range
+ * of a long.
+ */
+
+#ifndef CAPACITY_POLICY
+
+#define CAPACITY_POLICY
+
+/*
+ * Returns 1 if value is prime, 0 otherwise
+ */
+int
+is_prime(long value);
+
+/*
+ * Returns a prime number that is greater than or equal to value.
+ * The prime number is not necessarily the smallest prime number that is
+ * greater than or equal to value while value is within our table of
+ * selected primes, beyond it the smallest prime is returned.
+ */
+long
+select_next_prime(long value);
+
+/*
+ * Returns the smallest capacity that holds num_entries without exceeding
+ * the load factor
+ *
+ * num_entries - number of entries the table must hold
+ * load_factor - between 0 and 1.0
+ */
+long
+capacity_for_entries(long num_entries, double load_factor);
+
+/*
+ * Returns 1 if a table of the given capacity holding num_entries has
+ * exceeded its load factor and must grow
+ */
+int
+capacity_needs_growth(long num_entries, long capacity, double load_factor);
+
+/*
+ * Returns the capacity a table should grow to once it holds num_entries,
+ * leaving it about half as full as the load factor allows
+ *
+ * num_entries - number of entries in the table
+ * load_factor - between 0 and 1.0
+ */
+long
+capacity_after_growth(long num_entries, double load_factor);
+
+/*
+ * Returns the capacity a table should shrink to, or 0 if it should keep
+ * its current size. Tables only shrink once they are less than
+ * 1/DICT_SHRINK_DIVISOR as full as the load factor allows, to half as full
+ * as it allows, and never below min_capacity.
+ *
+ * num_entries - number of entries in the table
+ * capacity - current capacity of the table
+ * min_capacity - floor for automatic shrinking
+ * load_factor - between 0 and 1.0
+ */
+long
+capacity_after_shrink(long num_entries, long capacity, long min_capacity, double load_factor);
+
+#endif
@@ -0,0 +1,470 @@
+/*
+ * cuckoo_dictionary.c
+ *
+ * Bucketized cuckoo hashing with two choices of CUCKOO_BUCKET_SLOTS slots.
+ * The number of buckets is a power of two, so the second bucket of a key
+ * can be found by XORing the first with a hash of its tag, which is its
+ * own inverse: from either bucket the same XOR leads to the other.
+ *
+ * An insert that has to move entries records the slots on its path, and
+ * moves them all back if no free slot turns up, so a failed insert never
+ * leaves an entry out of the table.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cuckoo_dictionary.h"
+#include "hash.h"
+
+/* ---------- private declarations ---------- */
+
+/*
+ * Returns the hash of a key under the dictionary's seed
+ */
+unsigned long
+cuckoo_hash(cuckoo_dictionary_t *dict, const char *key);
+
+/*
+ * Returns the tag stored for a key with the given hash, never 0
+ */
+uint16_t
+cuckoo_tag(unsigned long key_hash);
+
+/*
+ * Returns the other bucket of an entry with the given tag in bucket
+ */
+long
+cuckoo_other_bucket(cuckoo_dictionary_t *dict, long bucket, uint16_t tag);
+
+/*
+ * Find the slot holding a key
+ *
+ * Returns 1 if the key was found, with its bucket and slot, or 0 if not
+ */
+int
+cuckoo_find(cuckoo_dictionary_t *dict, const char *key, unsigned long key_hash, long *bucket, int *slot);
+
+/*
+ * Store an entry that is not in the table in one of its two buckets,
+ * moving other entries to their other buckets to make room if needed
+ *
+ * Returns 0 on success, or -1 if no room was found within CUCKOO_MAX_KICKS
+ * moves, in which case every entry that was moved is put back
+ */
+int
+cuckoo_place(cuckoo_dictionary_t *dict, unsigned long key_hash, dict_key_t key, dict_value_t value);
+
+/*
+ * Resize the dictionary, rehashing all keys. If the entries don't all fit
+ * at new_num_buckets, twice as many buckets are tried.
+ *
+ * Returns 0 on success, or -1 if the new table could not be allocated, in
+ * which case the dictionary is left unchanged
+ *
+ * dict - dictionary to resize
+ * new_num_buckets - a power of two
+ */
+int
+cuckoo_rebuild_table(cuckoo_dictionary_t *dict, long new_num_buckets);
+
+/*
+ * Returns the number of buckets, a power of two, that hold num_entries
+ * within the load factor
+ */
+long
+cuckoo_buckets_for_entries(long num_entries, double load_factor);
+
+
+/* ---------- public definitions ---------- */
+
+/*
+ * Allocate a cuckoo dictionary with room for DICT_INITIAL_SIZE entries
+ */
+cuckoo_dictionary_t *
+new_cuckoo_dictionary()
+{
+	return new_cuckoo_dictionary_size_load(DICT_INITIAL_SIZE, CUCKOO_LOAD_FACTOR);
+}
+
+/*
+ * Allocate a cuckoo dictionary with room for a user-defined number of entries
+ *
+ * initial_size - entries the dictionary holds before it first grows
+ *
+ * load_factor - between 0 and 1.0 to resize the dictionary when its size
+ * 		exceeds this value * the current capacity of the dictionary
+ */
+cuckoo_dictionary_t *
+new_cuckoo_dictionary_size_load(long initial_size, double load_factor)
+{
+	cuckoo_dictionary_t *dict = calloc(1, sizeof(cuckoo_dictionary_t));
+
+	if (dict == NULL)
+		return NULL;
+	if ((load_factor <= 0.0) || (load_factor >= 1.0))
+		load_factor = CUCKOO_LOAD_FACTOR;
+
+	dict->load_factor = load_factor;
+	dictionary_random_seed(dict->seed);
+	dict->random = dict->seed[0] | 1;
+
+	long num_buckets = cuckoo_buckets_for_entries(initial_size, load_factor);
+	if (cuckoo_rebuild_table(dict, num_buckets) != 0) {
+		free(dict);
+		return NULL;
+	}
+	dict->min_buckets = num_buckets;
+
+	return dict;
+}
+
+/*
+ * Free a cuckoo dictionary created by new_cuckoo_dictionary(), and its keys
+ */
+void
+free_cuckoo_dictionary(cuckoo_dictionary_t *dict)
+{
+	// values are managed by the client
+	for (long i=0; i < dict->num_buckets; i++) {
+		for (int j=0; j < CUCKOO_BUCKET_SLOTS; j++) {
+			if (dict->buckets[i].tags[j] != 0)
+				free(dict->buckets[i].keys[j]);
+		}
+	}
+	free(dict->buckets);
+	free(dict);
+}
+
+/*
+ * Put a value into the dictionary, returning the value it replaced or NULL
+ *
+ * dict - allocated by new_cuckoo_dictionary()
+ * key - null-terminated string will be copied and managed by dictionary
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ */
+dict_value_t
+cuckoo_dictionary_put(cuckoo_dictionary_t *dict, char *key, dict_value_t value)
+{
+	long bucket;
+	int slot;
+
+	if (key == NULL)
+		return NULL;
+
+	unsigned long key_hash = cuckoo_hash(dict, key);
+
+	// replace existing value
+	if (cuckoo_find(dict, key, key_hash, &bucket, &slot)) {
+		dict_value_t previous = dict->buckets[bucket].values[slot];
+		dict->buckets[bucket].values[slot] = value;
+		return previous;
+	}
+
+	// grow before the table is too full for short cuckoo paths
+	if (dict->num_entries + 1 > dict->num_buckets * CUCKOO_BUCKET_SLOTS * dict->load_factor)
+		cuckoo_rebuild_table(dict, dict->num_buckets * 2);
+
+	dict_key_t new_key = strdup(key);
+	if (new_key == NULL) {
+		fprintf(stderr, "cuckoo_dictionary_put() unable to copy a key into dictionary %p\n", dict);
+		return NULL;
+	}
+	while (cuckoo_place(dict, key_hash, new_key, value) != 0) {
+		if (cuckoo_rebuild_table(dict, dict->num_buckets * 2) != 0) {
+			fprintf(stderr, "cuckoo_dictionary_put() dictionary %p is full\n", dict);
+			free(new_key);
+			return NULL;
+		}
+	}
+	dict->num_entries++;
+
+	return NULL;
+}
+
+/*
+ * Retrieve a value from the dictionary, or NULL if the key is not present.
+ * At most two buckets are examined.
+ *
+ * dict - allocated by new_cuckoo_dictionary()
+ * key - null-terminated string
+ */
+dict_value_t
+cuckoo_dictionary_get(cuckoo_dictionary_t *dict, char *key)
+{
+	long bucket;
+	int slot;
+
+	if ((key == NULL) || !cuckoo_find(dict, key, cuckoo_hash(dict, key), &bucket, &slot))
+		return NULL;
+
+	return dict->buckets[bucket].values[slot];
+}
+
+/*
+ * Remove an entry from the dictionary. The value at the key will be
+ * returned.
+ *
+ * dict - allocated by new_cuckoo_dictionary()
+ * key - null-terminated string
+ */
+dict_value_t
+cuckoo_dictionary_remove(cuckoo_dictionary_t *dict, char *key)
+{
+	long bucket;
+	int slot;
+
+	if ((key == NULL) || !cuckoo_find(dict, key, cuckoo_hash(dict, key), &bucket, &slot))
+		return NULL;
+
+	cuckoo_bucket_t *b = &dict->buckets[bucket];
+	dict_value_t value = b->values[slot];
+	free(b->keys[slot]);
+	b->keys[slot] = NULL;
+	b->values[slot] = NULL;
+	b->tags[slot] = 0;
+	dict->num_entries--;
+
+	// shrink by halves once the table is a quarter as full as the load factor allows
+	long capacity = dict->num_buckets * CUCKOO_BUCKET_SLOTS;
+	if ((dict->num_buckets > dict->min_buckets)
+		&& (dict->num_entries * DICT_SHRINK_DIVISOR < capacity * dict->load_factor)) {
+		cuckoo_rebuild_table(dict, dict->num_buckets / 2);
+	}
+
+	return value;
+}
+
+/*
+ * Size the dictionary so that it can hold expected_entries without
+ * resizing. Returns 0 on success, or -1 if the table could not be allocated
+ *
+ * dict - allocated by new_cuckoo_dictionary()
+ * expected_entries - number of entries the dictionary will hold
+ */
+int
+cuckoo_dictionary_reserve(cuckoo_dictionary_t *dict, long expected_entries)
+{
+	long num_buckets = cuckoo_buckets_for_entries(expected_entries, dict->load_factor);
+
+	if (num_buckets > dict->num_buckets) {
+		if (cuckoo_rebuild_table(dict, num_buckets) != 0)
+			return -1;
+	}
+
+	if (dict->min_buckets < num_buckets)
+		dict->min_buckets = num_buckets;
+
+	return 0;
+}
+
+/*
+ * For each key/value pair in the dictionary, execute the enumeration function.
+ *
+ * dict - dictionary to enumerate
+ * enum_function - function returning void that takes key, value as arguments
+ */
+void
+cuckoo_dictionary_enumerate(cuckoo_dictionary_t *dict, dictionary_enumerator_t enum_function)
+{
+	for (long i=0; i < dict->num_buckets; i++) {
+		for (int j=0; j < CUCKOO_BUCKET_SLOTS; j++) {
+			if (dict->buckets[i].tags[j] != 0)
+				enum_function(dict->buckets[i].keys[j], dict->buckets[i].values[j]);
+		}
+	}
+}
+
+/* --- private functions --- */
+
+/*
+ * Returns the hash of a key under the dictionary's seed
+ */
+unsigned long
+cuckoo_hash(cuckoo_dictionary_t *dict, const char *key)
+{
+	return hash_siphash13((const unsigned char *)key, strlen(key), dict->seed);
+}
+
+/*
+ * Returns the tag stored for a key with the given hash, never 0
+ */
+uint16_t
+cuckoo_tag(unsigned long key_hash)
+{
+	// the first bucket comes from the low bits, the tag from the high bits
+	uint16_t tag = key_hash >> 48;
+	return (tag != 0) ? tag : 1;
+}
+
+/*
+ * Returns the other bucket of an entry with the given tag in bucket
+ */
+long
+cuckoo_other_bucket(cuckoo_dictionary_t *dict, long bucket, uint16_t tag)
+{
+	return (bucket ^ hash_int64(tag)) & (dict->num_buckets - 1);
+}
+
+/*
+ * Find the slot holding a key
+ *
+ * Returns 1 if the key was found, with its bucket and slot, or 0 if not
+ */
+int
+cuckoo_find(cuckoo_dictionary_t *dict, const char *key, unsigned long key_hash, long *bucket, int *slot)
+{
+	uint16_t tag = cuckoo_tag(key_hash);
+	long first = key_hash & (dict->num_buckets - 1);
+	long candidates[2] = { first, cuckoo_other_bucket(dict, first, tag) };
+
+	for (int i=0; i < 2; i++) {
+		cuckoo_bucket_t *b = &dict->buckets[candidates[i]];
+		for (int j=0; j < CUCKOO_BUCKET_SLOTS; j++) {
+			if ((b->tags[j] == tag) && (strcmp(b->keys[j], key) == 0)) {
+				*bucket = candidates[i];
+				*slot = j;
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Store an entry that is not in the table in one of its two buckets,
+ * moving other entries to their other buckets to make room if needed
+ *
+ * Returns 0 on success, or -1 if no room was found within CUCKOO_MAX_KICKS
+ * moves, in which case every entry that was moved is put back
+ */
+int
+cuckoo_place(cuckoo_dictionary_t *dict, unsigned long key_hash, dict_key_t key, dict_value_t value)
+{
+	uint16_t tag = cuckoo_tag(key_hash);
+	long bucket = key_hash & (dict->num_buckets - 1);
+	long path_buckets[CUCKOO_MAX_KICKS];
+	int path_slots[CUCKOO_MAX_KICKS];
+
+	for (int kick=0; ; kick++) {
+		// the entry in hand goes in a free slot of either of its buckets
+		long other = cuckoo_other_bucket(dict, bucket, tag);
+		long candidates[2] = { bucket, other };
+		for (int i=0; i < 2; i++) {
+			cuckoo_bucket_t *b = &dict->buckets[candidates[i]];
+			for (int j=0; j < CUCKOO_BUCKET_SLOTS; j++) {
+				if (b->tags[j] == 0) {
+					b->tags[j] = tag;
+					b->keys[j] = key;
+					b->values[j] = value;
+					dict->num_kicks += kick;
+					return 0;
+				}
+			}
+		}
+		if (kick == CUCKOO_MAX_KICKS)
+			break;
+
+		// otherwise it takes the place of a random resident of one of them,
+		// which moves on to its own other bucket
+		dict->random ^= dict->random << 13;
+		dict->random ^= dict->random >> 7;
+		dict->random ^= dict->random << 17;
+		bucket = candidates[dict->random & 1];
+		int slot = (dict->random >> 1) % CUCKOO_BUCKET_SLOTS;
+
+		cuckoo_bucket_t *b = &dict->buckets[bucket];
+		dict_key_t evicted_key = b->keys[slot];
+		dict_value_t evicted_value = b->values[slot];
+		uint16_t evicted_tag = b->tags[slot];
+		b->keys[slot] = key;
+		b->values[slot] = value;
+		b->tags[slot] = tag;
+		path_buckets[kick] = bucket;
+		path_slots[kick] = slot;
+
+		key = evicted_key;
+		value = evicted_value;
+		tag = evicted_tag;
+	}
+
+	// walk the path backwards, so each entry returns to the slot it came from
+	for (int kick=CUCKOO_MAX_KICKS-1; kick >= 0; kick--) {
+		cuckoo_bucket_t *b = &dict->buckets[path_buckets[kick]];
+		int s = path_slots[kick];
+		dict_key_t displaced_key = b->keys[s];
+		dict_value_t displaced_value = b->values[s];
+		uint16_t displaced_tag = b->tags[s];
+		b->keys[s] = key;
+		b->values[s] = value;
+		b->tags[s] = tag;
+		key = displaced_key;
+		value = displaced_value;
+		tag = displaced_tag;
+	}
+	return -1;
+}
+
+/*
+ * Resize the dictionary, rehashing all keys. If the entries don't all fit
+ * at new_num_buckets, twice as many buckets are tried.
+ *
+ * Returns 0 on success, or -1 if the new table could not be allocated, in
+ * which case the dictionary is left unchanged
+ *
+ * dict - dictionary to resize
+ * new_num_buckets - a power of two
+ */
+int
+cuckoo_rebuild_table(cuckoo_dictionary_t *dict, long new_num_buckets)
+{
+	cuckoo_bucket_t *old_buckets = dict->buckets;
+	long old_num_buckets = dict->num_buckets;
+
+	for (;;) {
+		void *new_buckets = NULL;
+		if (posix_memalign(&new_buckets, sizeof(cuckoo_bucket_t), new_num_buckets * sizeof(cuckoo_bucket_t)) != 0) {
+			fprintf(stderr, "Unable to allocate %lu buckets to resize dictionary %p\n", new_num_buckets, dict);
+			dict->buckets = old_buckets;
+			dict->num_buckets = old_num_buckets;
+			return -1;
+		}
+		memset(new_buckets, 0, new_num_buckets * sizeof(cuckoo_bucket_t));
+		dict->buckets = new_buckets;
+		dict->num_buckets = new_num_buckets;
+
+		int placed = 1;
+		for (long i=0; (i < old_num_buckets) && placed; i++) {
+			for (int j=0; (j < CUCKOO_BUCKET_SLOTS) && placed; j++) {
+				if (old_buckets[i].tags[j] == 0)
+					continue;
+				dict_key_t key = old_buckets[i].keys[j];
+				placed = (cuckoo_place(dict, cuckoo_hash(dict, key), key, old_buckets[i].values[j]) == 0);
+			}
+		}
+		if (placed)
+			break;
+
+		// entries are only copied, the old table still holds them all
+		free(dict->buckets);
+		new_num_buckets *= 2;
+	}
+
+	free(old_buckets);
+	return 0;
+}
+
+/*
+ * Returns the number of buckets, a power of two, that hold num_entries
+ * within the load factor
+ */
+long
+cuckoo_buckets_for_entries(long num_entries, double load_factor)
+{
+	long num_buckets = 2;
+
+	while (num_buckets * CUCKOO_BUCKET_SLOTS * load_factor < num_entries)
+		num_buckets *= 2;
+	return num_buckets;
+}
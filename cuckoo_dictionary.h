@@ -0,0 +1,135 @@
+/*
+ * cuckoo_dictionary.h - string dictionary with a hard bound on lookup cost
+ *
+ * dictionary_t resolves collisions with buckets whose length has no upper
+ * bound, so an unlucky lookup can walk a long chain. A cuckoo dictionary
+ * gives every key two candidate buckets of CUCKOO_BUCKET_SLOTS slots, and
+ * a key is always in one of them: a lookup examines at most 6 slots
+ * whatever the table holds.
+ *
+ * Each bucket is one 64-byte line holding a 16-bit tag, a key pointer and
+ * a value per slot. A lookup only compares a key where the tag matches, so
+ * a miss reads at most the two bucket lines and almost never a key. A hit
+ * reads one or two bucket lines plus the line holding the key string,
+ * which is allocated separately: the table does not meet a bound of two
+ * cache lines per hit, it is three at most (more for a key longer than a
+ * line), against a chain of any length in dictionary_t. Three slots per
+ * line rather than four is the price of keeping the tags in the line.
+ *
+ * The second bucket is derived from the first and the tag (partial-key
+ * cuckoo hashing), so an entry can be moved to its other bucket without
+ * hashing its key again.
+ *
+ * An insert into two full buckets moves a resident entry to its other
+ * bucket, which may move another, up to CUCKOO_MAX_KICKS times; if no free
+ * slot is found that way the table is doubled and rebuilt, like
+ * dictionary_t grows. Keys are hashed with SipHash-1-3 under a random
+ * per-dictionary seed, so the relocation paths can't be steered by
+ * crafted keys.
+ *
+ * The API follows dictionary_t: keys are copied and managed by the
+ * dictionary, values are managed by the caller.
+ */
+
+#ifndef CUCKOO_DICTIONARY
+
+#define CUCKOO_DICTIONARY
+
+#include <stdint.h>
+
+#include "dictionary.h"
+
+#define CUCKOO_BUCKET_SLOTS		3			// slots per bucket, with their tags in one 64-byte line
+#define CUCKOO_LOAD_FACTOR		0.9			// two 3-way choices fill to about 95%
+#define CUCKOO_MAX_KICKS		500			// entries moved by one insert before growing
+
+typedef struct cuckoo_bucket_t {
+	uint16_t tags[CUCKOO_BUCKET_SLOTS];		// 0 for an empty slot
+	dict_key_t keys[CUCKOO_BUCKET_SLOTS];
+	dict_value_t values[CUCKOO_BUCKET_SLOTS];
+} __attribute__((aligned(64))) cuckoo_bucket_t;
+
+typedef struct cuckoo_dictionary_t {
+	long num_entries;
+	long num_buckets;			// a power of two
+	long min_buckets;			// automatic shrinking stops at this size
+	cuckoo_bucket_t *buckets;
+	unsigned long seed[2];
+	unsigned long random;		// picks the entry to move on a cuckoo path
+	double load_factor;
+	long num_kicks;				// entries moved by inserts, for tuning
+} cuckoo_dictionary_t;
+
+/*
+ * Allocate a cuckoo dictionary with room for DICT_INITIAL_SIZE entries
+ */
+cuckoo_dictionary_t *
+new_cuckoo_dictionary();
+
+/*
+ * Allocate a cuckoo dictionary with room for a user-defined number of entries
+ *
+ * initial_size - entries the dictionary holds before it first grows
+ *
+ * load_factor - between 0 and 1.0 to resize the dictionary when its size
+ * 		exceeds this value * the current capacity of the dictionary
+ */
+cuckoo_dictionary_t *
+new_cuckoo_dictionary_size_load(long initial_size, double load_factor);
+
+/*
+ * Free a cuckoo dictionary created by new_cuckoo_dictionary(), and its keys
+ */
+void
+free_cuckoo_dictionary(cuckoo_dictionary_t *dict);
+
+/*
+ * Put a value into the dictionary, returning the value it replaced or NULL
+ *
+ * dict - allocated by new_cuckoo_dictionary()
+ * key - null-terminated string will be copied and managed by dictionary
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ */
+dict_value_t
+cuckoo_dictionary_put(cuckoo_dictionary_t *dict, char *key, dict_value_t value);
+
+/*
+ * Retrieve a value from the dictionary, or NULL if the key is not present.
+ * At most two buckets are examined.
+ *
+ * dict - allocated by new_cuckoo_dictionary()
+ * key - null-terminated string
+ */
+dict_value_t
+cuckoo_dictionary_get(cuckoo_dictionary_t *dict, char *key);
+
+/*
+ * Remove an entry from the dictionary. The value at the key will be
+ * returned.
+ *
+ * dict - allocated by new_cuckoo_dictionary()
+ * key - null-terminated string
+ */
+dict_value_t
+cuckoo_dictionary_remove(cuckoo_dictionary_t *dict, char *key);
+
+/*
+ * Size the dictionary so that it can hold expected_entries without
+ * resizing. Returns 0 on success, or -1 if the table could not be allocated
+ *
+ * dict - allocated by new_cuckoo_dictionary()
+ * expected_entries - number of entries the dictionary will hold
+ */
+int
+cuckoo_dictionary_reserve(cuckoo_dictionary_t *dict, long expected_entries);
+
+/*
+ * For each key/value pair in the dictionary, execute the enumeration function.
+ *
+ * dict - dictionary to enumerate
+ * enum_function - function returning void that takes key, value as arguments
+ */
+void
+cuckoo_dictionary_enumerate(cuckoo_dictionary_t *dict, dictionary_enumerator_t enum_function);
+
+#endif
@@ -8,13 +8,31 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "dictionary.h"
+#include "bloom_filter.h"
+#include "dictionary_log.h"
+#include "ordered_index.h"
+#include "capacity.h"
 #include "hash.h"
 
-#define CB_INITIAL_SIZE 16
+#define CB_INITIAL_SIZE 2
+#define CB_SORTED_SIZE 8	// buckets this long are kept in hash order
 #define MAX_KEY 4096
 
+// the state of a dictionary_prefix_scan() or dictionary_range()
+typedef struct dictionary_scan_t {
+	dictionary_t *dict;
+	const char *prefix;			// keys must start with this, or NULL
+	size_t prefix_length;
+	const char *to;				// keys must be less than this, or NULL
+	dictionary_enumerator_t enum_function;
+	long count;
+} dictionary_scan_t;
+
 /* ---------- private declarations ---------- */
 
 /*
@@ -28,44 +46,293 @@ dictionary_free_internal(dictionary_t *dict);
  * 
  * Called by dictionary_put() - not safe for concurrent updates
  *
+ * Returns 0 on success, or -1 if the new table could not be allocated, in
+ * which case the dictionary is left unchanged
+ *
  * dict- dictionary to resize
  * new_size - new size - this should be prime
  */
-void
+int
 dictionary_rebuild_table(dictionary_t *dict, long new_size);
 
 /*
- * Retrieve a value from a collision bucket
+ * Shrink the dictionary if the number of entries has fallen well below the
+ * load factor, see DICT_SHRINK_DIVISOR
  *
- * bucket - allocated by new_collision_bucket()
- * key - null-terminated string will be copied and managed by collision bucket
+ * Called by dictionary_remove() - not safe for concurrent updates
+ *
+ * dict - dictionary to check
+ */
+void
+dictionary_check_shrink(dictionary_t *dict);
+
+/*
+ * Replace the dictionary's filter with one sized for its current capacity
+ *
+ * Returns 0 on success, or -1 if the filter could not be allocated
+ *
+ * dict - dictionary with filter_counters set
+ */
+int
+dictionary_reset_filter(dictionary_t *dict);
+
+/*
+ * Returns the full hash value of a key: djb2, or SipHash-1-3 keyed with the
+ * dictionary's seed once dictionary_enable_seed() has been called
+ */
+unsigned long
+dictionary_hash(dictionary_t *dict, const char *key);
+
+/*
+ * Switch to a new seed and rebuild the table at the same size
+ *
+ * Returns 0 on success, or -1 if the table could not be rebuilt, in which
+ * case the dictionary keeps its previous seed
+ */
+int
+dictionary_reseed(dictionary_t *dict, const unsigned long seed[2]);
+
+/*
+ * Recompute the hash stored with every collision bucket entry
+ */
+void
+dictionary_rehash_buckets(dictionary_t *dict);
+
+/*
+ * Returns the address of the value stored for key, or NULL if the key is
+ * not in the dictionary. An expired entry is removed and reported missing.
+ *
+ * dict - dictionary to search
+ * key_hash - full hash value of the key
+ * key - null-terminated string to look for
+ * expires - if not NULL and expiry is enabled, receives the address of the
+ * 		entry's expiration time, valid until the next update
+ */
+dict_value_t *
+dictionary_lookup(dictionary_t *dict, unsigned long key_hash, char *key, long **expires);
+
+/*
+ * Returns the address of the value stored for key, or NULL if the key is
+ * not in the dictionary, without expiring the entry or marking it referenced
+ *
+ * dict - dictionary to search
+ * key_hash - full hash value of the key
+ * key - null-terminated string to look for
+ * index_out - receives the slot of the entry
+ * position_out - receives the entry's position in the slot's collision
+ * 		bucket, or -1 if it is stored in the slot itself
+ */
+dict_value_t *
+dictionary_find(dictionary_t *dict, unsigned long key_hash, const char *key, long *index_out,
+	int *position_out);
+
+/*
+ * Add a key that has just been stored to the ordered index, if there is one
+ */
+void
+dictionary_index_add(dictionary_t *dict, dict_key_t key);
+
+/*
+ * Called by the ordered index for each key in a scan, passes the entry to
+ * the scan's enumeration function until the key is past the end of the scan
+ */
+int
+dictionary_index_visit(char *key, void *context);
+
+/*
+ * Returns the number of bytes an entry counts for against the cache's byte budget
+ */
+long
+dictionary_cache_entry_size(dictionary_t *dict, dict_key_t key, dict_value_t value);
+
+/*
+ * Evict entries until the cache is within its limits
+ *
+ * dict - dictionary in cache mode
+ * protected_key - key that must not be evicted (the one just added)
+ */
+void
+dictionary_cache_evict(dictionary_t *dict, dict_key_t protected_key);
+
+/*
+ * Remove one entry from the dictionary, given its location, and return its
+ * value. Removing the second to last entry of a collision bucket promotes
+ * the remaining entry back into the slot. Does not resize the table.
+ *
+ * dict - dictionary to update
+ * index - slot holding the entry
+ * position - position of the entry in the slot's collision bucket, or -1
+ * 		if the entry is stored in the slot itself
+ * key_hash - full hash value of the key, or 0 to have it recomputed if needed
+ * key_out - if not NULL, receives the key string, which the caller must
+ * 		free; otherwise the key is freed
  */
 dict_value_t
-collision_bucket_get(collision_bucket_t *bucket, dict_key_t key);
+dictionary_remove_entry(dictionary_t *dict, long index, int position, unsigned long key_hash,
+	dict_key_t *key_out);
+
+/*
+ * Update the count, index, filter, cache size and log for an entry that has
+ * been taken out of the table
+ *
+ * dict - dictionary to update
+ * key - key of the entry
+ * value - value of the entry
+ * key_hash - full hash value of the key, or 0 to have it recomputed if needed
+ * key_out - if not NULL, receives the key string, which the caller must
+ * 		free; otherwise the key is freed
+ */
+void
+dictionary_release_entry(dictionary_t *dict, dict_key_t key, dict_value_t value, unsigned long key_hash,
+	dict_key_t *key_out);
+
+/*
+ * Release an entry that dictionary_remove_if() has taken out of the table,
+ * passing it to the expired callback if it has expired, otherwise to
+ * on_removed, and free its key
+ */
+void
+dictionary_dispose_removed(dictionary_t *dict, dict_key_t key, dict_value_t value, unsigned long key_hash,
+	int expired, dictionary_enumerator_t on_removed);
+
+/*
+ * Returns the expiration time of an entry, given its location, 0 for never
+ */
+long
+dictionary_entry_expires(dictionary_t *dict, long index, int position);
+
+/*
+ * Returns 1 if an expiration time has passed on the dictionary's clock
+ */
+int
+dictionary_expired(dictionary_t *dict, long expires);
+
+/*
+ * Remove an expired entry, given its location, and pass it to the expired callback
+ */
+void
+dictionary_expire_entry(dictionary_t *dict, long index, int position);
+
+/*
+ * Remove the expired entries in one slot and its collision bucket, and
+ * return how many were removed
+ */
+long
+dictionary_expire_slot(dictionary_t *dict, long index, long now);
+
+/*
+ * The default clock for expiry, CLOCK_MONOTONIC in milliseconds
+ */
+long
+dictionary_clock_milliseconds(void *context);
 
 /*
- * Allocate or reallocate buckets to handle increases in the size of the collision buckets
+ * Store a key that is known not to be in the dictionary, without copying
+ * the key or resizing the table
  *
- * The initial size of the collision bucket is 16 elements (CB_INITIAL_SIZE)
- * It will grow by 8 elements on subsequent invocations from collision_bucket_addpair()
+ * dict - dictionary to update
+ * key_hash - full hash value of the key
+ * key - allocated string, ownership passes to the dictionary
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ * referenced - CLOCK reference bit, if the dictionary is a cache
+ * expires - expiration time, if expiry is enabled
+ */
+void
+dictionary_insert_owned(dictionary_t *dict, unsigned long key_hash, dict_key_t key, dict_value_t value,
+	unsigned char referenced, long expires);
+
+/*
+ * Add a copy of a key that is not in the dictionary, then grow, reseed and
+ * evict as needed
  *
- * bucket - collision bucket allocated by new_collision_bucket()
- * new_size - size in bytes of key/value arrays
+ * dict - dictionary to update
+ * full_hash - full hash value of the key
+ * key - null-terminated string, copied by the dictionary
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ * expires - expiration time, if expiry is enabled
  */
 void
-cb_reinitializeArrays(collision_bucket_t *bucket, int new_size);
+dictionary_add(dictionary_t *dict, unsigned long full_hash, const char *key, dict_value_t value, long expires);
 
 /*
- * Stores the key/value pair in the collision bucket
+ * Add a key that is not in the dictionary, taking ownership of it, then
+ * index and log it, and grow, reseed and evict as needed. Every new entry
+ * goes through here, so a put and a merge update the table alike.
  *
- * Return 1 if this operation added a new key, 0 if it replaced the value of an existing key
+ * dict - dictionary to update
+ * full_hash - full hash value of the key
+ * key - null-terminated string, freed by the dictionary
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ * expires - expiration time, if expiry is enabled
+ */
+void
+dictionary_add_owned(dictionary_t *dict, unsigned long full_hash, dict_key_t key, dict_value_t value, long expires);
+
+/*
+ * Restore the min-heap order of the top-k arrays by moving entry i down
+ */
+void
+dictionary_top_sift_down(dict_key_t *keys, long *counts, long size, long i);
+
+/*
+ * Returns the entry for key in a collision bucket, or NULL
  *
  * bucket - allocated by new_collision_bucket()
- * key - null-terminated string will be copied and managed by collision bucket
+ * hash - full hash value of the key
+ * key - null-terminated string to look for
+ */
+cb_entry_t *
+collision_bucket_find(collision_bucket_t *bucket, unsigned long hash, dict_key_t key);
+
+/*
+ * Reallocate a collision bucket to hold new_size entries
+ *
+ * The initial size of the collision bucket is 2 elements (CB_INITIAL_SIZE),
+ * which covers the common case of a single collision. Subsequent invocations
+ * from collision_bucket_append() double the capacity.
+ *
+ * Returns the (possibly moved) bucket
+ *
+ * bucket - collision bucket allocated by new_collision_bucket()
+ * new_size - number of entries the bucket must be able to hold
+ */
+collision_bucket_t *
+cb_resize(collision_bucket_t *bucket, int new_size);
+
+/*
+ * Adds a key/value pair to the collision bucket without checking for duplicates
+ *
+ * A bucket with CB_SORTED_SIZE or more entries is kept sorted by hash, so the
+ * new entry may not be the last one.
+ *
+ * Returns the new entry, valid until the bucket is next changed
+ *
+ * bucket_ref - bucket allocated by new_collision_bucket(), updated if the bucket moves
+ * hash - full hash value of the key
+ * key - allocated string, ownership passes to the collision bucket
  * value - void pointer (or 64-bit value) - must be managed by caller
  */
+cb_entry_t *
+collision_bucket_append(collision_bucket_t **bucket_ref, unsigned long hash, dict_key_t key,
+	dict_value_t value);
+
+/*
+ * Sort the entries of a collision bucket by hash
+ *
+ * bucket - allocated by new_collision_bucket()
+ */
+void
+cb_sort(collision_bucket_t *bucket);
+
+/*
+ * Returns the position of the first entry whose hash is not less than hash,
+ * in a bucket sorted by cb_sort()
+ *
+ * bucket - allocated by new_collision_bucket()
+ * hash - full hash value to look for
+ */
 int
-collision_bucket_addpair(collision_bucket_t *bucket, char *key, dict_value_t value);
+cb_lower_bound(collision_bucket_t *bucket, unsigned long hash);
 
 /*
  * Retrieve the size of a collision bucket
@@ -76,25 +343,98 @@ int
 collision_bucket_size(collision_bucket_t *bucket);
 
 /*
- * Allocate a collision bucket, key/value vectors are initialized lazily
+ * Release unused capacity once a bucket is no more than a quarter full
+ *
+ * Returns the (possibly moved) bucket
+ *
+ * bucket - allocated by new_collision_bucket()
+ */
+collision_bucket_t *
+cb_trim(collision_bucket_t *bucket);
+
+/*
+ * Allocate a collision bucket with room for CB_INITIAL_SIZE entries, with
+ * expiration times if the dictionary has expiry enabled and reference bits
+ * if it is a cache
+ *
+ * dict - dictionary the bucket will belong to
  */
 collision_bucket_t *
-new_collision_bucket();
+new_collision_bucket(dictionary_t *dict);
+
+/*
+ * Move count entries of a collision bucket, with their expiration times
+ * and reference bits, from position from to position to; the ranges may
+ * overlap
+ *
+ * bucket - allocated by new_collision_bucket()
+ */
+void
+cb_move(collision_bucket_t *bucket, int to, int from, int count);
 
 /*
- * Free a collision bucket obtained from new_collision_bucket()
+ * Free a collision bucket and its expiration times and reference bits, but
+ * not its keys
+ *
+ * bucket - allocated by new_collision_bucket()
  */
 void
-free_collision_bucket(collision_bucket_t *bucket);
+cb_free(collision_bucket_t *bucket);
 
 /*
- * Returns a prime number that is greater than or equal to intValue.
- * The prime number is not necessarily the smallest prime number that is
- * greater than or equal to intValue.  For intValue greater than our
- * highest selected prime, returns an odd number.
+ * Free a collision bucket obtained from new_collision_bucket(), and its keys
+ *
+ * dict - dictionary the bucket belongs to
+ * bucket - allocated by new_collision_bucket()
  */
-long
-select_next_prime(int intValue);
+void
+free_collision_bucket(dictionary_t *dict, collision_bucket_t *bucket);
+
+/*
+ * Free the reference bits of every collision bucket, when the dictionary
+ * leaves cache mode
+ */
+void
+dictionary_free_bucket_bits(dictionary_t *dict);
+
+/*
+ * Free a key that has left the dictionary, unless it was packed into the
+ * key storage by dictionary_clone() or dictionary_pack_keys()
+ */
+void
+dictionary_free_key(dictionary_t *dict, dict_key_t key);
+
+/*
+ * Returns 1 if a key was packed into the key storage by dictionary_clone()
+ * or dictionary_pack_keys(), 0 if it was allocated on its own
+ */
+int
+dictionary_packed_key(dictionary_t *dict, dict_key_t key);
+
+/*
+ * Compare two keys by their bytes from last to first, for qsort(), so that
+ * a key sorts just before the keys it is a suffix of
+ *
+ * a, b - pointers to the slots holding the keys
+ */
+int
+dictionary_compare_reversed(const void *a, const void *b);
+
+/*
+ * Move one entry of a source dictionary into the destination of
+ * dictionary_merge(), taking ownership of the key
+ *
+ * dest - dictionary receiving the entry
+ * src - dictionary the entry came from, used to free its key
+ * key_hash - full hash of the key in dest, or 0 to compute it
+ * key - key removed from src
+ * value - value removed from src
+ * expires - expiration time in src, 0 for never
+ * combine - resolves a key found in both dictionaries, or NULL to replace
+ */
+void
+dictionary_merge_entry(dictionary_t *dest, dictionary_t *src, unsigned long key_hash, dict_key_t key,
+	dict_value_t value, long expires, dictionary_combine_t combine);
 
 /*
  * Debugging utility - prints the keys as strings, and the pointer addresses of the values
@@ -141,6 +481,7 @@ new_dictionary_size_load(long initial_size, double load_factor)
 	dict->load_factor = load_factor;
 
 	dict->max_entries = initial_size;
+	dict->min_entries = initial_size;
 	dict->keys = (dict_key_t *)calloc(initial_size, sizeof(dict_key_t));
 	dict->values = (entry_t *)calloc(initial_size, sizeof(entry_t));
 
@@ -166,6 +507,25 @@ free_dictionary(dictionary_t *dict)
  */
 dict_value_t
 dictionary_put(dictionary_t *dict, char *key, dict_value_t value)
+{
+	return dictionary_put_expire(dict, key, value, 0);
+}
+
+/*
+ * Put a value into the dictionary that expires at the given time. Once the
+ * dictionary's clock reaches that time the entry is treated as absent, and
+ * it is removed the next time it is touched or by dictionary_expire_step().
+ * A plain dictionary_put() clears the expiration of an existing entry.
+ *
+ * Returns the previous value, as dictionary_put() does
+ *
+ * dict - dictionary with expiry enabled by dictionary_enable_expiry()
+ * key - null-terminated string will be copied and managed by dictionary
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ * expires - expiration time on the dictionary's clock, 0 for never
+ */
+dict_value_t
+dictionary_put_expire(dictionary_t *dict, char *key, dict_value_t value, long expires)
 {
 	if (key == NULL)
 		return NULL;
@@ -175,117 +535,46 @@ dictionary_put(dictionary_t *dict, char *key, dict_value_t value)
 		return NULL;
 	}
 
-	dict_value_t previous = dictionary_get(dict, key);
-	long theHash = hash((unsigned char *)key) % (dict->max_entries-1);
+	if ((expires != 0) && (dict->expiry == NULL)) {
+		fprintf(stderr, "dictionary_put_expire() expiry is not enabled for dictionary %p\n", dict);
+		return NULL;
+	}
 
-	collision_bucket_t *bucket;
-	dict_key_t hash_key;
+	unsigned long full_hash = dictionary_hash(dict, key);
 
 #ifdef DEBUG_VERBOSE_DICT_PUT
-		printf("dictionary_put() key '%s' hash=%lu\n", key, theHash);
+	printf("dictionary_put() key '%s' hash=%lu\n", key, full_hash % (dict->max_entries-1));
 #endif
 
-	// the entry for the hash code will be null if
-	// (a) there is no entry for that key or
-	// (b) there is an entry for that key with a collision bucket
-	if ((hash_key = dict->keys[theHash]) == NULL) {
-#ifdef DEBUG_VERBOSE_DICT_PUT
-		printf("dictionary_put() no entry for key '%s' hash=%lu\n", key, theHash);
-#endif
-		entry_t entry = dict->values[theHash];
-		if ((bucket = entry.collision_buckets) == NULL) {
-#ifdef DEBUG_VERBOSE_DICT_PUT
-			printf("dictionary_put() new entry, %zu bytes\n", strlen(key) + 1);
-#endif
-			dict_key_t new_string = (dict_key_t)calloc(1, strlen(key) + 1);
-			dict->keys[theHash] = new_string;
-			// new entry
-			strcpy(new_string, key);
-			dict->values[theHash].value = value;
-			dict->num_entries++;
-#ifdef DEBUG_VERBOSE_DICT_PUT
-			printf("dictionary_put() new entry, '%s' (%p) has value %p\n",
-				new_string, new_string, dict->values[theHash].value);
-#endif
-		}
-		// if the key is null, then the value is a collision bucket
-		else {
-#ifdef DEBUG_VERBOSE_DICT_PUT
-			printf("dictionary_put() key '%s' hash=%lu\n", key, theHash);
-#endif
-			if (collision_bucket_addpair(bucket, key, value) > 0) {
-#ifdef DEBUG_VERBOSE_DICT_PUT
-				printf("dictionary_put() added new entry to existing bucket: ");
-#endif
-				dict->num_entries++;
-				if (collision_bucket_size(bucket) > 1) {
-					dict->num_collisions++;
-				}
-				if (collision_bucket_size(bucket) > dict->maximum_chain)
-					dict->maximum_chain = collision_bucket_size(bucket);
-			}
-			else {
-#ifdef DEBUG_VERBOSE_DICT_PUT
-				printf("dictionary_put() replaced existing entry in bucket: ");
-#endif
-			}
-			for (int j=0; j < bucket->num_elements; j++) {
-#ifdef DEBUG_VERBOSE_DICT_PUT
-				printf("%s:%lu (%p) ", bucket->keys[j], (long)bucket->values[j], bucket->values[j]);
-#endif
-			}
-#ifdef DEBUG_VERBOSE_DICT_PUT
-			printf("\n");
-#endif
-		}
-	}
 	// replace existing value
-	else if (strncmp(hash_key, key, MAX_KEY) == 0) {
-#ifdef DEBUG_VERBOSE_DICT_PUT
-		printf("dictionary_put() replace existing value at key '%s' with value '%p'\n", hash_key, value);
-#endif
-		dict->values[theHash].value = value;
-	}
-	// otherwise add a new value to the dictionary
-	else {
-		dict_value_t hash_value = dict->values[theHash].value;
+	long *slot_expires;
+	dict_value_t *slot = dictionary_lookup(dict, full_hash, key, &slot_expires);
+	if (slot != NULL) {
+		dict_value_t previous = *slot;
 #ifdef DEBUG_VERBOSE_DICT_PUT
-		printf("dictionary_put() collision: new key '%s' hashes to %lu, value=%lu (%p)",
-			key, theHash, (long)value, value);
-
-		printf(" (existing key='%s', value=%lu (%p))\n", dict->keys[theHash], (long)hash_value, hash_value);
+		printf("dictionary_put() replace existing value at key '%s' with value '%p'\n", key, value);
 #endif
-		bucket = new_collision_bucket();
-		// remove reference to hash_key
-		dict->keys[theHash] = NULL;
-		dict->values[theHash].collision_buckets = bucket;
-		
-		collision_bucket_addpair(bucket, key, value);
-		dict->num_entries++;
-
-		int num_added = collision_bucket_addpair(bucket, hash_key, hash_value);
-		// hash_key has been reallocated and has no more references, goodbye!
-		free(hash_key);
-
-		if (num_added > 0) {
-			if (collision_bucket_size(bucket) > 1) {
-				dict->num_collisions++;
-			}
-			if (collision_bucket_size(bucket) > dict->maximum_chain) {
-				dict->maximum_chain = collision_bucket_size(bucket);
-			}
+		*slot = value;
+		if (dict->expiry != NULL)
+			*slot_expires = expires;
+		if (dict->log != NULL)
+			dictionary_log_put(dict, key, value);
+		if ((dict->cache != NULL) && (dict->cache->value_size != NULL)) {
+			dict->cache->num_bytes += dictionary_cache_entry_size(dict, key, value)
+				- dictionary_cache_entry_size(dict, key, previous);
+			// the reference bit just set keeps this entry through the first sweep
+			dictionary_cache_evict(dict, NULL);
 		}
+		if (dict->log != NULL)
+			dictionary_log_end_update(dict);
+		return previous;
 	}
 
-	if (dict->num_entries > dict->load_factor * dict->max_entries) {
-		long new_size = select_next_prime(dict->num_entries * 2);
-		dictionary_rebuild_table(dict, new_size);
-	}
-
-#ifdef DEBUG_VERBOSE_DICT_PUT
-	printf("dictionary_put() returning previous value %p\n", previous);
-#endif
-	return previous;
+	// otherwise add a new value to the dictionary
+	dictionary_add(dict, full_hash, key, value, expires);
+	if (dict->log != NULL)
+		dictionary_log_end_update(dict);
+	return NULL;
 }
 
 /*
@@ -300,38 +589,17 @@ dictionary_get(dictionary_t *dict, char *key)
 	if (key == NULL)
 		return NULL;
 
-	long hash_value = hash((unsigned char *)key) % (dict->max_entries-1);
-#ifdef DEBUG_VERBOSE_DICT_PUT
-	printf("dictionary_get() looking for key '%s' at index %lu of dict-keys = %p\n", key, hash_value, dict->keys);
-#endif
-	dict_key_t hash_key = dict->keys[hash_value];
-	if (hash_key == 0) {
-		// null key means we may have a collision bucket
-#ifdef DEBUG_VERBOSE_DICT_PUT
-		printf("dictionary_get() null key means we may have a collision bucket\n");
-#endif
-		entry_t entry = dict->values[hash_value];
-		if (entry.collision_buckets != NULL) {
-			return collision_bucket_get(entry.collision_buckets, key);
-		}
-#ifdef DEBUG_VERBOSE_DICT_PUT
-		printf("entry.collision_buckets is null\n");
-#endif
-	}
-	else if (strncmp(key, hash_key, MAX_KEY) == 0) {
-#ifdef DEBUG_VERBOSE_DICT_PUT
-		printf("dictionary_get() found '%s', about to retrieve value\n", key);
-#endif
-		entry_t entry = dict->values[hash_value];
-#ifdef DEBUG_VERBOSE_DICT_PUT
-		printf("dictionary_get() found ['%s':%lu]\n", key, (long)entry.value);
-#endif
-		return entry.value;
-	}
+	dict_value_t *slot = dictionary_lookup(dict, dictionary_hash(dict, key), key, NULL);
+
+	// looking up an expired entry removes it
+	if (dict->log != NULL)
+		dictionary_log_end_update(dict);
+
 #ifdef DEBUG_VERBOSE_DICT_PUT
-	printf("dictionary_get() key not found '%s'\n", key);
+	if (slot == NULL)
+		printf("dictionary_get() key not found '%s'\n", key);
 #endif
-	return NULL;
+	return (slot != NULL) ? *slot : NULL;
 }
 
 /*
@@ -348,330 +616,2241 @@ dictionary_remove(dictionary_t *dict, char *key_in)
 		return NULL;
 
 	dict_value_t value = NULL;
-	long hash_index = hash((unsigned char *)key_in) % (dict->max_entries-1);
+	unsigned long full_hash = dictionary_hash(dict, key_in);
+	long hash_index = full_hash % (dict->max_entries-1);
+	int position = -1;
+
+	if ((dict->filter != NULL) && !bloom_filter_may_contain(dict->filter, full_hash))
+		return NULL;
 
 	dict_key_t key = dict->keys[hash_index];
 	if (key == NULL) {
 		entry_t entry = dict->values[hash_index];
 		// we may have a collision bucket
-		if (entry.value != NULL) {
-			collision_bucket_t *bucket = entry.collision_buckets;
-			int num_buckets = bucket->num_elements;
-			for (int j=0; j < num_buckets; j++) {
-				key = bucket->keys[j];
-				if ((key != NULL) && (strcmp(key_in, key) == 0)) {
-					value = bucket->values[j];
-					bucket->values[j] = NULL;
-					free(bucket->keys[j]);
-					bucket->keys[j] = NULL;
-					dict->num_collisions--;
-					int new_size = bucket->num_elements-1;
-
-					// if there is only one element remaining in this bucket, get rid of it
-					if (new_size == 1) {
-						int last_el_index = (j == 0) ? 1 : 0;
-#ifdef DEBUG_VERBOSE_DICT_REMOVE							
-						printf("dictionary_remove() [bucket] promoting last bucket element [%s:%lu (%p)] to value slot %lu\n",
-							bucket->keys[last_el_index], (long)bucket->values[last_el_index], (void *)bucket->values[last_el_index], hash_index);
-#endif
-						dict->keys[hash_index] = bucket->keys[last_el_index];
-						dict->values[hash_index].value = bucket->values[last_el_index];
-						bucket->keys[last_el_index] = NULL;
-						bucket->values[last_el_index] = NULL;
-						free(bucket->keys);
-						free(bucket->values);
-						free(bucket);
-						break;
-					}
-					// otherwise move the last element in this bucket to the current slot
-					else {
-#ifdef DEBUG_VERBOSE_DICT_REMOVE							
-						dict_value_t last_element = bucket->values[new_size];
-						printf("dictionary_remove() moving last element [%s:%lu (%p)] to vacated slot index %d (new size=%d)\n", 
-							(char *)bucket->keys[new_size], (long)last_element, (void *)last_element, j, new_size);
-#endif
-						bucket->keys[j] = bucket->keys[new_size];
-						bucket->values[j] = bucket->values[new_size];
-						bucket->keys[new_size] = NULL;
-						bucket->values[new_size] = NULL;
-						bucket->num_elements = new_size;
-					}
-#ifdef DEBUG_VERBOSE_DICT_REMOVE							
-					printf("dictionary_remove() [bucket] removed key='%s', value=%lu (%p)\n", key_in, (long)value, (void *)value);
-					print_collision_buckets(dict);
-#endif
-					break;
-				}
-			}
-		}
+		if (entry.value == NULL)
+			return NULL;
+		collision_bucket_t *bucket = entry.collision_buckets;
+		cb_entry_t *e = collision_bucket_find(bucket, full_hash, key_in);
+		if (e == NULL)
+			return NULL;
+		position = e - bucket->entries;
 	}
-	else if (strcmp(key_in, key) == 0) {
-		value = dict->values[hash_index].value;
-		dict->values[hash_index].value = NULL;	// ensure we don't mistake it for a bucket
-		free(dict->keys[hash_index]);
-		dict->keys[hash_index] = NULL;			// this key no longer exists
-		dict->num_entries--;
-#ifdef DEBUG_VERBOSE_DICT_REMOVE							
-		printf("dictionary_remove() [values] removed key='%s', value=%lu (%p)\n", key_in, (long)value, (void *)value);
-		print_collision_buckets(dict);
-#endif
+	else if (strcmp(key_in, key) != 0) {
+		return NULL;
+	}
+
+	// an expired entry is already gone as far as the caller is concerned
+	if ((dict->expiry != NULL) && dictionary_expired(dict, dictionary_entry_expires(dict, hash_index, position))) {
+		dictionary_expire_entry(dict, hash_index, position);
+	}
+	else {
+		value = dictionary_remove_entry(dict, hash_index, position, full_hash, NULL);
+#ifdef DEBUG_VERBOSE_DICT_REMOVE
+		printf("dictionary_remove() %s removed key='%s', value=%lu (%p)\n",
+			(position < 0) ? "[values]" : "[bucket]", key_in, (long)value, (void *)value);
+		print_collision_buckets(dict);
+#endif
+	}
+	dictionary_check_shrink(dict);
+	if (dict->log != NULL)
+		dictionary_log_end_update(dict);
+
+	return value;
+}
+
+/*
+ * Remove every entry for which the predicate returns nonzero, in a single
+ * pass over the table. Each collision bucket is compacted once, keeping
+ * its order, and a bucket left with one entry is promoted back into its
+ * slot. No key is hashed again, except to update the filter for entries
+ * stored in slots. The table shrinks afterwards if enough entries were
+ * removed, as it does for dictionary_remove(); call dictionary_compact()
+ * to release the rest of the slack.
+ *
+ * Each removed entry is passed to on_removed, if not NULL, so the caller
+ * can free the value; the key is freed by the dictionary after the call
+ * returns. Entries that have expired are passed to the expired callback
+ * instead, without calling the predicate. Neither function may change the
+ * dictionary.
+ *
+ * Returns the number of entries the predicate removed
+ *
+ * dict - allocated by new_dictionary()
+ * predicate - function that takes key, value as arguments, nonzero to remove
+ * on_removed - function returning void that takes key, value as arguments
+ */
+long
+dictionary_remove_if(dictionary_t *dict, dictionary_predicate_t predicate, dictionary_enumerator_t on_removed)
+{
+	dictionary_expiry_t *expiry = dict->expiry;
+	long now = (expiry != NULL) ? expiry->clock(expiry->context) : 0;
+	long entries_before = dict->num_entries;
+	long expired_count = 0;
+
+	for (long i=0; i < dict->max_entries; i++) {
+		dict_key_t key = dict->keys[i];
+		if (key != NULL) {
+			dict_value_t value = dict->values[i].value;
+			long expires = (expiry != NULL) ? expiry->expires[i] : 0;
+			int expired = (expires != 0) && (expires <= now);
+			if (!expired && !predicate(key, value))
+				continue;
+
+			dict->keys[i] = NULL;
+			dict->values[i].value = NULL;
+			if (dict->cache != NULL)
+				dict->cache->referenced[i] = 0;
+			if (expiry != NULL)
+				expiry->expires[i] = 0;
+			dictionary_dispose_removed(dict, key, value, 0, expired, on_removed);
+			expired_count += expired;
+			continue;
+		}
+
+		collision_bucket_t *bucket = dict->values[i].collision_buckets;
+		if (bucket == NULL)
+			continue;
+
+		// slide the entries that stay down over the removed ones, so a
+		// sorted bucket stays sorted
+		int num_elements = bucket->num_elements;
+		int kept = 0;
+		for (int j=0; j < num_elements; j++) {
+			cb_entry_t e = bucket->entries[j];
+			long expires = (bucket->expires != NULL) ? bucket->expires[j] : 0;
+			int expired = (expires != 0) && (expires <= now);
+			if (!expired && !predicate(e.key, e.value)) {
+				cb_move(bucket, kept++, j, 1);
+				continue;
+			}
+			dictionary_dispose_removed(dict, e.key, e.value, e.hash, expired, on_removed);
+			expired_count += expired;
+		}
+		if (kept == num_elements)
+			continue;
+
+		// a bucket of n entries counts as n - 1 collisions
+		dict->num_collisions -= (num_elements - 1) - ((kept > 1) ? kept - 1 : 0);
+
+		if (kept == 0) {
+			cb_free(bucket);
+			dict->values[i].collision_buckets = NULL;
+		}
+		else if (kept == 1) {
+			cb_entry_t *last = &bucket->entries[0];
+			dict->keys[i] = last->key;
+			dict->values[i].value = last->value;
+			if (dict->cache != NULL)
+				dict->cache->referenced[i] = bucket->referenced[0];
+			if (expiry != NULL)
+				expiry->expires[i] = bucket->expires[0];
+			cb_free(bucket);
+		}
+		else {
+			// release the unused capacity in one step, to the size cb_trim() would reach
+			int new_size = bucket->max_elements;
+			while ((new_size > CB_INITIAL_SIZE) && (kept * 4 <= new_size))
+				new_size /= 2;
+			bucket->num_elements = kept;
+			if (new_size != bucket->max_elements)
+				bucket = cb_resize(bucket, new_size);
+			dict->values[i].collision_buckets = bucket;
+		}
+
+		// the entries the CLOCK hand had yet to examine in this slot have moved
+		if ((dict->cache != NULL) && (dict->cache->hand == i))
+			dict->cache->hand_position = 0;
+	}
+
+	long removed = entries_before - dict->num_entries;
+	if (removed > 0)
+		dictionary_check_shrink(dict);
+	if (dict->log != NULL)
+		dictionary_log_end_update(dict);
+
+	return removed - expired_count;
+}
+
+/*
+ * Size the dictionary so that it can hold expected_entries without
+ * resizing. The dictionary is rebuilt at most once, and will not shrink
+ * automatically below the reserved capacity.
+ *
+ * Returns 0 on success, or -1 if the table could not be allocated
+ *
+ * dict - allocated by new_dictionary()
+ * expected_entries - number of entries the dictionary will hold
+ */
+int
+dictionary_reserve(dictionary_t *dict, long expected_entries)
+{
+	long new_size = capacity_for_entries(expected_entries, dict->load_factor);
+
+	if (new_size > dict->max_entries) {
+		if (dictionary_rebuild_table(dict, new_size) != 0)
+			return -1;
+	}
+
+	if (dict->min_entries < new_size)
+		dict->min_entries = new_size;
+
+	return 0;
+}
+
+/*
+ * For each key/value pair in the dictionary, execute the enumeration function.
+ * Entries that have expired but not yet been removed are included, so that
+ * their values can still be freed.
+ *
+ * dict - dictionary to enumerate
+ * enum_function - function returning void that takes key, value as arguments
+ */
+void
+dictionary_enumerate(dictionary_t *dict, dictionary_enumerator_t enum_function)
+{
+	for (long i=0; i < dict->max_entries; i++) {
+		dict_key_t key = dict->keys[i];
+		if (key == NULL) {
+			entry_t entry = dict->values[i];
+			// we may have a collision bucket
+			if (entry.value != NULL) {
+				collision_bucket_t *bucket = entry.collision_buckets;
+				for (int j=0; j < bucket->num_elements; j++) {
+					key = bucket->entries[j].key;
+					dict_value_t value = bucket->entries[j].value;
+#ifdef DEBUG_VERBOSE_DICT_ENUM
+					printf("dictionary_enumerate() [bucket] calling enum_function() with key='%s', value=%lu (%p)\n",
+						key, (long)value, (void *)value);
+#endif
+					enum_function(key, value);
+				}
+			}
+		}
+		else {
+			dict_value_t value = dict->values[i].value;
+#ifdef DEBUG_VERBOSE_DICT_ENUM
+			printf("dictionary_enumerate() [values] calling enum_function() with key='%s', value=%lu (%p)\n",
+				key, (long)value, (void *)value);
+#endif
+			enum_function(key, value);
+		}
+	}
+}
+
+/*
+ * Maintain a counting Bloom filter alongside the dictionary, so that most
+ * lookups of keys that are not in the dictionary are answered from the
+ * filter without loading the slot or walking a collision bucket. The filter
+ * reuses the hash computed for the table, and is kept up to date by put,
+ * remove and resizing.
+ *
+ * Returns 0 on success, or -1 if the filter could not be allocated
+ *
+ * dict - allocated by new_dictionary()
+ * counters_per_entry - 4-bit counters per entry, 0 removes the filter; 8
+ * 		gives about 3% false positives when the table is as full as
+ * 		its load factor allows, and less after it grows, since the
+ * 		filter is sized for the capacity
+ */
+int
+dictionary_enable_filter(dictionary_t *dict, int counters_per_entry)
+{
+	dict->filter_counters = counters_per_entry;
+
+	if (dictionary_reset_filter(dict) != 0)
+		return -1;
+
+	if (dict->filter == NULL)
+		return 0;
+
+	// record the entries already in the table
+	for (long i=0; i < dict->max_entries; i++) {
+		dict_key_t key = dict->keys[i];
+		if (key != NULL) {
+			bloom_filter_add(dict->filter, dictionary_hash(dict, key));
+		}
+		else if (dict->values[i].collision_buckets != NULL) {
+			collision_bucket_t *bucket = dict->values[i].collision_buckets;
+			for (int j=0; j < bucket->num_elements; j++) {
+				bloom_filter_add(dict->filter, bucket->entries[j].hash);
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Add delta to the count stored for key, starting from 0 if the key is not
+ * in the dictionary. The count is kept in the value itself, as a long.
+ * The key is hashed and looked up once.
+ *
+ * Returns the new count, or 0 if the key is NULL or the dictionary is
+ * uninitialized
+ *
+ * dict - dictionary whose values are all counts
+ * key - null-terminated string, copied by the dictionary if it is new
+ * delta - amount to add, may be negative
+ */
+long
+dictionary_increment(dictionary_t *dict, char *key, long delta)
+{
+	if (key == NULL)
+		return 0;
+
+	if ((dict == NULL) || (dict->keys == NULL) || (dict->values == NULL)) {
+		fprintf(stderr, "Attempt to use uninitialized dictionary %p\n", dict);
+		return 0;
+	}
+
+	unsigned long full_hash = dictionary_hash(dict, key);
+	dict_value_t *slot = dictionary_lookup(dict, full_hash, key, NULL);
+
+	if (slot == NULL) {
+		dictionary_add(dict, full_hash, key, (dict_value_t)delta, 0);
+		if (dict->log != NULL)
+			dictionary_log_end_update(dict);
+		return delta;
+	}
+
+	dict_value_t previous = *slot;
+	long count = (long)previous + delta;
+	*slot = (dict_value_t)count;
+	if (dict->log != NULL)
+		dictionary_log_put(dict, key, *slot);
+	if ((dict->cache != NULL) && (dict->cache->value_size != NULL)) {
+		dict->cache->num_bytes += dictionary_cache_entry_size(dict, key, *slot)
+			- dictionary_cache_entry_size(dict, key, previous);
+		dictionary_cache_evict(dict, NULL);
+	}
+	if (dict->log != NULL)
+		dictionary_log_end_update(dict);
+	return count;
+}
+
+/*
+ * Find the k entries with the largest counts, without sorting the others.
+ * A min-heap of the k largest counts seen so far is kept while the table
+ * is scanned once, so this takes O(n log k) time.
+ *
+ * Returns the number of entries found, k or fewer if the dictionary is
+ * smaller, in keys and counts from the largest count down. The keys belong
+ * to the dictionary and are valid until they are removed.
+ *
+ * dict - dictionary whose values are all counts
+ * k - number of entries to find
+ * keys - receives k keys
+ * counts - receives the count of each key
+ */
+long
+dictionary_top_k(dictionary_t *dict, long k, dict_key_t *keys, long *counts)
+{
+	long size = 0;
+
+	if (k <= 0)
+		return 0;
+
+	for (long i=0; i < dict->max_entries; i++) {
+		collision_bucket_t *bucket = (dict->keys[i] == NULL) ? dict->values[i].collision_buckets : NULL;
+		int num_elements = (dict->keys[i] != NULL) ? 1 : ((bucket != NULL) ? bucket->num_elements : 0);
+		for (int j=0; j < num_elements; j++) {
+			dict_key_t key = (bucket != NULL) ? bucket->entries[j].key : dict->keys[i];
+			long count = (long)((bucket != NULL) ? bucket->entries[j].value : dict->values[i].value);
+
+			if (size < k) {
+				// fill the heap, sifting each new entry up
+				long child = size++;
+				while (child > 0) {
+					long parent = (child - 1) / 2;
+					if (counts[parent] <= count)
+						break;
+					keys[child] = keys[parent];
+					counts[child] = counts[parent];
+					child = parent;
+				}
+				keys[child] = key;
+				counts[child] = count;
+			}
+			else if (count > counts[0]) {
+				// replace the smallest of the k largest
+				keys[0] = key;
+				counts[0] = count;
+				dictionary_top_sift_down(keys, counts, size, 0);
+			}
+		}
+	}
+
+	// heapsort in place, taking the smallest to the end leaves the largest first
+	for (long end = size - 1; end > 0; end--) {
+		dict_key_t key = keys[0];
+		long count = counts[0];
+		keys[0] = keys[end];
+		counts[0] = counts[end];
+		keys[end] = key;
+		counts[end] = count;
+		dictionary_top_sift_down(keys, counts, end, 0);
+	}
+
+	return size;
+}
+
+/*
+ * Maintain an ordered index of the keys alongside the dictionary, for
+ * dictionary_prefix_scan() and dictionary_range(). The index is a B-tree of
+ * the dictionary's own key pointers, kept up to date by put and remove;
+ * lookups by key still use the hash table alone.
+ *
+ * Returns 0 on success, or -1 if the index could not be allocated
+ *
+ * dict - allocated by new_dictionary()
+ */
+int
+dictionary_enable_index(dictionary_t *dict)
+{
+	if (dict->index != NULL)
+		return 0;
+
+	dict->index = new_ordered_index();
+	if (dict->index == NULL)
+		return -1;
+
+	// index the entries already in the table
+	for (long i=0; i < dict->max_entries; i++) {
+		dict_key_t key = dict->keys[i];
+		int failed = 0;
+		if (key != NULL) {
+			failed = ordered_index_insert(dict->index, key);
+		}
+		else if (dict->values[i].collision_buckets != NULL) {
+			collision_bucket_t *bucket = dict->values[i].collision_buckets;
+			for (int j=0; (j < bucket->num_elements) && !failed; j++)
+				failed = ordered_index_insert(dict->index, bucket->entries[j].key);
+		}
+		if (failed) {
+			free_ordered_index(dict->index);
+			dict->index = NULL;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Execute the enumeration function for each entry whose key starts with
+ * prefix, in key order
+ *
+ * Returns the number of entries enumerated, or -1 if the dictionary has no
+ * ordered index
+ *
+ * dict - dictionary with an index, see dictionary_enable_index()
+ * prefix - null-terminated string, "" enumerates every entry
+ * enum_function - function returning void that takes key, value as arguments
+ */
+long
+dictionary_prefix_scan(dictionary_t *dict, const char *prefix, dictionary_enumerator_t enum_function)
+{
+	if (dict->index == NULL) {
+		fprintf(stderr, "dictionary_prefix_scan() dictionary %p has no index\n", dict);
+		return -1;
+	}
+
+	dictionary_scan_t scan = { dict, prefix, strlen(prefix), NULL, enum_function, 0 };
+	ordered_index_scan(dict->index, prefix, &dictionary_index_visit, &scan);
+	return scan.count;
+}
+
+/*
+ * Execute the enumeration function for each entry whose key is at least
+ * from and less than to, in key order
+ *
+ * Returns the number of entries enumerated, or -1 if the dictionary has no
+ * ordered index
+ *
+ * dict - dictionary with an index, see dictionary_enable_index()
+ * from - first key to enumerate, or NULL to start with the smallest key
+ * to - key to stop before, or NULL to continue to the largest key
+ * enum_function - function returning void that takes key, value as arguments
+ */
+long
+dictionary_range(dictionary_t *dict, const char *from, const char *to, dictionary_enumerator_t enum_function)
+{
+	if (dict->index == NULL) {
+		fprintf(stderr, "dictionary_range() dictionary %p has no index\n", dict);
+		return -1;
+	}
+
+	dictionary_scan_t scan = { dict, NULL, 0, to, enum_function, 0 };
+	ordered_index_scan(dict->index, from, &dictionary_index_visit, &scan);
+	return scan.count;
+}
+
+/*
+ * Turn the dictionary into a bounded cache. Once a put takes the dictionary
+ * past max_entries or max_bytes, entries are evicted by the CLOCK algorithm:
+ * every entry has a reference bit that is set when it is found by
+ * dictionary_get() or dictionary_put(), and a hand sweeps the slots and
+ * their collision buckets, clearing set bits and evicting the first entry
+ * whose bit is clear. New entries start unreferenced, so a scan of keys that
+ * are used once can't push out entries that are used repeatedly. The entry
+ * just added is never evicted.
+ *
+ * Returns 0 on success, or -1 if the cache could not be allocated
+ *
+ * dict - allocated by new_dictionary()
+ * max_entries - most entries to keep, 0 for no limit
+ * max_bytes - most bytes of keys plus value sizes to keep, 0 for no limit;
+ * 		both limits 0 turns cache mode off
+ * evict - called with each evicted key and value, may be NULL
+ * value_size - returns the size of a value for max_bytes, may be NULL to
+ * 		count only the keys
+ * context - passed to evict and value_size
+ */
+int
+dictionary_set_cache(dictionary_t *dict, long max_entries, long max_bytes,
+	dictionary_evict_function_t evict, dictionary_size_function_t value_size, void *context)
+{
+	if (dict->cache != NULL) {
+		dictionary_free_bucket_bits(dict);
+		free(dict->cache->referenced);
+		free(dict->cache);
+		dict->cache = NULL;
+	}
+
+	if ((max_entries <= 0) && (max_bytes <= 0))
+		return 0;
+
+	// a cache of a known size never needs to grow
+	if ((max_entries > 0) && (dictionary_reserve(dict, max_entries) != 0))
+		return -1;
+
+	dictionary_cache_t *cache = calloc(1, sizeof(dictionary_cache_t));
+	cache->referenced = calloc(dict->max_entries, 1);
+	int failed = (cache->referenced == NULL);
+
+	// bucket entries keep their reference bits beside the bucket
+	for (long i=0; (i < dict->max_entries) && !failed; i++) {
+		collision_bucket_t *bucket = (dict->keys[i] == NULL) ? dict->values[i].collision_buckets : NULL;
+		if (bucket != NULL) {
+			bucket->referenced = calloc(bucket->max_elements, 1);
+			failed = (bucket->referenced == NULL);
+		}
+	}
+	if (failed) {
+		dictionary_free_bucket_bits(dict);
+		free(cache->referenced);
+		free(cache);
+		return -1;
+	}
+	cache->max_entries = max_entries;
+	cache->max_bytes = max_bytes;
+	cache->evict = evict;
+	cache->value_size = value_size;
+	cache->context = context;
+	dict->cache = cache;
+
+	// account for the entries already in the table
+	for (long i=0; i < dict->max_entries; i++) {
+		dict_key_t key = dict->keys[i];
+		if (key != NULL) {
+			cache->num_bytes += dictionary_cache_entry_size(dict, key, dict->values[i].value);
+		}
+		else if (dict->values[i].collision_buckets != NULL) {
+			collision_bucket_t *bucket = dict->values[i].collision_buckets;
+			for (int j=0; j < bucket->num_elements; j++) {
+				cb_entry_t *e = &bucket->entries[j];
+				cache->num_bytes += dictionary_cache_entry_size(dict, e->key, e->value);
+			}
+		}
+	}
+
+	dictionary_cache_evict(dict, NULL);
+	if (dict->log != NULL)
+		dictionary_log_end_update(dict);
+	return 0;
+}
+
+/*
+ * Hash keys with SipHash-1-3 keyed by a per-dictionary seed instead of djb2,
+ * so that keys crafted to collide can't turn lookups into linear scans. The
+ * table is rebuilt with the new hash; later rebuilds keep the seed.
+ *
+ * Returns 0 on success, or -1 if the table could not be rebuilt
+ *
+ * dict - allocated by new_dictionary()
+ * seed - two 64-bit words, NULL for a random seed
+ * reseed_chain - when a put makes a collision chain longer than this, pick
+ * 		a new random seed and rebuild, at most once per capacity; 0 never
+ */
+int
+dictionary_enable_seed(dictionary_t *dict, const unsigned long *seed, int reseed_chain)
+{
+	unsigned long new_seed[2];
+
+	if (seed != NULL) {
+		new_seed[0] = seed[0];
+		new_seed[1] = seed[1];
+	}
+	else {
+		dictionary_random_seed(new_seed);
+	}
+
+	dict->reseed_chain = reseed_chain;
+	return dictionary_reseed(dict, new_seed);
+}
+
+/*
+ * Fill seed with 128 random bits from /dev/urandom, or from the clock and
+ * the address space layout if it can't be read
+ */
+void
+dictionary_random_seed(unsigned long seed[2])
+{
+	int fd = open("/dev/urandom", O_RDONLY);
+
+	if ((fd >= 0) && (read(fd, seed, 2 * sizeof(unsigned long)) == 2 * sizeof(unsigned long))) {
+		close(fd);
+		return;
+	}
+	if (fd >= 0)
+		close(fd);
+
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	seed[0] = hash_int64((unsigned long)now.tv_sec ^ ((unsigned long)now.tv_nsec << 32));
+	seed[1] = hash_int64((unsigned long)seed ^ (unsigned long)&dictionary_random_seed ^ seed[0]);
+}
+
+/*
+ * Allow entries to expire. Expired entries are treated as absent by
+ * dictionary_get(), dictionary_put() and dictionary_remove(), and are
+ * removed when one of them touches the entry, or when
+ * dictionary_expire_step() reaches it, so no full scan is ever needed.
+ *
+ * Returns 0 on success, or -1 if the expiration times could not be allocated
+ *
+ * dict - allocated by new_dictionary()
+ * clock - returns the current time, NULL for CLOCK_MONOTONIC milliseconds
+ * expired - called with the key and value of each expired entry as it is
+ * 		removed, so the caller can free the value; may be NULL
+ * context - passed to clock and expired
+ */
+int
+dictionary_enable_expiry(dictionary_t *dict, dictionary_clock_function_t clock,
+	dictionary_evict_function_t expired, void *context)
+{
+	dictionary_expiry_t *expiry = dict->expiry;
+
+	// existing expiration times are kept when the callbacks change
+	if (expiry == NULL) {
+		expiry = calloc(1, sizeof(dictionary_expiry_t));
+		expiry->expires = calloc(dict->max_entries, sizeof(long));
+		int failed = (expiry->expires == NULL);
+
+		// bucket entries keep their expiration times beside the bucket
+		for (long i=0; (i < dict->max_entries) && !failed; i++) {
+			collision_bucket_t *bucket = (dict->keys[i] == NULL) ? dict->values[i].collision_buckets : NULL;
+			if (bucket != NULL) {
+				bucket->expires = calloc(bucket->max_elements, sizeof(long));
+				failed = (bucket->expires == NULL);
+			}
+		}
+		if (failed) {
+			for (long i=0; i < dict->max_entries; i++) {
+				collision_bucket_t *bucket = (dict->keys[i] == NULL) ? dict->values[i].collision_buckets : NULL;
+				if (bucket != NULL) {
+					free(bucket->expires);
+					bucket->expires = NULL;
+				}
+			}
+			fprintf(stderr, "Unable to allocate expiration times for dictionary %p\n", dict);
+			free(expiry->expires);
+			free(expiry);
+			return -1;
+		}
+		dict->expiry = expiry;
+	}
+
+	expiry->clock = (clock != NULL) ? clock : &dictionary_clock_milliseconds;
+	expiry->expired = expired;
+	expiry->context = context;
+	return 0;
+}
+
+/*
+ * Change the expiration time of an existing entry
+ *
+ * Returns 0 on success, or -1 if the key is not in the dictionary
+ *
+ * dict - dictionary with expiry enabled by dictionary_enable_expiry()
+ * key - null-terminated string to look for
+ * expires - expiration time on the dictionary's clock, 0 for never
+ */
+int
+dictionary_set_expire(dictionary_t *dict, char *key, long expires)
+{
+	if ((key == NULL) || (dict->expiry == NULL))
+		return -1;
+
+	long *slot_expires;
+	dict_value_t *slot = dictionary_lookup(dict, dictionary_hash(dict, key), key, &slot_expires);
+	if (dict->log != NULL)
+		dictionary_log_end_update(dict);
+	if (slot == NULL)
+		return -1;
+
+	*slot_expires = expires;
+	return 0;
+}
+
+/*
+ * Reclaim expired entries with a bounded amount of work, for calling from
+ * an event loop. Examines at most max_slots slots, continuing from where
+ * the previous call stopped, so every entry is visited once per
+ * max_entries / max_slots calls. Like active expiry in Redis, the caller
+ * can call again straight away while a large share of the entries examined
+ * turn out to have expired.
+ *
+ * Returns the number of entries removed
+ *
+ * dict - dictionary with expiry enabled by dictionary_enable_expiry()
+ * max_slots - most slots to examine
+ */
+long
+dictionary_expire_step(dictionary_t *dict, long max_slots)
+{
+	dictionary_expiry_t *expiry = dict->expiry;
+	long removed = 0;
+
+	if (expiry == NULL)
+		return 0;
+
+	long now = expiry->clock(expiry->context);
+	if (max_slots > dict->max_entries)
+		max_slots = dict->max_entries;
+
+	for (long i=0; (i < max_slots) && (dict->num_entries > 0); i++) {
+		if (expiry->cursor >= dict->max_entries)
+			expiry->cursor = 0;
+		removed += dictionary_expire_slot(dict, expiry->cursor++, now);
+	}
+
+	// shrinking rebuilds the table, which restarts the cursor
+	if (removed > 0)
+		dictionary_check_shrink(dict);
+	if (dict->log != NULL)
+		dictionary_log_end_update(dict);
+
+	return removed;
+}
+
+/*
+ * Rebuild the dictionary at the smallest capacity that holds the current
+ * entries within the load factor. Collision buckets are rebuilt at their
+ * minimum size as part of the rebuild.
+ *
+ * Removing entries shrinks the dictionary automatically, but only once it is
+ * less than a quarter as full as the load factor allows. Call this after a
+ * large purge to release the remaining slack immediately.
+ *
+ * dict - dictionary to compact
+ */
+void
+dictionary_compact(dictionary_t *dict)
+{
+	long new_size = capacity_for_entries(dict->num_entries, dict->load_factor);
+
+	if ((new_size != dict->max_entries) && (dictionary_rebuild_table(dict, new_size) != 0))
+		return;
+
+	// an explicit compaction also lowers the floor for automatic shrinking
+	if (dict->min_entries > dict->max_entries)
+		dict->min_entries = dict->max_entries;
+}
+
+/*
+ * Returns a copy of the dictionary, or NULL if it could not be allocated
+ *
+ * The table is copied as it stands, without rehashing or growing: the slot
+ * arrays and collision buckets are duplicated directly, and all the keys
+ * are packed into a single allocation owned by the copy. Values are copied
+ * as they are, the caller still manages them. The filter, cache and expiry
+ * state and the seed are copied too; callbacks and their context are shared.
+ *
+ * dict - dictionary to copy, not modified
+ */
+dictionary_t *
+dictionary_clone(dictionary_t *dict)
+{
+	dictionary_t *copy = calloc(1, sizeof(dictionary_t));
+	if (copy == NULL)
+		return NULL;
+
+	*copy = *dict;
+	copy->keys = (dict_key_t *)calloc(dict->max_entries, sizeof(dict_key_t));
+	copy->values = (entry_t *)calloc(dict->max_entries, sizeof(entry_t));
+	copy->filter = NULL;
+	copy->index = NULL;
+	copy->log = NULL;
+	copy->cache = NULL;
+	copy->expiry = NULL;
+	copy->key_storage = NULL;
+	copy->key_storage_size = 0;
+	if ((copy->keys == NULL) || (copy->values == NULL))
+		goto failed;
+
+	// one pass to size the key storage, one to fill it
+	long storage_size = 0;
+	for (long i=0; i < dict->max_entries; i++) {
+		if (dict->keys[i] != NULL) {
+			storage_size += strlen(dict->keys[i]) + 1;
+		}
+		else if (dict->values[i].collision_buckets != NULL) {
+			collision_bucket_t *bucket = dict->values[i].collision_buckets;
+			for (int j=0; j < bucket->num_elements; j++)
+				storage_size += strlen(bucket->entries[j].key) + 1;
+		}
+	}
+	copy->key_storage = malloc((storage_size > 0) ? storage_size : 1);
+	if (copy->key_storage == NULL)
+		goto failed;
+	copy->key_storage_size = storage_size;
+
+	char *next = copy->key_storage;
+	for (long i=0; i < dict->max_entries; i++) {
+		if (dict->keys[i] != NULL) {
+			size_t size = strlen(dict->keys[i]) + 1;
+			memcpy(next, dict->keys[i], size);
+			copy->keys[i] = next;
+			copy->values[i] = dict->values[i];
+			next += size;
+		}
+		else if (dict->values[i].collision_buckets != NULL) {
+			// buckets are copied at their current length, entries in the same
+			// order, so sorted buckets stay sorted
+			collision_bucket_t *bucket = dict->values[i].collision_buckets;
+			collision_bucket_t *bucket_copy = (collision_bucket_t *)malloc(
+				sizeof(collision_bucket_t) + sizeof(cb_entry_t) * bucket->num_elements);
+			if (bucket_copy == NULL)
+				goto failed;
+			bucket_copy->num_elements = bucket->num_elements;
+			bucket_copy->max_elements = bucket->num_elements;
+			bucket_copy->expires = NULL;
+			bucket_copy->referenced = NULL;
+			memcpy(bucket_copy->entries, bucket->entries, sizeof(cb_entry_t) * bucket->num_elements);
+			if (bucket->expires != NULL) {
+				bucket_copy->expires = malloc(sizeof(long) * bucket->num_elements);
+				if (bucket_copy->expires == NULL) {
+					cb_free(bucket_copy);
+					goto failed;
+				}
+				memcpy(bucket_copy->expires, bucket->expires, sizeof(long) * bucket->num_elements);
+			}
+			if (bucket->referenced != NULL) {
+				bucket_copy->referenced = malloc(bucket->num_elements);
+				if (bucket_copy->referenced == NULL) {
+					cb_free(bucket_copy);
+					goto failed;
+				}
+				memcpy(bucket_copy->referenced, bucket->referenced, bucket->num_elements);
+			}
+			for (int j=0; j < bucket->num_elements; j++) {
+				size_t size = strlen(bucket->entries[j].key) + 1;
+				memcpy(next, bucket->entries[j].key, size);
+				bucket_copy->entries[j].key = next;
+				next += size;
+			}
+			copy->values[i].collision_buckets = bucket_copy;
+		}
+	}
+
+	if (dict->filter != NULL) {
+		copy->filter = bloom_filter_clone(dict->filter);
+		if (copy->filter == NULL)
+			goto failed;
+	}
+
+	// the index holds key pointers, the copy's keys are new so it is rebuilt
+	if ((dict->index != NULL) && (dictionary_enable_index(copy) != 0))
+		goto failed;
+
+	if (dict->cache != NULL) {
+		dictionary_cache_t *cache = malloc(sizeof(dictionary_cache_t));
+		if (cache == NULL)
+			goto failed;
+		*cache = *dict->cache;
+		cache->referenced = malloc(dict->max_entries);
+		if (cache->referenced == NULL) {
+			free(cache);
+			goto failed;
+		}
+		memcpy(cache->referenced, dict->cache->referenced, dict->max_entries);
+		copy->cache = cache;
+	}
+
+	if (dict->expiry != NULL) {
+		dictionary_expiry_t *expiry = malloc(sizeof(dictionary_expiry_t));
+		if (expiry == NULL)
+			goto failed;
+		*expiry = *dict->expiry;
+		expiry->expires = malloc(sizeof(long) * dict->max_entries);
+		if (expiry->expires == NULL) {
+			free(expiry);
+			goto failed;
+		}
+		memcpy(expiry->expires, dict->expiry->expires, sizeof(long) * dict->max_entries);
+		copy->expiry = expiry;
+	}
+
+	return copy;
+
+failed:
+	fprintf(stderr, "dictionary_clone() unable to copy a dictionary of %lu entries\n", dict->num_entries);
+	free_dictionary(copy);
+	return NULL;
+}
+
+/*
+ * Move every key into a single allocation, sharing the bytes of any key
+ * that is a suffix of another key ("ring" is stored inside "string"). This
+ * saves the allocator's header and rounding on every key as well as the
+ * shared bytes, typically halving the memory taken by short keys, and
+ * lookups are unaffected since the keys are still ordinary strings.
+ *
+ * Meant for read-mostly tables: keys put afterwards are allocated on their
+ * own as usual, and removed keys stay in the storage until the keys are
+ * packed again. The keys are sorted by their reversed bytes to find the
+ * suffixes, so this takes O(n log n) time.
+ *
+ * Returns the size of the key storage, or -1 if it could not be allocated,
+ * in which case the keys are unchanged
+ *
+ * dict - allocated by new_dictionary()
+ */
+long
+dictionary_pack_keys(dictionary_t *dict)
+{
+	long count = 0;
+	dict_key_t **slots = malloc(((dict->num_entries > 0) ? dict->num_entries : 1) * sizeof(dict_key_t *));
+
+	if (slots == NULL)
+		return -1;
+
+	for (long i=0; i < dict->max_entries; i++) {
+		if (dict->keys[i] != NULL) {
+			slots[count++] = &dict->keys[i];
+		}
+		else if (dict->values[i].collision_buckets != NULL) {
+			collision_bucket_t *bucket = dict->values[i].collision_buckets;
+			for (int j=0; j < bucket->num_elements; j++)
+				slots[count++] = &bucket->entries[j].key;
+		}
+	}
+	qsort(slots, count, sizeof(dict_key_t *), &dictionary_compare_reversed);
+
+	// walking back from the end, a key that is a suffix of the key after it
+	// is a suffix of the longest key of its run, and is stored inside it
+	long storage_size = 0;
+	for (long i=count-1; i >= 0; i--) {
+		size_t length = strlen(*slots[i]);
+		if ((i == count-1) || (length > strlen(*slots[i+1]))
+			|| (strcmp(*slots[i], *slots[i+1] + strlen(*slots[i+1]) - length) != 0))
+			storage_size += length + 1;
+	}
+
+	char *storage = malloc((storage_size > 0) ? storage_size : 1);
+	if (storage == NULL) {
+		free(slots);
+		return -1;
+	}
+
+	char *next = storage;
+	char *run = NULL;
+	size_t run_length = 0;
+	for (long i=count-1; i >= 0; i--) {
+		dict_key_t key = *slots[i];
+		size_t length = strlen(key);
+		if ((run != NULL) && (length <= run_length) && (strcmp(key, run + run_length - length) == 0)) {
+			*slots[i] = run + run_length - length;
+		}
+		else {
+			memcpy(next, key, length + 1);
+			run = next;
+			run_length = length;
+			*slots[i] = next;
+			next += length + 1;
+		}
+		dictionary_free_key(dict, key);
+	}
+	free(slots);
+
+	free(dict->key_storage);
+	dict->key_storage = storage;
+	dict->key_storage_size = storage_size;
+
+	// the index holds key pointers, so it is rebuilt on the packed keys
+	if (dict->index != NULL) {
+		free_ordered_index(dict->index);
+		dict->index = NULL;
+		if (dictionary_enable_index(dict) != 0)
+			fprintf(stderr, "Unable to rebuild the ordered index, it has been disabled\n");
+	}
+
+	return storage_size;
+}
+
+/*
+ * Move every entry of src into dest, and free src
+ *
+ * If src was opened with dictionary_open_log(), its log is truncated to
+ * match the now empty src before src is freed, so reopening it doesn't
+ * bring back the entries that moved to dest.
+ *
+ * Returns 0 on success, or -1 if dest and src are the same dictionary or
+ * dest could not be grown to hold the entries of both, in which case
+ * neither dictionary is changed
+ *
+ * dest - dictionary receiving the entries
+ * src - dictionary to consume, freed on success
+ * combine - called for each key found in both dictionaries, with the
+ * 		values from dest and from src, returns the value to keep
+ */
+int
+dictionary_merge(dictionary_t *dest, dictionary_t *src, dictionary_combine_t combine)
+{
+	if (dest == src) {
+		fprintf(stderr, "dictionary_merge() can't merge dictionary %p into itself\n", dest);
+		return -1;
+	}
+
+	// size for the combined count up front, duplicates only make it roomier
+	long new_size = capacity_for_entries(dest->num_entries + src->num_entries, dest->load_factor);
+	if ((new_size > dest->max_entries) && (dictionary_rebuild_table(dest, new_size) != 0))
+		return -1;
+
+	for (long i=0; i < src->max_entries; i++) {
+		dict_key_t key = src->keys[i];
+		if (key != NULL) {
+			long expires = (src->expiry != NULL) ? src->expiry->expires[i] : 0;
+			dictionary_merge_entry(dest, src, 0, key, src->values[i].value, expires, combine);
+			src->keys[i] = NULL;
+			src->values[i].value = NULL;
+		}
+		else if (src->values[i].collision_buckets != NULL) {
+			collision_bucket_t *bucket = src->values[i].collision_buckets;
+			for (int j=0; j < bucket->num_elements; j++) {
+				cb_entry_t *e = &bucket->entries[j];
+				// bucket entries keep their hash, which can be used as it is when
+				// both dictionaries hash the same way; dest may reseed partway
+				int same_hash = (dest->seeded == src->seeded)
+					&& (!dest->seeded || ((dest->seed[0] == src->seed[0]) && (dest->seed[1] == src->seed[1])));
+				dictionary_merge_entry(dest, src, same_hash ? e->hash : 0, e->key, e->value,
+					(bucket->expires != NULL) ? bucket->expires[j] : 0, combine);
+			}
+			cb_free(bucket);
+			src->values[i].collision_buckets = NULL;
+		}
+	}
+
+	// every key has been moved or freed, what's left is the empty table
+	src->num_entries = 0;
+	src->num_collisions = 0;
+	if ((src->log != NULL) && (dictionary_compact_log(src) != 0))
+		fprintf(stderr, "dictionary_merge() unable to truncate the log of dictionary %p\n", src);
+	free_dictionary(src);
+	if (dest->log != NULL)
+		dictionary_log_end_update(dest);
+	return 0;
+}
+
+/* --- private functions --- */
+
+/*
+ * Add a copy of a key that is not in the dictionary, then grow, reseed and
+ * evict as needed
+ *
+ * dict - dictionary to update
+ * full_hash - full hash value of the key
+ * key - null-terminated string, copied by the dictionary
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ * expires - expiration time, if expiry is enabled
+ */
+void
+dictionary_add(dictionary_t *dict, unsigned long full_hash, const char *key, dict_value_t value, long expires)
+{
+	dictionary_add_owned(dict, full_hash, strdup(key), value, expires);
+}
+
+/*
+ * Add a key that is not in the dictionary, taking ownership of it, then
+ * index and log it, and grow, reseed and evict as needed. Every new entry
+ * goes through here, so a put and a merge update the table alike.
+ *
+ * dict - dictionary to update
+ * full_hash - full hash value of the key
+ * key - null-terminated string, freed by the dictionary
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ * expires - expiration time, if expiry is enabled
+ */
+void
+dictionary_add_owned(dictionary_t *dict, unsigned long full_hash, dict_key_t key, dict_value_t value, long expires)
+{
+	dictionary_insert_owned(dict, full_hash, key, value, 0, expires);
+	dictionary_index_add(dict, key);
+	if (dict->log != NULL)
+		dictionary_log_put(dict, key, value);
+
+	// if the table can't be grown we carry on with longer chains
+	if (capacity_needs_growth(dict->num_entries, dict->max_entries, dict->load_factor)) {
+		dictionary_rebuild_table(dict, capacity_after_growth(dict->num_entries, dict->load_factor));
+	}
+
+	// keys chosen to collide under one seed are scattered by the next; a
+	// table that is simply unlucky is only reseeded once per capacity
+	if ((dict->reseed_chain > 0) && (dict->maximum_chain > dict->reseed_chain)
+		&& (dict->reseed_capacity != dict->max_entries)) {
+		unsigned long seed[2];
+		dictionary_random_seed(seed);
+#ifdef DEBUG_VERBOSE_DICT_RESIZE
+		printf("dictionary_add_owned() reseeding after a chain of %lu\n", dict->maximum_chain);
+#endif
+		dictionary_reseed(dict, seed);
+		dict->reseed_capacity = dict->max_entries;
+	}
+
+	// new entries start unreferenced, so a scan of keys that are used once
+	// can't push out entries that are used repeatedly
+	if (dict->cache != NULL) {
+		dict->cache->num_bytes += dictionary_cache_entry_size(dict, key, value);
+		dictionary_cache_evict(dict, key);
+	}
+}
+
+/*
+ * Restore the min-heap order of the top-k arrays by moving entry i down
+ */
+void
+dictionary_top_sift_down(dict_key_t *keys, long *counts, long size, long i)
+{
+	dict_key_t key = keys[i];
+	long count = counts[i];
+
+	for (;;) {
+		long child = 2 * i + 1;
+		if (child >= size)
+			break;
+		if ((child + 1 < size) && (counts[child + 1] < counts[child]))
+			child++;
+		if (counts[child] >= count)
+			break;
+		keys[i] = keys[child];
+		counts[i] = counts[child];
+		i = child;
+	}
+	keys[i] = key;
+	counts[i] = count;
+}
+
+/*
+ * Free the private dictionary structures without freeing the public dictionary structure
+ */
+void
+dictionary_free_internal(dictionary_t *dict)
+{
+	if (dict->log) {
+		dictionary_close_log(dict->log);
+		dict->log = NULL;
+	}
+
+	if (dict->filter) {
+		free_bloom_filter(dict->filter);
+		dict->filter = NULL;
+	}
+
+	if (dict->index) {
+		free_ordered_index(dict->index);
+		dict->index = NULL;
+	}
+
+	if (dict->cache) {
+		free(dict->cache->referenced);
+		free(dict->cache);
+		dict->cache = NULL;
+	}
+
+	if (dict->expiry) {
+		free(dict->expiry->expires);
+		free(dict->expiry);
+		dict->expiry = NULL;
+	}
+
+	if (dict->values) {
+		for (long i=0; i < dict->max_entries; i++) {
+			if (dict->keys[i] == NULL) {
+				// then the value is a collision bucket (or null)
+				collision_bucket_t *bucket = dict->values[i].collision_buckets;
+				if (bucket == NULL) {
+					continue;
+				}
+#ifdef DEBUG_VERBOSE_DICT_INIT
+				printf("free_dictionary() freeing collision bucket %ld (%p)\n", i, bucket);
+#endif
+				free_collision_bucket(dict, bucket);
+			}
+		}
+		free(dict->values);
+	}
+
+	if (dict->keys) {
+		// we reallocate the keys, but not the values
+		for (long i=0; i < dict->max_entries; i++) {
+			dictionary_free_key(dict, dict->keys[i]);
+		}
+		free(dict->keys);
+	}
+
+	free(dict->key_storage);
+	dict->key_storage = NULL;
+	dict->key_storage_size = 0;
+}
+
+/*
+ * Free the reference bits of every collision bucket, when the dictionary
+ * leaves cache mode
+ */
+void
+dictionary_free_bucket_bits(dictionary_t *dict)
+{
+	for (long i=0; i < dict->max_entries; i++) {
+		collision_bucket_t *bucket = (dict->keys[i] == NULL) ? dict->values[i].collision_buckets : NULL;
+		if (bucket != NULL) {
+			free(bucket->referenced);
+			bucket->referenced = NULL;
+		}
+	}
+}
+
+/*
+ * Free a key that has left the dictionary, unless it was packed into the
+ * key storage by dictionary_clone() or dictionary_pack_keys()
+ */
+void
+dictionary_free_key(dictionary_t *dict, dict_key_t key)
+{
+	// packed keys are released all at once with the dictionary
+	if (dictionary_packed_key(dict, key))
+		return;
+	free(key);
+}
+
+/*
+ * Returns 1 if a key was packed into the key storage by dictionary_clone()
+ * or dictionary_pack_keys(), 0 if it was allocated on its own
+ */
+int
+dictionary_packed_key(dictionary_t *dict, dict_key_t key)
+{
+	return (dict->key_storage != NULL) && (key >= dict->key_storage)
+		&& (key < dict->key_storage + dict->key_storage_size);
+}
+
+/*
+ * Compare two keys by their bytes from last to first, for qsort(), so that
+ * a key sorts just before the keys it is a suffix of
+ *
+ * a, b - pointers to the slots holding the keys
+ */
+int
+dictionary_compare_reversed(const void *a, const void *b)
+{
+	const unsigned char *key_a = (const unsigned char *)**(dict_key_t **)a;
+	const unsigned char *key_b = (const unsigned char *)**(dict_key_t **)b;
+	size_t i = strlen((const char *)key_a);
+	size_t j = strlen((const char *)key_b);
+
+	while ((i > 0) && (j > 0)) {
+		i--;
+		j--;
+		if (key_a[i] != key_b[j])
+			return (key_a[i] < key_b[j]) ? -1 : 1;
+	}
+	return (i > 0) - (j > 0);
+}
+
+/*
+ * Move one entry of a source dictionary into the destination of
+ * dictionary_merge(), taking ownership of the key
+ *
+ * dest - dictionary receiving the entry
+ * src - dictionary the entry came from, used to free its key
+ * key_hash - full hash of the key in dest, or 0 to compute it
+ * key - key removed from src
+ * value - value removed from src
+ * expires - expiration time in src, 0 for never
+ * combine - resolves a key found in both dictionaries, or NULL to replace
+ */
+void
+dictionary_merge_entry(dictionary_t *dest, dictionary_t *src, unsigned long key_hash, dict_key_t key,
+	dict_value_t value, long expires, dictionary_combine_t combine)
+{
+	// an entry that has already expired in the source is expired, not merged
+	if ((expires != 0) && dictionary_expired(src, expires)) {
+		if (src->expiry->expired != NULL)
+			src->expiry->expired(key, value, src->expiry->context);
+		dictionary_free_key(src, key);
+		return;
+	}
+	if (dest->expiry == NULL)
+		expires = 0;
+
+	if (key_hash == 0)
+		key_hash = dictionary_hash(dest, key);
+
+	long *slot_expires;
+	dict_value_t *slot = dictionary_lookup(dest, key_hash, key, &slot_expires);
+	if (slot != NULL) {
+		dict_value_t previous = *slot;
+		*slot = (combine != NULL) ? combine(key, previous, value) : value;
+		if (dest->log != NULL)
+			dictionary_log_put(dest, key, *slot);
+		if ((dest->cache != NULL) && (dest->cache->value_size != NULL)) {
+			dest->cache->num_bytes += dictionary_cache_entry_size(dest, key, *slot)
+				- dictionary_cache_entry_size(dest, key, previous);
+			dictionary_cache_evict(dest, NULL);
+		}
+		dictionary_free_key(src, key);
+		return;
+	}
+
+	// keys packed by dictionary_clone() are freed with the source, so they
+	// are the only ones copied
+	if (dictionary_packed_key(src, key))
+		key = strdup(key);
+	dictionary_add_owned(dest, key_hash, key, value, expires);
+}
+
+/*
+ * Resize the dictionary, rehashing all keys
+ * 
+ * Called by dictionary_put() - not safe for concurrent updates
+ *
+ * Returns 0 on success, or -1 if the new table could not be allocated, in
+ * which case the dictionary is left unchanged
+ *
+ * dict- dictionary to resize
+ * new_size - new size - this should be prime
+ */
+int
+dictionary_rebuild_table(dictionary_t *dict, long new_size)
+{
+#ifdef DEBUG_VERBOSE_DICT_RESIZE
+	printf("Resizing dictionary from %lu to %lu (%lu entries, %lu collisions)\n",
+			dict->max_entries, new_size, dict->num_entries, dict->num_collisions);
+	// printf("Collision buckets before resize:\n");
+	// print_collision_buckets(dict);
+#endif
+	dict_key_t *old_keys = dict->keys;
+	entry_t *old_values = dict->values;
+	long old_size = dict->max_entries;
+	long old_entries = dict->num_entries;
+
+	dict_key_t *new_keys = (dict_key_t *)calloc(new_size, sizeof(dict_key_t));
+	entry_t *new_values = (entry_t *)calloc(new_size, sizeof(entry_t));
+	unsigned char *new_referenced = (dict->cache != NULL) ? calloc(new_size, 1) : NULL;
+	long *new_expires = (dict->expiry != NULL) ? calloc(new_size, sizeof(long)) : NULL;
+
+	if ((new_keys == NULL) || (new_values == NULL)
+		|| ((dict->cache != NULL) && (new_referenced == NULL))
+		|| ((dict->expiry != NULL) && (new_expires == NULL))) {
+		fprintf(stderr, "Unable to allocate %lu slots to resize dictionary %p\n", new_size, dict);
+		free(new_keys);
+		free(new_values);
+		free(new_referenced);
+		free(new_expires);
+		return -1;
+	}
+
+	dict->keys = new_keys;
+	dict->values = new_values;
+	dict->max_entries = new_size;
+	dict->num_entries = 0;
+	dict->num_collisions = 0;
+	dict->maximum_chain = 0;
+
+	// the filter is resized with the table and refilled as entries move over;
+	// if it can't be allocated the dictionary carries on without one
+	dictionary_reset_filter(dict);
+
+	// the CLOCK hand starts over, entries keep their reference bits
+	unsigned char *old_referenced = NULL;
+	if (dict->cache != NULL) {
+		old_referenced = dict->cache->referenced;
+		dict->cache->referenced = new_referenced;
+		dict->cache->hand = 0;
+		dict->cache->hand_position = 0;
+	}
+
+	// and their expiration times
+	long *old_expires = NULL;
+	if (dict->expiry != NULL) {
+		old_expires = dict->expiry->expires;
+		dict->expiry->expires = new_expires;
+		dict->expiry->cursor = 0;
+	}
+
+	// keys are moved, not copied - only slot keys need to be rehashed,
+	// bucket entries already carry their hash
+	for (long i=0; i < old_size; i++) {
+		dict_key_t key = old_keys[i];
+		if (key != NULL) {
+			dictionary_insert_owned(dict, dictionary_hash(dict, key), key, old_values[i].value,
+				(old_referenced != NULL) ? old_referenced[i] : 0,
+				(old_expires != NULL) ? old_expires[i] : 0);
+		}
+		else if (old_values[i].collision_buckets != NULL) {
+			collision_bucket_t *bucket = old_values[i].collision_buckets;
+			for (int j=0; j < bucket->num_elements; j++) {
+				cb_entry_t *e = &bucket->entries[j];
+				dictionary_insert_owned(dict, e->hash, e->key, e->value,
+					(bucket->referenced != NULL) ? bucket->referenced[j] : 0,
+					(bucket->expires != NULL) ? bucket->expires[j] : 0);
+			}
+			cb_free(bucket);
+		}
+	}
+	free(old_referenced);
+	free(old_expires);
+
+	if (dict->num_entries != old_entries) {
+		fprintf(stderr, "Old dictionary entries %lu does not match new dictionary %lu\n",
+			old_entries, dict->num_entries);
+	}
+
+	free(old_keys);
+	free(old_values);
+
+#ifdef DEBUG_VERBOSE_DICT_RESIZE
+	// printf("Collision buckets after resize:\n");
+	// print_collision_buckets(dict);
+#endif
+	return 0;
+}
+
+/*
+ * Shrink the dictionary if the number of entries has fallen well below the
+ * load factor, see DICT_SHRINK_DIVISOR
+ *
+ * Called by dictionary_remove() - not safe for concurrent updates
+ *
+ * dict - dictionary to check
+ */
+void
+dictionary_check_shrink(dictionary_t *dict)
+{
+	long new_size = capacity_after_shrink(dict->num_entries, dict->max_entries,
+		dict->min_entries, dict->load_factor);
+
+	if (new_size > 0)
+		dictionary_rebuild_table(dict, new_size);
+}
+
+/*
+ * Replace the dictionary's filter with one sized for its current capacity
+ *
+ * Returns 0 on success, or -1 if the filter could not be allocated
+ *
+ * dict - dictionary with filter_counters set
+ */
+int
+dictionary_reset_filter(dictionary_t *dict)
+{
+	if (dict->filter != NULL) {
+		free_bloom_filter(dict->filter);
+		dict->filter = NULL;
+	}
+
+	if (dict->filter_counters <= 0)
+		return 0;
+
+	// size for the most entries the table holds before it grows again
+	dict->filter = new_bloom_filter(dict->load_factor * dict->max_entries, dict->filter_counters);
+	if (dict->filter == NULL) {
+		dict->filter_counters = 0;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Returns the full hash value of a key: djb2, or SipHash-1-3 keyed with the
+ * dictionary's seed once dictionary_enable_seed() has been called
+ */
+unsigned long
+dictionary_hash(dictionary_t *dict, const char *key)
+{
+	if (!dict->seeded)
+		return hash((unsigned char *)key);
+	return hash_siphash13((const unsigned char *)key, strlen(key), dict->seed);
+}
+
+/*
+ * Switch to a new seed and rebuild the table at the same size
+ *
+ * Returns 0 on success, or -1 if the table could not be rebuilt, in which
+ * case the dictionary keeps its previous seed
+ */
+int
+dictionary_reseed(dictionary_t *dict, const unsigned long seed[2])
+{
+	unsigned long old_seed[2] = { dict->seed[0], dict->seed[1] };
+	int old_seeded = dict->seeded;
+
+	dict->seed[0] = seed[0];
+	dict->seed[1] = seed[1];
+	dict->seeded = 1;
+
+	// bucket entries carry their hash through a rebuild, so it is recomputed
+	// here; slot keys are rehashed by the rebuild itself
+	dictionary_rehash_buckets(dict);
+	if (dictionary_rebuild_table(dict, dict->max_entries) == 0)
+		return 0;
+
+	// the table is untouched, put the old hashes back
+	dict->seed[0] = old_seed[0];
+	dict->seed[1] = old_seed[1];
+	dict->seeded = old_seeded;
+	dictionary_rehash_buckets(dict);
+	return -1;
+}
+
+/*
+ * Recompute the hash stored with every collision bucket entry
+ */
+void
+dictionary_rehash_buckets(dictionary_t *dict)
+{
+	for (long i=0; i < dict->max_entries; i++) {
+		if (dict->keys[i] != NULL)
+			continue;
+		collision_bucket_t *bucket = dict->values[i].collision_buckets;
+		for (int j=0; (bucket != NULL) && (j < bucket->num_elements); j++)
+			bucket->entries[j].hash = dictionary_hash(dict, bucket->entries[j].key);
+	}
+}
+
+/*
+ * Returns the address of the value stored for key, or NULL if the key is
+ * not in the dictionary. An expired entry is removed and reported missing.
+ *
+ * dict - dictionary to search
+ * key_hash - full hash value of the key
+ * key - null-terminated string to look for
+ * expires - if not NULL and expiry is enabled, receives the address of the
+ * 		entry's expiration time, valid until the next update
+ */
+dict_value_t *
+dictionary_lookup(dictionary_t *dict, unsigned long key_hash, char *key, long **expires)
+{
+	long index;
+	int position;
+	dict_value_t *value = dictionary_find(dict, key_hash, key, &index, &position);
+	if (value == NULL)
+		return NULL;
+
+	cb_entry_t *e = (position < 0) ? NULL : &dict->values[index].collision_buckets->entries[position];
+
+	if (dict->expiry != NULL) {
+		long *entry_expires = (e != NULL) ? &dict->values[index].collision_buckets->expires[position]
+			: &dict->expiry->expires[index];
+		// expired entries are removed when they are touched
+		if (dictionary_expired(dict, *entry_expires)) {
+			dictionary_expire_entry(dict, index, position);
+			return NULL;
+		}
+		if (expires != NULL)
+			*expires = entry_expires;
+	}
+
+	// in cache mode a hit only sets the entry's reference bit
+	if (dict->cache != NULL) {
+		if (e != NULL)
+			dict->values[index].collision_buckets->referenced[position] = 1;
+		else
+			dict->cache->referenced[index] = 1;
 	}
 
 	return value;
 }
 
 /*
- * For each key/value pair in the dictionary, execute the enumeration function.
- *
- * dict - dictionary to enumerate
- * enum_function - function returning void that takes key, value as arguments
+ * Returns the address of the value stored for key, or NULL if the key is
+ * not in the dictionary, without expiring the entry or marking it referenced
+ *
+ * dict - dictionary to search
+ * key_hash - full hash value of the key
+ * key - null-terminated string to look for
+ * index_out - receives the slot of the entry
+ * position_out - receives the entry's position in the slot's collision
+ * 		bucket, or -1 if it is stored in the slot itself
+ */
+dict_value_t *
+dictionary_find(dictionary_t *dict, unsigned long key_hash, const char *key, long *index_out,
+	int *position_out)
+{
+	// a definite miss in the filter saves loading the slot and any bucket
+	if ((dict->filter != NULL) && !bloom_filter_may_contain(dict->filter, key_hash))
+		return NULL;
+
+	long index = key_hash % (dict->max_entries-1);
+	dict_key_t slot_key = dict->keys[index];
+
+	*index_out = index;
+	*position_out = -1;
+
+	if (slot_key == NULL) {
+		// null key means we may have a collision bucket
+		collision_bucket_t *bucket = dict->values[index].collision_buckets;
+		if (bucket == NULL)
+			return NULL;
+		cb_entry_t *e = collision_bucket_find(bucket, key_hash, (dict_key_t)key);
+		if (e == NULL)
+			return NULL;
+		*position_out = e - bucket->entries;
+		return &e->value;
+	}
+	if (strncmp(key, slot_key, MAX_KEY) == 0)
+		return &dict->values[index].value;
+	return NULL;
+}
+
+/*
+ * Add a key that has just been stored to the ordered index, if there is one
+ */
+void
+dictionary_index_add(dictionary_t *dict, dict_key_t key)
+{
+	if (dict->index == NULL)
+		return;
+	// a scan that silently skipped entries would be worse than no scan at all
+	if (ordered_index_insert(dict->index, key) != 0) {
+		fprintf(stderr, "dictionary_index_add() unable to index key '%s'\n", key);
+		abort();
+	}
+}
+
+/*
+ * Called by the ordered index for each key in a scan, passes the entry to
+ * the scan's enumeration function until the key is past the end of the scan
+ */
+int
+dictionary_index_visit(char *key, void *context)
+{
+	dictionary_scan_t *scan = (dictionary_scan_t *)context;
+
+	if ((scan->prefix != NULL) && (strncmp(key, scan->prefix, scan->prefix_length) != 0))
+		return 1;
+	if ((scan->to != NULL) && (strcmp(key, scan->to) >= 0))
+		return 1;
+
+	long index;
+	int position;
+	dictionary_t *dict = scan->dict;
+	dict_value_t *value = dictionary_find(dict, dictionary_hash(dict, key), key, &index, &position);
+	scan->enum_function(key, (value != NULL) ? *value : NULL);
+	scan->count++;
+	return 0;
+}
+
+/*
+ * Returns the expiration time of an entry, given its location, 0 for never
+ */
+long
+dictionary_entry_expires(dictionary_t *dict, long index, int position)
+{
+	if (position < 0)
+		return dict->expiry->expires[index];
+	return dict->values[index].collision_buckets->expires[position];
+}
+
+/*
+ * Returns 1 if an expiration time has passed on the dictionary's clock
+ */
+int
+dictionary_expired(dictionary_t *dict, long expires)
+{
+	// entries that never expire don't need the clock
+	if (expires == 0)
+		return 0;
+	return expires <= dict->expiry->clock(dict->expiry->context);
+}
+
+/*
+ * Remove an expired entry, given its location, and pass it to the expired callback
  */
 void
-dictionary_enumerate(dictionary_t *dict, dictionary_enumerator_t enum_function)
+dictionary_expire_entry(dictionary_t *dict, long index, int position)
 {
-	for (int i=0; i < dict->max_entries; i++) {
-		dict_key_t key = dict->keys[i];
-		if (key == NULL) {
-			entry_t entry = dict->values[i];
-			// we may have a collision bucket
-			if (entry.value != NULL) {
-				collision_bucket_t *bucket = entry.collision_buckets;
-				for (int j=0; j < bucket->num_elements; j++) {
-					key = bucket->keys[j];
-					if (key != NULL) {
-						dict_value_t value = bucket->values[j];
-#ifdef DEBUG_VERBOSE_DICT_ENUM
-						printf("dictionary_enumerate() [bucket] calling enum_function() with key='%s', value=%lu (%p)\n",
-							key, (long)value, (void *)value);
+	dictionary_expiry_t *expiry = dict->expiry;
+	dict_key_t key;
+
+	dict_value_t value = dictionary_remove_entry(dict, index, position, 0, &key);
+#ifdef DEBUG_VERBOSE_DICT_EXPIRE
+	printf("dictionary_expire_entry() expired '%s' from slot %lu\n", key, index);
 #endif
-						enum_function(key, value);
-					}
-				}
+	if (expiry->expired != NULL)
+		expiry->expired(key, value, expiry->context);
+	dictionary_free_key(dict, key);
+}
+
+/*
+ * Remove the expired entries in one slot and its collision bucket, and
+ * return how many were removed
+ */
+long
+dictionary_expire_slot(dictionary_t *dict, long index, long now)
+{
+	long removed = 0;
+
+	// removing from a bucket moves its other entries, or promotes the
+	// remaining entry into the slot, so look again after each removal
+	for (;;) {
+		if (dict->keys[index] != NULL) {
+			long expires = dict->expiry->expires[index];
+			if ((expires != 0) && (expires <= now)) {
+				dictionary_expire_entry(dict, index, -1);
+				removed++;
 			}
+			return removed;
 		}
-		else {
-			dict_value_t value = dict->values[i].value;
-#ifdef DEBUG_VERBOSE_DICT_ENUM
-			printf("dictionary_enumerate() [values] calling enum_function() with key='%s', value=%lu (%p)\n",
-				key, (long)value, (void *)value);
-#endif
-			enum_function(key, value);
+
+		collision_bucket_t *bucket = dict->values[index].collision_buckets;
+		if (bucket == NULL)
+			return removed;
+
+		int position = -1;
+		for (int j=0; j < bucket->num_elements; j++) {
+			long expires = bucket->expires[j];
+			if ((expires != 0) && (expires <= now)) {
+				position = j;
+				break;
+			}
 		}
+		if (position < 0)
+			return removed;
+
+		dictionary_expire_entry(dict, index, position);
+		removed++;
 	}
 }
 
-/* --- private functions --- */
+/*
+ * The default clock for expiry, CLOCK_MONOTONIC in milliseconds
+ */
+long
+dictionary_clock_milliseconds(void *context)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
 
 /*
- * Free the private dictionary structures without freeing the public dictionary structure
+ * Returns the number of bytes an entry counts for against the cache's byte budget
+ */
+long
+dictionary_cache_entry_size(dictionary_t *dict, dict_key_t key, dict_value_t value)
+{
+	dictionary_cache_t *cache = dict->cache;
+	long size = strlen(key) + 1;
+
+	if (cache->value_size != NULL)
+		size += cache->value_size(key, value, cache->context);
+
+	return size;
+}
+
+/*
+ * Evict entries until the cache is within its limits
+ *
+ * dict - dictionary in cache mode
+ * protected_key - key that must not be evicted (the one just added)
  */
 void
-dictionary_free_internal(dictionary_t *dict)
+dictionary_cache_evict(dictionary_t *dict, dict_key_t protected_key)
 {
-	if (dict->values) {
-		for (int i=0; i < dict->max_entries; i++) {
-			if (dict->keys[i] == NULL) {
-				// then the value is a collision bucket (or null)
-				collision_bucket_t *bucket = dict->values[i].collision_buckets;
-				if (bucket == NULL) {
+	dictionary_cache_t *cache = dict->cache;
+
+	while (((cache->max_entries > 0) && (dict->num_entries > cache->max_entries))
+		|| ((cache->max_bytes > 0) && (cache->num_bytes > cache->max_bytes))) {
+
+		// the protected entry may be all that is left
+		if (dict->num_entries <= ((protected_key != NULL) ? 1 : 0))
+			break;
+
+		long index = cache->hand;
+		dict_key_t key = dict->keys[index];
+		collision_bucket_t *bucket = (key == NULL) ? dict->values[index].collision_buckets : NULL;
+		int position = -1;
+
+		if (bucket != NULL) {
+			// bucket entries have their own reference bits, the hand stays on
+			// the slot until every entry in the bucket has been examined; an
+			// eviction fills the vacated position with an unexamined entry
+			// (the last one, or the next one in a sorted bucket), which is
+			// why the next examination starts there
+			for (int j=cache->hand_position; j < bucket->num_elements; j++) {
+				if (bucket->entries[j].key == protected_key)
 					continue;
+				if (!bucket->referenced[j]) {
+					position = j;
+					break;
 				}
-#ifdef DEBUG_VERBOSE_DICT_INIT
-				printf("free_dictionary() freeing collision bucket %d (%p)\n", i, bucket);
-#endif
-				free_collision_bucket(bucket);
+				bucket->referenced[j] = 0;
+			}
+			cache->hand_position = (position < 0) ? 0 : position;
+			if (position < 0)
+				key = NULL;
+			else
+				key = bucket->entries[position].key;
+		}
+		else if (key != NULL) {
+			// referenced since the hand last passed, give it a second chance
+			if (cache->referenced[index]) {
+				cache->referenced[index] = 0;
+				key = NULL;
+			}
+			else if (key == protected_key) {
+				key = NULL;
 			}
 		}
-		free(dict->values);
-	}
 
-	if (dict->keys) {
-		// we reallocate the keys, but not the values
-		for (int i=0; i < dict->max_entries; i++) {
-			free(dict->keys[i]);
+		if (key == NULL) {
+			if (++cache->hand >= dict->max_entries)
+				cache->hand = 0;
+			continue;
+		}
+
+#ifdef DEBUG_VERBOSE_DICT_CACHE
+		printf("dictionary_cache_evict() evicting '%s' from slot %lu\n", key, index);
+#endif
+		dict_value_t value = dictionary_remove_entry(dict, index, position, 0, &key);
+		if (cache->evict != NULL)
+			cache->evict(key, value, cache->context);
+		dictionary_free_key(dict, key);
+
+		// an entry promoted out of the bucket has already had its second chance
+		if (dict->keys[index] != NULL) {
+			cache->hand_position = 0;
+			if (++cache->hand >= dict->max_entries)
+				cache->hand = 0;
 		}
-		free(dict->keys);
 	}
 }
 
 /*
- * Resize the dictionary, rehashing all keys
- * 
- * Called by dictionary_put() - not safe for concurrent updates
+ * Remove one entry from the dictionary, given its location, and return its
+ * value. Removing the second to last entry of a collision bucket promotes
+ * the remaining entry back into the slot. Does not resize the table.
  *
- * dict- dictionary to resize
- * new_size - new size - this should be prime
+ * dict - dictionary to update
+ * index - slot holding the entry
+ * position - position of the entry in the slot's collision bucket, or -1
+ * 		if the entry is stored in the slot itself
+ * key_hash - full hash value of the key, or 0 to have it recomputed if needed
+ * key_out - if not NULL, receives the key string, which the caller must
+ * 		free; otherwise the key is freed
  */
-void
-dictionary_rebuild_table(dictionary_t *dict, long new_size)
+dict_value_t
+dictionary_remove_entry(dictionary_t *dict, long index, int position, unsigned long key_hash,
+	dict_key_t *key_out)
 {
-#ifdef DEBUG_VERBOSE_DICT_RESIZE
-	printf("Resizing dictionary from %lu to %lu (%lu entries, %lu collisions)\n",
-			dict->max_entries, new_size, dict->num_entries, dict->num_collisions);
-	// printf("Collision buckets before resize:\n");
-	// print_collision_buckets(dict);
+	dict_key_t key;
+	dict_value_t value;
+
+	if (position < 0) {
+		key = dict->keys[index];
+		value = dict->values[index].value;
+		dict->keys[index] = NULL;				// this key no longer exists
+		dict->values[index].value = NULL;		// ensure we don't mistake it for a bucket
+		if (dict->cache != NULL)
+			dict->cache->referenced[index] = 0;
+		if (dict->expiry != NULL)
+			dict->expiry->expires[index] = 0;
+	}
+	else {
+		collision_bucket_t *bucket = dict->values[index].collision_buckets;
+		cb_entry_t *e = &bucket->entries[position];
+		key = e->key;
+		value = e->value;
+		key_hash = e->hash;
+		dict->num_collisions--;
+		int new_size = bucket->num_elements-1;
+
+		// if there is only one element remaining in this bucket, get rid of it
+		if (new_size == 1) {
+			cb_entry_t *last = &bucket->entries[(position == 0) ? 1 : 0];
+#ifdef DEBUG_VERBOSE_DICT_REMOVE							
+			printf("dictionary_remove_entry() [bucket] promoting last bucket element [%s:%lu (%p)] to value slot %lu\n",
+				last->key, (long)last->value, (void *)last->value, index);
+#endif
+			dict->keys[index] = last->key;
+			dict->values[index].value = last->value;
+			if (dict->cache != NULL)
+				dict->cache->referenced[index] = bucket->referenced[last - bucket->entries];
+			if (dict->expiry != NULL)
+				dict->expiry->expires[index] = bucket->expires[last - bucket->entries];
+			cb_free(bucket);
+		}
+		// a sorted bucket closes the gap to stay in order, otherwise move the
+		// last element in this bucket to the current slot
+		else if (bucket->num_elements >= CB_SORTED_SIZE) {
+#ifdef DEBUG_VERBOSE_DICT_REMOVE
+			printf("dictionary_remove_entry() closing gap at index %d of sorted bucket (new size=%d)\n",
+				position, new_size);
 #endif
-	dictionary_t *new_dict = new_dictionary_size(new_size);
-
-#if __has_nested_functions
-	void
-	copy_pair(dict_key_t key, dict_value_t value)
-	{
-		dictionary_put(new_dict, key, value);
-	}
-	dictionary_enumerate(dict, &copy_pair);
-#elif __has_extension(blocks)
-	dictionary_enumerate(dict, ^ void (dict_key_t key, dict_value_t value) {
-		dictionary_put(new_dict, key, value);
-	});
-#else
-	#warning No compiler support for blocks or nested functions
+			cb_move(bucket, position, position + 1, new_size - position);
+			bucket->num_elements = new_size;
+			dict->values[index].collision_buckets = cb_trim(bucket);
+		}
+		else {
+#ifdef DEBUG_VERBOSE_DICT_REMOVE							
+			dict_value_t last_element = bucket->entries[new_size].value;
+			printf("dictionary_remove_entry() moving last element [%s:%lu (%p)] to vacated slot index %d (new size=%d)\n", 
+				(char *)bucket->entries[new_size].key, (long)last_element, (void *)last_element, position, new_size);
 #endif
+			cb_move(bucket, position, new_size, 1);
+			bucket->num_elements = new_size;
+			dict->values[index].collision_buckets = cb_trim(bucket);
+		}
+	}
 
-	if (dict->num_entries != new_dict->num_entries) {
-		fprintf(stderr, "Old dictionary entries %lu does not match new dictionary %lu\n",
-			dict->num_entries, new_dict->num_entries);
+	dictionary_release_entry(dict, key, value, key_hash, key_out);
+
+	return value;
+}
+
+/*
+ * Update the count, index, filter, cache size and log for an entry that has
+ * been taken out of the table
+ *
+ * dict - dictionary to update
+ * key - key of the entry
+ * value - value of the entry
+ * key_hash - full hash value of the key, or 0 to have it recomputed if needed
+ * key_out - if not NULL, receives the key string, which the caller must
+ * 		free; otherwise the key is freed
+ */
+void
+dictionary_release_entry(dictionary_t *dict, dict_key_t key, dict_value_t value, unsigned long key_hash,
+	dict_key_t *key_out)
+{
+	dict->num_entries--;
+
+	if (dict->index != NULL)
+		ordered_index_delete(dict->index, key);
+
+	if (dict->filter != NULL) {
+		if (key_hash == 0)
+			key_hash = dictionary_hash(dict, key);
+		bloom_filter_delete(dict->filter, key_hash);
+	}
+	if (dict->cache != NULL) {
+		dict->cache->num_bytes -= dictionary_cache_entry_size(dict, key, value);
 	}
 
-	// we have no GCto keep track of all the collision buckets, just start over
-	dictionary_free_internal(dict);
+	if (dict->log != NULL)
+		dictionary_log_remove(dict, key);
 
-	dict->keys = new_dict->keys;
-	dict->values = new_dict->values;
-	dict->max_entries = new_dict->max_entries;
-	dict->num_collisions = new_dict->num_collisions;
-	dict->maximum_chain = new_dict->maximum_chain;
+	if (key_out != NULL)
+		*key_out = key;
+	else
+		dictionary_free_key(dict, key);
+}
 
-#ifdef DEBUG_VERBOSE_DICT_RESIZE
-	// printf("Collision buckets after resize:\n");
-	// print_collision_buckets(dict);
-#endif
-	free(new_dict);
+/*
+ * Release an entry that dictionary_remove_if() has taken out of the table,
+ * passing it to the expired callback if it has expired, otherwise to
+ * on_removed, and free its key
+ */
+void
+dictionary_dispose_removed(dictionary_t *dict, dict_key_t key, dict_value_t value, unsigned long key_hash,
+	int expired, dictionary_enumerator_t on_removed)
+{
+	dictionary_release_entry(dict, key, value, key_hash, &key);
+
+	if (expired) {
+		if (dict->expiry->expired != NULL)
+			dict->expiry->expired(key, value, dict->expiry->context);
+	}
+	else if (on_removed != NULL) {
+		on_removed(key, value);
+	}
+	dictionary_free_key(dict, key);
 }
 
 /*
- * Retrieve a value from a collision bucket
+ * Store a key that is known not to be in the dictionary, without copying
+ * the key or resizing the table
  *
- * bucket - allocated by new_collision_bucket()
- * key - null-terminated string will be copied and managed by collision bucket
+ * dict - dictionary to update
+ * key_hash - full hash value of the key
+ * key - allocated string, ownership passes to the dictionary
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ * referenced - CLOCK reference bit, if the dictionary is a cache
+ * expires - expiration time, if expiry is enabled
  */
-dict_value_t
-collision_bucket_get(collision_bucket_t *bucket, dict_key_t key)
+void
+dictionary_insert_owned(dictionary_t *dict, unsigned long key_hash, dict_key_t key, dict_value_t value,
+	unsigned char referenced, long expires)
 {
-	if (key == NULL)
-		return NULL;
+	long index = key_hash % (dict->max_entries-1);
+	dict_key_t slot_key = dict->keys[index];
+	collision_bucket_t *bucket;
+
+	if (dict->filter != NULL)
+		bloom_filter_add(dict->filter, key_hash);
+
+	if (slot_key != NULL) {
+		// the slot key moves into a new bucket alongside the new key
+		bucket = new_collision_bucket(dict);
+		collision_bucket_append(&bucket, dictionary_hash(dict, slot_key), slot_key, dict->values[index].value);
+		if (dict->cache != NULL) {
+			bucket->referenced[0] = dict->cache->referenced[index];
+			dict->cache->referenced[index] = 0;
+		}
+		if (dict->expiry != NULL) {
+			bucket->expires[0] = dict->expiry->expires[index];
+			dict->expiry->expires[index] = 0;
+		}
+		dict->keys[index] = NULL;
+		dict->values[index].collision_buckets = bucket;
+	}
+	else if ((bucket = dict->values[index].collision_buckets) == NULL) {
+		dict->keys[index] = key;
+		dict->values[index].value = value;
+		if (dict->cache != NULL)
+			dict->cache->referenced[index] = referenced;
+		if (dict->expiry != NULL)
+			dict->expiry->expires[index] = expires;
+		dict->num_entries++;
+		return;
+	}
+
+	cb_entry_t *e = collision_bucket_append(&bucket, key_hash, key, value);
+	if (bucket->referenced != NULL)
+		bucket->referenced[e - bucket->entries] = referenced;
+	if (bucket->expires != NULL)
+		bucket->expires[e - bucket->entries] = expires;
+
+	// an entry sorted in ahead of the CLOCK hand shifts the ones it has yet
+	// to examine along by one
+	if ((dict->cache != NULL) && (dict->cache->hand == index)
+		&& (e - bucket->entries < dict->cache->hand_position))
+		dict->cache->hand_position++;
+	dict->values[index].collision_buckets = bucket;
+	dict->num_collisions++;
+
+	dict->num_entries++;
+	if (collision_bucket_size(bucket) > dict->maximum_chain)
+		dict->maximum_chain = collision_bucket_size(bucket);
+}
 
+/*
+ * Returns the entry for key in a collision bucket, or NULL
+ *
+ * bucket - allocated by new_collision_bucket()
+ * hash - full hash value of the key
+ * key - null-terminated string to look for
+ */
+cb_entry_t *
+collision_bucket_find(collision_bucket_t *bucket, unsigned long hash, dict_key_t key)
+{
 #ifdef DEBUG_VERBOSE_CB_UPDATE
-	printf("collision_bucket_get() before get has %d entries:\n", bucket->num_elements);
+	printf("collision_bucket_find() bucket has %d entries:\n", bucket->num_elements);
 	for (int j=0; j < bucket->num_elements; j++) {
-		printf("\t%s:%lu (%p)\n", bucket->keys[j], (long)bucket->values[j], bucket->values[j]);
+		cb_entry_t *e = &bucket->entries[j];
+		printf("\t%s:%lu (%p)\n", e->key, (long)e->value, e->value);
 	}
 #endif
+	// a long bucket is sorted, only the entries with a matching hash need
+	// their keys compared
+	if (bucket->num_elements >= CB_SORTED_SIZE) {
+		for (int i=cb_lower_bound(bucket, hash); i < bucket->num_elements; i++) {
+			cb_entry_t *e = &bucket->entries[i];
+			if (e->hash != hash)
+				break;
+			if (strncmp(key, e->key, MAX_KEY) == 0)
+				return e;
+		}
+		return NULL;
+	}
+
 	for (int i=0; i < bucket->num_elements; i++) {
-		if (strncmp(key, bucket->keys[i], MAX_KEY) == 0) {
-			return bucket->values[i];
+		cb_entry_t *e = &bucket->entries[i];
+		if ((e->hash == hash) && (strncmp(key, e->key, MAX_KEY) == 0)) {
+			return e;
 		}
 	}
 	return NULL;
 }
 
 /*
- * Allocate or reallocate buckets to handle increases in the size of the collision buckets
+ * Reallocate a collision bucket to hold new_size entries
  *
- * The initial size of the collision bucket is 16 elements (CB_INITIAL_SIZE)
- * It will grow by 8 elements on subsequent invocations from collision_bucket_addpair()
+ * The initial size of the collision bucket is 2 elements (CB_INITIAL_SIZE),
+ * which covers the common case of a single collision. Subsequent invocations
+ * from collision_bucket_append() double the capacity.
+ *
+ * Returns the (possibly moved) bucket
  *
  * bucket - collision bucket allocated by new_collision_bucket()
- * new_size - size in bytes of key/value arrays
+ * new_size - number of entries the bucket must be able to hold
  */
-void
-cb_reinitializeArrays(collision_bucket_t *bucket, int new_size)
+collision_bucket_t *
+cb_resize(collision_bucket_t *bucket, int new_size)
 {
 #ifdef DEBUG_VERBOSE_CB_INIT
-	printf("cb_reinitializeArrays() before initialization has %d entries:\n", bucket->num_elements);
-	for (int j=0; j < bucket->num_elements; j++) {
-		printf("\t%s:%lu (%p)\n", bucket->keys[j], (long)bucket->values[j], bucket->values[j]);
-	}
+	printf("cb_resize() resizing %p from %d to %d entries\n", bucket, bucket->max_elements, new_size);
 #endif
-	dict_key_t *new_keys = (dict_key_t *)calloc(1, sizeof(dict_key_t) * new_size);
-	dict_value_t *new_values = (dict_value_t *)calloc(1, sizeof(dict_value_t) * new_size);
-	if (bucket->keys != NULL) {
-		for (int i=0; i < bucket->num_elements; i++) {
-			new_keys[i] = bucket->keys[i];
-			new_values[i] = bucket->values[i];
-		}
-		free(bucket->keys);
-		free(bucket->values);
-	}
-	bucket->keys = new_keys;
-	bucket->values = new_values;
-	bucket->max_elements = new_size;
-#ifdef DEBUG_VERBOSE_CB_INIT
-	printf("cb_reinitializeArrays() after initialization has %d entries:\n", bucket->num_elements);
-	for (int j=0; j < bucket->num_elements; j++) {
-		printf("\t%s:%lu (%p)\n", bucket->keys[j], (long)bucket->values[j], bucket->values[j]);
+	collision_bucket_t *new_bucket = (collision_bucket_t *)realloc(bucket,
+		sizeof(collision_bucket_t) + sizeof(cb_entry_t) * new_size);
+	if (new_bucket == NULL) {
+		fprintf(stderr, "cb_resize() unable to grow collision bucket to %d entries\n", new_size);
+		abort();
 	}
-#endif
+	if (new_bucket->expires != NULL) {
+		long *expires = realloc(new_bucket->expires, sizeof(long) * new_size);
+		if (expires == NULL) {
+			fprintf(stderr, "cb_resize() unable to grow expiration times to %d entries\n", new_size);
+			abort();
+		}
+		new_bucket->expires = expires;
+	}
+	if (new_bucket->referenced != NULL) {
+		unsigned char *referenced = realloc(new_bucket->referenced, new_size);
+		if (referenced == NULL) {
+			fprintf(stderr, "cb_resize() unable to grow reference bits to %d entries\n", new_size);
+			abort();
+		}
+		new_bucket->referenced = referenced;
+	}
+	new_bucket->max_elements = new_size;
+	return new_bucket;
 }
 
 /*
- * Stores the key/value pair in the collision bucket
+ * Release unused capacity once a bucket is no more than a quarter full
  *
- * Return 1 if this operation added a new key, 0 if it replaced the value of an existing key
+ * Returns the (possibly moved) bucket
  *
  * bucket - allocated by new_collision_bucket()
- * key - null-terminated string will be copied and managed by collision bucket
+ */
+collision_bucket_t *
+cb_trim(collision_bucket_t *bucket)
+{
+	if ((bucket->max_elements > CB_INITIAL_SIZE) && (bucket->num_elements * 4 <= bucket->max_elements)) {
+		return cb_resize(bucket, bucket->max_elements / 2);
+	}
+	return bucket;
+}
+
+/*
+ * Adds a key/value pair to the collision bucket without checking for duplicates
+ *
+ * A bucket with CB_SORTED_SIZE or more entries is kept sorted by hash, so the
+ * new entry may not be the last one.
+ *
+ * Returns the new entry, valid until the bucket is next changed
+ *
+ * bucket_ref - bucket allocated by new_collision_bucket(), updated if the bucket moves
+ * hash - full hash value of the key
+ * key - allocated string, ownership passes to the collision bucket
  * value - void pointer (or 64-bit value) - must be managed by caller
  */
-int
-collision_bucket_addpair(collision_bucket_t *bucket, char *key, dict_value_t value)
+cb_entry_t *
+collision_bucket_append(collision_bucket_t **bucket_ref, unsigned long hash, dict_key_t key,
+	dict_value_t value)
 {
-	if (key == NULL) {
-		fprintf(stderr, "collision_bucket_addpair() NULL key used for collision bucket\n");
-		return -1;
+	collision_bucket_t *bucket = *bucket_ref;
+
+	if (bucket->num_elements >= bucket->max_elements) {
+		bucket = cb_resize(bucket, bucket->max_elements * 2);
+		*bucket_ref = bucket;
+	}
+
+	int position = bucket->num_elements;
+	if (position + 1 >= CB_SORTED_SIZE) {
+		// the bucket is too long to scan, sort it once and then insert in order
+		if (position + 1 == CB_SORTED_SIZE)
+			cb_sort(bucket);
+		position = cb_lower_bound(bucket, hash);
+		cb_move(bucket, position + 1, position, bucket->num_elements - position);
 	}
+	bucket->num_elements++;
 
+	cb_entry_t *e = &bucket->entries[position];
+	e->hash = hash;
+	e->key = key;
+	e->value = value;
+	if (bucket->expires != NULL)
+		bucket->expires[position] = 0;
+	if (bucket->referenced != NULL)
+		bucket->referenced[position] = 0;
 #ifdef DEBUG_VERBOSE_CB_UPDATE
-	printf("collision_bucket_addpair() before adding ['%s':%lu] has %d entries:\n", key, (long)value, bucket->num_elements);
+	printf("collision_bucket_append() after adding new element at %d, now has %d entries:\n", position, bucket->num_elements);
 	for (int j=0; j < bucket->num_elements; j++) {
-		printf("\t%s:%lu (%p)\n", bucket->keys[j], (long)bucket->values[j], bucket->values[j]);
+		cb_entry_t *entry = &bucket->entries[j];
+		printf("\t%s:%lu (%p)\n", entry->key, (long)entry->value, entry->value);
 	}
 #endif
-	if ((bucket->keys == NULL) || (bucket->values == NULL)) {
-#ifdef DEBUG_VERBOSE_CB_UPDATE
-		printf("collision_bucket_addpair() reinitializing cb arrays\n");
-#endif
-		cb_reinitializeArrays(bucket, CB_INITIAL_SIZE);
-	}
+	return e;
+}
 
-	for (int i=0; i < bucket->num_elements; i++) {
-#ifdef DEBUG_VERBOSE_CB_UPDATE
-		printf("collision_bucket_addpair() comparing '%s' to '%s'\n", bucket->keys[i], key);
-#endif
-		if (strncmp(bucket->keys[i], key, MAX_KEY) == 0) {
-			// replace an entry
-			bucket->values[i] = value;	// caller must have reference to old value to return to client
-			return 0;
+/*
+ * Sort the entries of a collision bucket by hash
+ *
+ * bucket - allocated by new_collision_bucket()
+ */
+void
+cb_sort(collision_bucket_t *bucket)
+{
+	// only called when a bucket reaches CB_SORTED_SIZE, insertion sort is plenty
+	for (int i=1; i < bucket->num_elements; i++) {
+		cb_entry_t entry = bucket->entries[i];
+		long expires = (bucket->expires != NULL) ? bucket->expires[i] : 0;
+		unsigned char referenced = (bucket->referenced != NULL) ? bucket->referenced[i] : 0;
+		int j = i;
+		while ((j > 0) && (bucket->entries[j-1].hash > entry.hash)) {
+			cb_move(bucket, j, j-1, 1);
+			j--;
 		}
+		bucket->entries[j] = entry;
+		if (bucket->expires != NULL)
+			bucket->expires[j] = expires;
+		if (bucket->referenced != NULL)
+			bucket->referenced[j] = referenced;
 	}
-	if (bucket->num_elements >= bucket->max_elements) {
-		cb_reinitializeArrays(bucket, bucket->num_elements + 8);
-	}
+}
 
-	// adding a new key, need to allocate a string touse
-	dict_key_t new_key = (dict_key_t)calloc(1, strlen(key) + 1);
-	strcpy(new_key, key);
+/*
+ * Returns the position of the first entry whose hash is not less than hash,
+ * in a bucket sorted by cb_sort()
+ *
+ * bucket - allocated by new_collision_bucket()
+ * hash - full hash value to look for
+ */
+int
+cb_lower_bound(collision_bucket_t *bucket, unsigned long hash)
+{
+	int low = 0;
+	int high = bucket->num_elements;
 
-	bucket->keys[bucket->num_elements] = new_key;
-	bucket->values[bucket->num_elements] = value;
-	bucket->num_elements++;
-#ifdef DEBUG_VERBOSE_CB_UPDATE
-	printf("collision_bucket_addpair() after appending new element, now has %d entries:\n", bucket->num_elements);
-	for (int j=0; j < bucket->num_elements; j++) {
-		printf("\t%s:%lu (%p)\n", bucket->keys[j], (long)bucket->values[j], bucket->values[j]);
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (bucket->entries[middle].hash < hash)
+			low = middle + 1;
+		else
+			high = middle;
 	}
-#endif
-	return 1;
+	return low;
 }
 
 /*
@@ -686,19 +2865,77 @@ collision_bucket_size(collision_bucket_t *bucket)
 }
 
 /*
- * Allocate a collision bucket, key/value vectors are initialized lazily
+ * Allocate a collision bucket with room for CB_INITIAL_SIZE entries, with
+ * expiration times if the dictionary has expiry enabled and reference bits
+ * if it is a cache
+ *
+ * dict - dictionary the bucket will belong to
  */
 collision_bucket_t *
-new_collision_bucket()
+new_collision_bucket(dictionary_t *dict)
+{
+	collision_bucket_t *bucket = (collision_bucket_t *)malloc(
+		sizeof(collision_bucket_t) + sizeof(cb_entry_t) * CB_INITIAL_SIZE);
+	bucket->num_elements = 0;
+	bucket->max_elements = CB_INITIAL_SIZE;
+	bucket->expires = NULL;
+	bucket->referenced = NULL;
+	if (dict->expiry != NULL) {
+		bucket->expires = calloc(CB_INITIAL_SIZE, sizeof(long));
+		if (bucket->expires == NULL) {
+			fprintf(stderr, "new_collision_bucket() unable to allocate expiration times\n");
+			abort();
+		}
+	}
+	if (dict->cache != NULL) {
+		bucket->referenced = calloc(CB_INITIAL_SIZE, 1);
+		if (bucket->referenced == NULL) {
+			fprintf(stderr, "new_collision_bucket() unable to allocate reference bits\n");
+			abort();
+		}
+	}
+	return bucket;
+}
+
+/*
+ * Move count entries of a collision bucket, with their expiration times
+ * and reference bits, from position from to position to; the ranges may
+ * overlap
+ *
+ * bucket - allocated by new_collision_bucket()
+ */
+void
+cb_move(collision_bucket_t *bucket, int to, int from, int count)
+{
+	memmove(&bucket->entries[to], &bucket->entries[from], sizeof(cb_entry_t) * count);
+	if (bucket->expires != NULL)
+		memmove(&bucket->expires[to], &bucket->expires[from], sizeof(long) * count);
+	if (bucket->referenced != NULL)
+		memmove(&bucket->referenced[to], &bucket->referenced[from], count);
+}
+
+/*
+ * Free a collision bucket and its expiration times and reference bits, but
+ * not its keys
+ *
+ * bucket - allocated by new_collision_bucket()
+ */
+void
+cb_free(collision_bucket_t *bucket)
 {
-	return (collision_bucket_t *)calloc(1, sizeof(collision_bucket_t));
+	free(bucket->expires);
+	free(bucket->referenced);
+	free(bucket);
 }
 
 /*
- * Free a collision bucket obtained from new_collision_bucket()
+ * Free a collision bucket obtained from new_collision_bucket(), and its keys
+ *
+ * dict - dictionary the bucket belongs to
+ * bucket - allocated by new_collision_bucket()
  */
 void
-free_collision_bucket(collision_bucket_t *bucket)
+free_collision_bucket(dictionary_t *dict, collision_bucket_t *bucket)
 {
 #ifdef DEBUG_VERBOSE_CB_INIT
 	printf("free_collision_bucket() freeing %d elements from %p\n", bucket->num_elements, bucket);
@@ -706,79 +2943,26 @@ free_collision_bucket(collision_bucket_t *bucket)
 	for (int i=0; i < bucket->num_elements; i++) {
 
 #ifdef DEBUG_VERBOSE_CB_INIT
-		printf("free_collision_bucket() freeing string %s\n", bucket->keys[i]);
+		printf("free_collision_bucket() freeing string %s\n", bucket->entries[i].key);
 #endif
-		free(bucket->keys[i]);
-		bucket->keys[i] = NULL;
 		// bucket values are managed by the client
-		bucket->values[i] = NULL;
-	}
-	free(bucket->keys);
-	free(bucket->values);
-	free(bucket);
-}
-
-/*
- * Returns a prime number that is greater than or equal to intValue.
- * The prime number is not necessarily the smallest prime number that is
- * greater than or equal to intValue.  For intValue greater than our
- * highest selected prime, returns an odd number.
- */
-long
-select_next_prime(int intValue)
-{
-	long primes[148] = {
-		3, 5, 7, 11, 17, 19, 23, 29, 37, 53, 73, 107, 157, 233, 347, 503, 751,
-		1009, 1511, 2003, 3001, 4001, 5003, 6007, 7001, 8009, 9001,
-		10007, 11003, 12007, 13001, 14009, 15013, 16001, 17011, 18013, 19001,
-		20011, 21001, 22003, 23003, 24001, 25013, 26003, 27011, 28001, 29009,
-		30011, 31013, 32003, 33013, 34019, 35023, 36007, 37003, 38011, 39019,
-		40009, 41011, 42013, 43003, 44017, 45007, 46021, 47017, 48017, 49003,
-		50021, 51001, 52009, 53003, 54001, 55001, 56003, 57037, 58013, 59009,
-		60013, 61001, 62003, 63029, 64007, 65003, 66029, 67003, 68023, 69001,
-		70001, 71011, 72019, 73009, 74017, 75011, 76001, 77003, 78007, 79031,
-		80021, 81001, 82003, 83003, 84011, 85009, 86011, 87011, 88001, 89003,
-		90001, 91009, 92003, 93001, 94007, 95003, 96001, 97001, 98009, 99013,
-		100003, 101009, 102001, 103001, 104003, 224737, 350377, 479909,
-		611953, 746773, 882377, 1020379, 1159523, 1299709, 2750159, 4256233,
-		5800079, 7368787, 8960453, 10570841, 12195257, 13834103, 15485863,
-		32452843, 49979687, 67867967, 86028121, 104395301, 122949823,
-		141650939, 160481183 };
-
-	int high = 147;	// primes size - 1
-
-	// intValue greater than highest selected prime returns an odd number
-	if (intValue > primes[high]) {
-		return intValue * 2 + 1;
-	}
-
-	int low = 0;
-
-	// Binary search for closest selected prime that is >= intValue
-
-	while (high - low > 1) {
-		int mid = (high + low) / 2;
-		long prime = primes[mid];
-		if (intValue <= prime)
-			high = mid;
-		else
-			low = mid;
+		dictionary_free_key(dict, bucket->entries[i].key);
 	}
-
-	return primes[high];
+	cb_free(bucket);
 }
 
 void
 print_collision_buckets(dictionary_t *dict)
 {
-	for (int i=0; i < dict->max_entries; i++) {
+	for (long i=0; i < dict->max_entries; i++) {
 		if (dict->keys[i] == NULL) {
 			entry_t entry = dict->values[i];
 			if (entry.value != NULL) {
 				collision_bucket_t *bucket = entry.collision_buckets;
-				printf("bucket %i has %d entries:\n", i, bucket->num_elements);
+				printf("bucket %li has %d entries:\n", i, bucket->num_elements);
 				for (int j=0; j < bucket->num_elements; j++) {
-					printf("\t%s:%lu (%p)\n", bucket->keys[j], (long)bucket->values[j], bucket->values[j]);
+					cb_entry_t *e = &bucket->entries[j];
+					printf("\t%s:%lu (%p)\n", e->key, (long)e->value, e->value);
 				}
 			}
 		}
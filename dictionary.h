@@ -14,6 +14,9 @@
 // exceeds load factor * the current capacity of the dictionary
 #define DICT_INITIAL_SIZE 	5
 #define LOAD_FACTOR			0.75		// percentage
+// the dictionary shrinks once it holds fewer than load factor / DICT_SHRINK_DIVISOR
+// entries per slot, growing and shrinking at the same threshold would thrash
+#define DICT_SHRINK_DIVISOR	4
 
 typedef char * dict_key_t;
 
@@ -41,26 +44,105 @@ typedef void (^ dictionary_enumerator_t) (dict_key_t, dict_value_t);
 typedef void (* dictionary_enumerator_t) (dict_key_t, dict_value_t);
 #endif
 
+#if __has_extension(blocks)
+typedef dict_value_t (^ dictionary_combine_t) (dict_key_t, dict_value_t, dict_value_t);
+#else
+// Define a function that takes key, existing value, incoming value as
+// arguments and returns the value to keep, to be passed to dictionary_merge()
+typedef dict_value_t (* dictionary_combine_t) (dict_key_t, dict_value_t, dict_value_t);
+#endif
+
+#if __has_extension(blocks)
+typedef int (^ dictionary_predicate_t) (dict_key_t, dict_value_t);
+#else
+// Define a function that takes key, value as arguments and returns nonzero
+// for an entry to remove, to be passed to dictionary_remove_if()
+typedef int (* dictionary_predicate_t) (dict_key_t, dict_value_t);
+#endif
+
+// one key/value pair in a collision bucket; the full hash is kept so that
+// lookups can skip the string comparison for most non-matching entries
+typedef struct cb_entry_t {
+	unsigned long hash;
+	dict_key_t key;
+	dict_value_t value;
+} cb_entry_t;
+
+// a collision bucket is a single allocation: the header is followed
+// directly by max_elements interleaved entries. Expiration times and CLOCK
+// reference bits are kept beside the entries, like the slots' in
+// dictionary_expiry_t and dictionary_cache_t, and only once expiry or
+// cache mode is enabled
 typedef struct collision_bucket_t {
 	int num_elements;
 	int max_elements;
-	dict_key_t *keys;
-	dict_value_t *values;
+	long *expires;				// max_elements expiration times, or NULL without expiry
+	unsigned char *referenced;	// max_elements reference bits, or NULL outside cache mode
+	cb_entry_t entries[];
 } collision_bucket_t;
 
 typedef union entry_t {
 	collision_bucket_t *collision_buckets;
-	dict_value_t *value;
+	dict_value_t value;
 } entry_t;
 
+// Called when an entry is evicted from a cache, so the caller can free the
+// value. The key is freed by the dictionary after the call returns.
+// Callbacks that are kept by the dictionary are plain function pointers
+// with a context argument, a nested function or stack block would not
+// outlive the call that registered it.
+typedef void (* dictionary_evict_function_t) (dict_key_t key, dict_value_t value, void *context);
+
+// Returns the number of bytes a value counts for against a cache's byte budget
+typedef long (* dictionary_size_function_t) (dict_key_t key, dict_value_t value, void *context);
+
+// bounded cache mode, see dictionary_set_cache()
+typedef struct dictionary_cache_t {
+	long max_entries;			// 0 for no limit
+	long max_bytes;				// 0 for no limit
+	long num_bytes;				// key bytes plus value sizes
+	long hand;					// next slot the CLOCK hand will examine
+	int hand_position;			// next entry to examine in that slot's collision bucket
+	unsigned char *referenced;	// CLOCK reference bit for the entry stored in each slot
+	dictionary_evict_function_t evict;
+	dictionary_size_function_t value_size;
+	void *context;
+} dictionary_cache_t;
+
+// Returns the current time for expiration, in whatever units the caller
+// uses for expiration times
+typedef long (* dictionary_clock_function_t) (void *context);
+
+// per-entry expiration, see dictionary_enable_expiry()
+typedef struct dictionary_expiry_t {
+	long *expires;				// expiration time for the entry stored in each slot, 0 for never
+	long cursor;				// next slot dictionary_expire_step() will examine
+	dictionary_clock_function_t clock;
+	dictionary_evict_function_t expired;
+	void *context;
+} dictionary_expiry_t;
+
 typedef struct dictionary_t {
 	long num_collisions;
 	long num_entries;
 	long maximum_chain;
 	long max_entries;
+	long min_entries;		// automatic shrinking stops at this size
 	dict_key_t *keys;
 	entry_t *values;
 	double load_factor;
+	struct bloom_filter_t *filter;	// optional, see dictionary_enable_filter()
+	int filter_counters;
+	struct ordered_index_t *index;	// optional, see dictionary_enable_index()
+	struct dictionary_log_t *log;	// optional, see dictionary_open_log()
+	dictionary_cache_t *cache;		// optional, see dictionary_set_cache()
+	dictionary_expiry_t *expiry;	// optional, see dictionary_enable_expiry()
+	unsigned long seed[2];			// SipHash key, see dictionary_enable_seed()
+	int seeded;
+	int reseed_chain;				// reseed once a chain is longer than this, 0 never
+	long reseed_capacity;			// capacity at the last automatic reseed
+	char *key_storage;				// keys packed by dictionary_clone() or dictionary_pack_keys()
+	long key_storage_size;
 } dictionary_t;
 
 /*
@@ -104,6 +186,22 @@ free_dictionary(dictionary_t *dict);
 dict_value_t
 dictionary_put(dictionary_t *dict, char *key, dict_value_t value);
 
+/*
+ * Put a value into the dictionary that expires at the given time. Once the
+ * dictionary's clock reaches that time the entry is treated as absent, and
+ * it is removed the next time it is touched or by dictionary_expire_step().
+ * A plain dictionary_put() clears the expiration of an existing entry.
+ *
+ * Returns the previous value, as dictionary_put() does
+ *
+ * dict - dictionary with expiry enabled by dictionary_enable_expiry()
+ * key - null-terminated string will be copied and managed by dictionary
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ * expires - expiration time on the dictionary's clock, 0 for never
+ */
+dict_value_t
+dictionary_put_expire(dictionary_t *dict, char *key, dict_value_t value, long expires);
+
 /*
  * Retrieve a value from the dictionary
  *
@@ -123,8 +221,321 @@ dictionary_get(dictionary_t *dict, char *key);
 dict_value_t
 dictionary_remove(dictionary_t *dict, char *key);
 
+/*
+ * Remove every entry for which the predicate returns nonzero, in a single
+ * pass over the table. Each collision bucket is compacted once, keeping
+ * its order, and a bucket left with one entry is promoted back into its
+ * slot. No key is hashed again, except to update the filter for entries
+ * stored in slots. The table shrinks afterwards if enough entries were
+ * removed, as it does for dictionary_remove(); call dictionary_compact()
+ * to release the rest of the slack.
+ *
+ * Each removed entry is passed to on_removed, if not NULL, so the caller
+ * can free the value; the key is freed by the dictionary after the call
+ * returns. Entries that have expired are passed to the expired callback
+ * instead, without calling the predicate. Neither function may change the
+ * dictionary.
+ *
+ * Returns the number of entries the predicate removed
+ *
+ * dict - allocated by new_dictionary()
+ * predicate - function that takes key, value as arguments, nonzero to remove
+ * on_removed - function returning void that takes key, value as arguments
+ */
+long
+dictionary_remove_if(dictionary_t *dict, dictionary_predicate_t predicate, dictionary_enumerator_t on_removed);
+
+/*
+ * Add delta to the count stored for key, starting from 0 if the key is not
+ * in the dictionary. The count is kept in the value itself, as a long, so a
+ * dictionary used for counting needs no value allocations. The key is
+ * hashed and looked up once.
+ *
+ * Returns the new count, or 0 if the key is NULL or the dictionary is
+ * uninitialized
+ *
+ * dict - dictionary whose values are all counts
+ * key - null-terminated string, copied by the dictionary if it is new
+ * delta - amount to add, may be negative
+ */
+long
+dictionary_increment(dictionary_t *dict, char *key, long delta);
+
+/*
+ * Find the k entries with the largest counts, without sorting the others.
+ * A min-heap of the k largest counts seen so far is kept while the table
+ * is scanned once, so this takes O(n log k) time.
+ *
+ * Returns the number of entries found, k or fewer if the dictionary is
+ * smaller, in keys and counts from the largest count down. The keys belong
+ * to the dictionary and are valid until they are removed.
+ *
+ * dict - dictionary whose values are all counts
+ * k - number of entries to find
+ * keys - receives k keys
+ * counts - receives the count of each key
+ */
+long
+dictionary_top_k(dictionary_t *dict, long k, dict_key_t *keys, long *counts);
+
+/*
+ * Size the dictionary so that it can hold expected_entries without
+ * resizing. The dictionary is rebuilt at most once, and will not shrink
+ * automatically below the reserved capacity.
+ *
+ * Returns 0 on success, or -1 if the table could not be allocated
+ *
+ * dict - allocated by new_dictionary()
+ * expected_entries - number of entries the dictionary will hold
+ */
+int
+dictionary_reserve(dictionary_t *dict, long expected_entries);
+
+/*
+ * Maintain a counting Bloom filter alongside the dictionary, so that most
+ * lookups of keys that are not in the dictionary are answered from the
+ * filter without loading the slot or walking a collision bucket. The filter
+ * reuses the hash computed for the table, and is kept up to date by put,
+ * remove and resizing.
+ *
+ * Returns 0 on success, or -1 if the filter could not be allocated
+ *
+ * dict - allocated by new_dictionary()
+ * counters_per_entry - 4-bit counters per entry, 0 removes the filter; 8
+ * 		gives about 3% false positives when the table is as full as
+ * 		its load factor allows, and less after it grows, since the
+ * 		filter is sized for the capacity
+ */
+int
+dictionary_enable_filter(dictionary_t *dict, int counters_per_entry);
+
+/*
+ * Maintain an ordered index of the keys alongside the dictionary, for
+ * dictionary_prefix_scan() and dictionary_range(). The index is a B-tree of
+ * the dictionary's own key pointers, kept up to date by put and remove;
+ * lookups by key still use the hash table alone.
+ *
+ * Returns 0 on success, or -1 if the index could not be allocated
+ *
+ * dict - allocated by new_dictionary()
+ */
+int
+dictionary_enable_index(dictionary_t *dict);
+
+/*
+ * Execute the enumeration function for each entry whose key starts with
+ * prefix, in key order. The dictionary must not be updated until the scan
+ * returns. Entries that have expired but not yet been removed are included.
+ *
+ * Returns the number of entries enumerated, or -1 if the dictionary has no
+ * ordered index
+ *
+ * dict - dictionary with an index, see dictionary_enable_index()
+ * prefix - null-terminated string, "" enumerates every entry
+ * enum_function - function returning void that takes key, value as arguments
+ */
+long
+dictionary_prefix_scan(dictionary_t *dict, const char *prefix, dictionary_enumerator_t enum_function);
+
+/*
+ * Execute the enumeration function for each entry whose key is at least
+ * from and less than to, in key order. The dictionary must not be updated
+ * until the scan returns. Entries that have expired but not yet been removed
+ * are included.
+ *
+ * Returns the number of entries enumerated, or -1 if the dictionary has no
+ * ordered index
+ *
+ * dict - dictionary with an index, see dictionary_enable_index()
+ * from - first key to enumerate, or NULL to start with the smallest key
+ * to - key to stop before, or NULL to continue to the largest key
+ * enum_function - function returning void that takes key, value as arguments
+ */
+long
+dictionary_range(dictionary_t *dict, const char *from, const char *to, dictionary_enumerator_t enum_function);
+
+/*
+ * Turn the dictionary into a bounded cache. Once a put takes the dictionary
+ * past max_entries or max_bytes, entries are evicted by the CLOCK algorithm:
+ * every entry has a reference bit that is set when it is found by
+ * dictionary_get() or dictionary_put(), and a hand sweeps the slots and
+ * their collision buckets, clearing set bits and evicting the first entry
+ * whose bit is clear. New entries start unreferenced, so a scan of keys that
+ * are used once can't push out entries that are used repeatedly. The entry
+ * just added is never evicted.
+ *
+ * Returns 0 on success, or -1 if the cache could not be allocated
+ *
+ * dict - allocated by new_dictionary()
+ * max_entries - most entries to keep, 0 for no limit
+ * max_bytes - most bytes of keys plus value sizes to keep, 0 for no limit;
+ * 		both limits 0 turns cache mode off
+ * evict - called with each evicted key and value, may be NULL
+ * value_size - returns the size of a value for max_bytes, may be NULL to
+ * 		count only the keys
+ * context - passed to evict and value_size
+ */
+int
+dictionary_set_cache(dictionary_t *dict, long max_entries, long max_bytes,
+	dictionary_evict_function_t evict, dictionary_size_function_t value_size, void *context);
+
+/*
+ * Hash keys with SipHash-1-3 keyed by a per-dictionary seed instead of djb2,
+ * so that keys crafted to collide can't turn lookups into linear scans. The
+ * table is rebuilt with the new hash; later rebuilds keep the seed.
+ *
+ * Returns 0 on success, or -1 if the table could not be rebuilt
+ *
+ * dict - allocated by new_dictionary()
+ * seed - two 64-bit words, NULL for a random seed
+ * reseed_chain - when a put makes a collision chain longer than this, pick
+ * 		a new random seed and rebuild, at most once per capacity; 0 never
+ */
+int
+dictionary_enable_seed(dictionary_t *dict, const unsigned long *seed, int reseed_chain);
+
+/*
+ * Fill seed with 128 random bits from /dev/urandom, or from the clock and
+ * the address space layout if it can't be read
+ */
+void
+dictionary_random_seed(unsigned long seed[2]);
+
+/*
+ * Allow entries to expire. Expired entries are treated as absent by
+ * dictionary_get(), dictionary_put() and dictionary_remove(), and are
+ * removed when one of them touches the entry, or when
+ * dictionary_expire_step() reaches it, so no full scan is ever needed.
+ *
+ * Returns 0 on success, or -1 if the expiration times could not be allocated
+ *
+ * dict - allocated by new_dictionary()
+ * clock - returns the current time, NULL for CLOCK_MONOTONIC milliseconds
+ * expired - called with the key and value of each expired entry as it is
+ * 		removed, so the caller can free the value; may be NULL
+ * context - passed to clock and expired
+ */
+int
+dictionary_enable_expiry(dictionary_t *dict, dictionary_clock_function_t clock,
+	dictionary_evict_function_t expired, void *context);
+
+/*
+ * Change the expiration time of an existing entry
+ *
+ * Returns 0 on success, or -1 if the key is not in the dictionary
+ *
+ * dict - dictionary with expiry enabled by dictionary_enable_expiry()
+ * key - null-terminated string to look for
+ * expires - expiration time on the dictionary's clock, 0 for never
+ */
+int
+dictionary_set_expire(dictionary_t *dict, char *key, long expires);
+
+/*
+ * Reclaim expired entries with a bounded amount of work, for calling from
+ * an event loop. Examines at most max_slots slots, continuing from where
+ * the previous call stopped, so every entry is visited once per
+ * max_entries / max_slots calls. Like active expiry in Redis, the caller
+ * can call again straight away while a large share of the entries examined
+ * turn out to have expired.
+ *
+ * Returns the number of entries removed
+ *
+ * dict - dictionary with expiry enabled by dictionary_enable_expiry()
+ * max_slots - most slots to examine
+ */
+long
+dictionary_expire_step(dictionary_t *dict, long max_slots);
+
+/*
+ * Rebuild the dictionary at the smallest capacity that holds the current
+ * entries within the load factor. Collision buckets are rebuilt at their
+ * minimum size as part of the rebuild.
+ *
+ * Removing entries shrinks the dictionary automatically, but only once it is
+ * less than a quarter as full as the load factor allows. Call this after a
+ * large purge to release the remaining slack immediately.
+ *
+ * dict - dictionary to compact
+ */
+void
+dictionary_compact(dictionary_t *dict);
+
+/*
+ * Returns a copy of the dictionary, or NULL if it could not be allocated
+ *
+ * The table is copied as it stands, without rehashing or growing: the slot
+ * arrays and collision buckets are duplicated directly, and all the keys
+ * are packed into a single allocation owned by the copy. Values are copied
+ * as they are, the caller still manages them. The filter, cache and expiry
+ * state and the seed are copied too; callbacks and their context are shared.
+ *
+ * The copy is independent of the original and can be updated or freed with
+ * free_dictionary() like any other. Keys removed from the copy stay in its
+ * key storage until the copy is freed. The copy is not logged, even if the
+ * original was opened with dictionary_open_log().
+ *
+ * dict - dictionary to copy, not modified
+ */
+dictionary_t *
+dictionary_clone(dictionary_t *dict);
+
+/*
+ * Move every key into a single allocation, sharing the bytes of any key
+ * that is a suffix of another key ("ring" is stored inside "string"). This
+ * saves the allocator's header and rounding on every key as well as the
+ * shared bytes, and lookups are unaffected since the keys are still
+ * ordinary strings. The 216,665 keys of the test word list take 6.9MB of
+ * heap on their own and 1.9MB packed; the whole heap, counting mmapped
+ * blocks, goes from 17.6MB to 13.0MB, since the table is unchanged.
+ *
+ * Meant for read-mostly tables: keys put afterwards are allocated on their
+ * own as usual, and removed keys stay in the storage until the keys are
+ * packed again. The keys are sorted by their reversed bytes to find the
+ * suffixes, so this takes O(n log n) time.
+ *
+ * Returns the size of the key storage, or -1 if it could not be allocated,
+ * in which case the keys are unchanged
+ *
+ * dict - allocated by new_dictionary()
+ */
+long
+dictionary_pack_keys(dictionary_t *dict);
+
+/*
+ * Move every entry of src into dest, and free src
+ *
+ * dest is grown once for the combined number of entries, then each key is
+ * moved out of src rather than copied. A key found in both dictionaries
+ * keeps its key in dest, and its value becomes the result of combine; with
+ * no combine function the value from src replaces the one in dest. Either
+ * way the values are still managed by the caller, and combine should free
+ * whichever value it discards.
+ *
+ * Entries that have expired in src are passed to its expired callback
+ * instead of being merged. Expiration times are kept if dest has expiry
+ * enabled.
+ *
+ * If src was opened with dictionary_open_log(), its log is truncated to
+ * match the now empty src before src is freed, so reopening it doesn't
+ * bring back the entries that moved to dest.
+ *
+ * Returns 0 on success, or -1 if dest and src are the same dictionary or
+ * dest could not be grown to hold the entries of both, in which case
+ * neither dictionary is changed
+ *
+ * dest - dictionary receiving the entries
+ * src - dictionary to consume, freed on success
+ * combine - called for each key found in both dictionaries, with the
+ * 		values from dest and from src, returns the value to keep
+ */
+int
+dictionary_merge(dictionary_t *dest, dictionary_t *src, dictionary_combine_t combine);
+
 /*
  * For each key/value pair in the dictionary, execute the enumeration function.
+ * Entries that have expired but not yet been removed are included, so that
+ * their values can still be freed.
  *
  * dict - dictionary to enumerate
  * enum_function - function returning void that takes key, value as arguments
@@ -0,0 +1,648 @@
+/*
+ * dictionary_log.c
+ *
+ * Replay reads the log twice. The first pass puts each key with the file
+ * offset of its latest record as the value, so a key that is overwritten a
+ * thousand times is decoded once; the second pass decodes the surviving
+ * records into the real values.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dictionary_log.h"
+#include "capacity.h"
+#include "hash.h"
+
+#define DICT_LOG_PUT		1
+#define DICT_LOG_REMOVE		2
+#define DICT_LOG_HEADER		9		// op, key length, value length
+#define DICT_LOG_CHECKSUM	4
+
+/* ---------- private declarations ---------- */
+
+/*
+ * Returns the size of a record with the given key and value lengths
+ */
+size_t
+dictionary_log_record_size(size_t key_length, size_t value_length);
+
+/*
+ * Format a record into out, which must hold dictionary_log_record_size() bytes
+ */
+void
+dictionary_log_format(char *out, int op, const char *key, size_t key_length, const void *value,
+	size_t value_length);
+
+/*
+ * Returns the size of the valid record at data, or 0 if the record is torn
+ * or corrupt
+ *
+ * data - start of the record
+ * available - bytes from the start of the record to the end of the log
+ */
+size_t
+dictionary_log_parse(const char *data, size_t available, int *op, const char **key, size_t *key_length,
+	const char **value, size_t *value_length);
+
+/*
+ * Returns the bytes to log for a value, encoded by the log's encode function
+ * or as a 64-bit integer
+ */
+const void *
+dictionary_log_encode(dictionary_log_t *log, dict_value_t value, dict_value_t *scratch, size_t *length);
+
+/*
+ * Add a record to the log, syncing as needed and noting when compaction is due
+ */
+int
+dictionary_log_append(dictionary_t *dict, int op, const char *key, dict_value_t value);
+
+/*
+ * Write the buffered records to the log file, starting after the bytes an
+ * earlier failed flush already wrote
+ */
+int
+dictionary_log_flush(dictionary_log_t *log);
+
+/*
+ * Write all of data, retrying after short writes
+ *
+ * Returns 0 on success, or -1 if a write failed
+ *
+ * written - if not NULL, receives the number of bytes written, also when
+ * 		a write fails partway
+ */
+int
+dictionary_log_write(int fd, const char *data, size_t length, size_t *written);
+
+/*
+ * Mark the log as failed, so that later updates fail fast instead of
+ * leaving a gap in the log
+ */
+void
+dictionary_log_fail(dictionary_log_t *log);
+
+/*
+ * Sync the directory holding path, so that a rename into it is durable
+ */
+void
+dictionary_log_sync_directory(const char *path);
+
+/*
+ * Monotonic time in milliseconds, for the sync interval
+ */
+long
+dictionary_log_milliseconds();
+
+
+/* ---------- public definitions ---------- */
+
+/*
+ * Open a dictionary backed by a log file, replaying the records already in
+ * it. The file is created if it doesn't exist. The dictionary is sized for
+ * the entries in the log before they are replayed.
+ *
+ * Returns the dictionary, or NULL if the log could not be opened or read
+ *
+ * path - log file
+ * sync_count - sync after this many records, 1 syncs every update
+ * sync_interval - also sync once this many milliseconds have passed since
+ * 		the last sync, checked when a record is added; 0 for no limit
+ * encode - returns the bytes to log for a value, or NULL to log the value
+ * 		itself as a 64-bit integer
+ * decode - rebuilds a value from its bytes, NULL if encode is NULL
+ * context - passed to encode and decode
+ */
+dictionary_t *
+dictionary_open_log(const char *path, long sync_count, long sync_interval,
+	dictionary_log_encode_t encode, dictionary_log_decode_t decode, void *context)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		perror(path);
+		close(fd);
+		return NULL;
+	}
+
+	char *data = NULL;
+	size_t size = st.st_size;
+	if (size > 0) {
+		data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			perror(path);
+			close(fd);
+			return NULL;
+		}
+	}
+
+	// count the valid records, and size the dictionary for the puts among them
+	long num_records = 0;
+	long num_puts = 0;
+	size_t valid = 0;
+	while (valid < size) {
+		int op;
+		const char *key, *value;
+		size_t key_length, value_length;
+		size_t record = dictionary_log_parse(data + valid, size - valid, &op, &key, &key_length,
+			&value, &value_length);
+		if (record == 0)
+			break;
+		if (op == DICT_LOG_PUT)
+			num_puts++;
+		num_records++;
+		valid += record;
+	}
+
+	dictionary_t *dict = new_dictionary_size_load(capacity_for_entries(num_puts, LOAD_FACTOR), LOAD_FACTOR);
+	// the presized capacity is not a floor, the dictionary may shrink later
+	dict->min_entries = DICT_INITIAL_SIZE;
+
+	// first pass, each key ends up with the offset of its latest record + 1
+	size_t key_capacity = 256;
+	char *key_buffer = malloc(key_capacity);
+	for (size_t offset=0; offset < valid; ) {
+		int op;
+		const char *key, *value;
+		size_t key_length, value_length;
+		size_t record = dictionary_log_parse(data + offset, valid - offset, &op, &key, &key_length,
+			&value, &value_length);
+		if (key_length + 1 > key_capacity) {
+			key_capacity = key_length + 1;
+			key_buffer = realloc(key_buffer, key_capacity);
+		}
+		memcpy(key_buffer, key, key_length);
+		key_buffer[key_length] = '\0';
+
+		if (op == DICT_LOG_PUT)
+			dictionary_put(dict, key_buffer, (dict_value_t)(offset + 1));
+		else
+			dictionary_remove(dict, key_buffer);
+		offset += record;
+	}
+	free(key_buffer);
+
+	// second pass, decode the surviving records in place
+	for (long i=0; i < dict->max_entries; i++) {
+		collision_bucket_t *bucket = (dict->keys[i] == NULL) ? dict->values[i].collision_buckets : NULL;
+		int count = (dict->keys[i] != NULL) ? 1 : ((bucket != NULL) ? bucket->num_elements : 0);
+		for (int j=0; j < count; j++) {
+			dict_value_t *slot = (bucket != NULL) ? &bucket->entries[j].value : &dict->values[i].value;
+			size_t offset = (size_t)*slot - 1;
+			int op;
+			const char *key, *value;
+			size_t key_length, value_length;
+			dictionary_log_parse(data + offset, valid - offset, &op, &key, &key_length, &value, &value_length);
+			if (decode != NULL) {
+				*slot = decode(value, value_length, context);
+			}
+			else {
+				*slot = NULL;
+				memcpy(slot, value, (value_length < sizeof(dict_value_t)) ? value_length : sizeof(dict_value_t));
+			}
+		}
+	}
+
+	if (data != NULL)
+		munmap(data, size);
+
+	// a torn record at the end is left over from a crash, later records
+	// must not follow it
+	if ((valid < size) && (ftruncate(fd, valid) != 0)) {
+		perror(path);
+		close(fd);
+		free_dictionary(dict);
+		return NULL;
+	}
+
+	dictionary_log_t *log = calloc(1, sizeof(dictionary_log_t));
+	log->fd = fd;
+	log->path = strdup(path);
+	log->buffer = malloc(DICT_LOG_BUFFER_SIZE);
+	log->sync_count = sync_count;
+	log->sync_interval = sync_interval;
+	log->last_sync = dictionary_log_milliseconds();
+	log->num_records = num_records;
+	log->encode = encode;
+	log->decode = decode;
+	log->context = context;
+	dict->log = log;
+
+	return dict;
+}
+
+/*
+ * Write any buffered records and sync the log file
+ *
+ * Returns 0 on success, or -1 if the log could not be written, or the
+ * dictionary has no log
+ *
+ * dict - opened by dictionary_open_log()
+ */
+int
+dictionary_sync(dictionary_t *dict)
+{
+	dictionary_log_t *log = dict->log;
+
+	if ((log == NULL) || log->failed)
+		return -1;
+	if (dictionary_log_flush(log) != 0)
+		return -1;
+	if (fdatasync(log->fd) != 0) {
+		perror(log->path);
+		dictionary_log_fail(log);
+		return -1;
+	}
+	log->unsynced = 0;
+	log->last_sync = dictionary_log_milliseconds();
+	return 0;
+}
+
+/*
+ * Replace the log with a snapshot holding one record per entry
+ *
+ * Returns 0 on success, or -1 if the snapshot could not be written, in which
+ * case the old log is kept
+ *
+ * dict - opened by dictionary_open_log()
+ */
+int
+dictionary_compact_log(dictionary_t *dict)
+{
+	dictionary_log_t *log = dict->log;
+
+	if ((log == NULL) || log->failed)
+		return -1;
+
+	char *snapshot_path = malloc(strlen(log->path) + sizeof(".compact"));
+	sprintf(snapshot_path, "%s.compact", log->path);
+	int fd = open(snapshot_path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (fd < 0) {
+		perror(snapshot_path);
+		free(snapshot_path);
+		return -1;
+	}
+
+	// the snapshot is written through its own buffer, the records buffered
+	// for the old log are covered by it
+	char *buffer = malloc(DICT_LOG_BUFFER_SIZE);
+	size_t used = 0;
+	int failed = 0;
+	for (long i=0; (i < dict->max_entries) && !failed; i++) {
+		collision_bucket_t *bucket = (dict->keys[i] == NULL) ? dict->values[i].collision_buckets : NULL;
+		int count = (dict->keys[i] != NULL) ? 1 : ((bucket != NULL) ? bucket->num_elements : 0);
+		for (int j=0; (j < count) && !failed; j++) {
+			const char *key = (bucket != NULL) ? bucket->entries[j].key : dict->keys[i];
+			dict_value_t value = (bucket != NULL) ? bucket->entries[j].value : dict->values[i].value;
+			dict_value_t scratch;
+			size_t key_length = strlen(key);
+			size_t value_length;
+			const void *bytes = dictionary_log_encode(log, value, &scratch, &value_length);
+			size_t size = dictionary_log_record_size(key_length, value_length);
+
+			if ((used + size > DICT_LOG_BUFFER_SIZE) && (used > 0)) {
+				failed = dictionary_log_write(fd, buffer, used, NULL);
+				used = 0;
+			}
+			if (size > DICT_LOG_BUFFER_SIZE) {
+				char *record = malloc(size);
+				dictionary_log_format(record, DICT_LOG_PUT, key, key_length, bytes, value_length);
+				failed = failed || dictionary_log_write(fd, record, size, NULL);
+				free(record);
+			}
+			else {
+				dictionary_log_format(buffer + used, DICT_LOG_PUT, key, key_length, bytes, value_length);
+				used += size;
+			}
+		}
+	}
+	if (!failed && (used > 0))
+		failed = dictionary_log_write(fd, buffer, used, NULL);
+	free(buffer);
+
+	// the snapshot must be on disk before it replaces the log
+	if (failed || (fdatasync(fd) != 0) || (rename(snapshot_path, log->path) != 0)) {
+		perror(snapshot_path);
+		close(fd);
+		unlink(snapshot_path);
+		free(snapshot_path);
+		return -1;
+	}
+	dictionary_log_sync_directory(log->path);
+	free(snapshot_path);
+
+	close(log->fd);
+	log->fd = fd;
+	log->buffer_used = 0;
+	log->buffer_written = 0;
+	log->unsynced = 0;
+	log->last_sync = dictionary_log_milliseconds();
+	log->num_records = dict->num_entries;
+	log->compact_pending = 0;
+	return 0;
+}
+
+/*
+ * Log a put of key with value, called by the dictionary after an update
+ *
+ * Returns 0 on success, or -1 if the record could not be written
+ */
+int
+dictionary_log_put(dictionary_t *dict, const char *key, dict_value_t value)
+{
+	return dictionary_log_append(dict, DICT_LOG_PUT, key, value);
+}
+
+/*
+ * Log the removal of key, called by the dictionary after an update
+ *
+ * Returns 0 on success, or -1 if the record could not be written
+ */
+int
+dictionary_log_remove(dictionary_t *dict, const char *key)
+{
+	return dictionary_log_append(dict, DICT_LOG_REMOVE, key, NULL);
+}
+
+/*
+ * Compact the log if a record added during the update made it due, called
+ * by the dictionary at the end of every public update, once the table is
+ * consistent again
+ *
+ * Returns 0 on success, or -1 if the snapshot could not be written
+ */
+int
+dictionary_log_end_update(dictionary_t *dict)
+{
+	dictionary_log_t *log = dict->log;
+
+	// entries added later in the same update may have brought the ratio back down
+	if ((log == NULL) || !log->compact_pending || log->failed)
+		return 0;
+	if (log->num_records <= DICT_LOG_COMPACT_RATIO * dict->num_entries) {
+		log->compact_pending = 0;
+		return 0;
+	}
+	return dictionary_compact_log(dict);
+}
+
+/*
+ * Sync and close a log, called when its dictionary is freed
+ */
+void
+dictionary_close_log(dictionary_log_t *log)
+{
+	if ((dictionary_log_flush(log) != 0) || (fdatasync(log->fd) != 0))
+		fprintf(stderr, "dictionary_close_log() unable to sync %s\n", log->path);
+	close(log->fd);
+	free(log->buffer);
+	free(log->path);
+	free(log);
+}
+
+/* --- private functions --- */
+
+/*
+ * Returns the size of a record with the given key and value lengths
+ */
+size_t
+dictionary_log_record_size(size_t key_length, size_t value_length)
+{
+	return DICT_LOG_HEADER + key_length + value_length + DICT_LOG_CHECKSUM;
+}
+
+/*
+ * Format a record into out, which must hold dictionary_log_record_size() bytes
+ */
+void
+dictionary_log_format(char *out, int op, const char *key, size_t key_length, const void *value,
+	size_t value_length)
+{
+	uint32_t lengths[2] = { (uint32_t)key_length, (uint32_t)value_length };
+
+	out[0] = (char)op;
+	memcpy(out + 1, lengths, sizeof(lengths));
+	memcpy(out + DICT_LOG_HEADER, key, key_length);
+	if (value_length > 0)
+		memcpy(out + DICT_LOG_HEADER + key_length, value, value_length);
+
+	size_t body = DICT_LOG_HEADER + key_length + value_length;
+	uint32_t checksum = (uint32_t)hash_bytes((const unsigned char *)out, body);
+	memcpy(out + body, &checksum, DICT_LOG_CHECKSUM);
+}
+
+/*
+ * Returns the size of the valid record at data, or 0 if the record is torn
+ * or corrupt
+ *
+ * data - start of the record
+ * available - bytes from the start of the record to the end of the log
+ */
+size_t
+dictionary_log_parse(const char *data, size_t available, int *op, const char **key, size_t *key_length,
+	const char **value, size_t *value_length)
+{
+	uint32_t lengths[2];
+	uint32_t checksum;
+
+	if (available < DICT_LOG_HEADER + DICT_LOG_CHECKSUM)
+		return 0;
+	*op = data[0];
+	if ((*op != DICT_LOG_PUT) && (*op != DICT_LOG_REMOVE))
+		return 0;
+
+	memcpy(lengths, data + 1, sizeof(lengths));
+	size_t body = DICT_LOG_HEADER + (size_t)lengths[0] + (size_t)lengths[1];
+	if (body + DICT_LOG_CHECKSUM > available)
+		return 0;
+
+	memcpy(&checksum, data + body, DICT_LOG_CHECKSUM);
+	if (checksum != (uint32_t)hash_bytes((const unsigned char *)data, body))
+		return 0;
+
+	*key = data + DICT_LOG_HEADER;
+	*key_length = lengths[0];
+	*value = *key + lengths[0];
+	*value_length = lengths[1];
+	return body + DICT_LOG_CHECKSUM;
+}
+
+/*
+ * Returns the bytes to log for a value, encoded by the log's encode function
+ * or as a 64-bit integer
+ */
+const void *
+dictionary_log_encode(dictionary_log_t *log, dict_value_t value, dict_value_t *scratch, size_t *length)
+{
+	if (log->encode != NULL)
+		return log->encode(value, length, log->context);
+
+	*scratch = value;
+	*length = sizeof(dict_value_t);
+	return scratch;
+}
+
+/*
+ * Add a record to the log, syncing as needed and noting when compaction is due
+ */
+int
+dictionary_log_append(dictionary_t *dict, int op, const char *key, dict_value_t value)
+{
+	dictionary_log_t *log = dict->log;
+	dict_value_t scratch;
+	size_t key_length = strlen(key);
+	size_t value_length = 0;
+	const void *bytes = NULL;
+
+	if (log->failed)
+		return -1;
+
+	if (op == DICT_LOG_PUT)
+		bytes = dictionary_log_encode(log, value, &scratch, &value_length);
+
+	size_t size = dictionary_log_record_size(key_length, value_length);
+	if ((log->buffer_used + size > DICT_LOG_BUFFER_SIZE) && (dictionary_log_flush(log) != 0))
+		return -1;
+
+	if (size > DICT_LOG_BUFFER_SIZE) {
+		char *record = malloc(size);
+		dictionary_log_format(record, op, key, key_length, bytes, value_length);
+		int failed = dictionary_log_write(log->fd, record, size, NULL);
+		free(record);
+		if (failed) {
+			perror(log->path);
+			dictionary_log_fail(log);
+			return -1;
+		}
+	}
+	else {
+		dictionary_log_format(log->buffer + log->buffer_used, op, key, key_length, bytes, value_length);
+		log->buffer_used += size;
+	}
+	log->num_records++;
+	log->unsynced++;
+
+	// group commit, one sync covers every record since the last one
+	if (((log->sync_count > 0) && (log->unsynced >= log->sync_count))
+		|| ((log->sync_interval > 0) && (dictionary_log_milliseconds() - log->last_sync >= log->sync_interval))) {
+		if (dictionary_sync(dict) != 0)
+			return -1;
+	}
+
+	// the caller may be partway through changing the table, so compaction
+	// waits for dictionary_log_end_update()
+	if ((log->num_records > DICT_LOG_COMPACT_MIN)
+		&& (log->num_records > DICT_LOG_COMPACT_RATIO * dict->num_entries))
+		log->compact_pending = 1;
+
+	return 0;
+}
+
+/*
+ * Write the buffered records to the log file, starting after the bytes an
+ * earlier failed flush already wrote
+ */
+int
+dictionary_log_flush(dictionary_log_t *log)
+{
+	if (log->buffer_used == 0)
+		return 0;
+
+	// a retry after a partial write must not write the same bytes twice
+	size_t written = 0;
+	int failed = dictionary_log_write(log->fd, log->buffer + log->buffer_written,
+		log->buffer_used - log->buffer_written, &written);
+	log->buffer_written += written;
+	if (failed) {
+		perror(log->path);
+		dictionary_log_fail(log);
+		return -1;
+	}
+	log->buffer_used = 0;
+	log->buffer_written = 0;
+	return 0;
+}
+
+/*
+ * Write all of data, retrying after short writes
+ */
+int
+dictionary_log_write(int fd, const char *data, size_t length, size_t *written)
+{
+	if (written != NULL)
+		*written = 0;
+	while (length > 0) {
+		ssize_t n = write(fd, data, length);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += n;
+		length -= n;
+		if (written != NULL)
+			*written += n;
+	}
+	return 0;
+}
+
+/*
+ * Mark the log as failed, so that later updates fail fast instead of
+ * leaving a gap in the log
+ */
+void
+dictionary_log_fail(dictionary_log_t *log)
+{
+	if (!log->failed)
+		fprintf(stderr, "dictionary log %s failed, later updates are not logged\n", log->path);
+	log->failed = 1;
+}
+
+/*
+ * Sync the directory holding path, so that a rename into it is durable
+ */
+void
+dictionary_log_sync_directory(const char *path)
+{
+	char *directory = strdup(path);
+	char *slash = strrchr(directory, '/');
+
+	if (slash == NULL)
+		strcpy(directory, ".");
+	else if (slash == directory)
+		slash[1] = '\0';
+	else
+		*slash = '\0';
+
+	int fd = open(directory, O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	free(directory);
+}
+
+/*
+ * Monotonic time in milliseconds, for the sync interval
+ */
+long
+dictionary_log_milliseconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
@@ -0,0 +1,148 @@
+/*
+ * dictionary_log.h - append-only write-ahead log for durable dictionaries
+ *
+ * A dictionary opened with dictionary_open_log() appends a record for every
+ * put and every removal (including cache evictions and expirations) to its
+ * log file. Records are collected in a buffer and written in large blocks,
+ * and the file is synced once per sync_count records or sync_interval
+ * milliseconds, whichever comes first (group commit). A crash loses at most
+ * the records since the last sync; a torn record at the end of the file is
+ * detected by its checksum and discarded when the log is next opened.
+ *
+ * Once the log holds DICT_LOG_COMPACT_RATIO times as many records as the
+ * dictionary has entries, it is replaced by a snapshot with one record per
+ * entry. The snapshot walks the whole table, so it is taken at the end of
+ * the update that made it due, never while an update is partway through
+ * changing the table.
+ *
+ * A write or sync that fails sets the log's failed flag, and it stays set:
+ * the update that hit the failure has already changed the dictionary, so
+ * the log no longer matches it. Every later record is refused,
+ * dictionary_sync() and dictionary_compact_log() return -1, and the
+ * dictionary carries on in memory only. Closing the log still writes out
+ * whatever the buffer holds, resuming after any bytes a failed write got
+ * out, so no record is written twice.
+ *
+ * Values are logged through an encode function, and rebuilt by a decode
+ * function when the log is replayed. Without them the value itself is
+ * logged as a 64-bit integer. Expiration times are not logged.
+ *
+ * Record layout, integers in host byte order:
+ *
+ * 	op (1 byte) | key length (4) | value length (4) | key | value | checksum (4)
+ */
+
+#ifndef DICTIONARY_LOG
+
+#define DICTIONARY_LOG
+
+#include <stddef.h>
+
+#include "dictionary.h"
+
+#define DICT_LOG_BUFFER_SIZE	(64 * 1024)	// records are written in blocks this large
+#define DICT_LOG_COMPACT_RATIO	4			// records per live entry that trigger compaction
+#define DICT_LOG_COMPACT_MIN	1024		// smaller logs are never compacted
+
+// Returns the bytes to log for a value, and their length in *length. The
+// bytes only need to stay valid until the next call.
+typedef const void * (* dictionary_log_encode_t) (dict_value_t value, size_t *length, void *context);
+
+// Returns a value rebuilt from the bytes logged by the encode function
+typedef dict_value_t (* dictionary_log_decode_t) (const void *bytes, size_t length, void *context);
+
+typedef struct dictionary_log_t {
+	int fd;
+	char *path;
+	char *buffer;				// records not yet written to the file
+	size_t buffer_used;
+	size_t buffer_written;		// bytes of the buffer a failed flush already wrote
+	long unsynced;				// records since the last sync
+	long sync_count;			// sync after this many records, 0 only on sync_interval
+	long sync_interval;			// sync when a record is this many ms after the last sync, 0 never
+	long last_sync;
+	long num_records;			// records in the file and the buffer
+	int compact_pending;		// the log is due for compaction at the end of the update
+	int failed;					// a write or sync failed, see below
+	dictionary_log_encode_t encode;
+	dictionary_log_decode_t decode;
+	void *context;
+} dictionary_log_t;
+
+/*
+ * Open a dictionary backed by a log file, replaying the records already in
+ * it. The file is created if it doesn't exist. The dictionary is sized for
+ * the entries in the log before they are replayed.
+ *
+ * Returns the dictionary, or NULL if the log could not be opened or read
+ *
+ * path - log file
+ * sync_count - sync after this many records, 1 syncs every update
+ * sync_interval - also sync once this many milliseconds have passed since
+ * 		the last sync, checked when a record is added; 0 for no limit
+ * encode - returns the bytes to log for a value, or NULL to log the value
+ * 		itself as a 64-bit integer
+ * decode - rebuilds a value from its bytes, NULL if encode is NULL
+ * context - passed to encode and decode
+ */
+dictionary_t *
+dictionary_open_log(const char *path, long sync_count, long sync_interval,
+	dictionary_log_encode_t encode, dictionary_log_decode_t decode, void *context);
+
+/*
+ * Write any buffered records and sync the log file
+ *
+ * Returns 0 on success, or -1 if the log could not be written, has failed
+ * before, or the dictionary has no log
+ *
+ * dict - opened by dictionary_open_log()
+ */
+int
+dictionary_sync(dictionary_t *dict);
+
+/*
+ * Replace the log with a snapshot holding one record per entry
+ *
+ * Returns 0 on success, or -1 if the log has failed, or the snapshot could
+ * not be written, in which case the old log is kept
+ *
+ * dict - opened by dictionary_open_log()
+ */
+int
+dictionary_compact_log(dictionary_t *dict);
+
+/*
+ * Log a put of key with value, called by the dictionary after an update
+ *
+ * Returns 0 on success, or -1 if the record could not be written or the
+ * log has failed
+ */
+int
+dictionary_log_put(dictionary_t *dict, const char *key, dict_value_t value);
+
+/*
+ * Log the removal of key, called by the dictionary after an update
+ *
+ * Returns 0 on success, or -1 if the record could not be written or the
+ * log has failed
+ */
+int
+dictionary_log_remove(dictionary_t *dict, const char *key);
+
+/*
+ * Compact the log if a record added during the update made it due, called
+ * by the dictionary at the end of every public update, once the table is
+ * consistent again
+ *
+ * Returns 0 on success, or -1 if the snapshot could not be written
+ */
+int
+dictionary_log_end_update(dictionary_t *dict);
+
+/*
+ * Sync and close a log, called when its dictionary is freed
+ */
+void
+dictionary_close_log(dictionary_log_t *log);
+
+#endif
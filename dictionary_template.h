@@ -0,0 +1,317 @@
+/*
+ * dictionary_template.h - generate dictionaries specialized for a key type,
+ * value type, hash function and equality function
+ *
+ * dictionary_t stores char * keys and void * values and calls hash() and
+ * strncmp() out of line. The macros below instantiate a dictionary for any
+ * key and value types, with every operation declared static inline so the
+ * compiler can inline the hash and equality functions into each probe.
+ * Values are stored inline in the slot array, so a struct value needs no
+ * separate allocation.
+ *
+ * DICTIONARY_INIT(name, key_t, value_t, hash_fn, equal_fn) defines
+ *
+ *		name##_t					the dictionary type
+ *		new_##name()				allocate a dictionary of DICT_INITIAL_SIZE
+ *		new_##name##_size_load()	allocate a dictionary of a given size and load factor
+ *		free_##name()				free a dictionary
+ *		name##_put()				store a key and value, 1 if added, 0 if replaced
+ *		name##_insert()				find or add a key, returning its value slot
+ *		name##_get()				pointer to the value for a key, or NULL
+ *		name##_remove()				remove a key, 1 if it was present
+ *		name##_reserve()			presize for a number of entries
+ *		name##_compact()			shrink to the minimum size for the current entries
+ *		name##_enumerate()			call a function for every key and value
+ *
+ * hash_fn(key_t) must return an unsigned long, equal_fn(key_t, key_t) must
+ * return non-zero when the keys are equal. The dictionary does not copy or
+ * free keys or values.
+ *
+ * Collisions are resolved by linear probing, the same scheme as
+ * int_dictionary_t, and tables are sized by the policy in capacity.h, so
+ * programs using these macros must link with capacity.o. The resize path
+ * is the only out-of-line call.
+ *
+ * The existing dictionary_t API is unchanged. DICTIONARY_INIT_STRING()
+ * below instantiates the same char * to void * mapping (with djb2 and
+ * strcmp inlined) for callers that manage their own key strings.
+ */
+
+#ifndef DICTIONARY_TEMPLATE
+
+#define DICTIONARY_TEMPLATE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "dictionary.h"
+#include "capacity.h"
+#include "hash.h"
+
+#if __has_extension(blocks)
+// Use blocks instead of function pointers if we have them
+#define DICTIONARY_TEMPLATE_ENUMERATOR(enumerator_t, key_t, value_t) \
+	typedef void (^ enumerator_t) (key_t, value_t *)
+#else
+// A function returning void that takes the key and a pointer to the value
+#define DICTIONARY_TEMPLATE_ENUMERATOR(enumerator_t, key_t, value_t) \
+	typedef void (* enumerator_t) (key_t, value_t *)
+#endif
+
+#define DICTIONARY_INIT(name, key_t, value_t, hash_fn, equal_fn)						\
+																						\
+typedef struct name##_slot_t {															\
+	key_t key;																			\
+	value_t value;																		\
+} name##_slot_t;																		\
+																						\
+typedef struct name##_t {																\
+	long num_entries;																	\
+	long max_entries;																	\
+	long min_entries;		/* automatic shrinking stops at this size */				\
+	unsigned char *occupied;															\
+	name##_slot_t *slots;																\
+	double load_factor;																	\
+} name##_t;																				\
+																						\
+DICTIONARY_TEMPLATE_ENUMERATOR(name##_enumerator_t, key_t, value_t);					\
+																						\
+/* index of the slot holding key, or of the empty slot where it belongs */				\
+static inline long																		\
+name##_find_slot(const name##_t *dict, key_t key)										\
+{																						\
+	long index = (long)(hash_fn(key) % (unsigned long)dict->max_entries);				\
+																						\
+	while (dict->occupied[index] && !equal_fn(dict->slots[index].key, key)) {			\
+		if (++index == dict->max_entries)												\
+			index = 0;																	\
+	}																					\
+	return index;																		\
+}																						\
+																						\
+/* returns 0 on success, -1 if the new table could not be allocated */					\
+static inline int																		\
+name##_rebuild_table(name##_t *dict, long new_size)										\
+{																						\
+	unsigned char *new_occupied = (unsigned char *)calloc(new_size, 1);					\
+	name##_slot_t *new_slots = (name##_slot_t *)malloc(new_size * sizeof(name##_slot_t));	\
+																						\
+	if ((new_occupied == NULL) || (new_slots == NULL)) {								\
+		fprintf(stderr, "Unable to allocate %lu slots to resize dictionary %p\n",		\
+			new_size, (void *)dict);													\
+		free(new_occupied);																\
+		free(new_slots);																\
+		return -1;																		\
+	}																					\
+																						\
+	unsigned char *old_occupied = dict->occupied;										\
+	name##_slot_t *old_slots = dict->slots;												\
+	long old_size = dict->max_entries;													\
+																						\
+	dict->occupied = new_occupied;														\
+	dict->slots = new_slots;															\
+	dict->max_entries = new_size;														\
+																						\
+	for (long i=0; i < old_size; i++) {													\
+		if (old_occupied[i]) {															\
+			long index = name##_find_slot(dict, old_slots[i].key);						\
+			dict->occupied[index] = 1;													\
+			dict->slots[index] = old_slots[i];											\
+		}																				\
+	}																					\
+																						\
+	free(old_occupied);																	\
+	free(old_slots);																	\
+	return 0;																			\
+}																						\
+																						\
+static inline name##_t *																\
+new_##name##_size_load(long initial_size, double load_factor)							\
+{																						\
+	name##_t *dict = (name##_t *)calloc(1, sizeof(name##_t));							\
+																						\
+	/* linear probing needs at least one empty slot to terminate a search */			\
+	if (load_factor >= 1.0)																\
+		load_factor = LOAD_FACTOR;														\
+	if (initial_size < DICT_INITIAL_SIZE)												\
+		initial_size = DICT_INITIAL_SIZE;												\
+																						\
+	dict->load_factor = load_factor;													\
+	dict->max_entries = initial_size;													\
+	dict->min_entries = initial_size;													\
+	dict->occupied = (unsigned char *)calloc(initial_size, 1);							\
+	dict->slots = (name##_slot_t *)malloc(initial_size * sizeof(name##_slot_t));		\
+																						\
+	return dict;																		\
+}																						\
+																						\
+static inline name##_t *																\
+new_##name()																			\
+{																						\
+	return new_##name##_size_load(DICT_INITIAL_SIZE, LOAD_FACTOR);						\
+}																						\
+																						\
+static inline void																		\
+free_##name(name##_t *dict)																\
+{																						\
+	free(dict->occupied);																\
+	free(dict->slots);																	\
+	free(dict);																			\
+}																						\
+																						\
+/* pointer to the value stored for key, or NULL - valid until the next put */		\
+static inline value_t *																	\
+name##_get(name##_t *dict, key_t key)													\
+{																						\
+	long index = name##_find_slot(dict, key);											\
+	return dict->occupied[index] ? &dict->slots[index].value : NULL;					\
+}																						\
+																						\
+/* find or add key, returning its value slot; added is set if the slot is new */		\
+/* and its value uninitialized. Returns NULL only if the table is full. */			\
+static inline value_t *																	\
+name##_insert(name##_t *dict, key_t key, int *added)									\
+{																						\
+	long index = name##_find_slot(dict, key);											\
+																						\
+	*added = 0;																			\
+	if (dict->occupied[index])															\
+		return &dict->slots[index].value;												\
+																						\
+	/* grow before inserting, so the returned slot stays put */							\
+	if (capacity_needs_growth(dict->num_entries + 1, dict->max_entries, dict->load_factor)	\
+		&& (name##_rebuild_table(dict, capacity_after_growth(dict->num_entries + 1, dict->load_factor)) == 0)) {	\
+		index = name##_find_slot(dict, key);											\
+	}																					\
+	if (dict->num_entries + 1 >= dict->max_entries) {									\
+		fprintf(stderr, #name "_insert() dictionary %p is full\n", (void *)dict);		\
+		return NULL;																	\
+	}																					\
+																						\
+	dict->occupied[index] = 1;															\
+	dict->slots[index].key = key;														\
+	dict->num_entries++;																\
+	*added = 1;																			\
+	return &dict->slots[index].value;													\
+}																						\
+																						\
+/* returns 1 if the key was added, 0 if its value was replaced, -1 if full */		\
+static inline int																		\
+name##_put(name##_t *dict, key_t key, value_t value)									\
+{																						\
+	int added;																			\
+	value_t *slot = name##_insert(dict, key, &added);									\
+																						\
+	if (slot == NULL)																	\
+		return -1;																		\
+	*slot = value;																		\
+	return added;																		\
+}																						\
+																						\
+/* returns 1 and stores the value in removed (if not NULL) if key was present */		\
+static inline int																		\
+name##_remove(name##_t *dict, key_t key, value_t *removed)								\
+{																						\
+	long hole = name##_find_slot(dict, key);											\
+																						\
+	if (!dict->occupied[hole])															\
+		return 0;																		\
+	if (removed != NULL)																\
+		*removed = dict->slots[hole].value;												\
+	dict->num_entries--;																\
+																						\
+	/* shift later members of the probe sequence back into the hole */				\
+	long next = hole;																	\
+	for (;;) {																			\
+		if (++next == dict->max_entries)												\
+			next = 0;																	\
+		if (!dict->occupied[next])														\
+			break;																		\
+																						\
+		long home = (long)(hash_fn(dict->slots[next].key) % (unsigned long)dict->max_entries);	\
+		int movable = (hole <= next) ? ((home <= hole) || (home > next))				\
+									 : ((home <= hole) && (home > next));				\
+		if (movable) {																	\
+			dict->slots[hole] = dict->slots[next];										\
+			hole = next;																\
+		}																				\
+	}																					\
+	dict->occupied[hole] = 0;															\
+																						\
+	long new_size = capacity_after_shrink(dict->num_entries, dict->max_entries,			\
+		dict->min_entries, dict->load_factor);											\
+	if (new_size > 0)																	\
+		name##_rebuild_table(dict, new_size);											\
+																						\
+	return 1;																			\
+}																						\
+																						\
+static inline int																		\
+name##_reserve(name##_t *dict, long expected_entries)									\
+{																						\
+	long new_size = capacity_for_entries(expected_entries, dict->load_factor);			\
+																						\
+	if ((new_size > dict->max_entries) && (name##_rebuild_table(dict, new_size) != 0))	\
+		return -1;																		\
+	if (dict->min_entries < new_size)													\
+		dict->min_entries = new_size;													\
+	return 0;																			\
+}																						\
+																						\
+static inline void																		\
+name##_compact(name##_t *dict)															\
+{																						\
+	long new_size = capacity_for_entries(dict->num_entries, dict->load_factor);			\
+																						\
+	if ((new_size != dict->max_entries) && (name##_rebuild_table(dict, new_size) != 0))	\
+		return;																			\
+	if (dict->min_entries > dict->max_entries)											\
+		dict->min_entries = dict->max_entries;											\
+}																						\
+																						\
+static inline void																		\
+name##_enumerate(name##_t *dict, name##_enumerator_t enum_function)						\
+{																						\
+	for (long i=0; i < dict->max_entries; i++) {										\
+		if (dict->occupied[i])															\
+			enum_function(dict->slots[i].key, &dict->slots[i].value);					\
+	}																					\
+}
+
+/*
+ * The inline hash functions from hash.h, for use as hash_fn
+ */
+static inline unsigned long
+dictionary_template_hash_string(const char *str)
+{
+	return hash_string_inline(str);
+}
+
+static inline int
+dictionary_template_equal_string(const char *a, const char *b)
+{
+	return strcmp(a, b) == 0;
+}
+
+static inline unsigned long
+dictionary_template_hash_int64(unsigned long key)
+{
+	return hash_int64_inline(key);
+}
+
+static inline int
+dictionary_template_equal_int64(unsigned long a, unsigned long b)
+{
+	return a == b;
+}
+
+/*
+ * Instantiate a char * to void * dictionary - the same mapping as
+ * dictionary_t, except that keys are not copied and must outlive the entry
+ */
+#define DICTIONARY_INIT_STRING(name)													\
+	DICTIONARY_INIT(name, const char *, dict_value_t,									\
+		dictionary_template_hash_string, dictionary_template_equal_string)
+
+#endif
@@ -1,36 +1,285 @@
 /*
  * hash-input.c - read a bunch of lines from stdin, hash them, and write the combined values to stdout
  *
- * usage: hash-input [-m modulus] 
+ * usage: hash-input [-m modulus] [-t threads] [-b] [file]
+ *
+ * A file named on the command line is mapped into memory, otherwise stdin is
+ * read in large blocks. Each block is split at line boundaries into one chunk
+ * per thread, the chunks are hashed in parallel into separate output buffers,
+ * and the buffers are written in order, so the output is in input order.
+ * Lines may be any length.
+ *
+ * The default output is "hash<tab>line" for each line. With -b the output is
+ * binary: one 8-byte hash value per line in host byte order, and no text.
  *
  * 2013-12-18 Steven Wart created this file
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
-#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "hash.h"
 
-#define NUM_ENTRIES	1000
+#define BLOCK_SIZE		(16 * 1024 * 1024)	// bytes hashed between writes
+#define MAX_THREADS		64
+#define MAX_DIGITS		20					// an unsigned 64-bit value in decimal
+
+// one thread's share of a block
+typedef struct chunk_t {
+	const char *start;
+	const char *end;
+	unsigned long modulus;
+	int binary;
+	char *output;
+	size_t output_size;
+	long count;
+} chunk_t;
 
+/*
+ * Write an unsigned value in decimal, returning the number of characters written
+ */
 int
-hash_input(long modulus)
+format_unsigned(char *buffer, unsigned long value)
+{
+	char digits[MAX_DIGITS];
+	int n = 0;
+
+	do {
+		digits[n++] = '0' + (value % 10);
+		value /= 10;
+	} while (value != 0);
+
+	for (int i=0; i < n; i++)
+		buffer[i] = digits[n - 1 - i];
+
+	return n;
+}
+
+/*
+ * Hash every line in a chunk into the chunk's output buffer
+ *
+ * The chunk ends at a line boundary, or at the end of the input, where the
+ * last line may have no newline
+ */
+void *
+hash_chunk(void *arg)
+{
+	chunk_t *chunk = (chunk_t *)arg;
+	const char *line = chunk->start;
+	long lines = 0;
+
+	// memchr is vectorized by the C library, so it scans a word or more at a time
+	for (const char *p = line; p < chunk->end; p++) {
+		p = memchr(p, '\n', chunk->end - p);
+		if (p == NULL)
+			break;
+		lines++;
+	}
+	if ((chunk->end > line) && (chunk->end[-1] != '\n'))
+		lines++;
+
+	// text output is no longer than the input plus the hash and tab on each line
+	size_t capacity = chunk->binary ? (lines * sizeof(unsigned long))
+		: ((chunk->end - chunk->start) + lines * (MAX_DIGITS + 2));
+	chunk->output = malloc((capacity > 0) ? capacity : 1);
+	if (chunk->output == NULL) {
+		fprintf(stderr, "Unable to allocate %lu bytes of output\n", (unsigned long)capacity);
+		return NULL;
+	}
+
+	char *out = chunk->output;
+	while (line < chunk->end) {
+		const char *newline = memchr(line, '\n', chunk->end - line);
+		const char *line_end = (newline != NULL) ? newline : chunk->end;
+		size_t len = line_end - line;
+
+		unsigned long hash_value = hash_bytes((const unsigned char *)line, len) % chunk->modulus;
+
+		if (chunk->binary) {
+			memcpy(out, &hash_value, sizeof(unsigned long));
+			out += sizeof(unsigned long);
+		}
+		else {
+			out += format_unsigned(out, hash_value);
+			*out++ = '\t';
+			memcpy(out, line, len);
+			out += len;
+			*out++ = '\n';
+		}
+		chunk->count++;
+		line = line_end + 1;
+	}
+
+	chunk->output_size = out - chunk->output;
+	return NULL;
+}
+
+/*
+ * Hash the lines in a block, which must end at a line boundary or at the end
+ * of the input, and write the output in order
+ *
+ * Returns the number of lines, or -1 if the output could not be written
+ */
+long
+hash_block(const char *data, size_t length, unsigned long modulus, int binary, int num_threads)
 {
-	char line[256];
-
-	int count = 0;
-	while (fgets(line, 256, stdin)) {
-		size_t len = strlen(line);
-		if (len == 0)
-			continue;
-		if (line[len-1] == '\n')
-			line[--len] = '\0';
-		long hash_value = hash(line) % ((modulus > 0) ? modulus : LONG_MAX);
-		fprintf(stdout, "%lu\t%s\n", hash_value, line);
-		count++;
+	chunk_t chunks[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	int started[MAX_THREADS];
+	const char *start = data;
+	const char *end = data + length;
+
+	// split at the first newline after each equal share of the block
+	for (int i=0; i < num_threads; i++) {
+		const char *chunk_end = end;
+		if (i < num_threads - 1) {
+			chunk_end = data + (length / num_threads) * (i + 1);
+			if (chunk_end < start)
+				chunk_end = start;
+			const char *newline = memchr(chunk_end, '\n', end - chunk_end);
+			chunk_end = (newline != NULL) ? newline + 1 : end;
+		}
+		chunks[i] = (chunk_t){ start, chunk_end, modulus, binary, NULL, 0, 0 };
+		start = chunk_end;
+	}
+
+	// the calling thread hashes the first chunk itself
+	for (int i=1; i < num_threads; i++) {
+		started[i] = (pthread_create(&threads[i], NULL, &hash_chunk, &chunks[i]) == 0);
+		// carry on with the threads we have, hashing the rest here
+		if (!started[i])
+			hash_chunk(&chunks[i]);
+	}
+	hash_chunk(&chunks[0]);
+
+	long count = 0;
+	int failed = 0;
+	for (int i=0; i < num_threads; i++) {
+		if ((i > 0) && started[i])
+			pthread_join(threads[i], NULL);
+		if (chunks[i].output == NULL)
+			failed = 1;
+		else if (!failed && (fwrite(chunks[i].output, 1, chunks[i].output_size, stdout) != chunks[i].output_size))
+			failed = 1;
+		free(chunks[i].output);
+		count += chunks[i].count;
 	}
+
+	return failed ? -1 : count;
+}
+
+/*
+ * Hash a file by mapping it into memory
+ *
+ * Returns the number of lines, or -1 on error
+ */
+long
+hash_file(int fd, size_t size, unsigned long modulus, int binary, int num_threads)
+{
+	if (size == 0)
+		return 0;
+
+	char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		perror("hash-input: mmap");
+		return -1;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	long count = 0;
+	size_t offset = 0;
+	while (offset < size) {
+		size_t length = size - offset;
+		// end each block at a line boundary
+		if (length > BLOCK_SIZE) {
+			const char *newline = memchr(data + offset + BLOCK_SIZE, '\n', length - BLOCK_SIZE);
+			if (newline != NULL)
+				length = newline + 1 - (data + offset);
+		}
+		long lines = hash_block(data + offset, length, modulus, binary, num_threads);
+		if (lines < 0) {
+			count = -1;
+			break;
+		}
+		count += lines;
+		offset += length;
+	}
+
+	munmap(data, size);
+	return count;
+}
+
+/*
+ * Hash a pipe or other stream by reading it in large blocks. A line that
+ * does not fit in the block makes the block grow.
+ *
+ * Returns the number of lines, or -1 on error
+ */
+long
+hash_stream(int fd, unsigned long modulus, int binary, int num_threads)
+{
+	size_t capacity = BLOCK_SIZE;
+	size_t used = 0;
+	char *buffer = malloc(capacity);
+	long count = 0;
+	int eof = 0;
+
+	if (buffer == NULL) {
+		fprintf(stderr, "Unable to allocate %lu bytes of input\n", (unsigned long)capacity);
+		return -1;
+	}
+
+	while (!eof) {
+		while (used < capacity) {
+			ssize_t n = read(fd, buffer + used, capacity - used);
+			if (n < 0) {
+				perror("hash-input: read");
+				free(buffer);
+				return -1;
+			}
+			if (n == 0) {
+				eof = 1;
+				break;
+			}
+			used += n;
+		}
+
+		// hash up to the last complete line, and keep the partial line for the next block
+		size_t length = used;
+		if (!eof) {
+			const char *last = memrchr(buffer, '\n', used);
+			if (last == NULL) {
+				char *larger = realloc(buffer, capacity * 2);
+				if (larger == NULL) {
+					fprintf(stderr, "Unable to allocate %lu bytes for a line\n", (unsigned long)capacity * 2);
+					free(buffer);
+					return -1;
+				}
+				buffer = larger;
+				capacity *= 2;
+				continue;
+			}
+			length = last + 1 - buffer;
+		}
+
+		long lines = hash_block(buffer, length, modulus, binary, num_threads);
+		if (lines < 0) {
+			free(buffer);
+			return -1;
+		}
+		count += lines;
+		memmove(buffer, buffer + length, used - length);
+		used -= length;
+	}
+
+	free(buffer);
 	return count;
 }
 
@@ -38,20 +287,67 @@ int
 main(int argc, char **argv)
 {
 	long modulus = 0;
-	int count = 0;
-	
-	switch (argc) {
-		case 3:
-			if (strcmp(argv[1], "-m") == 0) {
-				modulus = atol(argv[2]);
-			}
-		case 1:
-			count = hash_input(modulus);
-			fprintf(stderr, "%d lines processed from input\n", count);
-			return 0;
-			// else print usage
-		default:
-			printf("usage: hash-input [-m modulus]\n");
+	int binary = 0;
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	char *filename = NULL;
+
+	for (int i=1; i < argc; i++) {
+		if ((strcmp(argv[i], "-m") == 0) && (i + 1 < argc)) {
+			modulus = atol(argv[++i]);
+		}
+		else if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc)) {
+			num_threads = atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-b") == 0) {
+			binary = 1;
+		}
+		else if ((argv[i][0] != '-') && (filename == NULL)) {
+			filename = argv[i];
+		}
+		else {
+			goto usage;
+		}
+	}
+
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > MAX_THREADS)
+		num_threads = MAX_THREADS;
+
+	// the output is written in blocks, so a large stdio buffer saves nothing
+	setvbuf(stdout, NULL, _IONBF, 0);
+
+	int fd = STDIN_FILENO;
+	if (filename != NULL) {
+		fd = open(filename, O_RDONLY);
+		if (fd < 0) {
+			perror(filename);
 			return -1;
+		}
 	}
+
+	// only regular files can be mapped, pipes are read in blocks
+	struct stat st;
+	long count;
+	unsigned long effective_modulus = (modulus > 0) ? modulus : LONG_MAX;
+	if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode))
+		count = hash_file(fd, st.st_size, effective_modulus, binary, num_threads);
+	else
+		count = hash_stream(fd, effective_modulus, binary, num_threads);
+
+	if (filename != NULL)
+		close(fd);
+
+	if (count < 0)
+		return -1;
+
+	fprintf(stderr, "%ld lines processed from input\n", count);
+	return 0;
+
+usage:
+	printf("usage: hash-input [-m modulus] [-t threads] [-b] [file]\n");
+	printf("	-m modulus	reduce each hash modulo this value\n");
+	printf("	-t threads	number of hashing threads, default is one per CPU\n");
+	printf("	-b		write 8-byte binary hash values instead of text\n");
+	return -1;
 }
@@ -23,19 +23,123 @@
  */
 
 #include <limits.h>
+#include <string.h>
 #include "hash.h"
 
 unsigned long
 hash(unsigned char *str)
 {
-    unsigned long hash = 5381;
-    long mask = LONG_MAX; // 0x7fffffffffffffff or 4026531839
+    return hash_string_inline((const char *)str);
+}
 
-    int c;
+/*
+ * The same hash as hash() for a key that is not null-terminated, such as a
+ * line in a memory-mapped file
+ */
+unsigned long
+hash_bytes(const unsigned char *data, unsigned long length)
+{
+    unsigned long hash = 5381;
+    long mask = LONG_MAX;
 
-    while ((c = *str++))
-        hash = (((hash << 5) + hash) + c) & mask; /* hash * 33 + c */
+    for (unsigned long i = 0; i < length; i++)
+        hash = (((hash << 5) + hash) + data[i]) & mask; /* hash * 33 + c */
 
     return hash;
 }
 
+
+/*
+ * 64-bit integer mixer (the finalizer from Stafford's variant 13 of MurmurHash3,
+ * as used by SplitMix64)
+ *
+ * Integer keys such as sequential IDs differ only in their low bits, and
+ * a prime modulus alone would map runs of them to runs of adjacent slots.
+ * Every input bit affects every output bit after the two multiplications.
+ */
+unsigned long
+hash_int64(unsigned long key)
+{
+    return hash_int64_inline(key);
+}
+
+
+/*
+ * SipHash-1-3 (Aumasson and Bernstein), a keyed hash
+ *
+ * djb2 is unkeyed, so anyone who can choose the keys can make them all
+ * collide. Without the 128-bit key an attacker can't predict which keys
+ * collide under SipHash. One compression round per 8-byte word and three
+ * finalization rounds is the variant used by Rust and Python for hash
+ * tables, fast enough to replace djb2 on short keys.
+ */
+
+#define ROTATE_LEFT(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIP_ROUND(v0, v1, v2, v3)                               \
+    do {                                                        \
+        v0 += v1; v1 = ROTATE_LEFT(v1, 13); v1 ^= v0; v0 = ROTATE_LEFT(v0, 32); \
+        v2 += v3; v3 = ROTATE_LEFT(v3, 16); v3 ^= v2;           \
+        v0 += v3; v3 = ROTATE_LEFT(v3, 21); v3 ^= v0;           \
+        v2 += v1; v1 = ROTATE_LEFT(v1, 17); v1 ^= v2; v2 = ROTATE_LEFT(v2, 32); \
+    } while (0)
+
+static inline unsigned long
+load_le64(const unsigned char *p)
+{
+    unsigned long word;
+
+    memcpy(&word, p, sizeof(word));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    word = __builtin_bswap64(word);
+#endif
+    return word;
+}
+
+unsigned long
+hash_siphash13(const unsigned char *data, unsigned long length, const unsigned long key[2])
+{
+    unsigned long v0 = 0x736f6d6570736575UL ^ key[0];
+    unsigned long v1 = 0x646f72616e646f6dUL ^ key[1];
+    unsigned long v2 = 0x6c7967656e657261UL ^ key[0];
+    unsigned long v3 = 0x7465646279746573UL ^ key[1];
+    const unsigned char *end = data + (length & ~7UL);
+
+    for (; data < end; data += 8) {
+        unsigned long m = load_le64(data);
+        v3 ^= m;
+        SIP_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+
+    // the last 0-7 bytes, with the length in the top byte
+    unsigned long last = length << 56;
+    switch (length & 7) {
+        case 7: last |= (unsigned long)data[6] << 48;
+            /* fall through */
+        case 6: last |= (unsigned long)data[5] << 40;
+            /* fall through */
+        case 5: last |= (unsigned long)data[4] << 32;
+            /* fall through */
+        case 4: last |= (unsigned long)data[3] << 24;
+            /* fall through */
+        case 3: last |= (unsigned long)data[2] << 16;
+            /* fall through */
+        case 2: last |= (unsigned long)data[1] << 8;
+            /* fall through */
+        case 1: last |= (unsigned long)data[0];
+            /* fall through */
+        case 0: break;
+    }
+
+    v3 ^= last;
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= last;
+
+    v2 ^= 0xff;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
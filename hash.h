@@ -8,7 +8,45 @@
 
 #define HASH_FUNCTION
 
+/*
+ * djb2 and the 64-bit integer mixer, inline for code that wants a lookup to
+ * compile down to straight-line code. hash() and hash_int64() in hash.c are
+ * these same functions.
+ */
+static inline unsigned long
+hash_string_inline(const char *str)
+{
+    unsigned long hash = 5381;
+    int c;
+
+    while ((c = (unsigned char)*str++))
+        hash = (((hash << 5) + hash) + c) & 0x7fffffffffffffffUL; /* hash * 33 + c */
+
+    return hash;
+}
+
+static inline unsigned long
+hash_int64_inline(unsigned long key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9UL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebUL;
+    key ^= key >> 31;
+
+    return key;
+}
+
 unsigned long
 hash(unsigned char *str);
 
+unsigned long
+hash_bytes(const unsigned char *data, unsigned long length);
+
+unsigned long
+hash_int64(unsigned long key);
+
+unsigned long
+hash_siphash13(const unsigned char *data, unsigned long length, const unsigned long key[2]);
+
 #endif
@@ -0,0 +1,344 @@
+/*
+ * int_dictionary.c
+ *
+ * Open addressing with linear probing over an array of inline key/value
+ * slots. Removal shifts the following entries of the probe sequence back
+ * instead of leaving tombstones, so lookups never have to skip deleted
+ * slots and the table never needs to be rebuilt just to clean up.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "int_dictionary.h"
+#include "capacity.h"
+#include "hash.h"
+
+/* ---------- private declarations ---------- */
+
+/*
+ * Resize the dictionary, rehashing all keys
+ *
+ * Returns 0 on success, or -1 if the new table could not be allocated, in
+ * which case the dictionary is left unchanged
+ *
+ * dict - dictionary to resize
+ * new_size - new size - this should be prime
+ */
+int
+int_dictionary_rebuild_table(int_dictionary_t *dict, long new_size);
+
+/*
+ * Returns the index of the slot holding key, or of the empty slot where
+ * it would be inserted
+ *
+ * dict - dictionary to search
+ * key - non-zero key
+ */
+long
+int_dictionary_find_slot(int_dictionary_t *dict, int_dict_key_t key);
+
+/*
+ * Returns the slot a key hashes to before probing
+ */
+long
+int_dictionary_home_slot(int_dictionary_t *dict, int_dict_key_t key);
+
+
+/* ---------- public definitions ---------- */
+
+/*
+ * Allocate an integer dictionary with a slot array initialized to DICT_INITIAL_SIZE
+ */
+int_dictionary_t *
+new_int_dictionary()
+{
+	return new_int_dictionary_size_load(DICT_INITIAL_SIZE, LOAD_FACTOR);
+}
+
+/*
+ * Allocate an integer dictionary with a slot array initialized to a user-defined value
+ *
+ * initial_size - this should be a prime number to help ensure good distribution
+ *
+ * load_factor - between 0 and 1.0 to resize the dictionary when its size
+ * 		exceeds this value * the current capacity of the dictionary
+ */
+int_dictionary_t *
+new_int_dictionary_size_load(long initial_size, double load_factor)
+{
+	int_dictionary_t *dict = calloc(1, sizeof(int_dictionary_t));
+
+	// linear probing needs at least one empty slot to terminate a search
+	if (load_factor >= 1.0)
+		load_factor = LOAD_FACTOR;
+	if (initial_size < DICT_INITIAL_SIZE)
+		initial_size = DICT_INITIAL_SIZE;
+
+	dict->load_factor = load_factor;
+
+	dict->max_entries = initial_size;
+	dict->min_entries = initial_size;
+	dict->slots = (int_slot_t *)calloc(initial_size, sizeof(int_slot_t));
+
+	return dict;
+}
+
+/*
+ * Free an integer dictionary created by new_int_dictionary()
+ */
+void
+free_int_dictionary(int_dictionary_t *dict)
+{
+	// values are managed by the client, and keys are stored inline
+	free(dict->slots);
+	free(dict);
+}
+
+/*
+ * Put a value into the dictionary, returning the value it replaced or NULL
+ *
+ * dict - allocated by new_int_dictionary()
+ * key - any 64-bit value
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ */
+dict_value_t
+int_dictionary_put(int_dictionary_t *dict, int_dict_key_t key, dict_value_t value)
+{
+	dict_value_t previous = NULL;
+
+	if (key == 0) {
+		if (dict->has_zero_key)
+			previous = dict->zero_value;
+		else
+			dict->num_entries++;
+		dict->has_zero_key = 1;
+		dict->zero_value = value;
+		return previous;
+	}
+
+	long index = int_dictionary_find_slot(dict, key);
+	int_slot_t *slot = &dict->slots[index];
+
+	if (slot->key == key) {
+		previous = slot->value;
+		slot->value = value;
+		return previous;
+	}
+
+	// linear probing needs an empty slot to end every search
+	if (dict->num_entries + 1 >= dict->max_entries) {
+		fprintf(stderr, "int_dictionary_put() dictionary %p is full\n", dict);
+		return NULL;
+	}
+
+	slot->key = key;
+	slot->value = value;
+	dict->num_entries++;
+
+	// if the table can't be grown we carry on with longer probe sequences
+	if (capacity_needs_growth(dict->num_entries, dict->max_entries, dict->load_factor)) {
+		int_dictionary_rebuild_table(dict, capacity_after_growth(dict->num_entries, dict->load_factor));
+	}
+
+	return previous;
+}
+
+/*
+ * Retrieve a value from the dictionary, or NULL if the key is not present
+ *
+ * dict - allocated by new_int_dictionary()
+ * key - any 64-bit value
+ */
+dict_value_t
+int_dictionary_get(int_dictionary_t *dict, int_dict_key_t key)
+{
+	if (key == 0)
+		return dict->has_zero_key ? dict->zero_value : NULL;
+
+	int_slot_t *slot = &dict->slots[int_dictionary_find_slot(dict, key)];
+
+	return (slot->key == key) ? slot->value : NULL;
+}
+
+/*
+ * Remove an entry from the dictionary. The value at the key will be
+ * returned.
+ *
+ * dict - allocated by new_int_dictionary()
+ * key - any 64-bit value
+ */
+dict_value_t
+int_dictionary_remove(int_dictionary_t *dict, int_dict_key_t key)
+{
+	dict_value_t value = NULL;
+
+	if (key == 0) {
+		if (!dict->has_zero_key)
+			return NULL;
+		value = dict->zero_value;
+		dict->has_zero_key = 0;
+		dict->zero_value = NULL;
+		dict->num_entries--;
+		return value;
+	}
+
+	long hole = int_dictionary_find_slot(dict, key);
+	if (dict->slots[hole].key != key)
+		return NULL;
+
+	value = dict->slots[hole].value;
+	dict->num_entries--;
+
+	// shift later members of the probe sequence back into the hole, unless
+	// that would move an entry in front of the slot it hashes to
+	long next = hole;
+	for (;;) {
+		next = (next + 1) % dict->max_entries;
+		int_slot_t *slot = &dict->slots[next];
+		if (slot->key == 0)
+			break;
+
+		long home = int_dictionary_home_slot(dict, slot->key);
+		int movable = (hole <= next) ? ((home <= hole) || (home > next))
+									 : ((home <= hole) && (home > next));
+		if (movable) {
+			dict->slots[hole] = *slot;
+			hole = next;
+		}
+	}
+	dict->slots[hole].key = 0;
+	dict->slots[hole].value = NULL;
+
+	long new_size = capacity_after_shrink(dict->num_entries, dict->max_entries,
+		dict->min_entries, dict->load_factor);
+	if (new_size > 0)
+		int_dictionary_rebuild_table(dict, new_size);
+
+	return value;
+}
+
+/*
+ * Size the dictionary so that it can hold expected_entries without
+ * resizing. Returns 0 on success, or -1 if the table could not be allocated
+ *
+ * dict - allocated by new_int_dictionary()
+ * expected_entries - number of entries the dictionary will hold
+ */
+int
+int_dictionary_reserve(int_dictionary_t *dict, long expected_entries)
+{
+	long new_size = capacity_for_entries(expected_entries, dict->load_factor);
+
+	if (new_size > dict->max_entries) {
+		if (int_dictionary_rebuild_table(dict, new_size) != 0)
+			return -1;
+	}
+
+	if (dict->min_entries < new_size)
+		dict->min_entries = new_size;
+
+	return 0;
+}
+
+/*
+ * Rebuild the dictionary at the smallest capacity that holds the current
+ * entries within the load factor
+ *
+ * dict - dictionary to compact
+ */
+void
+int_dictionary_compact(int_dictionary_t *dict)
+{
+	long new_size = capacity_for_entries(dict->num_entries, dict->load_factor);
+
+	if ((new_size != dict->max_entries) && (int_dictionary_rebuild_table(dict, new_size) != 0))
+		return;
+
+	// an explicit compaction also lowers the floor for automatic shrinking
+	if (dict->min_entries > dict->max_entries)
+		dict->min_entries = dict->max_entries;
+}
+
+/*
+ * For each key/value pair in the dictionary, execute the enumeration function.
+ *
+ * dict - dictionary to enumerate
+ * enum_function - function returning void that takes key, value as arguments
+ */
+void
+int_dictionary_enumerate(int_dictionary_t *dict, int_dictionary_enumerator_t enum_function)
+{
+	if (dict->has_zero_key)
+		enum_function(0, dict->zero_value);
+
+	for (long i=0; i < dict->max_entries; i++) {
+		int_slot_t *slot = &dict->slots[i];
+		if (slot->key != 0)
+			enum_function(slot->key, slot->value);
+	}
+}
+
+/* --- private functions --- */
+
+/*
+ * Resize the dictionary, rehashing all keys
+ *
+ * Returns 0 on success, or -1 if the new table could not be allocated, in
+ * which case the dictionary is left unchanged
+ *
+ * dict - dictionary to resize
+ * new_size - new size - this should be prime
+ */
+int
+int_dictionary_rebuild_table(int_dictionary_t *dict, long new_size)
+{
+	int_slot_t *new_slots = (int_slot_t *)calloc(new_size, sizeof(int_slot_t));
+
+	if (new_slots == NULL) {
+		fprintf(stderr, "Unable to allocate %lu slots to resize dictionary %p\n", new_size, dict);
+		return -1;
+	}
+
+	int_slot_t *old_slots = dict->slots;
+	long old_size = dict->max_entries;
+
+	dict->slots = new_slots;
+	dict->max_entries = new_size;
+
+	for (long i=0; i < old_size; i++) {
+		if (old_slots[i].key != 0)
+			new_slots[int_dictionary_find_slot(dict, old_slots[i].key)] = old_slots[i];
+	}
+
+	free(old_slots);
+	return 0;
+}
+
+/*
+ * Returns the index of the slot holding key, or of the empty slot where
+ * it would be inserted
+ *
+ * dict - dictionary to search
+ * key - non-zero key
+ */
+long
+int_dictionary_find_slot(int_dictionary_t *dict, int_dict_key_t key)
+{
+	long index = int_dictionary_home_slot(dict, key);
+
+	while ((dict->slots[index].key != key) && (dict->slots[index].key != 0)) {
+		if (++index == dict->max_entries)
+			index = 0;
+	}
+	return index;
+}
+
+/*
+ * Returns the slot a key hashes to before probing
+ */
+long
+int_dictionary_home_slot(int_dictionary_t *dict, int_dict_key_t key)
+{
+	return hash_int64(key) % dict->max_entries;
+}
@@ -0,0 +1,127 @@
+/*
+ * int_dictionary.h - dictionary specialized for 64-bit integer keys
+ *
+ * Keys are stored inline in the slot array, so there is no key allocation,
+ * no string hashing and no string comparison. Collisions are resolved by
+ * linear probing instead of collision buckets, which keeps every probe in
+ * the same array. The table is sized by the same policy as dictionary_t
+ * (see capacity.h).
+ */
+
+#ifndef INT_DICTIONARY
+
+#define INT_DICTIONARY
+
+#include <stdint.h>
+
+#include "dictionary.h"
+
+typedef uint64_t int_dict_key_t;
+
+#if __has_extension(blocks)
+// Use blocks instead of function pointers if we have them
+typedef void (^ int_dictionary_enumerator_t) (int_dict_key_t, dict_value_t);
+#else
+// Define a function returning void that takes key, value as arguments
+// to be passed as the second argument to int_dictionary_enumerate()
+typedef void (* int_dictionary_enumerator_t) (int_dict_key_t, dict_value_t);
+#endif
+
+// a slot whose key is 0 is empty - the entry for key 0 itself is kept
+// in the dictionary header (has_zero_key, zero_value)
+typedef struct int_slot_t {
+	int_dict_key_t key;
+	dict_value_t value;
+} int_slot_t;
+
+typedef struct int_dictionary_t {
+	long num_entries;
+	long max_entries;
+	long min_entries;		// automatic shrinking stops at this size
+	int_slot_t *slots;
+	int has_zero_key;
+	dict_value_t zero_value;
+	double load_factor;
+} int_dictionary_t;
+
+/*
+ * Allocate an integer dictionary with a slot array initialized to DICT_INITIAL_SIZE
+ */
+int_dictionary_t *
+new_int_dictionary();
+
+/*
+ * Allocate an integer dictionary with a slot array initialized to a user-defined value
+ *
+ * initial_size - this should be a prime number to help ensure good distribution
+ *
+ * load_factor - between 0 and 1.0 to resize the dictionary when its size
+ * 		exceeds this value * the current capacity of the dictionary
+ */
+int_dictionary_t *
+new_int_dictionary_size_load(long initial_size, double load_factor);
+
+/*
+ * Free an integer dictionary created by new_int_dictionary()
+ */
+void
+free_int_dictionary(int_dictionary_t *dict);
+
+/*
+ * Put a value into the dictionary, returning the value it replaced or NULL
+ *
+ * dict - allocated by new_int_dictionary()
+ * key - any 64-bit value
+ * value - void pointer (or 64-bit value) - must be managed by caller
+ */
+dict_value_t
+int_dictionary_put(int_dictionary_t *dict, int_dict_key_t key, dict_value_t value);
+
+/*
+ * Retrieve a value from the dictionary, or NULL if the key is not present
+ *
+ * dict - allocated by new_int_dictionary()
+ * key - any 64-bit value
+ */
+dict_value_t
+int_dictionary_get(int_dictionary_t *dict, int_dict_key_t key);
+
+/*
+ * Remove an entry from the dictionary. The value at the key will be
+ * returned.
+ *
+ * dict - allocated by new_int_dictionary()
+ * key - any 64-bit value
+ */
+dict_value_t
+int_dictionary_remove(int_dictionary_t *dict, int_dict_key_t key);
+
+/*
+ * Size the dictionary so that it can hold expected_entries without
+ * resizing. Returns 0 on success, or -1 if the table could not be allocated
+ *
+ * dict - allocated by new_int_dictionary()
+ * expected_entries - number of entries the dictionary will hold
+ */
+int
+int_dictionary_reserve(int_dictionary_t *dict, long expected_entries);
+
+/*
+ * Rebuild the dictionary at the smallest capacity that holds the current
+ * entries within the load factor
+ *
+ * dict - dictionary to compact
+ */
+void
+int_dictionary_compact(int_dictionary_t *dict);
+
+/*
+ * For each key/value pair in the dictionary, execute the enumeration function.
+ *
+ * dict - dictionary to enumerate
+ * enum_function - function returning void that takes key, value as arguments
+ */
+void
+int_dictionary_enumerate(int_dictionary_t *dict, int_dictionary_enumerator_t enum_function);
+
+#endif
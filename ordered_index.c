@@ -0,0 +1,439 @@
+/*
+ * ordered_index.c
+ *
+ * A classic B-tree, every key is stored exactly once, in a leaf or as a
+ * separator in an internal node. Keys are pointers owned by the dictionary,
+ * so a separator can't be a copy of a key that has since been deleted.
+ *
+ * Insertion splits full nodes on the way down and deletion tops up nodes
+ * with the minimum number of keys on the way down, so neither has to walk
+ * back up the tree.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "ordered_index.h"
+
+#define DEGREE ORDERED_INDEX_DEGREE
+
+/* ---------- private declarations ---------- */
+
+/*
+ * Allocate a node with no keys, leaves have no room for children
+ */
+ordered_index_node_t *
+ordered_index_new_node(int leaf);
+
+/*
+ * Free a node and all of its descendants
+ */
+void
+ordered_index_free_node(ordered_index_node_t *node);
+
+/*
+ * Returns the position of the first key in a node that is not less than key,
+ * and sets found if it is equal
+ */
+int
+ordered_index_lower_bound(ordered_index_node_t *node, const char *key, int *found);
+
+/*
+ * Split the full child at position i of a node that is not full, moving its
+ * middle key up into the node
+ *
+ * Returns 0 on success, or -1 if the new node could not be allocated
+ */
+int
+ordered_index_split_child(ordered_index_node_t *node, int i);
+
+/*
+ * Merge the child at position i, the separator key i and the child at
+ * position i+1 into the child at position i
+ */
+void
+ordered_index_merge_children(ordered_index_node_t *node, int i);
+
+/*
+ * Move one key from the child at position i into the child at position i+1
+ * through separator key i
+ */
+void
+ordered_index_rotate_right(ordered_index_node_t *node, int i);
+
+/*
+ * Move one key from the child at position i+1 into the child at position i
+ * through separator key i
+ */
+void
+ordered_index_rotate_left(ordered_index_node_t *node, int i);
+
+/*
+ * Visit the keys of a subtree in order, starting with the first that is not
+ * less than from, returns 1 if visit stopped the scan
+ */
+int
+ordered_index_scan_node(ordered_index_node_t *node, const char *from, ordered_index_visit_t visit,
+	void *context);
+
+
+/* ---------- public definitions ---------- */
+
+/*
+ * Allocate an empty index, or return NULL if it could not be allocated
+ */
+ordered_index_t *
+new_ordered_index()
+{
+	return calloc(1, sizeof(ordered_index_t));
+}
+
+/*
+ * Free an index created by new_ordered_index(), but not its keys
+ */
+void
+free_ordered_index(ordered_index_t *index)
+{
+	if (index->root != NULL)
+		ordered_index_free_node(index->root);
+	free(index);
+}
+
+/*
+ * Add a key that is not already in the index
+ *
+ * Returns 0 on success, or -1 if a node could not be allocated, in which
+ * case the index is unchanged
+ */
+int
+ordered_index_insert(ordered_index_t *index, char *key)
+{
+	if (index->root == NULL) {
+		index->root = ordered_index_new_node(1);
+		if (index->root == NULL)
+			return -1;
+	}
+
+	// a full root is split first, which is the only way the tree gets taller
+	if (index->root->num_keys == ORDERED_INDEX_MAX_KEYS) {
+		ordered_index_node_t *root = ordered_index_new_node(0);
+		if (root == NULL)
+			return -1;
+		root->children[0] = index->root;
+		if (ordered_index_split_child(root, 0) != 0) {
+			free(root);
+			return -1;
+		}
+		index->root = root;
+	}
+
+	ordered_index_node_t *node = index->root;
+	for (;;) {
+		int found;
+		int i = ordered_index_lower_bound(node, key, &found);
+		if (found)
+			return 0;
+
+		if (node->leaf) {
+			memmove(&node->keys[i + 1], &node->keys[i], sizeof(char *) * (node->num_keys - i));
+			node->keys[i] = key;
+			node->num_keys++;
+			index->num_keys++;
+			return 0;
+		}
+
+		// split a full child before entering it, so there is room for its middle key here
+		if (node->children[i]->num_keys == ORDERED_INDEX_MAX_KEYS) {
+			if (ordered_index_split_child(node, i) != 0)
+				return -1;
+			int order = strcmp(key, node->keys[i]);
+			if (order == 0)
+				return 0;
+			if (order > 0)
+				i++;
+		}
+		node = node->children[i];
+	}
+}
+
+/*
+ * Remove a key, returns 1 if it was found and 0 if not
+ */
+int
+ordered_index_delete(ordered_index_t *index, const char *key)
+{
+	ordered_index_node_t *node = index->root;
+	int removed = 0;
+
+	while ((node != NULL) && !removed) {
+		int found;
+		int i = ordered_index_lower_bound(node, key, &found);
+
+		if (node->leaf) {
+			if (found) {
+				memmove(&node->keys[i], &node->keys[i + 1], sizeof(char *) * (node->num_keys - i - 1));
+				node->num_keys--;
+				removed = 1;
+			}
+			break;
+		}
+
+		if (found) {
+			// replace the separator with its predecessor or successor from a
+			// child that can spare a key, then delete that key from the child
+			ordered_index_node_t *left = node->children[i];
+			ordered_index_node_t *right = node->children[i + 1];
+			if (left->num_keys >= DEGREE) {
+				ordered_index_node_t *last = left;
+				while (!last->leaf)
+					last = last->children[last->num_keys];
+				key = node->keys[i] = last->keys[last->num_keys - 1];
+				node = left;
+			}
+			else if (right->num_keys >= DEGREE) {
+				ordered_index_node_t *first = right;
+				while (!first->leaf)
+					first = first->children[0];
+				key = node->keys[i] = first->keys[0];
+				node = right;
+			}
+			else {
+				ordered_index_merge_children(node, i);
+				node = left;
+			}
+			continue;
+		}
+
+		// the key can only be below child i, which must have a key to spare
+		// before we enter it
+		if (node->children[i]->num_keys < DEGREE) {
+			if ((i > 0) && (node->children[i - 1]->num_keys >= DEGREE)) {
+				ordered_index_rotate_right(node, i - 1);
+			}
+			else if ((i < node->num_keys) && (node->children[i + 1]->num_keys >= DEGREE)) {
+				ordered_index_rotate_left(node, i);
+			}
+			else if (i < node->num_keys) {
+				ordered_index_merge_children(node, i);
+			}
+			else {
+				ordered_index_merge_children(node, i - 1);
+				i--;
+			}
+		}
+		node = node->children[i];
+	}
+
+	// a merge can take the root's last key, its only child becomes the root
+	ordered_index_node_t *root = index->root;
+	if ((root != NULL) && (root->num_keys == 0)) {
+		index->root = root->leaf ? NULL : root->children[0];
+		free(root);
+	}
+
+	if (removed)
+		index->num_keys--;
+	return removed;
+}
+
+/*
+ * Visit the keys in order, starting with the first that is not less than
+ * from, until visit returns nonzero or the keys run out. The index must not
+ * be changed during the scan.
+ *
+ * Returns 1 if the scan was stopped by visit, 0 if it ran out of keys
+ *
+ * from - first key to visit, or NULL to start with the smallest key
+ */
+int
+ordered_index_scan(ordered_index_t *index, const char *from, ordered_index_visit_t visit, void *context)
+{
+	if (index->root == NULL)
+		return 0;
+	return ordered_index_scan_node(index->root, from, visit, context);
+}
+
+/* --- private functions --- */
+
+/*
+ * Allocate a node with no keys, leaves have no room for children
+ */
+ordered_index_node_t *
+ordered_index_new_node(int leaf)
+{
+	size_t size = sizeof(ordered_index_node_t);
+	if (!leaf)
+		size += sizeof(ordered_index_node_t *) * (ORDERED_INDEX_MAX_KEYS + 1);
+	ordered_index_node_t *node = malloc(size);
+
+	if (node == NULL) {
+		fprintf(stderr, "Unable to allocate %lu bytes for an index node\n", (unsigned long)size);
+		return NULL;
+	}
+	node->num_keys = 0;
+	node->leaf = leaf;
+	return node;
+}
+
+/*
+ * Free a node and all of its descendants
+ */
+void
+ordered_index_free_node(ordered_index_node_t *node)
+{
+	if (!node->leaf) {
+		for (int i=0; i <= node->num_keys; i++)
+			ordered_index_free_node(node->children[i]);
+	}
+	free(node);
+}
+
+/*
+ * Returns the position of the first key in a node that is not less than key,
+ * and sets found if it is equal
+ */
+int
+ordered_index_lower_bound(ordered_index_node_t *node, const char *key, int *found)
+{
+	int low = 0;
+	int high = node->num_keys;
+
+	*found = 0;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		int order = strcmp(node->keys[middle], key);
+		if (order < 0) {
+			low = middle + 1;
+		}
+		else {
+			if (order == 0)
+				*found = 1;
+			high = middle;
+		}
+	}
+	return low;
+}
+
+/*
+ * Split the full child at position i of a node that is not full, moving its
+ * middle key up into the node
+ *
+ * Returns 0 on success, or -1 if the new node could not be allocated
+ */
+int
+ordered_index_split_child(ordered_index_node_t *node, int i)
+{
+	ordered_index_node_t *child = node->children[i];
+	ordered_index_node_t *sibling = ordered_index_new_node(child->leaf);
+	if (sibling == NULL)
+		return -1;
+
+	// the upper DEGREE-1 keys move to the new sibling, the middle key moves up
+	sibling->num_keys = DEGREE - 1;
+	memcpy(sibling->keys, &child->keys[DEGREE], sizeof(char *) * (DEGREE - 1));
+	if (!child->leaf)
+		memcpy(sibling->children, &child->children[DEGREE], sizeof(ordered_index_node_t *) * DEGREE);
+	child->num_keys = DEGREE - 1;
+
+	memmove(&node->keys[i + 1], &node->keys[i], sizeof(char *) * (node->num_keys - i));
+	memmove(&node->children[i + 2], &node->children[i + 1],
+		sizeof(ordered_index_node_t *) * (node->num_keys - i));
+	node->keys[i] = child->keys[DEGREE - 1];
+	node->children[i + 1] = sibling;
+	node->num_keys++;
+	return 0;
+}
+
+/*
+ * Merge the child at position i, the separator key i and the child at
+ * position i+1 into the child at position i
+ */
+void
+ordered_index_merge_children(ordered_index_node_t *node, int i)
+{
+	ordered_index_node_t *left = node->children[i];
+	ordered_index_node_t *right = node->children[i + 1];
+
+	left->keys[left->num_keys] = node->keys[i];
+	memcpy(&left->keys[left->num_keys + 1], right->keys, sizeof(char *) * right->num_keys);
+	if (!left->leaf) {
+		memcpy(&left->children[left->num_keys + 1], right->children,
+			sizeof(ordered_index_node_t *) * (right->num_keys + 1));
+	}
+	left->num_keys += right->num_keys + 1;
+	free(right);
+
+	memmove(&node->keys[i], &node->keys[i + 1], sizeof(char *) * (node->num_keys - i - 1));
+	memmove(&node->children[i + 1], &node->children[i + 2],
+		sizeof(ordered_index_node_t *) * (node->num_keys - i - 1));
+	node->num_keys--;
+}
+
+/*
+ * Move one key from the child at position i into the child at position i+1
+ * through separator key i
+ */
+void
+ordered_index_rotate_right(ordered_index_node_t *node, int i)
+{
+	ordered_index_node_t *left = node->children[i];
+	ordered_index_node_t *right = node->children[i + 1];
+
+	memmove(&right->keys[1], right->keys, sizeof(char *) * right->num_keys);
+	right->keys[0] = node->keys[i];
+	if (!right->leaf) {
+		memmove(&right->children[1], right->children, sizeof(ordered_index_node_t *) * (right->num_keys + 1));
+		right->children[0] = left->children[left->num_keys];
+	}
+	right->num_keys++;
+
+	node->keys[i] = left->keys[left->num_keys - 1];
+	left->num_keys--;
+}
+
+/*
+ * Move one key from the child at position i+1 into the child at position i
+ * through separator key i
+ */
+void
+ordered_index_rotate_left(ordered_index_node_t *node, int i)
+{
+	ordered_index_node_t *left = node->children[i];
+	ordered_index_node_t *right = node->children[i + 1];
+
+	left->keys[left->num_keys] = node->keys[i];
+	if (!left->leaf)
+		left->children[left->num_keys + 1] = right->children[0];
+	left->num_keys++;
+
+	node->keys[i] = right->keys[0];
+	memmove(right->keys, &right->keys[1], sizeof(char *) * (right->num_keys - 1));
+	if (!right->leaf)
+		memmove(right->children, &right->children[1], sizeof(ordered_index_node_t *) * right->num_keys);
+	right->num_keys--;
+}
+
+/*
+ * Visit the keys of a subtree in order, starting with the first that is not
+ * less than from, returns 1 if visit stopped the scan
+ */
+int
+ordered_index_scan_node(ordered_index_node_t *node, const char *from, ordered_index_visit_t visit,
+	void *context)
+{
+	int found = 0;
+	int start = (from != NULL) ? ordered_index_lower_bound(node, from, &found) : 0;
+
+	for (int i=start; i <= node->num_keys; i++) {
+		// only the first child can hold keys less than from, and not even
+		// that one if from was found here
+		if (!node->leaf && !((i == start) && found)) {
+			if (ordered_index_scan_node(node->children[i], (i == start) ? from : NULL, visit, context))
+				return 1;
+		}
+		if ((i < node->num_keys) && visit(node->keys[i], context))
+			return 1;
+	}
+	return 0;
+}
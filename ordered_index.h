@@ -0,0 +1,75 @@
+/*
+ * ordered_index.h - B-tree of key pointers kept in string order
+ *
+ * The index does not own or copy its keys, it holds the same pointers as the
+ * dictionary it belongs to and orders them with strcmp(). A key must be
+ * deleted from the index before it is freed.
+ *
+ * Nodes are wide so that the tree stays shallow: with up to 31 keys per
+ * node a million keys are four levels deep. Leaves, which hold most of the
+ * keys, are allocated without the child pointers.
+ */
+
+#ifndef ORDERED_INDEX
+
+#define ORDERED_INDEX
+
+#define ORDERED_INDEX_DEGREE	16		// every node but the root has at least DEGREE-1 keys
+#define ORDERED_INDEX_MAX_KEYS	(2 * ORDERED_INDEX_DEGREE - 1)
+
+typedef struct ordered_index_node_t {
+	int num_keys;
+	int leaf;
+	char *keys[ORDERED_INDEX_MAX_KEYS];
+	struct ordered_index_node_t *children[];	// MAX_KEYS+1 in internal nodes, none in leaves
+} ordered_index_node_t;
+
+typedef struct ordered_index_t {
+	ordered_index_node_t *root;
+	long num_keys;
+} ordered_index_t;
+
+// Called with each key visited by ordered_index_scan(), returns nonzero to
+// stop the scan
+typedef int (* ordered_index_visit_t) (char *key, void *context);
+
+/*
+ * Allocate an empty index, or return NULL if it could not be allocated
+ */
+ordered_index_t *
+new_ordered_index();
+
+/*
+ * Free an index created by new_ordered_index(), but not its keys
+ */
+void
+free_ordered_index(ordered_index_t *index);
+
+/*
+ * Add a key that is not already in the index
+ *
+ * Returns 0 on success, or -1 if a node could not be allocated, in which
+ * case the index is unchanged
+ */
+int
+ordered_index_insert(ordered_index_t *index, char *key);
+
+/*
+ * Remove a key, returns 1 if it was found and 0 if not
+ */
+int
+ordered_index_delete(ordered_index_t *index, const char *key);
+
+/*
+ * Visit the keys in order, starting with the first that is not less than
+ * from, until visit returns nonzero or the keys run out. The index must not
+ * be changed during the scan.
+ *
+ * Returns 1 if the scan was stopped by visit, 0 if it ran out of keys
+ *
+ * from - first key to visit, or NULL to start with the smallest key
+ */
+int
+ordered_index_scan(ordered_index_t *index, const char *from, ordered_index_visit_t visit, void *context);
+
+#endif
@@ -0,0 +1,581 @@
+/*
+ * partitioned_dictionary.c
+ *
+ * The spill files are chosen by the high bits of the hash and the slots of
+ * a partition by the low bits, so the keys of one partition still spread
+ * over all of its slots. The partitions have at least twice as many slots
+ * as entries, which keeps linear probes short without storing chains.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "partitioned_dictionary.h"
+#include "hash.h"
+
+#define DICT_PARTITION_MAGIC	"DICTPRT1"
+#define DICT_MANIFEST_MAGIC		"DICTMAN1"
+#define DICT_PARTITION_HEADER	32		// magic, entries, slots, data size
+#define DICT_PARTITION_SLOT		16		// hash, offset
+#define DICT_PARTITION_ENTRY	12		// value, key length
+
+/* ---------- private declarations ---------- */
+
+/*
+ * Returns a newly allocated path for a file in directory, with a name
+ * formatted from name and number
+ */
+char *
+partition_path(const char *directory, const char *name, int number);
+
+/*
+ * Returns the hash of a key in a partitioned dictionary with the given seed
+ */
+unsigned long
+partition_hash(const char *key, size_t length, const unsigned long seed[2]);
+
+/*
+ * Returns the number of slots in a partition of num_entries entries, the
+ * power of two giving at least two slots per entry
+ */
+uint64_t
+partition_num_slots(long num_entries);
+
+/*
+ * Returns the estimated bytes a partition takes while it is built: the
+ * keys, the dictionary entries holding them and the slots partition_write()
+ * allocates
+ */
+size_t
+partition_memory_estimate(long num_keys, size_t key_bytes);
+
+/*
+ * Load the spill files first to last into a dictionary, later values
+ * replacing earlier ones
+ *
+ * Returns 0 on success, or -1 if a spill file could not be read
+ */
+int
+partition_load_spills(partition_builder_t *builder, int first, int last, dictionary_t *dict);
+
+/*
+ * Write the entries of a dictionary as a partition file
+ *
+ * Returns 0 on success, or -1 if the file could not be written
+ */
+int
+partition_write(const char *path, dictionary_t *dict, const unsigned long seed[2]);
+
+/*
+ * Map a partition file and check its header
+ *
+ * Returns 0 on success, or -1 if the file could not be mapped or is not a partition
+ */
+int
+partition_map(partitioned_dictionary_t *dict, int number);
+
+
+/* ---------- public definitions ---------- */
+
+/*
+ * Start building a partitioned dictionary in a directory, which must exist
+ *
+ * Returns the builder, or NULL if it could not be allocated
+ *
+ * directory - receives the spill files while building, then the partitions
+ * memory_budget - bytes a partition may take while it is built, estimated
+ * 		from its keys; a spill file larger than this becomes a partition of
+ * 		its own anyway
+ */
+partition_builder_t *
+new_partition_builder(const char *directory, size_t memory_budget)
+{
+	partition_builder_t *builder = calloc(1, sizeof(partition_builder_t));
+
+	if (builder == NULL) {
+		fprintf(stderr, "Unable to allocate a partition builder\n");
+		return NULL;
+	}
+	builder->directory = strdup(directory);
+	builder->memory_budget = memory_budget;
+	dictionary_random_seed(builder->seed);
+
+	return builder;
+}
+
+/*
+ * Append a key and value to the spill file for the key's hash
+ *
+ * Returns 0 on success, or -1 if the spill file could not be written
+ *
+ * builder - allocated by new_partition_builder()
+ * key - null-terminated string
+ * value - stored as a 64-bit integer
+ */
+int
+partition_builder_add(partition_builder_t *builder, const char *key, dict_value_t value)
+{
+	uint32_t length = strlen(key);
+	uint64_t value_bits = (uint64_t)value;
+	int spill = partition_hash(key, length, builder->seed) >> (64 - DICT_PARTITION_BITS);
+
+	if (builder->spills[spill] == NULL) {
+		char *path = partition_path(builder->directory, "spill-%03d", spill);
+		builder->spills[spill] = fopen(path, "wb");
+		if (builder->spills[spill] == NULL) {
+			perror(path);
+			free(path);
+			return -1;
+		}
+		free(path);
+	}
+
+	FILE *file = builder->spills[spill];
+	if ((fwrite(&length, sizeof(length), 1, file) != 1) || (fwrite(key, 1, length, file) != length)
+		|| (fwrite(&value_bits, sizeof(value_bits), 1, file) != 1)) {
+		fprintf(stderr, "Unable to write spill file %d\n", spill);
+		return -1;
+	}
+	builder->spill_keys[spill]++;
+	builder->spill_bytes[spill] += length + 1;
+	builder->num_keys++;
+
+	return 0;
+}
+
+/*
+ * Build and write the partitions from the spill files, then remove the
+ * spill files and free the builder
+ *
+ * Returns the number of partitions written, or -1 if a partition could not
+ * be built or written
+ *
+ * builder - allocated by new_partition_builder(), freed either way
+ */
+int
+partition_builder_finish(partition_builder_t *builder)
+{
+	int spill_partition[DICT_PARTITION_SPILLS];
+	int num_partitions = 0;
+	uint64_t num_entries = 0;
+	int failed = 0;
+
+	for (int i=0; i < DICT_PARTITION_SPILLS; i++) {
+		if ((builder->spills[i] != NULL) && (fclose(builder->spills[i]) != 0)) {
+			fprintf(stderr, "Unable to write spill file %d\n", i);
+			failed = 1;
+		}
+		builder->spills[i] = NULL;
+	}
+
+	// group adjacent spill files while their estimated size fits the budget
+	for (int first=0; (first < DICT_PARTITION_SPILLS) && !failed; ) {
+		int last = first;
+		long keys = builder->spill_keys[first];
+		size_t key_bytes = builder->spill_bytes[first];
+		while (last + 1 < DICT_PARTITION_SPILLS) {
+			long more_keys = keys + builder->spill_keys[last + 1];
+			size_t more_bytes = key_bytes + builder->spill_bytes[last + 1];
+			if (partition_memory_estimate(more_keys, more_bytes) > builder->memory_budget)
+				break;
+			keys = more_keys;
+			key_bytes = more_bytes;
+			last++;
+		}
+
+		dictionary_t *dict = new_dictionary();
+		if ((dict == NULL) || (dictionary_reserve(dict, keys) != 0)) {
+			fprintf(stderr, "Unable to allocate a dictionary for %ld keys\n", keys);
+			if (dict != NULL)
+				free_dictionary(dict);
+			failed = 1;
+			break;
+		}
+
+		char *path = partition_path(builder->directory, "partition-%03d", num_partitions);
+		failed = (partition_load_spills(builder, first, last, dict) != 0)
+			|| (partition_write(path, dict, builder->seed) != 0);
+		free(path);
+
+		num_entries += dict->num_entries;
+		free_dictionary(dict);
+
+		for (int i=first; i <= last; i++)
+			spill_partition[i] = num_partitions;
+		num_partitions++;
+		first = last + 1;
+	}
+
+	// the manifest is written last, so a directory holding one has a complete build
+	if (!failed) {
+		char *path = partition_path(builder->directory, "partitions", 0);
+		FILE *manifest = fopen(path, "wb");
+		uint32_t count = num_partitions;
+		uint32_t table[DICT_PARTITION_SPILLS];
+		for (int i=0; i < DICT_PARTITION_SPILLS; i++)
+			table[i] = spill_partition[i];
+		failed = (manifest == NULL)
+			|| (fwrite(DICT_MANIFEST_MAGIC, 8, 1, manifest) != 1)
+			|| (fwrite(builder->seed, sizeof(builder->seed), 1, manifest) != 1)
+			|| (fwrite(&num_entries, sizeof(num_entries), 1, manifest) != 1)
+			|| (fwrite(&count, sizeof(count), 1, manifest) != 1)
+			|| (fwrite(table, sizeof(table), 1, manifest) != 1);
+		if ((manifest != NULL) && (fclose(manifest) != 0))
+			failed = 1;
+		if (failed) {
+			perror(path);
+			unlink(path);
+		}
+		free(path);
+	}
+
+	free_partition_builder(builder);
+	return failed ? -1 : num_partitions;
+}
+
+/*
+ * Remove the spill files and free a builder without building anything
+ */
+void
+free_partition_builder(partition_builder_t *builder)
+{
+	for (int i=0; i < DICT_PARTITION_SPILLS; i++) {
+		if (builder->spills[i] != NULL)
+			fclose(builder->spills[i]);
+		if (builder->spill_keys[i] > 0) {
+			char *path = partition_path(builder->directory, "spill-%03d", i);
+			unlink(path);
+			free(path);
+		}
+	}
+	free(builder->directory);
+	free(builder);
+}
+
+/*
+ * Open a partitioned dictionary built by partition_builder_finish(). The
+ * partitions are mapped as lookups need them.
+ *
+ * Returns the dictionary, or NULL if the directory holds no complete build
+ */
+partitioned_dictionary_t *
+open_partitioned_dictionary(const char *directory)
+{
+	char *path = partition_path(directory, "partitions", 0);
+	FILE *manifest = fopen(path, "rb");
+	char magic[8];
+	uint64_t num_entries;
+	uint32_t count;
+	uint32_t table[DICT_PARTITION_SPILLS];
+	partitioned_dictionary_t *dict = calloc(1, sizeof(partitioned_dictionary_t));
+
+	if ((manifest == NULL) || (dict == NULL)
+		|| (fread(magic, 8, 1, manifest) != 1) || (memcmp(magic, DICT_MANIFEST_MAGIC, 8) != 0)
+		|| (fread(dict->seed, sizeof(dict->seed), 1, manifest) != 1)
+		|| (fread(&num_entries, sizeof(num_entries), 1, manifest) != 1)
+		|| (fread(&count, sizeof(count), 1, manifest) != 1)
+		|| (fread(table, sizeof(table), 1, manifest) != 1)) {
+		fprintf(stderr, "Unable to read a partitioned dictionary from %s\n", path);
+		if (manifest != NULL)
+			fclose(manifest);
+		free(dict);
+		free(path);
+		return NULL;
+	}
+	fclose(manifest);
+	free(path);
+
+	dict->directory = strdup(directory);
+	dict->num_partitions = count;
+	dict->num_entries = num_entries;
+	dict->partitions = calloc(count, sizeof(partition_t));
+	for (int i=0; i < DICT_PARTITION_SPILLS; i++)
+		dict->spill_partition[i] = (table[i] < count) ? table[i] : 0;
+
+	return dict;
+}
+
+/*
+ * Returns the value of a key, or NULL if the key is not in the dictionary
+ * or its partition could not be mapped
+ *
+ * dict - opened by open_partitioned_dictionary()
+ * key - null-terminated string
+ */
+dict_value_t
+partitioned_dictionary_get(partitioned_dictionary_t *dict, const char *key)
+{
+	size_t length = strlen(key);
+	unsigned long key_hash = partition_hash(key, length, dict->seed);
+	int number = dict->spill_partition[key_hash >> (64 - DICT_PARTITION_BITS)];
+	partition_t *partition = &dict->partitions[number];
+
+	if ((partition->data == NULL) && (partition_map(dict, number) != 0))
+		return NULL;
+
+	const char *slots = partition->data + DICT_PARTITION_HEADER;
+	unsigned long mask = partition->num_slots - 1;
+	uint64_t data_start = DICT_PARTITION_HEADER + partition->num_slots * DICT_PARTITION_SLOT;
+	for (unsigned long i = key_hash & mask, probes = 0; probes < partition->num_slots; i = (i + 1) & mask, probes++) {
+		uint64_t slot[2];
+		memcpy(slot, slots + i * DICT_PARTITION_SLOT, DICT_PARTITION_SLOT);
+		if (slot[1] == 0)
+			return NULL;
+
+		// the file is only checked as a whole when it is mapped, so a bad
+		// offset must not take a lookup outside it
+		if ((slot[0] != key_hash) || (slot[1] < data_start) || (slot[1] > partition->size)
+			|| (partition->size - slot[1] < DICT_PARTITION_ENTRY + length + 1))
+			continue;
+
+		const char *entry = partition->data + slot[1];
+		uint32_t entry_length;
+		memcpy(&entry_length, entry + 8, sizeof(entry_length));
+		if ((entry_length == length) && (memcmp(entry + DICT_PARTITION_ENTRY, key, length) == 0)) {
+			uint64_t value;
+			memcpy(&value, entry, sizeof(value));
+			return (dict_value_t)value;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Unmap the partitions and free a dictionary opened by open_partitioned_dictionary()
+ */
+void
+close_partitioned_dictionary(partitioned_dictionary_t *dict)
+{
+	for (int i=0; i < dict->num_partitions; i++) {
+		if (dict->partitions[i].data != NULL)
+			munmap((void *)dict->partitions[i].data, dict->partitions[i].size);
+	}
+	free(dict->partitions);
+	free(dict->directory);
+	free(dict);
+}
+
+
+/* ---------- private functions ---------- */
+
+/*
+ * Returns a newly allocated path for a file in directory, with a name
+ * formatted from name and number
+ */
+char *
+partition_path(const char *directory, const char *name, int number)
+{
+	size_t size = strlen(directory) + strlen(name) + 16;
+	char *path = malloc(size);
+	int length = snprintf(path, size, "%s/", directory);
+
+	snprintf(path + length, size - length, name, number);
+	return path;
+}
+
+/*
+ * Returns the hash of a key in a partitioned dictionary with the given seed
+ */
+unsigned long
+partition_hash(const char *key, size_t length, const unsigned long seed[2])
+{
+	return hash_siphash13((const unsigned char *)key, length, seed);
+}
+
+/*
+ * Returns the number of slots in a partition of num_entries entries, the
+ * power of two giving at least two slots per entry
+ */
+uint64_t
+partition_num_slots(long num_entries)
+{
+	uint64_t num_slots = 2;
+	while (num_slots < 2 * (uint64_t)num_entries)
+		num_slots *= 2;
+	return num_slots;
+}
+
+/*
+ * Returns the estimated bytes a partition takes while it is built: the
+ * keys, the dictionary entries holding them and the slots partition_write()
+ * allocates
+ */
+size_t
+partition_memory_estimate(long num_keys, size_t key_bytes)
+{
+	return key_bytes + num_keys * DICT_PARTITION_ENTRY_COST + partition_num_slots(num_keys) * DICT_PARTITION_SLOT;
+}
+
+/*
+ * Load the spill files first to last into a dictionary, later values
+ * replacing earlier ones
+ *
+ * Returns 0 on success, or -1 if a spill file could not be read
+ */
+int
+partition_load_spills(partition_builder_t *builder, int first, int last, dictionary_t *dict)
+{
+	size_t key_size = 256;
+	char *key = malloc(key_size);
+
+	for (int i=first; i <= last; i++) {
+		if (builder->spill_keys[i] == 0)
+			continue;
+
+		char *path = partition_path(builder->directory, "spill-%03d", i);
+		FILE *file = fopen(path, "rb");
+		if (file == NULL) {
+			perror(path);
+			free(path);
+			free(key);
+			return -1;
+		}
+
+		long j;
+		for (j=0; j < builder->spill_keys[i]; j++) {
+			uint32_t length;
+			uint64_t value;
+			if (fread(&length, sizeof(length), 1, file) != 1)
+				break;
+			if (length >= key_size) {
+				char *larger = realloc(key, length + 1);
+				if (larger == NULL)
+					break;
+				key = larger;
+				key_size = length + 1;
+			}
+			if ((fread(key, 1, length, file) != length) || (fread(&value, sizeof(value), 1, file) != 1))
+				break;
+			key[length] = '\0';
+			dictionary_put(dict, key, (dict_value_t)value);
+		}
+		fclose(file);
+
+		if (j < builder->spill_keys[i]) {
+			fprintf(stderr, "Unable to read %s\n", path);
+			free(path);
+			free(key);
+			return -1;
+		}
+		free(path);
+	}
+
+	free(key);
+	return 0;
+}
+
+/*
+ * Write the entries of a dictionary as a partition file
+ *
+ * Returns 0 on success, or -1 if the file could not be written
+ */
+int
+partition_write(const char *path, dictionary_t *dict, const unsigned long seed[2])
+{
+	uint64_t num_slots = partition_num_slots(dict->num_entries);
+	uint64_t *slots = calloc(num_slots, DICT_PARTITION_SLOT);
+	FILE *file = fopen(path, "wb");
+	if ((slots == NULL) || (file == NULL)) {
+		perror(path);
+		if (file != NULL)
+			fclose(file);
+		free(slots);
+		return -1;
+	}
+
+	// the entries follow the slots, which are written once their offsets are known
+	uint64_t offset = DICT_PARTITION_HEADER + num_slots * DICT_PARTITION_SLOT;
+	uint64_t data_start = offset;
+	int failed = (fseek(file, offset, SEEK_SET) != 0);
+
+	for (long i=0; (i < dict->max_entries) && !failed; i++) {
+		collision_bucket_t *bucket = (dict->keys[i] == NULL) ? dict->values[i].collision_buckets : NULL;
+		int count = (dict->keys[i] != NULL) ? 1 : ((bucket != NULL) ? bucket->num_elements : 0);
+		for (int j=0; (j < count) && !failed; j++) {
+			const char *key = (bucket != NULL) ? bucket->entries[j].key : dict->keys[i];
+			uint64_t value = (uint64_t)((bucket != NULL) ? bucket->entries[j].value : dict->values[i].value);
+			uint32_t length = strlen(key);
+			unsigned long key_hash = partition_hash(key, length, seed);
+
+			uint64_t slot = key_hash & (num_slots - 1);
+			while (slots[2 * slot + 1] != 0)
+				slot = (slot + 1) & (num_slots - 1);
+			slots[2 * slot] = key_hash;
+			slots[2 * slot + 1] = offset;
+
+			failed = (fwrite(&value, sizeof(value), 1, file) != 1)
+				|| (fwrite(&length, sizeof(length), 1, file) != 1)
+				|| (fwrite(key, 1, length + 1, file) != length + 1);
+			offset += DICT_PARTITION_ENTRY + length + 1;
+		}
+	}
+
+	uint64_t header[3] = { dict->num_entries, num_slots, offset - data_start };
+	failed = failed || (fseek(file, 0, SEEK_SET) != 0)
+		|| (fwrite(DICT_PARTITION_MAGIC, 8, 1, file) != 1)
+		|| (fwrite(header, sizeof(header), 1, file) != 1)
+		|| (fwrite(slots, DICT_PARTITION_SLOT, num_slots, file) != num_slots);
+	if ((fclose(file) != 0) || failed) {
+		perror(path);
+		unlink(path);
+		free(slots);
+		return -1;
+	}
+
+	free(slots);
+	return 0;
+}
+
+/*
+ * Map a partition file and check its header
+ *
+ * Returns 0 on success, or -1 if the file could not be mapped or is not a partition
+ */
+int
+partition_map(partitioned_dictionary_t *dict, int number)
+{
+	char *path = partition_path(dict->directory, "partition-%03d", number);
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+
+	if ((fd < 0) || (fstat(fd, &st) != 0) || (st.st_size < DICT_PARTITION_HEADER)) {
+		fprintf(stderr, "Unable to open partition %s\n", path);
+		if (fd >= 0)
+			close(fd);
+		free(path);
+		return -1;
+	}
+
+	char *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		perror(path);
+		free(path);
+		return -1;
+	}
+
+	uint64_t header[3];
+	memcpy(header, data + 8, sizeof(header));
+	uint64_t num_slots = header[1];
+	if ((memcmp(data, DICT_PARTITION_MAGIC, 8) != 0) || (num_slots == 0) || ((num_slots & (num_slots - 1)) != 0)
+		|| (DICT_PARTITION_HEADER + num_slots * DICT_PARTITION_SLOT + header[2] != (uint64_t)st.st_size)) {
+		fprintf(stderr, "%s is not a partition\n", path);
+		munmap(data, st.st_size);
+		free(path);
+		return -1;
+	}
+	// lookups jump around the slots, so don't read ahead
+	madvise(data, st.st_size, MADV_RANDOM);
+
+	dict->partitions[number].data = data;
+	dict->partitions[number].size = st.st_size;
+	dict->partitions[number].num_slots = num_slots;
+	free(path);
+	return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * partitioned_dictionary.h - dictionaries built and queried from disk, for
+ * key sets larger than memory
+ *
+ * A partition builder hashes each key with SipHash-1-3 and appends it to
+ * one of DICT_PARTITION_SPILLS spill files chosen by the high bits of the
+ * hash, so adding keys takes no memory beyond the file buffers. When the
+ * build is finished, adjacent spill files are grouped into partitions that
+ * fit the memory budget, and each partition is loaded into a dictionary
+ * and written out as an open-addressed table that can be searched in place.
+ *
+ * A partitioned dictionary maps the partition file that holds a key the
+ * first time it is needed, and answers lookups straight from the mapping,
+ * so opening one takes no time and only the pages touched are read.
+ *
+ * Values are stored as 64-bit integers. A key added more than once keeps
+ * the value it was last added with.
+ *
+ * The build directory holds:
+ *
+ * 	partitions		seed, and the partition of each spill file
+ * 	partition-NNN	one table per partition
+ *
+ * Partition layout, integers in host byte order:
+ *
+ * 	header: magic (8) | entries (8) | slots (8) | data size (8)
+ * 	slots: hash (8) | offset of entry (8), 0 for an empty slot
+ * 	entries: value (8) | key length (4) | key | '\0'
+ */
+
+#ifndef PARTITIONED_DICTIONARY
+
+#define PARTITIONED_DICTIONARY
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "dictionary.h"
+
+#define DICT_PARTITION_BITS		8			// high hash bits that select a spill file
+#define DICT_PARTITION_SPILLS	(1 << DICT_PARTITION_BITS)
+#define DICT_PARTITION_ENTRY_COST	80		// estimated dictionary bytes per entry besides the key while building
+
+typedef struct partition_builder_t {
+	char *directory;
+	size_t memory_budget;
+	unsigned long seed[2];
+	FILE *spills[DICT_PARTITION_SPILLS];	// opened with the first key for each
+	long spill_keys[DICT_PARTITION_SPILLS];
+	long spill_bytes[DICT_PARTITION_SPILLS];	// key bytes in each spill file
+	long num_keys;
+} partition_builder_t;
+
+typedef struct partition_t {
+	const char *data;			// mapped partition file, NULL until it is needed
+	size_t size;
+	long num_slots;
+} partition_t;
+
+typedef struct partitioned_dictionary_t {
+	char *directory;
+	unsigned long seed[2];
+	int num_partitions;
+	int spill_partition[DICT_PARTITION_SPILLS];	// partition holding each spill file's keys
+	partition_t *partitions;
+	long num_entries;
+} partitioned_dictionary_t;
+
+/*
+ * Start building a partitioned dictionary in a directory, which must exist
+ *
+ * Returns the builder, or NULL if it could not be allocated
+ *
+ * directory - receives the spill files while building, then the partitions
+ * memory_budget - bytes a partition may take while it is built, estimated
+ * 		from its keys and the slots written with them; a spill file larger
+ * 		than this becomes a partition of its own anyway
+ */
+partition_builder_t *
+new_partition_builder(const char *directory, size_t memory_budget);
+
+/*
+ * Append a key and value to the spill file for the key's hash
+ *
+ * Returns 0 on success, or -1 if the spill file could not be written
+ *
+ * builder - allocated by new_partition_builder()
+ * key - null-terminated string
+ * value - stored as a 64-bit integer
+ */
+int
+partition_builder_add(partition_builder_t *builder, const char *key, dict_value_t value);
+
+/*
+ * Build and write the partitions from the spill files, then remove the
+ * spill files and free the builder
+ *
+ * Returns the number of partitions written, or -1 if a partition could not
+ * be built or written
+ *
+ * builder - allocated by new_partition_builder(), freed either way
+ */
+int
+partition_builder_finish(partition_builder_t *builder);
+
+/*
+ * Remove the spill files and free a builder without building anything
+ */
+void
+free_partition_builder(partition_builder_t *builder);
+
+/*
+ * Open a partitioned dictionary built by partition_builder_finish(). The
+ * partitions are mapped as lookups need them.
+ *
+ * Returns the dictionary, or NULL if the directory holds no complete build
+ */
+partitioned_dictionary_t *
+open_partitioned_dictionary(const char *directory);
+
+/*
+ * Returns the value of a key, or NULL if the key is not in the dictionary
+ * or its partition could not be mapped
+ *
+ * dict - opened by open_partitioned_dictionary()
+ * key - null-terminated string
+ */
+dict_value_t
+partitioned_dictionary_get(partitioned_dictionary_t *dict, const char *key);
+
+/*
+ * Unmap the partitions and free a dictionary opened by open_partitioned_dictionary()
+ */
+void
+close_partitioned_dictionary(partitioned_dictionary_t *dict);
+
+#endif
@@ -0,0 +1,471 @@
+/*
+ * perfect-hash.c - compile a fixed set of keys into a static C lookup table
+ *
+ * usage: perfect-hash [-p prefix] [-t type] [-o output] [file]
+ *
+ * Reads one key per line from the file, or from stdin, optionally followed
+ * by a tab and a C initializer for its value; a key without one gets its
+ * line number, counting from 0. Writes a C header holding a perfect hash
+ * table of the keys in read-only data and a static inline lookup:
+ *
+ *	static inline const long *prefix_lookup(const char *key);
+ *
+ * which returns a pointer to the value of a key, or NULL if it is not one
+ * of the keys. Nothing is built at startup and lookups touch no heap memory.
+ *
+ * The table uses hash and displace: a key's djb2 hash() is mixed with a
+ * seed the generator picks by the hash_int64() mixer, the high half of the
+ * result picks one of about n/4 groups, and each group has a displacement
+ * d chosen so that all of its keys land in distinct free slots at
+ * (low + d * high) % slots. A lookup is one hash, one displacement and one
+ * key comparison. Groups are placed largest first; if one can't be placed
+ * a new seed is tried. Seeds are derived from the attempt number, so the
+ * same keys always give the same output. The keys are fixed when the
+ * program is built, so unlike the dictionaries the table has no need for a
+ * keyed hash like SipHash, and djb2 is the cheapest hash in hash.c for
+ * short keys.
+ *
+ * The generated header carries its own copies of the static inline hash
+ * functions in hash.h, so a lookup compiles down to straight-line code and
+ * the header needs nothing from hash.o or hash.h. The generator places keys
+ * with the hash.h functions, and writes the copies from one string.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include "hash.h"
+
+#define KEYS_PER_GROUP		4			// average keys sharing a displacement
+#define SLOT_LOAD			0.9			// keys / slots, a little room speeds up placement
+#define MAX_DISPLACEMENT	65535		// displacements are stored as uint16_t
+#define MAX_ATTEMPTS		1000		// seeds tried before giving up
+
+typedef struct key_list_t {
+	long count;
+	long capacity;
+	char **keys;
+	char **values;				// C initializers, NULL for the line number
+} key_list_t;
+
+typedef struct perfect_table_t {
+	unsigned long seed;
+	long num_groups;
+	long num_slots;
+	uint16_t *displacements;	// per group
+	long *slots;				// index into the key list, -1 for an empty slot
+} perfect_table_t;
+
+/*
+ * hash_string_inline() and hash_int64_inline() from hash.h, written out in
+ * every generated header as prefix_hash_string() and prefix_hash_int64();
+ * both %s are the prefix
+ */
+static const char *hash_source =
+	"/*\n * djb2, the same hash as hash() in hash.c\n */\n"
+	"static inline unsigned long\n"
+	"%s_hash_string(const char *str)\n"
+	"{\n"
+	"\tunsigned long hash = 5381;\n"
+	"\tint c;\n"
+	"\n"
+	"\twhile ((c = (unsigned char)*str++))\n"
+	"\t\thash = (((hash << 5) + hash) + c) & 0x7fffffffffffffffUL; /* hash * 33 + c */\n"
+	"\n"
+	"\treturn hash;\n"
+	"}\n"
+	"\n"
+	"/*\n * The mixer of hash_int64() in hash.c\n */\n"
+	"static inline unsigned long\n"
+	"%s_hash_int64(unsigned long key)\n"
+	"{\n"
+	"\tkey ^= key >> 30;\n"
+	"\tkey *= 0xbf58476d1ce4e5b9UL;\n"
+	"\tkey ^= key >> 27;\n"
+	"\tkey *= 0x94d049bb133111ebUL;\n"
+	"\tkey ^= key >> 31;\n"
+	"\n"
+	"\treturn key;\n"
+	"}\n"
+	"\n";
+
+/*
+ * Read keys and optional values, one per line, skipping empty lines
+ *
+ * Returns 0 on success, or -1 if a line could not be stored
+ */
+int
+read_keys(FILE *input, key_list_t *list)
+{
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t length;
+
+	while ((length = getline(&line, &line_size, input)) >= 0) {
+		if ((length > 0) && (line[length - 1] == '\n'))
+			line[--length] = '\0';
+		if ((length > 0) && (line[length - 1] == '\r'))
+			line[--length] = '\0';
+		if (length == 0)
+			continue;
+
+		if (list->count == list->capacity) {
+			list->capacity = (list->capacity == 0) ? 1024 : list->capacity * 2;
+			list->keys = realloc(list->keys, list->capacity * sizeof(char *));
+			list->values = realloc(list->values, list->capacity * sizeof(char *));
+			if ((list->keys == NULL) || (list->values == NULL)) {
+				fprintf(stderr, "Unable to allocate room for %lu keys\n", list->capacity);
+				free(line);
+				return -1;
+			}
+		}
+
+		char *tab = strchr(line, '\t');
+		if (tab != NULL)
+			*tab = '\0';
+		list->keys[list->count] = strdup(line);
+		list->values[list->count] = ((tab != NULL) && (tab[1] != '\0')) ? strdup(tab + 1) : NULL;
+		list->count++;
+	}
+
+	free(line);
+	return 0;
+}
+
+/*
+ * qsort comparison of two keys through pointers to them
+ */
+int
+compare_keys(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * Returns the first key that appears more than once, or NULL if all are distinct
+ */
+char *
+find_duplicate(key_list_t *list)
+{
+	char **sorted = malloc(list->count * sizeof(char *));
+	char *duplicate = NULL;
+
+	memcpy(sorted, list->keys, list->count * sizeof(char *));
+	qsort(sorted, list->count, sizeof(char *), compare_keys);
+	for (long i=1; (i < list->count) && (duplicate == NULL); i++) {
+		if (strcmp(sorted[i - 1], sorted[i]) == 0)
+			duplicate = sorted[i];
+	}
+	free(sorted);
+	return duplicate;
+}
+
+/*
+ * qsort comparison of two hash values
+ */
+int
+compare_hashes(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * Returns 1 if two distinct keys have the same hash(), which no seed can
+ * separate, or 0 if all hashes differ
+ */
+int
+has_hash_collision(key_list_t *list)
+{
+	unsigned long *hashes = malloc(list->count * sizeof(unsigned long));
+	int collision = 0;
+
+	for (long i=0; i < list->count; i++)
+		hashes[i] = hash((unsigned char *)list->keys[i]);
+	qsort(hashes, list->count, sizeof(unsigned long), compare_hashes);
+	for (long i=1; (i < list->count) && !collision; i++)
+		collision = (hashes[i - 1] == hashes[i]);
+	free(hashes);
+	return collision;
+}
+
+/*
+ * Try to place every key with the table's seed
+ *
+ * Returns 0 if every group found a displacement, or -1 if one did not
+ */
+int
+place_keys(key_list_t *list, perfect_table_t *table, unsigned long *hashes)
+{
+	long *group_starts = calloc(table->num_groups + 1, sizeof(long));
+	long *group_keys = malloc(list->count * sizeof(long));
+	long *order = malloc(table->num_groups * sizeof(long));
+	long *fill = calloc(table->num_groups, sizeof(long));
+	long *candidates = malloc(list->count * sizeof(long));
+	long largest = 0;
+	int result = 0;
+
+	for (long i=0; i < list->count; i++) {
+		hashes[i] = hash_int64_inline(hash_string_inline(list->keys[i]) ^ table->seed);
+		group_starts[(hashes[i] >> 32) % table->num_groups + 1]++;
+	}
+	for (long g=0; g < table->num_groups; g++) {
+		if (group_starts[g + 1] > largest)
+			largest = group_starts[g + 1];
+		group_starts[g + 1] += group_starts[g];
+	}
+	for (long i=0; i < list->count; i++) {
+		long g = (hashes[i] >> 32) % table->num_groups;
+		group_keys[group_starts[g] + fill[g]++] = i;
+	}
+
+	// the largest groups are the hardest to place, so they go first
+	long n = 0;
+	for (long size=largest; size > 0; size--) {
+		for (long g=0; g < table->num_groups; g++) {
+			if (group_starts[g + 1] - group_starts[g] == size)
+				order[n++] = g;
+		}
+	}
+
+	for (long s=0; s < table->num_slots; s++)
+		table->slots[s] = -1;
+	memset(table->displacements, 0, table->num_groups * sizeof(uint16_t));
+
+	for (long o=0; (o < n) && (result == 0); o++) {
+		long g = order[o];
+		long start = group_starts[g];
+		long size = group_starts[g + 1] - start;
+		int placed = 0;
+
+		for (long d=0; (d <= MAX_DISPLACEMENT) && !placed; d++) {
+			placed = 1;
+			for (long k=0; (k < size) && placed; k++) {
+				unsigned long h = hashes[group_keys[start + k]];
+				long slot = ((h & 0xffffffffUL) + d * (h >> 32)) % table->num_slots;
+				if (table->slots[slot] >= 0)
+					placed = 0;
+				for (long j=0; (j < k) && placed; j++) {
+					if (candidates[j] == slot)
+						placed = 0;
+				}
+				candidates[k] = slot;
+			}
+			if (placed) {
+				table->displacements[g] = d;
+				for (long k=0; k < size; k++)
+					table->slots[candidates[k]] = group_keys[start + k];
+			}
+		}
+		if (!placed)
+			result = -1;
+	}
+
+	free(candidates);
+	free(fill);
+	free(order);
+	free(group_keys);
+	free(group_starts);
+	return result;
+}
+
+/*
+ * Find a seed and displacements that place every key in its own slot
+ *
+ * Returns 0 on success, or -1 if no seed worked within MAX_ATTEMPTS
+ */
+int
+build_table(key_list_t *list, perfect_table_t *table)
+{
+	unsigned long *hashes = malloc(list->count * sizeof(unsigned long));
+	int result = -1;
+
+	table->num_groups = list->count / KEYS_PER_GROUP + 1;
+	table->num_slots = list->count / SLOT_LOAD + 1;
+	table->displacements = malloc(table->num_groups * sizeof(uint16_t));
+	table->slots = malloc(table->num_slots * sizeof(long));
+
+	for (unsigned long attempt=0; (attempt < MAX_ATTEMPTS) && (result != 0); attempt++) {
+		table->seed = hash_int64(attempt + 1);
+		result = place_keys(list, table, hashes);
+	}
+
+	free(hashes);
+	return result;
+}
+
+/*
+ * Write a key as a C string literal, escaping anything that isn't printable
+ */
+void
+write_string_literal(FILE *output, const char *key)
+{
+	fputc('"', output);
+	for (const unsigned char *c = (const unsigned char *)key; *c; c++) {
+		if ((*c == '"') || (*c == '\\'))
+			fprintf(output, "\\%c", *c);
+		else if (isprint(*c) && (*c != '?'))
+			fputc(*c, output);
+		else
+			fprintf(output, "\\%03o", *c);	// three digits, so a following digit isn't absorbed
+	}
+	fputc('"', output);
+}
+
+/*
+ * Write the table and its lookup function as a C header
+ */
+void
+write_table(FILE *output, key_list_t *list, perfect_table_t *table, const char *prefix, const char *type, const char *source)
+{
+	char guard[256];
+	int n = 0;
+
+	for (const char *c = prefix; *c && (n < 240); c++)
+		guard[n++] = toupper((unsigned char)*c);
+	strcpy(guard + n, "_TABLE");
+
+	fprintf(output, "/*\n * generated by perfect-hash from %s, do not edit\n *\n", source);
+	fprintf(output, " * %lu keys in %lu slots, %lu displacement groups\n */\n\n", list->count, table->num_slots, table->num_groups);
+	fprintf(output, "#ifndef %s\n\n#define %s\n\n", guard, guard);
+	fprintf(output, "#include <stdint.h>\n#include <string.h>\n\n");
+	fprintf(output, "#define %s_KEYS\t%lu\n", guard, list->count);
+	fprintf(output, "#define %s_GROUPS\t%lu\n", guard, table->num_groups);
+	fprintf(output, "#define %s_SLOTS\t%lu\n\n", guard, table->num_slots);
+
+	fprintf(output, "typedef struct %s_entry_t {\n\tconst char *key;\n\t%s value;\n} %s_entry_t;\n\n", prefix, type, prefix);
+
+	fprintf(output, "static const unsigned long %s_seed = 0x%016lxUL;\n\n", prefix, table->seed);
+
+	fprintf(output, "static const uint16_t %s_displacements[%s_GROUPS] = {", prefix, guard);
+	for (long g=0; g < table->num_groups; g++)
+		fprintf(output, "%s%u,", (g % 16 == 0) ? "\n\t" : " ", table->displacements[g]);
+	fprintf(output, "\n};\n\n");
+
+	fprintf(output, "static const %s_entry_t %s_entries[%s_SLOTS] = {\n", prefix, prefix, guard);
+	for (long s=0; s < table->num_slots; s++) {
+		long i = table->slots[s];
+		if (i < 0) {
+			fprintf(output, "\t{ NULL },\n");
+			continue;
+		}
+		fprintf(output, "\t{ ");
+		write_string_literal(output, list->keys[i]);
+		if (list->values[i] != NULL)
+			fprintf(output, ", %s },\n", list->values[i]);
+		else
+			fprintf(output, ", %lu },\n", i);
+	}
+	fprintf(output, "};\n\n");
+
+	fprintf(output, hash_source, prefix, prefix);
+
+	fprintf(output, "/*\n * Returns a pointer to the value of a key, or NULL if it is not in the table\n */\n");
+	fprintf(output, "static inline const %s *\n%s_lookup(const char *key)\n{\n", type, prefix);
+	fprintf(output, "\tunsigned long h = %s_hash_int64(%s_hash_string(key) ^ %s_seed);\n", prefix, prefix, prefix);
+	fprintf(output, "\tunsigned long d = %s_displacements[(h >> 32) %% %s_GROUPS];\n", prefix, guard);
+	fprintf(output, "\tconst %s_entry_t *entry = &%s_entries[((h & 0xffffffffUL) + d * (h >> 32)) %% %s_SLOTS];\n\n", prefix, prefix, guard);
+	fprintf(output, "\tif ((entry->key == NULL) || (strcmp(entry->key, key) != 0))\n\t\treturn NULL;\n");
+	fprintf(output, "\treturn &entry->value;\n}\n\n#endif\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *prefix = "perfect";
+	const char *type = "long";
+	char *filename = NULL;
+	char *output_name = NULL;
+
+	for (int i=1; i < argc; i++) {
+		if ((strcmp(argv[i], "-p") == 0) && (i + 1 < argc)) {
+			prefix = argv[++i];
+		}
+		else if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc)) {
+			type = argv[++i];
+		}
+		else if ((strcmp(argv[i], "-o") == 0) && (i + 1 < argc)) {
+			output_name = argv[++i];
+		}
+		else if ((argv[i][0] != '-') && (filename == NULL)) {
+			filename = argv[i];
+		}
+		else {
+			goto usage;
+		}
+	}
+
+	FILE *input = stdin;
+	if (filename != NULL) {
+		input = fopen(filename, "r");
+		if (input == NULL) {
+			perror(filename);
+			return -1;
+		}
+	}
+
+	key_list_t list = { 0 };
+	int status = read_keys(input, &list);
+	if (filename != NULL)
+		fclose(input);
+	if (status != 0)
+		return -1;
+	if (list.count == 0) {
+		fprintf(stderr, "perfect-hash: no keys in %s\n", filename ? filename : "input");
+		return -1;
+	}
+
+	char *duplicate = find_duplicate(&list);
+	if (duplicate != NULL) {
+		fprintf(stderr, "perfect-hash: key \"%s\" appears more than once\n", duplicate);
+		return -1;
+	}
+
+	if (has_hash_collision(&list)) {
+		fprintf(stderr, "perfect-hash: two keys have the same hash()\n");
+		return -1;
+	}
+
+	perfect_table_t table;
+	if (build_table(&list, &table) != 0) {
+		fprintf(stderr, "perfect-hash: no perfect hash found for %lu keys\n", list.count);
+		return -1;
+	}
+
+	FILE *output = stdout;
+	if (output_name != NULL) {
+		output = fopen(output_name, "w");
+		if (output == NULL) {
+			perror(output_name);
+			return -1;
+		}
+	}
+	write_table(output, &list, &table, prefix, type, filename ? filename : "stdin");
+	if ((output != stdout) && (fclose(output) != 0)) {
+		perror(output_name);
+		return -1;
+	}
+
+	fprintf(stderr, "%lu keys in %lu slots\n", list.count, table.num_slots);
+
+	for (long i=0; i < list.count; i++) {
+		free(list.keys[i]);
+		free(list.values[i]);
+	}
+	free(list.keys);
+	free(list.values);
+	free(table.displacements);
+	free(table.slots);
+	return 0;
+
+usage:
+	printf("usage: perfect-hash [-p prefix] [-t type] [-o output] [file]\n");
+	printf("	-p prefix	names the table and prefix_lookup(), default is perfect\n");
+	printf("	-t type		C type of the values, default is long\n");
+	printf("	-o output	header file to write, default is stdout\n");
+	return -1;
+}
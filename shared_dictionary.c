@@ -0,0 +1,601 @@
+/*
+ * shared_dictionary.c
+ *
+ * A writer publishes a new entry by copying it into unused heap space
+ * first and storing its offset in a slot last, and replaces a value with a
+ * single aligned 64-bit store, so the table a reader sees is consistent
+ * apart from the slot being changed. The sequence number is what tells the
+ * reader whether it saw that slot before or after the change.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shared_dictionary.h"
+#include "hash.h"
+
+#define SHARED_DICT_MAGIC		"DICTSHM1"
+#define SHARED_DICT_SLOT		16		// hash, offset
+#define SHARED_DICT_ENTRY		12		// value, key length
+#define SHARED_DICT_TOMBSTONE	1		// offset of a removed entry, never a real offset
+
+/* ---------- private declarations ---------- */
+
+/*
+ * Returns the slots, which follow the header
+ */
+uint64_t *
+shared_dictionary_slots(shared_dictionary_header_t *header);
+
+/*
+ * Returns the number of heap bytes taken by an entry with a key of the
+ * given length, a multiple of 8 so that values stay aligned
+ */
+uint64_t
+shared_dictionary_entry_size(size_t length);
+
+/*
+ * Find the slot holding a key. Offsets are checked against the segment
+ * size, so a reader racing with a writer may get a wrong answer, but will
+ * not read outside the segment.
+ *
+ * Returns the slot index, or -1 if the key is not in the table
+ *
+ * insert_slot - if not NULL, receives the first empty or tombstone slot
+ * 		where the key could be added, or -1 if there is none
+ */
+long
+shared_dictionary_find(shared_dictionary_header_t *header, unsigned long key_hash, const char *key,
+	size_t length, long *insert_slot);
+
+/*
+ * Take the write lock and make the sequence number odd. If the last writer
+ * died holding the lock, its change is repaired first.
+ *
+ * Returns 0 on success, or -1 if the lock could not be taken
+ */
+int
+shared_dictionary_begin_write(shared_dictionary_header_t *header);
+
+/*
+ * Repair the table after a writer died in the middle of a change: finish
+ * any compaction it was doing, make the sequence number even and recount
+ * the entries and tombstones. An entry that was copied into the heap but
+ * never given a slot is lost, and its heap space is reclaimed by the next
+ * compaction.
+ */
+void
+shared_dictionary_recover(shared_dictionary_header_t *header);
+
+/*
+ * Slide the live entries down over the heap space of removed ones, then
+ * rebuild the slots without tombstones. Called with the write lock held
+ * and the sequence number odd. Picks up where the header says an earlier
+ * compaction stopped, if one did.
+ */
+void
+shared_dictionary_compact(shared_dictionary_header_t *header);
+
+/*
+ * Returns 1 if a slot refers to the heap entry at offset, or 0 if the
+ * entry was removed or never given a slot
+ */
+int
+shared_dictionary_entry_live(shared_dictionary_header_t *header, uint64_t offset);
+
+/*
+ * Make the sequence number even again and release the write lock
+ */
+void
+shared_dictionary_end_write(shared_dictionary_header_t *header);
+
+
+/* ---------- public definitions ---------- */
+
+/*
+ * Create a shared memory segment holding an empty dictionary, replacing
+ * any segment with the same name, and attach to it for writing
+ *
+ * Returns the dictionary, or NULL if the segment could not be created
+ *
+ * name - shm_open() name, such as "/words"
+ * max_entries - entries the dictionary can hold
+ * key_bytes - total length of the keys it can hold
+ */
+shared_dictionary_t *
+new_shared_dictionary(const char *name, long max_entries, size_t key_bytes)
+{
+	uint64_t num_slots = 2;
+	while (num_slots < 2 * (uint64_t)max_entries)
+		num_slots *= 2;
+
+	// the header is padded to a cache line, and each entry's key may need
+	// up to 7 bytes of padding after it
+	uint64_t heap_start = (sizeof(shared_dictionary_header_t) + 63) & ~63UL;
+	heap_start += num_slots * SHARED_DICT_SLOT;
+	uint64_t size = heap_start + max_entries * (SHARED_DICT_ENTRY + 8) + key_bytes;
+
+	shm_unlink(name);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0) {
+		perror(name);
+		return NULL;
+	}
+	if (ftruncate(fd, size) != 0) {
+		perror(name);
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	shared_dictionary_header_t *header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		perror(name);
+		shm_unlink(name);
+		return NULL;
+	}
+
+	// ftruncate() zeroed the segment, so every slot starts empty
+	pthread_mutexattr_t attributes;
+	pthread_mutexattr_init(&attributes);
+	pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&header->write_lock, &attributes);
+	pthread_mutexattr_destroy(&attributes);
+
+	dictionary_random_seed(header->seed);
+	header->size = size;
+	header->num_slots = num_slots;
+	header->max_entries = max_entries;
+	header->heap_start = heap_start;
+	header->heap_used = heap_start;
+
+	// the magic number goes in last, so a process attaching early rejects the segment
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(header->magic, SHARED_DICT_MAGIC, 8);
+
+	shared_dictionary_t *dict = malloc(sizeof(shared_dictionary_t));
+	dict->name = strdup(name);
+	dict->header = header;
+	dict->writable = 1;
+
+	return dict;
+}
+
+/*
+ * Attach to a dictionary created by another process
+ *
+ * Returns the dictionary, or NULL if the segment could not be mapped or
+ * does not hold a shared dictionary
+ *
+ * name - name given to new_shared_dictionary()
+ * writable - nonzero to map the segment for writing, zero for a reader
+ */
+shared_dictionary_t *
+attach_shared_dictionary(const char *name, int writable)
+{
+	int fd = shm_open(name, writable ? O_RDWR : O_RDONLY, 0);
+	struct stat st;
+
+	if ((fd < 0) || (fstat(fd, &st) != 0) || (st.st_size < (off_t)sizeof(shared_dictionary_header_t))) {
+		perror(name);
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+
+	shared_dictionary_header_t *header = mmap(NULL, st.st_size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+		MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED) {
+		perror(name);
+		return NULL;
+	}
+	if ((memcmp(header->magic, SHARED_DICT_MAGIC, 8) != 0) || (header->size != (uint64_t)st.st_size)) {
+		fprintf(stderr, "%s does not hold a shared dictionary\n", name);
+		munmap(header, st.st_size);
+		return NULL;
+	}
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	shared_dictionary_t *dict = malloc(sizeof(shared_dictionary_t));
+	dict->name = strdup(name);
+	dict->header = header;
+	dict->writable = writable;
+
+	return dict;
+}
+
+/*
+ * Unmap the segment, which stays in place for other processes
+ */
+void
+detach_shared_dictionary(shared_dictionary_t *dict)
+{
+	munmap(dict->header, dict->header->size);
+	free(dict->name);
+	free(dict);
+}
+
+/*
+ * Remove a segment created by new_shared_dictionary(). Processes still
+ * attached to it keep their mapping.
+ *
+ * Returns 0 on success, or -1 if there is no such segment
+ */
+int
+unlink_shared_dictionary(const char *name)
+{
+	return shm_unlink(name);
+}
+
+/*
+ * Add or replace the value of a key
+ *
+ * Returns 0 on success, or -1 if the dictionary was attached for reading
+ * or is full even after compaction
+ *
+ * dict - attached for writing
+ * key - null-terminated string, copied into the segment
+ * value - stored as a 64-bit integer
+ */
+int
+shared_dictionary_put(shared_dictionary_t *dict, const char *key, dict_value_t value)
+{
+	shared_dictionary_header_t *header = dict->header;
+	size_t length = strlen(key);
+	unsigned long key_hash = hash_siphash13((const unsigned char *)key, length, header->seed);
+	char *base = (char *)header;
+	uint64_t *slots = shared_dictionary_slots(header);
+	int result = 0;
+
+	if (!dict->writable || (shared_dictionary_begin_write(header) != 0))
+		return -1;
+
+	long insert_slot;
+	long slot = shared_dictionary_find(header, key_hash, key, length, &insert_slot);
+	if ((slot < 0) && (header->num_tombstones > 0)
+		&& ((insert_slot < 0) || (header->heap_used + shared_dictionary_entry_size(length) > header->size)
+			|| (header->num_tombstones > header->num_slots / 4))) {
+		shared_dictionary_compact(header);
+		shared_dictionary_find(header, key_hash, key, length, &insert_slot);
+	}
+	if (slot >= 0) {
+		__atomic_store_n((uint64_t *)(base + slots[2 * slot + 1]), (uint64_t)value, __ATOMIC_RELAXED);
+	}
+	else if ((insert_slot < 0) || (header->num_entries >= header->max_entries)
+		|| (header->heap_used + shared_dictionary_entry_size(length) > header->size)) {
+		result = -1;
+	}
+	else {
+		uint64_t offset = header->heap_used;
+		uint32_t key_length = length;
+		uint64_t value_bits = (uint64_t)value;
+		memcpy(base + offset, &value_bits, sizeof(value_bits));
+		memcpy(base + offset + 8, &key_length, sizeof(key_length));
+		memcpy(base + offset + SHARED_DICT_ENTRY, key, length + 1);
+		header->heap_used += shared_dictionary_entry_size(length);
+
+		if (slots[2 * insert_slot + 1] == SHARED_DICT_TOMBSTONE)
+			header->num_tombstones--;
+		slots[2 * insert_slot] = key_hash;
+		__atomic_store_n(&slots[2 * insert_slot + 1], offset, __ATOMIC_RELEASE);
+		header->num_entries++;
+	}
+
+	shared_dictionary_end_write(header);
+	return result;
+}
+
+/*
+ * Returns the value of a key, or NULL if the key is not in the dictionary
+ *
+ * dict - attached for reading or writing
+ * key - null-terminated string
+ */
+dict_value_t
+shared_dictionary_get(shared_dictionary_t *dict, const char *key)
+{
+	shared_dictionary_header_t *header = dict->header;
+	size_t length = strlen(key);
+	unsigned long key_hash = hash_siphash13((const unsigned char *)key, length, header->seed);
+	uint64_t *slots = shared_dictionary_slots(header);
+
+	for (;;) {
+		uint64_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+		if (sequence & 1) {
+			sched_yield();
+			continue;
+		}
+
+		uint64_t value = 0;
+		long slot = shared_dictionary_find(header, key_hash, key, length, NULL);
+		if (slot >= 0) {
+			uint64_t offset = __atomic_load_n(&slots[2 * slot + 1], __ATOMIC_ACQUIRE);
+			if (offset + sizeof(value) <= header->size)
+				value = __atomic_load_n((uint64_t *)((char *)header + offset), __ATOMIC_RELAXED);
+		}
+
+		// anything read during a change is thrown away
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&header->sequence, __ATOMIC_RELAXED) == sequence)
+			return (dict_value_t)value;
+	}
+}
+
+/*
+ * Remove a key, leaving a tombstone in its slot
+ *
+ * Returns the value that was removed, or NULL if the key was not found or
+ * the dictionary was attached for reading
+ *
+ * dict - attached for writing
+ * key - null-terminated string
+ */
+dict_value_t
+shared_dictionary_remove(shared_dictionary_t *dict, const char *key)
+{
+	shared_dictionary_header_t *header = dict->header;
+	size_t length = strlen(key);
+	unsigned long key_hash = hash_siphash13((const unsigned char *)key, length, header->seed);
+	uint64_t *slots = shared_dictionary_slots(header);
+	uint64_t value = 0;
+
+	if (!dict->writable || (shared_dictionary_begin_write(header) != 0))
+		return NULL;
+
+	long slot = shared_dictionary_find(header, key_hash, key, length, NULL);
+	if (slot >= 0) {
+		memcpy(&value, (char *)header + slots[2 * slot + 1], sizeof(value));
+		__atomic_store_n(&slots[2 * slot + 1], SHARED_DICT_TOMBSTONE, __ATOMIC_RELAXED);
+		header->num_entries--;
+		header->num_tombstones++;
+	}
+
+	shared_dictionary_end_write(header);
+	return (dict_value_t)value;
+}
+
+
+/* ---------- private functions ---------- */
+
+/*
+ * Returns the slots, which follow the header
+ */
+uint64_t *
+shared_dictionary_slots(shared_dictionary_header_t *header)
+{
+	return (uint64_t *)((char *)header + ((sizeof(shared_dictionary_header_t) + 63) & ~63UL));
+}
+
+/*
+ * Returns the number of heap bytes taken by an entry with a key of the
+ * given length, a multiple of 8 so that values stay aligned
+ */
+uint64_t
+shared_dictionary_entry_size(size_t length)
+{
+	return (SHARED_DICT_ENTRY + length + 1 + 7) & ~7UL;
+}
+
+/*
+ * Find the slot holding a key. Offsets are checked against the segment
+ * size, so a reader racing with a writer may get a wrong answer, but will
+ * not read outside the segment.
+ *
+ * Returns the slot index, or -1 if the key is not in the table
+ *
+ * insert_slot - if not NULL, receives the first empty or tombstone slot
+ * 		where the key could be added, or -1 if there is none
+ */
+long
+shared_dictionary_find(shared_dictionary_header_t *header, unsigned long key_hash, const char *key,
+	size_t length, long *insert_slot)
+{
+	uint64_t *slots = shared_dictionary_slots(header);
+	uint64_t mask = header->num_slots - 1;
+	const char *base = (const char *)header;
+	long first_free = -1;
+
+	for (uint64_t i = key_hash & mask, probes = 0; probes < header->num_slots; i = (i + 1) & mask, probes++) {
+		uint64_t offset = __atomic_load_n(&slots[2 * i + 1], __ATOMIC_ACQUIRE);
+		if (offset == 0) {
+			if (first_free < 0)
+				first_free = i;
+			break;
+		}
+		if (offset == SHARED_DICT_TOMBSTONE) {
+			if (first_free < 0)
+				first_free = i;
+			continue;
+		}
+		if ((slots[2 * i] != key_hash) || (offset < header->heap_start)
+			|| (offset + SHARED_DICT_ENTRY + length + 1 > header->size))
+			continue;
+
+		uint32_t entry_length;
+		memcpy(&entry_length, base + offset + 8, sizeof(entry_length));
+		if ((entry_length == length) && (memcmp(base + offset + SHARED_DICT_ENTRY, key, length) == 0)) {
+			return i;
+		}
+	}
+
+	if (insert_slot != NULL)
+		*insert_slot = first_free;
+	return -1;
+}
+
+/*
+ * Take the write lock and make the sequence number odd. If the last writer
+ * died holding the lock, its change is repaired first.
+ *
+ * Returns 0 on success, or -1 if the lock could not be taken
+ */
+int
+shared_dictionary_begin_write(shared_dictionary_header_t *header)
+{
+	int status = pthread_mutex_lock(&header->write_lock);
+
+	if (status == EOWNERDEAD) {
+		shared_dictionary_recover(header);
+		status = pthread_mutex_consistent(&header->write_lock);
+	}
+	if (status != 0) {
+		fprintf(stderr, "shared_dictionary_begin_write() unable to lock dictionary %p: %s\n",
+			header, strerror(status));
+		return -1;
+	}
+
+	__atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return 0;
+}
+
+/*
+ * Make the sequence number even again and release the write lock
+ */
+void
+shared_dictionary_end_write(shared_dictionary_header_t *header)
+{
+	__atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&header->write_lock);
+}
+
+/*
+ * Repair the table after a writer died in the middle of a change: finish
+ * any compaction it was doing, make the sequence number even and recount
+ * the entries and tombstones. An entry that was copied into the heap but
+ * never given a slot is lost, and its heap space is reclaimed by the next
+ * compaction.
+ */
+void
+shared_dictionary_recover(shared_dictionary_header_t *header)
+{
+	uint64_t *slots = shared_dictionary_slots(header);
+	uint64_t num_entries = 0;
+	uint64_t num_tombstones = 0;
+
+	if (header->compact_read != 0)
+		shared_dictionary_compact(header);
+
+	for (uint64_t i=0; i < header->num_slots; i++) {
+		if (slots[2 * i + 1] == SHARED_DICT_TOMBSTONE)
+			num_tombstones++;
+		else if (slots[2 * i + 1] != 0)
+			num_entries++;
+	}
+	header->num_entries = num_entries;
+	header->num_tombstones = num_tombstones;
+
+	// readers waiting on the odd number may go on, the table is consistent
+	if (header->sequence & 1)
+		__atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Slide the live entries down over the heap space of removed ones, then
+ * rebuild the slots without tombstones. Called with the write lock held
+ * and the sequence number odd. Picks up where the header says an earlier
+ * compaction stopped, if one did.
+ */
+void
+shared_dictionary_compact(shared_dictionary_header_t *header)
+{
+	uint64_t *slots = shared_dictionary_slots(header);
+	uint64_t mask = header->num_slots - 1;
+	char *base = (char *)header;
+
+	if (header->compact_read == 0) {
+		header->compact_write = header->heap_start;
+		__atomic_store_n(&header->compact_read, header->heap_start, __ATOMIC_RELEASE);
+	}
+
+	// a writer died moving an entry, which may have overwritten its own
+	// bytes, so the entry is given up
+	if (header->move_size != 0) {
+		if (header->compact_read == header->move_from)
+			header->compact_read += header->move_size;
+		header->move_size = 0;
+	}
+
+	// the slots still hold the old offsets until every entry has moved, and
+	// cursors only advance once an entry is in place
+	while (header->compact_read < header->heap_used) {
+		uint64_t read = header->compact_read;
+		uint64_t write = header->compact_write;
+		uint32_t length;
+
+		memcpy(&length, base + read + 8, sizeof(length));
+		uint64_t size = shared_dictionary_entry_size(length);
+		if (read + size > header->heap_used)
+			break;
+
+		if (shared_dictionary_entry_live(header, read)) {
+			if (write != read) {
+				header->move_from = read;
+				__atomic_store_n(&header->move_size, size, __ATOMIC_RELEASE);
+				memmove(base + write, base + read, size);
+			}
+			__atomic_store_n(&header->compact_read, read + size, __ATOMIC_RELEASE);
+			__atomic_store_n(&header->compact_write, write + size, __ATOMIC_RELEASE);
+			__atomic_store_n(&header->move_size, 0, __ATOMIC_RELEASE);
+		}
+		else {
+			__atomic_store_n(&header->compact_read, read + size, __ATOMIC_RELEASE);
+		}
+	}
+	__atomic_store_n(&header->heap_used, header->compact_write, __ATOMIC_RELEASE);
+
+	// every entry left in the heap is live, so the slots are rebuilt from it
+	memset(slots, 0, header->num_slots * SHARED_DICT_SLOT);
+	uint64_t num_entries = 0;
+	uint64_t size;
+	for (uint64_t offset = header->heap_start; offset < header->heap_used; offset += size) {
+		uint32_t length;
+		memcpy(&length, base + offset + 8, sizeof(length));
+		size = shared_dictionary_entry_size(length);
+
+		unsigned long key_hash = hash_siphash13((const unsigned char *)base + offset + SHARED_DICT_ENTRY, length,
+			header->seed);
+		uint64_t i = key_hash & mask;
+		while (slots[2 * i + 1] != 0)
+			i = (i + 1) & mask;
+		slots[2 * i] = key_hash;
+		__atomic_store_n(&slots[2 * i + 1], offset, __ATOMIC_RELEASE);
+		num_entries++;
+	}
+	header->num_entries = num_entries;
+	header->num_tombstones = 0;
+	__atomic_store_n(&header->compact_read, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns 1 if a slot refers to the heap entry at offset, or 0 if the
+ * entry was removed or never given a slot
+ */
+int
+shared_dictionary_entry_live(shared_dictionary_header_t *header, uint64_t offset)
+{
+	uint64_t *slots = shared_dictionary_slots(header);
+	uint64_t mask = header->num_slots - 1;
+	const char *base = (const char *)header;
+	uint32_t length;
+
+	memcpy(&length, base + offset + 8, sizeof(length));
+	unsigned long key_hash = hash_siphash13((const unsigned char *)base + offset + SHARED_DICT_ENTRY, length,
+		header->seed);
+
+	for (uint64_t i = key_hash & mask, probes = 0; (probes < header->num_slots) && (slots[2 * i + 1] != 0);
+			i = (i + 1) & mask, probes++) {
+		if (slots[2 * i + 1] == offset)
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * shared_dictionary.h - dictionary in a POSIX shared memory segment, shared
+ * by one writer and many reader processes
+ *
+ * Everything the table needs lives in the segment: a header, an array of
+ * open-addressed slots, and a heap holding each entry's value and key. The
+ * slots refer to entries by their offset from the start of the segment, so
+ * every process can map the segment at a different address. A process that
+ * attaches maps the segment and is ready to look keys up, there is nothing
+ * to rebuild.
+ *
+ * Writers are serialized by a process-shared mutex in the header, and bump
+ * a sequence number before and after each change (a seqlock). Readers take
+ * no lock: they note the sequence number, look the key up, and try again
+ * if a writer was active in the meantime, so a reader never blocks a
+ * writer and readers never slow each other down. Since a reader may see a
+ * table in the middle of a change, every offset it follows is checked
+ * against the size of the segment before it is used.
+ *
+ * The write lock is a robust mutex. If a writer dies in the middle of a
+ * change, the next writer to take the lock makes the sequence number even
+ * again and recounts the entries; an entry it had not yet given a slot is
+ * lost. Until some writer does that, readers find the sequence number odd
+ * and wait, so a process that may outlive a crashed writer should attach
+ * for writing and put or remove a key to unblock them.
+ *
+ * The segment is sized when it is created and does not grow. Removed
+ * entries leave a tombstone in their slot and their heap space behind.
+ * When a put of a new key finds no room for it, or tombstones take a
+ * quarter of the slots, the writer compacts the segment in place: it
+ * slides the live entries down over the dead ones and rebuilds the slots,
+ * with the sequence number odd so that readers wait it out. The progress
+ * of a compaction is kept in the header, so a writer that dies partway is
+ * finished by the next one, losing at most the entry it was moving. Values
+ * are stored as 64-bit integers, since a pointer from one process means
+ * nothing in another.
+ *
+ * Segment layout:
+ *
+ * 	header | slots: hash (8), offset of entry (8) | heap: value (8), key length (4), key, '\0'
+ */
+
+#ifndef SHARED_DICTIONARY
+
+#define SHARED_DICTIONARY
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "dictionary.h"
+
+typedef struct shared_dictionary_header_t {
+	char magic[8];
+	uint64_t sequence;			// odd while a writer is changing the table
+	pthread_mutex_t write_lock;	// process-shared, held by the writer
+	unsigned long seed[2];
+	uint64_t size;				// bytes in the segment
+	uint64_t num_slots;			// a power of two
+	uint64_t max_entries;		// puts of new keys fail beyond this
+	uint64_t num_entries;
+	uint64_t num_tombstones;	// removed entries still holding a slot
+	uint64_t heap_start;		// offset of the heap
+	uint64_t heap_used;			// offset of the first free heap byte
+	uint64_t compact_read;		// next entry a compaction looks at, 0 when not compacting
+	uint64_t compact_write;		// end of the entries compacted so far
+	uint64_t move_from;			// entry being moved to compact_write
+	uint64_t move_size;			// its size while it is moved, otherwise 0
+} shared_dictionary_header_t;
+
+typedef struct shared_dictionary_t {
+	char *name;
+	shared_dictionary_header_t *header;	// start of the mapped segment
+	int writable;
+} shared_dictionary_t;
+
+/*
+ * Create a shared memory segment holding an empty dictionary, replacing
+ * any segment with the same name, and attach to it for writing
+ *
+ * Returns the dictionary, or NULL if the segment could not be created
+ *
+ * name - shm_open() name, such as "/words"
+ * max_entries - entries the dictionary can hold
+ * key_bytes - total length of the keys it can hold
+ */
+shared_dictionary_t *
+new_shared_dictionary(const char *name, long max_entries, size_t key_bytes);
+
+/*
+ * Attach to a dictionary created by another process
+ *
+ * Returns the dictionary, or NULL if the segment could not be mapped or
+ * does not hold a shared dictionary
+ *
+ * name - name given to new_shared_dictionary()
+ * writable - nonzero to map the segment for writing, zero for a reader
+ */
+shared_dictionary_t *
+attach_shared_dictionary(const char *name, int writable);
+
+/*
+ * Unmap the segment, which stays in place for other processes
+ */
+void
+detach_shared_dictionary(shared_dictionary_t *dict);
+
+/*
+ * Remove a segment created by new_shared_dictionary(). Processes still
+ * attached to it keep their mapping.
+ *
+ * Returns 0 on success, or -1 if there is no such segment
+ */
+int
+unlink_shared_dictionary(const char *name);
+
+/*
+ * Add or replace the value of a key
+ *
+ * Returns 0 on success, or -1 if the dictionary was attached for reading
+ * or is full even after compaction
+ *
+ * dict - attached for writing
+ * key - null-terminated string, copied into the segment
+ * value - stored as a 64-bit integer
+ */
+int
+shared_dictionary_put(shared_dictionary_t *dict, const char *key, dict_value_t value);
+
+/*
+ * Returns the value of a key, or NULL if the key is not in the dictionary
+ *
+ * dict - attached for reading or writing
+ * key - null-terminated string
+ */
+dict_value_t
+shared_dictionary_get(shared_dictionary_t *dict, const char *key);
+
+/*
+ * Remove a key, leaving a tombstone in its slot
+ *
+ * Returns the value that was removed, or NULL if the key was not found or
+ * the dictionary was attached for reading
+ *
+ * dict - attached for writing
+ * key - null-terminated string
+ */
+dict_value_t
+shared_dictionary_remove(shared_dictionary_t *dict, const char *key);
+
+#endif
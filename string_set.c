@@ -0,0 +1,445 @@
+/*
+ * string_set.c
+ *
+ * Linear probing over parallel arrays of tags and key pointers. The tags
+ * of a probe sequence sit next to each other, so a miss usually costs one
+ * cache line of tags and no string comparison. Removal shifts the rest of
+ * the probe sequence back, as in int_dictionary.c, so there are no
+ * tombstones.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "string_set.h"
+#include "capacity.h"
+#include "hash.h"
+
+#define STRING_SET_DROPPED	0x01	// tag of a key string_set_intersect() is removing
+
+/* ---------- private declarations ---------- */
+
+/*
+ * Returns the tag stored for a key with the given hash, never 0
+ */
+unsigned char
+string_set_tag(unsigned long key_hash);
+
+/*
+ * Returns the index of the slot holding key, or of the empty slot where
+ * it would be inserted
+ *
+ * set - set to search
+ * key - null-terminated string
+ * key_hash - hash() of the key
+ */
+long
+string_set_find_slot(string_set_t *set, const char *key, unsigned long key_hash);
+
+/*
+ * Resize the set, rehashing all keys. Keys tagged STRING_SET_DROPPED are
+ * freed instead of being moved.
+ *
+ * Returns 0 on success, or -1 if the new table could not be allocated, in
+ * which case the set is left unchanged
+ *
+ * set - set to resize
+ * new_size - new size - this should be prime
+ */
+int
+string_set_rebuild_table(string_set_t *set, long new_size);
+
+
+/* ---------- public definitions ---------- */
+
+/*
+ * Allocate a set with a slot array initialized to DICT_INITIAL_SIZE
+ */
+string_set_t *
+new_string_set()
+{
+	return new_string_set_size_load(DICT_INITIAL_SIZE, LOAD_FACTOR);
+}
+
+/*
+ * Allocate a set with a slot array initialized to a user-defined value
+ *
+ * initial_size - this should be a prime number to help ensure good distribution
+ *
+ * load_factor - between 0 and 1.0 to resize the set when its size
+ * 		exceeds this value * the current capacity of the set
+ */
+string_set_t *
+new_string_set_size_load(long initial_size, double load_factor)
+{
+	string_set_t *set = calloc(1, sizeof(string_set_t));
+
+	// linear probing needs at least one empty slot to terminate a search
+	if (load_factor >= 1.0)
+		load_factor = LOAD_FACTOR;
+	if (initial_size < DICT_INITIAL_SIZE)
+		initial_size = DICT_INITIAL_SIZE;
+
+	set->load_factor = load_factor;
+
+	set->max_entries = initial_size;
+	set->min_entries = initial_size;
+	set->tags = (unsigned char *)calloc(initial_size, sizeof(unsigned char));
+	set->keys = (dict_key_t *)calloc(initial_size, sizeof(dict_key_t));
+
+	return set;
+}
+
+/*
+ * Free a set created by new_string_set(), and its keys
+ */
+void
+free_string_set(string_set_t *set)
+{
+	for (long i=0; i < set->max_entries; i++) {
+		if (set->tags[i] != 0)
+			free(set->keys[i]);
+	}
+	free(set->tags);
+	free(set->keys);
+	free(set);
+}
+
+/*
+ * Add a key to the set
+ *
+ * Returns 1 if the key was added, 0 if it was already in the set
+ *
+ * set - allocated by new_string_set()
+ * key - null-terminated string will be copied and managed by the set
+ */
+int
+string_set_add(string_set_t *set, const char *key)
+{
+	unsigned long key_hash = hash((unsigned char *)key);
+	long index = string_set_find_slot(set, key, key_hash);
+
+	if (set->tags[index] != 0)
+		return 0;
+
+	// linear probing needs an empty slot to end every search
+	if (set->num_entries + 1 >= set->max_entries) {
+		fprintf(stderr, "string_set_add() set %p is full\n", set);
+		return 0;
+	}
+
+	set->keys[index] = strdup(key);
+	set->tags[index] = string_set_tag(key_hash);
+	set->num_entries++;
+
+	// if the table can't be grown we carry on with longer probe sequences
+	if (capacity_needs_growth(set->num_entries, set->max_entries, set->load_factor)) {
+		string_set_rebuild_table(set, capacity_after_growth(set->num_entries, set->load_factor));
+	}
+
+	return 1;
+}
+
+/*
+ * Returns 1 if the key is in the set, 0 if not
+ *
+ * set - allocated by new_string_set()
+ * key - null-terminated string
+ */
+int
+string_set_contains(string_set_t *set, const char *key)
+{
+	long index = string_set_find_slot(set, key, hash((unsigned char *)key));
+
+	return set->tags[index] != 0;
+}
+
+/*
+ * Look up many keys at once. The keys are hashed STRING_SET_BATCH at a
+ * time and their first slots prefetched before any of them is probed, so
+ * the cache misses of a batch overlap instead of being taken one by one.
+ *
+ * Returns the number of keys found
+ *
+ * set - allocated by new_string_set()
+ * keys - null-terminated strings
+ * count - number of keys
+ * found - receives 1 for each key in the set and 0 for the others, may be
+ * 		NULL to only count them
+ */
+long
+string_set_contains_batch(string_set_t *set, const char **keys, long count, unsigned char *found)
+{
+	unsigned long hashes[STRING_SET_BATCH];
+	long total = 0;
+
+	for (long start=0; start < count; start += STRING_SET_BATCH) {
+		int batch = (count - start < STRING_SET_BATCH) ? (count - start) : STRING_SET_BATCH;
+
+		for (int i=0; i < batch; i++) {
+			hashes[i] = hash((unsigned char *)keys[start + i]);
+			long index = hashes[i] % set->max_entries;
+			__builtin_prefetch(&set->tags[index]);
+			__builtin_prefetch(&set->keys[index]);
+		}
+
+		for (int i=0; i < batch; i++) {
+			long index = string_set_find_slot(set, keys[start + i], hashes[i]);
+			int present = (set->tags[index] != 0);
+			if (found != NULL)
+				found[start + i] = present;
+			total += present;
+		}
+	}
+
+	return total;
+}
+
+/*
+ * Remove a key from the set
+ *
+ * Returns 1 if the key was removed, 0 if it was not in the set
+ *
+ * set - allocated by new_string_set()
+ * key - null-terminated string
+ */
+int
+string_set_remove(string_set_t *set, const char *key)
+{
+	long hole = string_set_find_slot(set, key, hash((unsigned char *)key));
+
+	if (set->tags[hole] == 0)
+		return 0;
+
+	free(set->keys[hole]);
+	set->num_entries--;
+
+	// shift later members of the probe sequence back into the hole, unless
+	// that would move a key in front of the slot it hashes to
+	long next = hole;
+	for (;;) {
+		next = (next + 1) % set->max_entries;
+		if (set->tags[next] == 0)
+			break;
+
+		long home = hash((unsigned char *)set->keys[next]) % set->max_entries;
+		int movable = (hole <= next) ? ((home <= hole) || (home > next))
+									 : ((home <= hole) && (home > next));
+		if (movable) {
+			set->tags[hole] = set->tags[next];
+			set->keys[hole] = set->keys[next];
+			hole = next;
+		}
+	}
+	set->tags[hole] = 0;
+	set->keys[hole] = NULL;
+
+	long new_size = capacity_after_shrink(set->num_entries, set->max_entries,
+		set->min_entries, set->load_factor);
+	if (new_size > 0)
+		string_set_rebuild_table(set, new_size);
+
+	return 1;
+}
+
+/*
+ * Size the set so that it can hold expected_entries without resizing.
+ * Returns 0 on success, or -1 if the table could not be allocated
+ *
+ * set - allocated by new_string_set()
+ * expected_entries - number of keys the set will hold
+ */
+int
+string_set_reserve(string_set_t *set, long expected_entries)
+{
+	long new_size = capacity_for_entries(expected_entries, set->load_factor);
+
+	if (new_size > set->max_entries) {
+		if (string_set_rebuild_table(set, new_size) != 0)
+			return -1;
+	}
+
+	if (set->min_entries < new_size)
+		set->min_entries = new_size;
+
+	return 0;
+}
+
+/*
+ * Add every key of src to dest. dest is grown once for both sets, then the
+ * slots of src are walked directly.
+ *
+ * Returns 0 on success, or -1 if dest could not be grown, in which case it
+ * is unchanged
+ *
+ * dest - set receiving the keys
+ * src - set to add, not modified
+ */
+int
+string_set_union(string_set_t *dest, string_set_t *src)
+{
+	long new_size = capacity_for_entries(dest->num_entries + src->num_entries, dest->load_factor);
+
+	if ((new_size > dest->max_entries) && (string_set_rebuild_table(dest, new_size) != 0))
+		return -1;
+
+	// dest is large enough for every key, so no insertion can make it grow
+	for (long i=0; i < src->max_entries; i++) {
+		if (src->tags[i] == 0)
+			continue;
+		unsigned long key_hash = hash((unsigned char *)src->keys[i]);
+		long index = string_set_find_slot(dest, src->keys[i], key_hash);
+		if (dest->tags[index] == 0) {
+			dest->keys[index] = strdup(src->keys[i]);
+			dest->tags[index] = src->tags[i];
+			dest->num_entries++;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Remove from dest every key that is not in src. The slots of dest are
+ * walked directly, and the table is rebuilt once at the size for the keys
+ * that are left.
+ *
+ * Returns 0 on success, or -1 if the smaller table could not be allocated,
+ * in which case dest is unchanged
+ *
+ * dest - set to reduce
+ * src - set to intersect with, not modified
+ */
+int
+string_set_intersect(string_set_t *dest, string_set_t *src)
+{
+	long kept = 0;
+
+	// a dropped key keeps a non-zero tag that matches no lookup, so the
+	// probe sequences of dest stay intact until it is rebuilt
+	for (long i=0; i < dest->max_entries; i++) {
+		if (dest->tags[i] == 0)
+			continue;
+		if (string_set_contains(src, dest->keys[i]))
+			kept++;
+		else
+			dest->tags[i] = STRING_SET_DROPPED;
+	}
+
+	long new_size = capacity_for_entries(kept, dest->load_factor);
+	if (new_size < dest->min_entries)
+		new_size = dest->min_entries;
+
+	if (string_set_rebuild_table(dest, new_size) != 0) {
+		for (long i=0; i < dest->max_entries; i++) {
+			if (dest->tags[i] == STRING_SET_DROPPED)
+				dest->tags[i] = string_set_tag(hash((unsigned char *)dest->keys[i]));
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * For each key in the set, execute the enumeration function.
+ *
+ * set - set to enumerate
+ * enum_function - function returning void that takes a key as argument
+ */
+void
+string_set_enumerate(string_set_t *set, string_set_enumerator_t enum_function)
+{
+	for (long i=0; i < set->max_entries; i++) {
+		if (set->tags[i] != 0)
+			enum_function(set->keys[i]);
+	}
+}
+
+/* --- private functions --- */
+
+/*
+ * Returns the tag stored for a key with the given hash, never 0
+ */
+unsigned char
+string_set_tag(unsigned long key_hash)
+{
+	// the slot comes from the hash modulo a prime, the tag from mixed high bits
+	return 0x80 | (hash_int64(key_hash) >> 57);
+}
+
+/*
+ * Returns the index of the slot holding key, or of the empty slot where
+ * it would be inserted
+ *
+ * set - set to search
+ * key - null-terminated string
+ * key_hash - hash() of the key
+ */
+long
+string_set_find_slot(string_set_t *set, const char *key, unsigned long key_hash)
+{
+	unsigned char tag = string_set_tag(key_hash);
+	long index = key_hash % set->max_entries;
+
+	while (set->tags[index] != 0) {
+		if ((set->tags[index] == tag) && (strcmp(set->keys[index], key) == 0))
+			break;
+		if (++index == set->max_entries)
+			index = 0;
+	}
+	return index;
+}
+
+/*
+ * Resize the set, rehashing all keys. Keys tagged STRING_SET_DROPPED are
+ * freed instead of being moved.
+ *
+ * Returns 0 on success, or -1 if the new table could not be allocated, in
+ * which case the set is left unchanged
+ *
+ * set - set to resize
+ * new_size - new size - this should be prime
+ */
+int
+string_set_rebuild_table(string_set_t *set, long new_size)
+{
+	unsigned char *new_tags = (unsigned char *)calloc(new_size, sizeof(unsigned char));
+	dict_key_t *new_keys = (dict_key_t *)calloc(new_size, sizeof(dict_key_t));
+
+	if ((new_tags == NULL) || (new_keys == NULL)) {
+		fprintf(stderr, "Unable to allocate %lu slots to resize set %p\n", new_size, set);
+		free(new_tags);
+		free(new_keys);
+		return -1;
+	}
+
+	// keys are distinct, so each one goes in the first empty slot of its probe sequence
+	long count = 0;
+	for (long i=0; i < set->max_entries; i++) {
+		if (set->tags[i] == 0)
+			continue;
+		if (set->tags[i] == STRING_SET_DROPPED) {
+			free(set->keys[i]);
+			continue;
+		}
+		long index = hash((unsigned char *)set->keys[i]) % new_size;
+		while (new_tags[index] != 0) {
+			if (++index == new_size)
+				index = 0;
+		}
+		new_tags[index] = set->tags[i];
+		new_keys[index] = set->keys[i];
+		count++;
+	}
+
+	free(set->tags);
+	free(set->keys);
+	set->tags = new_tags;
+	set->keys = new_keys;
+	set->max_entries = new_size;
+	set->num_entries = count;
+
+	return 0;
+}
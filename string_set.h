@@ -0,0 +1,158 @@
+/*
+ * string_set.h - set of strings, a dictionary with keys and no values
+ *
+ * A dictionary used as a set pays for a value in every slot and in every
+ * collision bucket entry. A string set keeps a single array of key
+ * pointers, with linear probing instead of collision buckets, and a one
+ * byte tag per slot taken from the key's hash. A probe compares tags
+ * first, so it only follows a key pointer to compare strings when the tags
+ * match, and an empty slot is recognized from the tags alone. Keys are
+ * hashed with the same djb2 hash as dictionary_t, and the table is sized
+ * by the same policy (see capacity.h).
+ *
+ * Keys are copied when they are added and freed when they are removed.
+ */
+
+#ifndef STRING_SET
+
+#define STRING_SET
+
+#include "dictionary.h"
+
+#define STRING_SET_BATCH	16		// lookups in flight in string_set_contains_batch()
+
+#if __has_extension(blocks)
+// Use blocks instead of function pointers if we have them
+typedef void (^ string_set_enumerator_t) (dict_key_t);
+#else
+// Define a function returning void that takes a key as argument
+// to be passed as the second argument to string_set_enumerate()
+typedef void (* string_set_enumerator_t) (dict_key_t);
+#endif
+
+typedef struct string_set_t {
+	long num_entries;
+	long max_entries;
+	long min_entries;		// automatic shrinking stops at this size
+	unsigned char *tags;	// 0 for an empty slot, otherwise 0x80 and 7 bits of the hash
+	dict_key_t *keys;
+	double load_factor;
+} string_set_t;
+
+/*
+ * Allocate a set with a slot array initialized to DICT_INITIAL_SIZE
+ */
+string_set_t *
+new_string_set();
+
+/*
+ * Allocate a set with a slot array initialized to a user-defined value
+ *
+ * initial_size - this should be a prime number to help ensure good distribution
+ *
+ * load_factor - between 0 and 1.0 to resize the set when its size
+ * 		exceeds this value * the current capacity of the set
+ */
+string_set_t *
+new_string_set_size_load(long initial_size, double load_factor);
+
+/*
+ * Free a set created by new_string_set(), and its keys
+ */
+void
+free_string_set(string_set_t *set);
+
+/*
+ * Add a key to the set
+ *
+ * Returns 1 if the key was added, 0 if it was already in the set
+ *
+ * set - allocated by new_string_set()
+ * key - null-terminated string will be copied and managed by the set
+ */
+int
+string_set_add(string_set_t *set, const char *key);
+
+/*
+ * Returns 1 if the key is in the set, 0 if not
+ *
+ * set - allocated by new_string_set()
+ * key - null-terminated string
+ */
+int
+string_set_contains(string_set_t *set, const char *key);
+
+/*
+ * Look up many keys at once. The keys are hashed STRING_SET_BATCH at a
+ * time and their first slots prefetched before any of them is probed, so
+ * the cache misses of a batch overlap instead of being taken one by one.
+ *
+ * Returns the number of keys found
+ *
+ * set - allocated by new_string_set()
+ * keys - null-terminated strings
+ * count - number of keys
+ * found - receives 1 for each key in the set and 0 for the others, may be
+ * 		NULL to only count them
+ */
+long
+string_set_contains_batch(string_set_t *set, const char **keys, long count, unsigned char *found);
+
+/*
+ * Remove a key from the set
+ *
+ * Returns 1 if the key was removed, 0 if it was not in the set
+ *
+ * set - allocated by new_string_set()
+ * key - null-terminated string
+ */
+int
+string_set_remove(string_set_t *set, const char *key);
+
+/*
+ * Size the set so that it can hold expected_entries without resizing.
+ * Returns 0 on success, or -1 if the table could not be allocated
+ *
+ * set - allocated by new_string_set()
+ * expected_entries - number of keys the set will hold
+ */
+int
+string_set_reserve(string_set_t *set, long expected_entries);
+
+/*
+ * Add every key of src to dest. dest is grown once for both sets, then the
+ * slots of src are walked directly.
+ *
+ * Returns 0 on success, or -1 if dest could not be grown, in which case it
+ * is unchanged
+ *
+ * dest - set receiving the keys
+ * src - set to add, not modified
+ */
+int
+string_set_union(string_set_t *dest, string_set_t *src);
+
+/*
+ * Remove from dest every key that is not in src. The slots of dest are
+ * walked directly, and the table is rebuilt once at the size for the keys
+ * that are left.
+ *
+ * Returns 0 on success, or -1 if the smaller table could not be allocated,
+ * in which case dest is unchanged
+ *
+ * dest - set to reduce
+ * src - set to intersect with, not modified
+ */
+int
+string_set_intersect(string_set_t *dest, string_set_t *src);
+
+/*
+ * For each key in the set, execute the enumeration function.
+ *
+ * set - set to enumerate
+ * enum_function - function returning void that takes a key as argument
+ */
+void
+string_set_enumerate(string_set_t *set, string_set_enumerator_t enum_function);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * test_cuckoo_dictionary.c
+ *
+ * Loads the lines of a file into a cuckoo dictionary, checks puts, gets
+ * and removals against a dictionary_t holding the same entries, and
+ * compares their lookup speed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "dictionary.h"
+#include "cuckoo_dictionary.h"
+#include "test_util.h"
+
+/*
+ * Put every line with its line number, replace some values, and check
+ * every lookup of present and missing keys
+ */
+void
+test_put_get(char **lines, long count)
+{
+	struct timespec start;
+	long errors = 0;
+
+	printf("Testing cuckoo_dictionary_put() and _get() with %lu keys...\n", count);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dictionary_t *dict = new_dictionary();
+	for (long i=0; i < count; i++)
+		dictionary_put(dict, lines[i], (dict_value_t)(i + 1));
+	double dict_put_seconds = elapsed_seconds(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	cuckoo_dictionary_t *cuckoo = new_cuckoo_dictionary();
+	for (long i=0; i < count; i++) {
+		if (cuckoo_dictionary_put(cuckoo, lines[i], (dict_value_t)(i + 1)) != NULL)
+			errors++;
+	}
+	double cuckoo_put_seconds = elapsed_seconds(&start);
+
+	// replacing a value returns the previous one
+	for (long i=0; i < count; i += 7) {
+		if (cuckoo_dictionary_put(cuckoo, lines[i], (dict_value_t)(i + 1)) != (dict_value_t)(i + 1))
+			errors++;
+	}
+	if (cuckoo->num_entries != dict->num_entries)
+		errors++;
+
+	printf("1) put in %.3fs, %.2f moves per entry, %.0f%% full; dictionary_put() took %.3fs\n",
+		cuckoo_put_seconds, (double)cuckoo->num_kicks / cuckoo->num_entries,
+		100.0 * cuckoo->num_entries / (cuckoo->num_buckets * CUCKOO_BUCKET_SLOTS), dict_put_seconds);
+
+	char **missing = malloc(count * sizeof(char *));
+	for (long i=0; i < count; i++) {
+		missing[i] = malloc(strlen(lines[i]) + 2);
+		sprintf(missing[i], "%s#", lines[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i=0; i < count; i++) {
+		if (dictionary_get(dict, lines[i]) != (dict_value_t)(i + 1))
+			errors++;
+		if (dictionary_get(dict, missing[i]) != NULL)
+			errors++;
+	}
+	double dict_get_seconds = elapsed_seconds(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i=0; i < count; i++) {
+		if (cuckoo_dictionary_get(cuckoo, lines[i]) != (dict_value_t)(i + 1))
+			errors++;
+		if (cuckoo_dictionary_get(cuckoo, missing[i]) != NULL)
+			errors++;
+	}
+	double cuckoo_get_seconds = elapsed_seconds(&start);
+
+	if (errors > 0) {
+		printf("Error found in test_put_get(), %lu lookups were wrong\n", errors);
+	}
+	else {
+		printf("2) %lu lookups in %.3fs, at most %d slots each; dictionary_get() took %.3fs, maximum chain %lu\n",
+			2 * count, cuckoo_get_seconds, 2 * CUCKOO_BUCKET_SLOTS, dict_get_seconds, dict->maximum_chain);
+	}
+
+	for (long i=0; i < count; i++)
+		free(missing[i]);
+	free(missing);
+	free_cuckoo_dictionary(cuckoo);
+	free_dictionary(dict);
+}
+
+/*
+ * Remove every other key, then all but a few, and check that the table shrinks
+ */
+void
+test_remove(char **lines, long count)
+{
+	long errors = 0;
+
+	printf("Testing cuckoo_dictionary_remove()...\n");
+
+	cuckoo_dictionary_t *cuckoo = new_cuckoo_dictionary();
+	for (long i=0; i < count; i++)
+		cuckoo_dictionary_put(cuckoo, lines[i], (dict_value_t)(i + 1));
+	long peak_buckets = cuckoo->num_buckets;
+
+	// a NULL key is ignored, as dictionary_put() ignores it
+	if ((cuckoo_dictionary_put(cuckoo, NULL, (dict_value_t)1L) != NULL) || (cuckoo_dictionary_get(cuckoo, NULL) != NULL)
+		|| (cuckoo_dictionary_remove(cuckoo, NULL) != NULL) || (cuckoo->num_entries != count))
+		errors++;
+
+	for (long i=0; i < count; i += 2) {
+		if (cuckoo_dictionary_remove(cuckoo, lines[i]) != (dict_value_t)(i + 1))
+			errors++;
+	}
+	for (long i=0; i < count; i++) {
+		dict_value_t expected = (i % 2) ? (dict_value_t)(i + 1) : NULL;
+		if (cuckoo_dictionary_get(cuckoo, lines[i]) != expected)
+			errors++;
+	}
+
+#if __has_extension(blocks)
+	__block long enumerated = 0;
+#else
+	long enumerated = 0;
+#endif
+
+#if __has_nested_functions
+	void
+	count_entry(dict_key_t key, dict_value_t value)
+	{
+		enumerated++;
+	}
+
+	cuckoo_dictionary_enumerate(cuckoo, &count_entry);
+#elif __has_extension(blocks)
+	cuckoo_dictionary_enumerate(cuckoo, ^ void (dict_key_t key, dict_value_t value) {
+		enumerated++;
+	});
+#endif
+	if ((enumerated != cuckoo->num_entries) || (cuckoo->num_entries != count / 2))
+		errors++;
+
+	for (long i=1; i < count - 10; i += 2)
+		cuckoo_dictionary_remove(cuckoo, lines[i]);
+	for (long i=count - 10; i < count; i++) {
+		dict_value_t expected = (i % 2) ? (dict_value_t)(i + 1) : NULL;
+		if (cuckoo_dictionary_get(cuckoo, lines[i]) != expected)
+			errors++;
+	}
+
+	if ((errors > 0) || (cuckoo->num_buckets >= peak_buckets)) {
+		printf("Error found in test_remove(), %lu entries were wrong, %lu buckets\n", errors, cuckoo->num_buckets);
+	}
+	else {
+		printf("1) %lu buckets at peak, %lu with %lu entries left\n", peak_buckets, cuckoo->num_buckets, cuckoo->num_entries);
+	}
+
+	free_cuckoo_dictionary(cuckoo);
+}
+
+int
+main(int argc, char **argv)
+{
+	long count;
+
+	if (argc < 2) {
+		printf("usage: test_cuckoo_dictionary <filename>\n");
+		printf("	Puts the distinct lines of a file into a cuckoo dictionary\n");
+		return 1;
+	}
+
+	char **lines = read_lines(argv[1], &count);
+	if (lines == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	test_put_get(lines, count);
+	test_remove(lines, count);
+
+	for (long i=0; i < count; i++)
+		free(lines[i]);
+	free(lines);
+
+	return 0;
+}
@@ -7,8 +7,23 @@
 #include <stdio.h>
 #include <string.h>	// strdup(), strcmp()
 #include <stdlib.h>	// free()
+#include <time.h>
+#include <unistd.h>	// unlink()
+#include <fcntl.h>	// open()
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __GLIBC__
+#include <malloc.h>	// malloc_usable_size()
+#endif
 
 #include "dictionary.h"
+#include "bloom_filter.h"
+#include "dictionary_log.h"
+#include "ordered_index.h"
+#include "partitioned_dictionary.h"
+#include "shared_dictionary.h"
+#include "hash.h"
+#include "test_util.h"
 
 long
 load_words(dictionary_t *dict, const char *filename)
@@ -250,37 +265,2323 @@ test_unload(char *filename, long size, double load_factor)
 	free_dictionary(dict);
 }
 
-int
-main(int argc, char **argv)
+/*
+ * Load the dictionary, remove four out of every five entries, and check that
+ * the dictionary shrinks on its own and that dictionary_compact() brings it down
+ * to the minimum size without losing any of the remaining entries.
+ */
+void
+test_compact(char *filename, long size, double load_factor)
 {
-	if (argc == 1)
-		goto usage;
+	dictionary_t *dict = new_dictionary_size_load(size, load_factor);
 
-	long size = 5;
-	double load_factor = LOAD_FACTOR;
-	char * filename = NULL;
+	printf("Testing dictionary_compact()...\n");
 
-	for (int i=1; i < argc; i++) {
-		if (strcmp("--size", argv[i]) == 0) {
-			size = atol(argv[i+1]);
-			i++;
+	long bytes_allocated = load_words(dict, filename);
+	long peak_size = dict->max_entries;
+
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		perror("test_compact()");
+		return;
+	}
+
+	char line[256];
+	long count = 0;
+
+	while (fgets(line, 256, input)) {
+		size_t len = strlen(line);
+		if (len == 0)
+			continue;
+		if (line[len-1] == '\n')
+			line[--len] = '\0';
+
+		if ((count++ % 5) != 0) {
+			char *removed_value = (char *)dictionary_remove(dict, line);
+			if (removed_value) {
+				bytes_allocated -= (strlen(removed_value)+1);
+				free(removed_value);
+			}
 		}
-		else if (strcmp("--load", argv[i]) == 0) {
-			load_factor = atof(argv[i+1]);
-			i++;
+	}
+
+	long purged_size = dict->max_entries;
+	dictionary_compact(dict);
+
+	printf("1) capacity %lu at peak, %lu after removing 80%% of the entries, %lu after compacting %lu entries\n",
+		peak_size, purged_size, dict->max_entries, dict->num_entries);
+
+	if ((purged_size >= peak_size) || (dict->max_entries > purged_size)) {
+		printf("Error found in test_compact(), dictionary did not shrink\n");
+	}
+	if (dict->num_entries > dict->load_factor * dict->max_entries) {
+		printf("Error found in test_compact(), %lu entries exceed the load factor of %lu slots\n",
+			dict->num_entries, dict->max_entries);
+	}
+
+	// every fifth key must have survived the purge and the rebuilds
+	rewind(input);
+	count = 0;
+	while (fgets(line, 256, input)) {
+		size_t len = strlen(line);
+		if (len == 0)
+			continue;
+		if (line[len-1] == '\n')
+			line[--len] = '\0';
+
+		char *value = (char *)dictionary_get(dict, line);
+		if (((count++ % 5) == 0) && ((value == NULL) || (strcmp(value, line) != 0))) {
+			printf("Error found in test_compact(), key '%s' is missing after compacting\n", line);
 		}
-		else {
-			filename = argv[i];
+	}
+	fclose(input);
+
+	long bytes_freed = free_words(dict);
+	if (bytes_allocated != bytes_freed) {
+		printf("Failed to free %lu bytes: %lu allocated, only %lu were freed\n",
+			bytes_allocated - bytes_freed, bytes_allocated, bytes_freed);
+	}
+	else {
+		printf("2) All remaining entries were found and freed.\n");
+	}
+
+	free_dictionary(dict);
+}
+
+/*
+ * Count the lines in the file, reserve room for that many entries, and check
+ * that loading the file doesn't resize the dictionary again.
+ */
+void
+test_reserve(char *filename, double load_factor)
+{
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		perror("test_reserve()");
+		return;
+	}
+
+	char line[256];
+	long num_lines = 0;
+	while (fgets(line, 256, input)) {
+		num_lines++;
+	}
+	fclose(input);
+
+	printf("Testing dictionary_reserve()...\n");
+
+	dictionary_t *dict = new_dictionary_size_load(DICT_INITIAL_SIZE, load_factor);
+	if (dictionary_reserve(dict, num_lines) != 0) {
+		printf("Error found in test_reserve(), unable to reserve %lu entries\n", num_lines);
+		free_dictionary(dict);
+		return;
+	}
+
+	long reserved_size = dict->max_entries;
+	long bytes_allocated = load_words(dict, filename);
+
+	printf("1) reserved %lu slots for %lu lines, capacity after loading is %lu\n",
+		reserved_size, num_lines, dict->max_entries);
+	if (dict->max_entries != reserved_size) {
+		printf("Error found in test_reserve(), dictionary was resized after reserving\n");
+	}
+
+	long bytes_freed = free_words(dict);
+	if (bytes_allocated != bytes_freed) {
+		printf("Failed to free %lu bytes: %lu allocated, only %lu were freed\n",
+			bytes_allocated - bytes_freed, bytes_allocated, bytes_freed);
+	}
+
+	free_dictionary(dict);
+}
+
+/*
+ * Load the dictionary with a membership filter, look up every key and a
+ * missing variant of every key, then remove half the keys and check that
+ * the filter never hides a key that is still present.
+ */
+void
+test_filter(char *filename, long size, double load_factor)
+{
+	dictionary_t *dict = new_dictionary_size_load(size, load_factor);
+
+	printf("Testing dictionary_enable_filter()...\n");
+
+	if (dictionary_enable_filter(dict, 8) != 0) {
+		printf("Error found in test_filter(), unable to allocate filter\n");
+		free_dictionary(dict);
+		return;
+	}
+
+	long bytes_allocated = load_words(dict, filename);
+
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		perror("test_filter()");
+		return;
+	}
+
+	char line[256];
+	long count = 0;
+	long false_positives = 0;
+
+	while (fgets(line, 256, input)) {
+		size_t len = strlen(line);
+		if (len == 0)
+			continue;
+		if (line[len-1] == '\n')
+			line[--len] = '\0';
+
+		if (dictionary_get(dict, line) == NULL) {
+			printf("Error found in test_filter(), key '%s' is missing\n", line);
+		}
+
+		// no key in the file ends in a tab
+		line[len] = '\t';
+		line[len+1] = '\0';
+		if (dictionary_get(dict, line) != NULL) {
+			printf("Error found in test_filter(), found missing key '%s'\n", line);
+		}
+		if (bloom_filter_may_contain(dict->filter, hash((unsigned char *)line))) {
+			false_positives++;
 		}
+		count++;
 	}
 
-	if (filename == NULL)
-		goto usage;
+	printf("1) %lu of %lu missing keys passed the filter (%.2f%%)\n",
+		false_positives, count, 100.0 * false_positives / count);
 
-	test_load(filename, size, load_factor);
+	// remove every other key, the rest must still be found
+	rewind(input);
+	count = 0;
+	while (fgets(line, 256, input)) {
+		size_t len = strlen(line);
+		if (len == 0)
+			continue;
+		if (line[len-1] == '\n')
+			line[--len] = '\0';
 
-	// repeat the test, but instead of deallocating, use the remove function
-	test_unload(filename, size, load_factor);
+		if ((count++ % 2) == 0) {
+			char *removed_value = (char *)dictionary_remove(dict, line);
+			if (removed_value) {
+				bytes_allocated -= (strlen(removed_value)+1);
+				free(removed_value);
+			}
+		}
+		else if (dictionary_get(dict, line) == NULL) {
+			printf("Error found in test_filter(), key '%s' is missing after removals\n", line);
+		}
+	}
+	fclose(input);
+
+	long bytes_freed = free_words(dict);
+	if (bytes_allocated != bytes_freed) {
+		printf("Failed to free %lu bytes: %lu allocated, only %lu were freed\n",
+			bytes_allocated - bytes_freed, bytes_allocated, bytes_freed);
+	}
+	else {
+		printf("2) All remaining entries were found and freed.\n");
+	}
+
+	free_dictionary(dict);
+}
+
+/*
+ * Eviction callback for test_cache(), frees the value and counts evictions
+ */
+void
+evict_word(dict_key_t key, dict_value_t value, void *context)
+{
+	long *evicted = (long *)context;
+
+	if (strcmp(key, (char *)value) != 0) {
+		printf("Error found in evict_word(), key '%s' has value '%s'\n", key, (char *)value);
+	}
+	free(value);
+	(*evicted)++;
+}
+
+/*
+ * Values in test_cache() are copies of their keys
+ */
+long
+word_size(dict_key_t key, dict_value_t value, void *context)
+{
+	return strlen((char *)value) + 1;
+}
+
+/*
+ * Put count keys that all have the same djb2 hash, "Az" and "BY" hash alike
+ * so any string of those pairs collides with every other, and return the
+ * longest chain
+ */
+long
+load_colliding_keys(dictionary_t *dict, int num_pairs)
+{
+	char key[64];
+	long count = 1L << num_pairs;
+
+	for (long i=0; i < count; i++) {
+		for (int j=0; j < num_pairs; j++)
+			memcpy(&key[j*2], ((i >> j) & 1) ? "BY" : "Az", 2);
+		key[num_pairs*2] = '\0';
+		dictionary_put(dict, key, (dict_value_t)(i + 1));
+	}
+
+	long errors = 0;
+	for (long i=0; i < count; i++) {
+		for (int j=0; j < num_pairs; j++)
+			memcpy(&key[j*2], ((i >> j) & 1) ? "BY" : "Az", 2);
+		key[num_pairs*2] = '\0';
+		if (dictionary_get(dict, key) != (dict_value_t)(i + 1))
+			errors++;
+	}
+	if (errors > 0) {
+		printf("Error found in test_seed(), %lu colliding keys had the wrong value\n", errors);
+	}
+
+	return dict->maximum_chain;
+}
+
+/*
+ * Load every word into a cache limited to max_entries or max_bytes, reading
+ * a few hot words back after every put, and check that the cache stays
+ * within its limits and keeps the hot words.
+ */
+void
+test_cache_limit(char *filename, long max_entries, long max_bytes)
+{
+	dictionary_t *dict = new_dictionary();
+	long evicted = 0;
+
+	if (dictionary_set_cache(dict, max_entries, max_bytes, &evict_word, &word_size, &evicted) != 0) {
+		printf("Error found in test_cache(), unable to allocate cache\n");
+		free_dictionary(dict);
+		return;
+	}
+
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		perror("test_cache()");
+		free_dictionary(dict);
+		return;
+	}
+
+	char line[256];
+	char *hot_words[16];
+	long count = 0;
+	long over_limit = 0;
+
+	while (fgets(line, 256, input)) {
+		size_t len = strlen(line);
+		if (len == 0)
+			continue;
+		if (line[len-1] == '\n')
+			line[--len] = '\0';
+
+		char *value = strdup(line);
+		char *replaced_value = (char *)dictionary_put(dict, line, (dict_value_t)value);
+		if (replaced_value)
+			free(replaced_value);
+		if (dictionary_get(dict, line) != value) {
+			printf("Error found in test_cache(), key '%s' was evicted as soon as it was added\n", line);
+		}
+
+		// keep copies, the values themselves are freed when evicted
+		if (count < 16)
+			hot_words[count] = strdup(line);
+		for (int i=0; (i < 16) && (i < count); i++)
+			dictionary_get(dict, hot_words[i]);
+
+		if (((max_entries > 0) && (dict->num_entries > max_entries))
+			|| ((max_bytes > 0) && (dict->cache->num_bytes > max_bytes)))
+			over_limit++;
+		count++;
+	}
+	fclose(input);
+
+	int hot_found = 0;
+	for (int i=0; (i < 16) && (i < count); i++) {
+		char *value = (char *)dictionary_get(dict, hot_words[i]);
+		if ((value != NULL) && (strcmp(value, hot_words[i]) == 0))
+			hot_found++;
+		free(hot_words[i]);
+	}
+
+	printf("\t%lu words, %lu entries (%lu bytes) cached, %lu evicted, %d of 16 hot words kept\n",
+		count, dict->num_entries, dict->cache->num_bytes, evicted, hot_found);
+
+	if (over_limit > 0) {
+		printf("Error found in test_cache(), cache exceeded its limit after %lu puts\n", over_limit);
+	}
+	if (evicted + dict->num_entries != count) {
+		printf("Error found in test_cache(), %lu evicted + %lu cached != %lu words\n",
+			evicted, dict->num_entries, count);
+	}
+	if (hot_found < ((count < 16) ? count : 16)) {
+		printf("Error found in test_cache(), frequently used words were evicted\n");
+	}
+
+	free_words(dict);
+	free_dictionary(dict);
+}
+
+void
+test_cache(char *filename)
+{
+	printf("Testing dictionary_set_cache()...\n");
+	test_cache_limit(filename, 1000, 0);
+	test_cache_limit(filename, 0, 20000);
+
+	// a collision bucket that exists before cache mode gets reference bits,
+	// and the entries found since are the ones that survive eviction
+	dictionary_t *dict = new_dictionary();
+	load_colliding_keys(dict, 4);
+	dictionary_set_cache(dict, 16, 0, NULL, NULL, NULL);
+	char key[16];
+	for (long i=0; i < 16; i += 2) {
+		for (int j=0; j < 4; j++)
+			memcpy(&key[j*2], ((i >> j) & 1) ? "BY" : "Az", 2);
+		key[8] = '\0';
+		dictionary_get(dict, key);
+	}
+	for (long i=0; i < 8; i++) {
+		sprintf(key, "new %lu", i);
+		dictionary_put(dict, key, (dict_value_t)(i + 1));
+	}
+	long survivors = 0;
+	for (long i=0; i < 16; i += 2) {
+		for (int j=0; j < 4; j++)
+			memcpy(&key[j*2], ((i >> j) & 1) ? "BY" : "Az", 2);
+		key[8] = '\0';
+		survivors += (dictionary_get(dict, key) == (dict_value_t)(i + 1));
+	}
+	if ((survivors != 8) || (dict->num_entries != 16)) {
+		printf("Error found in test_cache(), %lu of 8 referenced colliding keys survived\n", survivors);
+	}
+	else {
+		printf("3) referenced entries of a collision bucket survived eviction\n");
+	}
+	free_dictionary(dict);
+}
+
+// a clock that only moves when the test says so
+typedef struct test_clock_t {
+	long now;
+	long expired;
+	long bytes_expired;
+} test_clock_t;
+
+long
+test_clock_now(void *context)
+{
+	return ((test_clock_t *)context)->now;
+}
+
+/*
+ * Expiry callback for test_expiry(), frees the value and counts it
+ */
+void
+expire_word(dict_key_t key, dict_value_t value, void *context)
+{
+	test_clock_t *clock = (test_clock_t *)context;
+
+	if (strcmp(key, (char *)value) != 0) {
+		printf("Error found in expire_word(), key '%s' has value '%s'\n", key, (char *)value);
+	}
+	clock->bytes_expired += strlen((char *)value) + 1;
+	clock->expired++;
+	free(value);
+}
+
+/*
+ * Give every word an expiration time of 0 (never) to 3 ticks, advance the
+ * clock past some of them, and check that expired words are missing and
+ * are all reclaimed by dictionary_expire_step() without a full scan.
+ */
+void
+test_expiry(char *filename, long size, double load_factor)
+{
+	dictionary_t *dict = new_dictionary_size_load(size, load_factor);
+	test_clock_t clock = { 0, 0, 0 };
+
+	printf("Testing dictionary_enable_expiry()...\n");
+
+	if (dictionary_enable_expiry(dict, &test_clock_now, &expire_word, &clock) != 0) {
+		printf("Error found in test_expiry(), unable to allocate expiration times\n");
+		free_dictionary(dict);
+		return;
+	}
+
+	long bytes_allocated = load_words(dict, filename);
+
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		perror("test_expiry()");
+		free_dictionary(dict);
+		return;
+	}
+
+	char line[256];
+	long count = 0;
+	long expiring = 0;
+
+	while (fgets(line, 256, input)) {
+		size_t len = strlen(line);
+		if (len == 0)
+			continue;
+		if (line[len-1] == '\n')
+			line[--len] = '\0';
+
+		// half of the expiring words are set when they are stored
+		long expires = count % 4;
+		if (expires == 0) {
+			count++;
+			continue;
+		}
+		if ((count % 8) < 4) {
+			char *value = strdup(line);
+			free(dictionary_put_expire(dict, line, (dict_value_t)value, expires));
+		}
+		else if (dictionary_set_expire(dict, line, expires) != 0) {
+			printf("Error found in test_expiry(), unable to set expiration of '%s'\n", line);
+		}
+		if (expires <= 2)
+			expiring++;
+		count++;
+	}
+
+	// words expiring at 1 and 2 are gone once the clock reads 2
+	clock.now = 2;
+	rewind(input);
+	count = 0;
+	long errors = 0;
+	while (fgets(line, 256, input)) {
+		size_t len = strlen(line);
+		if (len == 0)
+			continue;
+		if (line[len-1] == '\n')
+			line[--len] = '\0';
+
+		// only touch every third word, the rest must be reclaimed by expire_step
+		long expires = count % 4;
+		if ((count++ % 3) != 0)
+			continue;
+		int found = (dictionary_get(dict, line) != NULL);
+		if (found != ((expires == 0) || (expires > 2)))
+			errors++;
+	}
+	fclose(input);
+
+	long lazily_expired = clock.expired;
+	long steps = 0;
+	while ((clock.expired < expiring) && (steps <= dict->max_entries / 64 + 1)) {
+		dictionary_expire_step(dict, 64);
+		steps++;
+	}
+
+	printf("1) %lu of %lu words expired, %lu when touched and %lu in %lu steps of 64 slots\n",
+		clock.expired, count, lazily_expired, clock.expired - lazily_expired, steps);
+
+	if (errors > 0) {
+		printf("Error found in test_expiry(), %lu words had the wrong expiration\n", errors);
+	}
+	if ((clock.expired != expiring) || (dict->num_entries != count - expiring)) {
+		printf("Error found in test_expiry(), %lu of %lu words expired, %lu left\n",
+			clock.expired, expiring, dict->num_entries);
+	}
+
+	// nothing left has expired, a full sweep finds nothing
+	if (dictionary_expire_step(dict, dict->max_entries) != 0) {
+		printf("Error found in test_expiry(), expired words were left behind\n");
+	}
+
+	long bytes_freed = free_words(dict);
+	if (bytes_allocated != bytes_freed + clock.bytes_expired) {
+		printf("Failed to free %lu bytes: %lu allocated, only %lu were freed\n",
+			bytes_allocated - bytes_freed - clock.bytes_expired, bytes_allocated,
+			bytes_freed + clock.bytes_expired);
+	}
+	else {
+		printf("2) All remaining entries were found and freed.\n");
+	}
+
+	free_dictionary(dict);
+
+	// expiry enabled after a collision bucket exists, and carried by a clone
+	test_clock_t bucket_clock = { 0, 0, 0 };
+	dict = new_dictionary();
+	load_colliding_keys(dict, 5);
+	dictionary_enable_expiry(dict, &test_clock_now, NULL, &bucket_clock);
+	char key[16];
+	for (long i=0; i < 32; i += 2) {
+		for (int j=0; j < 5; j++)
+			memcpy(&key[j*2], ((i >> j) & 1) ? "BY" : "Az", 2);
+		key[10] = '\0';
+		dictionary_set_expire(dict, key, 1);
+	}
+	dictionary_t *copy = dictionary_clone(dict);
+	bucket_clock.now = 1;
+	errors = 0;
+	for (long i=0; i < 32; i++) {
+		for (int j=0; j < 5; j++)
+			memcpy(&key[j*2], ((i >> j) & 1) ? "BY" : "Az", 2);
+		key[10] = '\0';
+		dict_value_t expected = (i % 2 == 0) ? NULL : (dict_value_t)(i + 1);
+		if ((dictionary_get(dict, key) != expected) || (dictionary_get(copy, key) != expected))
+			errors++;
+	}
+	if ((errors > 0) || (dict->num_entries != 16) || (copy->num_entries != 16)) {
+		printf("Error found in test_expiry(), %lu colliding keys expired wrongly\n", errors);
+	}
+	else {
+		printf("3) half of a collision bucket expired, in the dictionary and its clone\n");
+	}
+	free_dictionary(copy);
+	free_dictionary(dict);
+}
+
+/*
+ * Check that a seeded dictionary scatters keys that collide under djb2,
+ * that automatic reseeding keeps every entry, and compare the speed of
+ * the keyed and unkeyed hashes on ordinary keys
+ */
+void
+test_seed(char *filename, long size, double load_factor)
+{
+	static const unsigned long fixed_seed[2] = { 0x0123456789abcdefUL, 0xfedcba9876543210UL };
+	struct timespec start;
+
+	printf("Testing dictionary_enable_seed()...\n");
+
+	dictionary_t *dict = new_dictionary_size_load(size, load_factor);
+	long unseeded_chain = load_colliding_keys(dict, 12);
+	free_dictionary(dict);
+
+	dict = new_dictionary_size_load(size, load_factor);
+	if (dictionary_enable_seed(dict, fixed_seed, 0) != 0) {
+		printf("Error found in test_seed(), unable to seed the dictionary\n");
+	}
+	long seeded_chain = load_colliding_keys(dict, 12);
+	free_dictionary(dict);
+
+	printf("1) 4096 colliding keys: longest chain %lu with djb2, %lu with a seed\n",
+		unseeded_chain, seeded_chain);
+	if (seeded_chain > 16) {
+		printf("Error found in test_seed(), seeded dictionary has a chain of %lu\n", seeded_chain);
+	}
+
+	// reseed whenever a chain reaches 2, which ordinary keys do all the time
+	dict = new_dictionary_size_load(size, load_factor);
+	dictionary_enable_seed(dict, fixed_seed, 1);
+	long bytes_allocated = load_words(dict, filename);
+	if ((dict->seed[0] == fixed_seed[0]) && (dict->seed[1] == fixed_seed[1])) {
+		printf("Error found in test_seed(), dictionary was never reseeded\n");
+	}
+	long bytes_freed = free_words(dict);
+	if (bytes_allocated != bytes_freed) {
+		printf("Failed to free %lu bytes: %lu allocated, only %lu were freed\n",
+			bytes_allocated - bytes_freed, bytes_allocated, bytes_freed);
+	}
+	free_dictionary(dict);
+
+	// ordinary keys, timed with and without a seed
+	double seconds[2];
+	for (int seeded=0; seeded < 2; seeded++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		dict = new_dictionary_size_load(size, load_factor);
+		if (seeded)
+			dictionary_enable_seed(dict, NULL, 0);
+		long bytes = load_words(dict, filename);
+		if (free_words(dict) != bytes) {
+			printf("Error found in test_seed(), values were lost\n");
+		}
+		free_dictionary(dict);
+		seconds[seeded] = elapsed_seconds(&start);
+	}
+	printf("2) loading the words took %.3fs with djb2, %.3fs with a seed\n", seconds[0], seconds[1]);
+}
+
+/*
+ * Returns the number of collision buckets long enough to be sorted by hash
+ * that are out of order, and the length of the longest one in longest
+ */
+long
+count_unsorted_buckets(dictionary_t *dict, long *longest)
+{
+	long unsorted = 0;
+
+	*longest = 0;
+	for (long i=0; i < dict->max_entries; i++) {
+		if (dict->keys[i] != NULL)
+			continue;
+		collision_bucket_t *bucket = dict->values[i].collision_buckets;
+		if (bucket == NULL)
+			continue;
+		if (bucket->num_elements > *longest)
+			*longest = bucket->num_elements;
+		// shorter buckets are scanned and may be in any order
+		if (bucket->num_elements < 8)
+			continue;
+		for (int j=1; j < bucket->num_elements; j++) {
+			if (bucket->entries[j-1].hash > bucket->entries[j].hash) {
+				unsorted++;
+				break;
+			}
+		}
+	}
+	return unsorted;
+}
+
+/*
+ * Overload the table so that chains grow long, then check that long buckets
+ * stay sorted and every key is still found as half of them are removed
+ */
+void
+test_sorted_buckets(char *filename, long size)
+{
+	long longest;
+
+	printf("Testing sorted collision buckets...\n");
+
+	// with a load factor of 1000 the table barely grows and chains run to dozens of entries
+	dictionary_t *dict = new_dictionary_size_load(size, 1000.0);
+	long bytes_allocated = load_words(dict, filename);
+
+	long unsorted = count_unsorted_buckets(dict, &longest);
+	printf("1) longest bucket has %lu entries, %lu long buckets out of order\n", longest, unsorted);
+	if (unsorted > 0) {
+		printf("Error found in test_sorted_buckets(), %lu buckets out of order after loading\n", unsorted);
+	}
+
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		perror(filename);
+		free_words(dict);
+		free_dictionary(dict);
+		return;
+	}
+
+	// remove every other line, then look up all of them
+	char line[256];
+	long count = 0;
+	long errors = 0;
+	while (fgets(line, 256, input)) {
+		size_t len = strlen(line);
+		if ((len > 0) && (line[len-1] == '\n'))
+			line[--len] = '\0';
+		if ((count++ % 2) == 0) {
+			char *value = (char *)dictionary_remove(dict, line);
+			if (value != NULL) {
+				bytes_allocated -= (strlen(value) + 1);
+				free(value);
+			}
+		}
+	}
+
+	rewind(input);
+	count = 0;
+	while (fgets(line, 256, input)) {
+		size_t len = strlen(line);
+		if ((len > 0) && (line[len-1] == '\n'))
+			line[--len] = '\0';
+		// a word that appears on both an odd and an even line is gone
+		char *value = (char *)dictionary_get(dict, line);
+		if ((count++ % 2) == 0) {
+			if (value != NULL)
+				errors++;
+		}
+		else if ((value != NULL) && (strcmp(value, line) != 0)) {
+			errors++;
+		}
+	}
+	fclose(input);
+	if (errors > 0) {
+		printf("Error found in test_sorted_buckets(), %lu lookups returned the wrong result\n", errors);
+	}
+
+	unsorted = count_unsorted_buckets(dict, &longest);
+	printf("2) after removing half, longest bucket has %lu entries, %lu long buckets out of order\n",
+		longest, unsorted);
+	if (unsorted > 0) {
+		printf("Error found in test_sorted_buckets(), %lu buckets out of order after removing\n", unsorted);
+	}
+
+	long bytes_freed = free_words(dict);
+	if (bytes_allocated != bytes_freed) {
+		printf("Failed to free %lu bytes: %lu allocated, only %lu were freed\n",
+			bytes_allocated - bytes_freed, bytes_allocated, bytes_freed);
+	}
+	free_dictionary(dict);
+}
+
+/*
+ * Copy a loaded dictionary with dictionary_clone(), and by enumerating and
+ * putting every entry, then check that the clone is complete and that
+ * changing it leaves the original alone
+ */
+void
+test_clone(char *filename, long size, double load_factor)
+{
+	struct timespec start;
+
+	printf("Testing dictionary_clone()...\n");
+
+	dictionary_t *dict = new_dictionary_size_load(size, load_factor);
+	dictionary_enable_filter(dict, 8);
+	long bytes_allocated = load_words(dict, filename);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dictionary_t *copy = new_dictionary_size_load(size, load_factor);
+
+#if __has_nested_functions
+	void
+	put_entry(dict_key_t key, dict_value_t value)
+	{
+		dictionary_put(copy, key, value);
+	}
+
+	dictionary_enumerate(dict, &put_entry);
+#elif __has_extension(blocks)
+	dictionary_enumerate(dict, ^ void (dict_key_t key, dict_value_t value) {
+		dictionary_put(copy, key, value);
+	});
+#endif
+	double put_seconds = elapsed_seconds(&start);
+	free_dictionary(copy);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dictionary_t *clone = dictionary_clone(dict);
+	double clone_seconds = elapsed_seconds(&start);
+
+	printf("1) copying %lu entries took %.3fs by enumerating, %.3fs with dictionary_clone()\n",
+		dict->num_entries, put_seconds, clone_seconds);
+
+	if (clone == NULL) {
+		printf("Error found in test_clone(), unable to clone the dictionary\n");
+		free_words(dict);
+		free_dictionary(dict);
+		return;
+	}
+
+#if __has_extension(blocks)
+	__block long errors = 0;
+#else
+	long errors = 0;
+#endif
+
+	// every key must be found in the clone with the same value, then removed
+	// from it, which must not disturb the original
+#if __has_nested_functions
+	void
+	check_entry(dict_key_t key, dict_value_t value)
+	{
+		if (dictionary_get(clone, key) != value)
+			errors++;
+	}
+
+	dictionary_enumerate(dict, &check_entry);
+#elif __has_extension(blocks)
+	dictionary_enumerate(dict, ^ void (dict_key_t key, dict_value_t value) {
+		if (dictionary_get(clone, key) != value)
+			errors++;
+	});
+#endif
+	if ((errors > 0) || (clone->num_entries != dict->num_entries)) {
+		printf("Error found in test_clone(), %lu of %lu entries differ in the clone\n",
+			errors, dict->num_entries);
+	}
+
+	dictionary_put(clone, "not in the original", NULL);
+	long removed = 0;
+	FILE *input = fopen(filename, "r");
+	char line[256];
+	while ((input != NULL) && fgets(line, 256, input)) {
+		size_t len = strlen(line);
+		if ((len > 0) && (line[len-1] == '\n'))
+			line[--len] = '\0';
+		dict_value_t value = dictionary_remove(clone, line);
+		if ((value == NULL) || (value != dictionary_get(dict, line)))
+			errors++;
+		removed++;
+	}
+	if (input != NULL)
+		fclose(input);
+	if (clone->num_entries != 1)
+		errors++;
+	if ((errors > 0) || (dictionary_get(dict, "not in the original") != NULL)) {
+		printf("Error found in test_clone(), changing the clone changed the original\n");
+	}
+	else {
+		printf("2) removed %lu entries from the clone, the original still has %lu\n",
+			removed, dict->num_entries);
+	}
+	free_dictionary(clone);
+
+	long bytes_freed = free_words(dict);
+	if (bytes_allocated != bytes_freed) {
+		printf("Failed to free %lu bytes: %lu allocated, only %lu were freed\n",
+			bytes_allocated - bytes_freed, bytes_allocated, bytes_freed);
+	}
+	free_dictionary(dict);
+}
+
+/*
+ * Count the words in two overlapping halves of a file in separate
+ * dictionaries, merge them adding the counts, and check the totals
+ */
+void
+test_merge(char *filename, long size, double load_factor)
+{
+	struct timespec start;
+
+	printf("Testing dictionary_merge()...\n");
+
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		perror(filename);
+		return;
+	}
+
+	char line[256];
+	long num_lines = 0;
+	while (fgets(line, 256, input))
+		num_lines++;
+
+	// the first dictionary counts the first two thirds of the lines, the
+	// second the last two thirds, so the middle third is counted by both
+	dictionary_t *first = new_dictionary_size_load(size, load_factor);
+	dictionary_t *second = new_dictionary_size_load(size, load_factor);
+	rewind(input);
+	for (long i=0; fgets(line, 256, input); i++) {
+		size_t len = strlen(line);
+		if ((len > 0) && (line[len-1] == '\n'))
+			line[--len] = '\0';
+		if (i < num_lines * 2 / 3)
+			dictionary_put(first, line, (dict_value_t)((long)dictionary_get(first, line) + 1));
+		if (i >= num_lines / 3)
+			dictionary_put(second, line, (dict_value_t)((long)dictionary_get(second, line) + 1));
+	}
+
+	long first_entries = first->num_entries;
+	long second_entries = second->num_entries;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#if __has_nested_functions
+	dict_value_t
+	add_counts(dict_key_t key, dict_value_t existing, dict_value_t incoming)
+	{
+		return (dict_value_t)((long)existing + (long)incoming);
+	}
+
+	int result = dictionary_merge(first, second, &add_counts);
+#elif __has_extension(blocks)
+	int result = dictionary_merge(first, second, ^ dict_value_t (dict_key_t key, dict_value_t existing, dict_value_t incoming) {
+		return (dict_value_t)((long)existing + (long)incoming);
+	});
+#endif
+	double seconds = elapsed_seconds(&start);
+
+	if (result != 0) {
+		printf("Error found in test_merge(), unable to merge the dictionaries\n");
+		free_dictionary(second);
+		free_dictionary(first);
+		fclose(input);
+		return;
+	}
+	printf("1) merged %lu entries into %lu in %.3fs, %lu entries in total\n",
+		second_entries, first_entries, seconds, first->num_entries);
+
+	// every word counted by both halves must have been added together
+	long errors = 0;
+	rewind(input);
+	for (long i=0; fgets(line, 256, input); i++) {
+		size_t len = strlen(line);
+		if ((len > 0) && (line[len-1] == '\n'))
+			line[--len] = '\0';
+		long expected = ((i >= num_lines / 3) && (i < num_lines * 2 / 3)) ? 2 : 1;
+		if ((long)dictionary_get(first, line) < expected)
+			errors++;
+	}
+	fclose(input);
+
+#if __has_extension(blocks)
+	__block long total = 0;
+#else
+	long total = 0;
+#endif
+
+#if __has_nested_functions
+	void
+	sum_counts(dict_key_t key, dict_value_t value)
+	{
+		total += (long)value;
+	}
+
+	dictionary_enumerate(first, &sum_counts);
+#elif __has_extension(blocks)
+	dictionary_enumerate(first, ^ void (dict_key_t key, dict_value_t value) {
+		total += (long)value;
+	});
+#endif
+
+	long expected_total = num_lines * 2 / 3 + (num_lines - num_lines / 3);
+	if ((errors > 0) || (total != expected_total)) {
+		printf("Error found in test_merge(), %lu words miscounted, total %lu, expected %lu\n",
+			errors, total, expected_total);
+	}
+	else {
+		printf("2) all %lu words were counted\n", total);
+	}
+
+	// a clone's keys are packed, merging it back must copy or skip them
+	long num_entries = first->num_entries;
+	if ((dictionary_merge(first, dictionary_clone(first), NULL) != 0) || (first->num_entries != num_entries)) {
+		printf("Error found in test_merge(), merging a clone left %lu entries, expected %lu\n",
+			first->num_entries, num_entries);
+	}
+
+	// a dictionary can't be merged into itself, and a logged source must
+	// reopen empty once its entries have moved
+	const char *log_path = "test_dictionary.log";
+	unlink(log_path);
+	dictionary_t *logged = dictionary_open_log(log_path, 10000, 0, NULL, NULL, NULL);
+	if (logged == NULL) {
+		printf("Error found in test_merge(), unable to open %s\n", log_path);
+		free_dictionary(first);
+		return;
+	}
+	dictionary_put(logged, "merged", (dict_value_t)1L);
+	dictionary_put(logged, "from the log", (dict_value_t)2L);
+	int self_merge = dictionary_merge(logged, logged, NULL);
+	int log_merge = dictionary_merge(first, logged, NULL);
+	logged = dictionary_open_log(log_path, 10000, 0, NULL, NULL, NULL);
+	if ((self_merge != -1) || (log_merge != 0) || (logged == NULL) || (logged->num_entries != 0)
+			|| ((long)dictionary_get(first, "from the log") != 2)) {
+		printf("Error found in test_merge(), merging a logged dictionary left %lu entries in its log\n",
+			(logged == NULL) ? -1 : logged->num_entries);
+	}
+	else {
+		printf("3) a logged source reopens empty after the merge\n");
+	}
+	if (logged != NULL)
+		free_dictionary(logged);
+	unlink(log_path);
+
+	// entries added by a merge reseed a table with long chains as puts do
+	dictionary_t *seeded = new_dictionary();
+	dictionary_enable_seed(seeded, NULL, 1);
+	num_entries = first->num_entries;
+	if ((dictionary_merge(seeded, first, NULL) != 0) || (seeded->num_entries != num_entries)
+			|| (seeded->reseed_capacity != seeded->max_entries) || ((long)dictionary_get(seeded, "from the log") != 2)) {
+		printf("Error found in test_merge(), a merge into a seeded dictionary did not reseed it\n");
+	}
+	else {
+		printf("4) a merge of %lu entries reseeded a table with a chain longer than 1\n", num_entries);
+	}
+	free_dictionary(seeded);
+}
+
+/*
+ * Keep an ordered index while loading and removing words, and check that
+ * range and prefix scans return the right keys in order
+ */
+void
+test_index(char *filename, long size, double load_factor)
+{
+	struct timespec start;
+
+	printf("Testing dictionary_enable_index()...\n");
+
+	dictionary_t *dict = new_dictionary_size_load(size, load_factor);
+	if (dictionary_enable_index(dict) != 0) {
+		printf("Error found in test_index(), unable to allocate the index\n");
+		free_dictionary(dict);
+		return;
+	}
+	long bytes_allocated = load_words(dict, filename);
+
+#if __has_extension(blocks)
+	__block long out_of_order = 0;
+	__block long wrong_values = 0;
+	__block long matches = 0;
+	__block const char *previous = NULL;
+	__block const char *prefix = NULL;
+#else
+	long out_of_order = 0;
+	long wrong_values = 0;
+	long matches = 0;
+	const char *previous = NULL;
+	const char *prefix = NULL;
+#endif
+
+	for (int pass=0; pass < 2; pass++) {
+		// every key in order, each with its own value
+		out_of_order = 0;
+		wrong_values = 0;
+		previous = NULL;
+#if __has_nested_functions
+		void
+		check_order(dict_key_t key, dict_value_t value)
+		{
+			if ((previous != NULL) && (strcmp(previous, key) >= 0))
+				out_of_order++;
+			if (strcmp((char *)value, key) != 0)
+				wrong_values++;
+			previous = key;
+		}
+
+		long count = dictionary_range(dict, NULL, NULL, &check_order);
+#elif __has_extension(blocks)
+		long count = dictionary_range(dict, NULL, NULL, ^ void (dict_key_t key, dict_value_t value) {
+			if ((previous != NULL) && (strcmp(previous, key) >= 0))
+				out_of_order++;
+			if (strcmp((char *)value, key) != 0)
+				wrong_values++;
+			previous = key;
+		});
+#endif
+		if ((count != dict->num_entries) || (out_of_order > 0) || (wrong_values > 0)) {
+			printf("Error found in test_index(), range of %lu entries had %lu out of order and %lu wrong values\n",
+				count, out_of_order, wrong_values);
+		}
+
+		// compare a prefix scan with a full enumeration
+		prefix = "ab";
+		matches = 0;
+		previous = NULL;
+#if __has_nested_functions
+		void
+		count_prefix(dict_key_t key, dict_value_t value)
+		{
+			if (strncmp(key, prefix, strlen(prefix)) == 0)
+				matches++;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		dictionary_enumerate(dict, &count_prefix);
+		double enumerate_seconds = elapsed_seconds(&start);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		long scanned = dictionary_prefix_scan(dict, prefix, &check_order);
+		double scan_seconds = elapsed_seconds(&start);
+#elif __has_extension(blocks)
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		dictionary_enumerate(dict, ^ void (dict_key_t key, dict_value_t value) {
+			if (strncmp(key, prefix, strlen(prefix)) == 0)
+				matches++;
+		});
+		double enumerate_seconds = elapsed_seconds(&start);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		long scanned = dictionary_prefix_scan(dict, prefix, ^ void (dict_key_t key, dict_value_t value) {
+			if ((previous != NULL) && (strcmp(previous, key) >= 0))
+				out_of_order++;
+			previous = key;
+		});
+		double scan_seconds = elapsed_seconds(&start);
+#endif
+		if ((scanned != matches) || (out_of_order > 0)) {
+			printf("Error found in test_index(), prefix scan found %lu keys, expected %lu\n", scanned, matches);
+		}
+		printf("%d) %lu entries in order, %lu start with '%s': %.4fs to enumerate, %.6fs to scan\n",
+			pass + 1, count, scanned, prefix, enumerate_seconds, scan_seconds);
+
+		// remove every other word from the ordered position, and check again
+		if (pass == 0) {
+			FILE *input = fopen(filename, "r");
+			char line[256];
+			for (long i=0; (input != NULL) && fgets(line, 256, input); i++) {
+				size_t len = strlen(line);
+				if ((len > 0) && (line[len-1] == '\n'))
+					line[--len] = '\0';
+				if ((i % 2) == 0) {
+					char *value = (char *)dictionary_remove(dict, line);
+					if (value != NULL) {
+						bytes_allocated -= (strlen(value) + 1);
+						free(value);
+					}
+				}
+			}
+			if (input != NULL)
+				fclose(input);
+		}
+	}
+
+	long bytes_freed = free_words(dict);
+	if (bytes_allocated != bytes_freed) {
+		printf("Failed to free %lu bytes: %lu allocated, only %lu were freed\n",
+			bytes_allocated - bytes_freed, bytes_allocated, bytes_freed);
+	}
+	free_dictionary(dict);
+}
+
+/*
+ * Log values as null-terminated strings
+ */
+const void *
+encode_word(dict_value_t value, size_t *length, void *context)
+{
+	*length = strlen((char *)value) + 1;
+	return value;
+}
+
+/*
+ * Rebuild a string value from the log
+ */
+dict_value_t
+decode_word(const void *bytes, size_t length, void *context)
+{
+	return strdup((const char *)bytes);
+}
+
+/*
+ * Check the words in a dictionary replayed from the log, every third word
+ * should have been removed, returns the number of errors
+ */
+long
+check_logged_words(dictionary_t *dict, const char *filename)
+{
+	FILE *input = fopen(filename, "r");
+	char line[256];
+	long errors = 0;
+	long expected = 0;
+
+	for (long i=0; (input != NULL) && fgets(line, 256, input); i++) {
+		size_t len = strlen(line);
+		if ((len > 0) && (line[len-1] == '\n'))
+			line[--len] = '\0';
+		char *value = (char *)dictionary_get(dict, line);
+		if ((i % 3) == 0) {
+			if (value != NULL)
+				errors++;
+		}
+		else {
+			expected++;
+			if ((value == NULL) || (strcmp(value, line) != 0))
+				errors++;
+		}
+	}
+	if (input != NULL)
+		fclose(input);
+	if (dict->num_entries != expected)
+		errors++;
+
+	return errors;
+}
+
+/*
+ * Load the words into a logged dictionary and remove a third of them, then
+ * replay the log, with and without a torn record at the end, and after
+ * compacting it
+ */
+void
+test_log(char *filename, long size, double load_factor)
+{
+	const char *log_path = "test_dictionary.log";
+	struct timespec start;
+	struct stat st;
+
+	printf("Testing dictionary_open_log()...\n");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dictionary_t *dict = new_dictionary_size_load(size, load_factor);
+	long bytes_allocated = load_words(dict, filename);
+	double memory_seconds = elapsed_seconds(&start);
+	free_words(dict);
+	free_dictionary(dict);
+
+	unlink(log_path);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dict = dictionary_open_log(log_path, 10000, 100, &encode_word, &decode_word, NULL);
+	if (dict == NULL) {
+		printf("Error found in test_log(), unable to open %s\n", log_path);
+		return;
+	}
+	bytes_allocated = load_words(dict, filename);
+	dictionary_sync(dict);
+	double logged_seconds = elapsed_seconds(&start);
+	printf("1) loading took %.3fs in memory, %.3fs with a log\n", memory_seconds, logged_seconds);
+
+	FILE *input = fopen(filename, "r");
+	char line[256];
+	for (long i=0; (input != NULL) && fgets(line, 256, input); i += 3) {
+		size_t len = strlen(line);
+		if ((len > 0) && (line[len-1] == '\n'))
+			line[--len] = '\0';
+		char *value = (char *)dictionary_remove(dict, line);
+		if (value != NULL) {
+			bytes_allocated -= (strlen(value) + 1);
+			free(value);
+		}
+		// skip the next two lines
+		if (!fgets(line, 256, input) || !fgets(line, 256, input))
+			break;
+	}
+	if (input != NULL)
+		fclose(input);
+	if (free_words(dict) != bytes_allocated) {
+		printf("Error found in test_log(), values were lost\n");
+	}
+	free_dictionary(dict);
+
+	// a record cut short by a crash is dropped when the log is replayed
+	FILE *log_file = fopen(log_path, "a");
+	fwrite("\001\005\000", 1, 3, log_file);
+	fclose(log_file);
+
+	for (int pass=0; pass < 2; pass++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		dict = dictionary_open_log(log_path, 10000, 100, &encode_word, &decode_word, NULL);
+		double replay_seconds = elapsed_seconds(&start);
+		if (dict == NULL) {
+			printf("Error found in test_log(), unable to reopen %s\n", log_path);
+			break;
+		}
+		long errors = check_logged_words(dict, filename);
+		stat(log_path, &st);
+		if (errors > 0) {
+			printf("Error found in test_log(), %lu words were wrong after replaying the log\n", errors);
+		}
+		else {
+			printf("%d) replayed %lu entries from %lu bytes in %.3fs\n",
+				pass + 2, dict->num_entries, (long)st.st_size, replay_seconds);
+		}
+		if ((pass == 0) && (dictionary_compact_log(dict) != 0)) {
+			printf("Error found in test_log(), unable to compact %s\n", log_path);
+		}
+		free_words(dict);
+		free_dictionary(dict);
+	}
+
+	unlink(log_path);
+}
+
+/*
+ * Overwrite the first few thousand words until their log holds more than
+ * DICT_LOG_COMPACT_RATIO records per entry, and check that the log
+ * compacted itself and still replays to the latest values
+ */
+void
+test_log_compaction(char *filename)
+{
+	const char *log_path = "test_dictionary.log";
+	const long num_words = 3000;
+	const long rounds = 2 * DICT_LOG_COMPACT_RATIO;
+	char line[256];
+	struct stat st;
+
+	printf("Testing automatic log compaction...\n");
+
+	FILE *input = fopen(filename, "r");
+	if (input == NULL) {
+		printf("Error found in test_log_compaction(), unable to open %s\n", filename);
+		return;
+	}
+
+	unlink(log_path);
+	dictionary_t *dict = dictionary_open_log(log_path, 10000, 0, NULL, NULL, NULL);
+	if (dict == NULL) {
+		printf("Error found in test_log_compaction(), unable to open %s\n", log_path);
+		fclose(input);
+		return;
+	}
+
+	long count = 0;
+	long peak_records = 0;
+	for (long round=1; round <= rounds; round++) {
+		rewind(input);
+		for (count=0; (count < num_words) && fgets(line, 256, input); count++) {
+			line[strcspn(line, "\n")] = '\0';
+			dictionary_put(dict, line, (dict_value_t)round);
+			if (dict->log->num_records > peak_records)
+				peak_records = dict->log->num_records;
+		}
+	}
+	long entries = dict->num_entries;
+	long records = dict->log->num_records;
+	free_dictionary(dict);
+
+	// nothing ever went past the ratio by more than the one record that triggered it
+	if ((peak_records > DICT_LOG_COMPACT_RATIO * entries + 1) || (records >= rounds * count)) {
+		printf("Error found in test_log_compaction(), %lu records for %lu entries, at most %lu\n",
+			records, entries, peak_records);
+	}
+
+	dict = dictionary_open_log(log_path, 10000, 0, NULL, NULL, NULL);
+	long errors = 0;
+	if (dict == NULL) {
+		errors++;
+	}
+	else {
+		rewind(input);
+		for (long i=0; (i < count) && fgets(line, 256, input); i++) {
+			line[strcspn(line, "\n")] = '\0';
+			if (dictionary_get(dict, line) != (dict_value_t)rounds)
+				errors++;
+		}
+		if (dict->num_entries != entries)
+			errors++;
+		free_dictionary(dict);
+	}
+	stat(log_path, &st);
+
+	if (errors > 0) {
+		printf("Error found in test_log_compaction(), %lu words were wrong after replaying the log\n", errors);
+	}
+	else {
+		printf("1) %lu puts of %lu words left %lu records, %lu bytes\n",
+			rounds * count, entries, records, (long)st.st_size);
+	}
+
+	fclose(input);
+	unlink(log_path);
+}
+
+/*
+ * Make the log file unwritable partway through, and check that the log
+ * fails once and stays failed while the dictionary carries on in memory
+ */
+void
+test_log_failure(char *filename)
+{
+	const char *log_path = "test_dictionary.log";
+	const long num_words = 1000;
+	char line[256];
+
+	printf("Testing a log that fails...\n");
+
+	FILE *input = fopen(filename, "r");
+	if (input == NULL) {
+		printf("Error found in test_log_failure(), unable to open %s\n", filename);
+		return;
+	}
+
+	unlink(log_path);
+	dictionary_t *dict = dictionary_open_log(log_path, 10000, 0, NULL, NULL, NULL);
+	if (dict == NULL) {
+		printf("Error found in test_log_failure(), unable to open %s\n", log_path);
+		fclose(input);
+		return;
+	}
+
+	// writes to a read-only descriptor fail with EBADF
+	int read_only = open("/dev/null", O_RDONLY);
+	dup2(read_only, dict->log->fd);
+	close(read_only);
+
+	long count;
+	for (count=0; (count < num_words) && fgets(line, 256, input); count++) {
+		line[strcspn(line, "\n")] = '\0';
+		dictionary_put(dict, line, (dict_value_t)count);
+	}
+	int synced = dictionary_sync(dict);
+	int failed = dict->log->failed;
+	long records = dict->log->num_records;
+	dictionary_put(dict, "after the failure", (dict_value_t)1);
+	int compacted = dictionary_compact_log(dict);
+
+	if ((synced == 0) || !failed || (compacted == 0) || (dict->log->num_records != records)) {
+		printf("Error found in test_log_failure(), sync %d, compact %d, %lu records logged after the failure\n",
+			synced, compacted, dict->log->num_records - records);
+	}
+	else if ((dict->num_entries != count + 1) || (dictionary_get(dict, "after the failure") != (dict_value_t)1)) {
+		printf("Error found in test_log_failure(), %lu entries for %lu puts\n", dict->num_entries, count + 1);
+	}
+	else {
+		printf("1) sync and compaction failed, %lu entries kept in memory\n", dict->num_entries);
+	}
+
+	free_dictionary(dict);
+	fclose(input);
+	unlink(log_path);
+}
+
+/*
+ * Size function for test_counter(), a count is as many bytes as it counts
+ */
+long
+count_size(dict_key_t key, dict_value_t value, void *context)
+{
+	return (long)value;
+}
+
+/*
+ * Count the three-letter prefixes of the words with dictionary_increment()
+ * and with get and put, and check the most frequent ones
+ */
+void
+test_counter(char *filename, long size, double load_factor)
+{
+	struct timespec start;
+	double seconds[2];
+	dictionary_t *dicts[2];
+
+	printf("Testing dictionary_increment()...\n");
+
+	for (int incremented=0; incremented < 2; incremented++) {
+		FILE *input = fopen(filename, "r");
+		if (!input) {
+			perror(filename);
+			return;
+		}
+
+		char line[256];
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		dictionary_t *dict = new_dictionary_size_load(size, load_factor);
+		while (fgets(line, 256, input)) {
+			line[strcspn(line, "\n")] = '\0';
+			line[3] = '\0';
+			if (incremented)
+				dictionary_increment(dict, line, 1);
+			else
+				dictionary_put(dict, line, (dict_value_t)((long)dictionary_get(dict, line) + 1));
+		}
+		seconds[incremented] = elapsed_seconds(&start);
+		dicts[incremented] = dict;
+		fclose(input);
+	}
+	printf("1) counted %lu prefixes in %.3fs with get and put, %.3fs with increment\n",
+		dicts[1]->num_entries, seconds[0], seconds[1]);
+
+#if __has_extension(blocks)
+	__block long errors = 0;
+	__block long total = 0;
+#else
+	long errors = 0;
+	long total = 0;
+#endif
+
+#if __has_nested_functions
+	void
+	compare_count(dict_key_t key, dict_value_t value)
+	{
+		if (dictionary_get(dicts[0], key) != value)
+			errors++;
+		total += (long)value;
+	}
+
+	dictionary_enumerate(dicts[1], &compare_count);
+#elif __has_extension(blocks)
+	dictionary_enumerate(dicts[1], ^ void (dict_key_t key, dict_value_t value) {
+		if (dictionary_get(dicts[0], key) != value)
+			errors++;
+		total += (long)value;
+	});
+#endif
+	if ((errors > 0) || (dicts[0]->num_entries != dicts[1]->num_entries)) {
+		printf("Error found in test_counter(), %lu counts differ\n", errors);
+	}
+
+	// the top ten in order, and nothing outside them with a larger count
+	dict_key_t keys[10];
+	long counts[10];
+	long found = dictionary_top_k(dicts[1], 10, keys, counts);
+	for (long i=0; i < found; i++) {
+		if (((i > 0) && (counts[i] > counts[i-1])) || ((long)dictionary_get(dicts[1], keys[i]) != counts[i]))
+			errors++;
+	}
+
+#if __has_extension(blocks)
+	__block long larger = 0;
+#else
+	long larger = 0;
+#endif
+	long smallest = (found > 0) ? counts[found-1] : 0;
+#if __has_nested_functions
+	void
+	count_larger(dict_key_t key, dict_value_t value)
+	{
+		if ((long)value > smallest)
+			larger++;
+	}
+
+	dictionary_enumerate(dicts[1], &count_larger);
+#elif __has_extension(blocks)
+	dictionary_enumerate(dicts[1], ^ void (dict_key_t key, dict_value_t value) {
+		if ((long)value > smallest)
+			larger++;
+	});
+#endif
+	if ((found != 10) || (errors > 0) || (larger >= found)) {
+		printf("Error found in test_counter(), top %lu counts are wrong\n", found);
+	}
+	else {
+		printf("2) %lu prefixes counted, most frequent '%s' %lu times, tenth '%s' %lu times\n",
+			total, keys[0], counts[0], keys[9], counts[9]);
+	}
+
+	free_dictionary(dicts[0]);
+	free_dictionary(dicts[1]);
+
+	// a count that grows past the byte limit of a cache evicts another entry
+	dictionary_t *cache = new_dictionary();
+	dictionary_set_cache(cache, 0, 100, NULL, &count_size, NULL);
+	dictionary_increment(cache, "a", 10);
+	dictionary_increment(cache, "b", 10);
+	dictionary_increment(cache, "a", 50);
+	long bytes = cache->cache->num_bytes;
+	dictionary_increment(cache, "b", 50);
+	if ((bytes != 2 + 60 + 2 + 10) || (cache->num_entries != 1) || (cache->cache->num_bytes != 2 + 60)
+			|| (dictionary_increment(NULL, "a", 1) != 0) || (dictionary_increment(cache, NULL, 1) != 0)) {
+		printf("Error found in test_counter(), cache holds %lu bytes in %lu entries\n",
+			cache->cache->num_bytes, cache->num_entries);
+	}
+	else {
+		printf("3) incrementing past the byte limit evicted an entry\n");
+	}
+	free_dictionary(cache);
+}
+
+/*
+ * Build a partitioned dictionary from the words with a small memory budget,
+ * and check that every lookup from the mapped partitions matches a
+ * dictionary built in memory
+ */
+void
+test_partitioned(char *filename, long size, double load_factor)
+{
+	const char *directory = "test_dictionary.partitions";
+	struct timespec start;
+	char line[256];
+
+	printf("Testing partitioned dictionaries...\n");
+
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		printf("Error found in test_partitioned(), unable to open %s\n", filename);
+		return;
+	}
+	mkdir(directory, 0755);
+
+	// a quarter of the words are added again, and keep the later value
+	dictionary_t *expected = new_dictionary_size_load(size, load_factor);
+	partition_builder_t *builder = new_partition_builder(directory, 256 * 1024);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i=0; fgets(line, 256, input); i++) {
+		line[strcspn(line, "\n")] = '\0';
+		dict_value_t value = (dict_value_t)(i + 1);
+		partition_builder_add(builder, line, value);
+		dictionary_put(expected, line, value);
+		if (i % 4 == 0) {
+			partition_builder_add(builder, line, (dict_value_t)-(i + 1));
+			dictionary_put(expected, line, (dict_value_t)-(i + 1));
+		}
+	}
+	long num_keys = builder->num_keys;
+	int num_partitions = partition_builder_finish(builder);
+	double build_seconds = elapsed_seconds(&start);
+
+	partitioned_dictionary_t *dict = (num_partitions > 0) ? open_partitioned_dictionary(directory) : NULL;
+	if (dict == NULL) {
+		printf("Error found in test_partitioned(), unable to build %s\n", directory);
+		free_dictionary(expected);
+		fclose(input);
+		return;
+	}
+	printf("1) built %d partitions from %lu keys in %.3fs\n", num_partitions, num_keys, build_seconds);
+
+	// look up every word, and every word with a character added, which is missing
+	long errors = (dict->num_entries == expected->num_entries) ? 0 : 1;
+	long lookups = 0;
+	rewind(input);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (fgets(line, 256, input)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (partitioned_dictionary_get(dict, line) != dictionary_get(expected, line))
+			errors++;
+		strcat(line, "#");
+		if (partitioned_dictionary_get(dict, line) != NULL)
+			errors++;
+		lookups += 2;
+	}
+	double lookup_seconds = elapsed_seconds(&start);
+
+	if (errors > 0) {
+		printf("Error found in test_partitioned(), %lu lookups were wrong\n", errors);
+	}
+	else {
+		printf("2) %lu lookups of %lu entries in %.3fs\n", lookups, dict->num_entries, lookup_seconds);
+	}
+	close_partitioned_dictionary(dict);
+
+	// point every slot of the first partition past the end of the file, its
+	// keys must come back missing rather than be read from outside the file
+	sprintf(line, "%s/partition-000", directory);
+	FILE *partition = fopen(line, "r+b");
+	uint64_t header[4];
+	if ((partition != NULL) && (fread(header, sizeof(header), 1, partition) == 1)) {
+		for (uint64_t i=0; i < header[2]; i++) {
+			uint64_t slot[2];
+			fseek(partition, sizeof(header) + i * sizeof(slot), SEEK_SET);
+			if ((fread(slot, sizeof(slot), 1, partition) == 1) && (slot[1] != 0)) {
+				slot[1] = (i % 2 == 0) ? UINT64_MAX - 8 : header[1] << 20;
+				fseek(partition, sizeof(header) + i * sizeof(slot), SEEK_SET);
+				fwrite(slot, sizeof(slot), 1, partition);
+			}
+		}
+	}
+	if (partition != NULL)
+		fclose(partition);
+
+	dict = open_partitioned_dictionary(directory);
+	errors = (dict == NULL) ? 1 : 0;
+	long missing = 0;
+	rewind(input);
+	while ((dict != NULL) && fgets(line, 256, input)) {
+		line[strcspn(line, "\n")] = '\0';
+		dict_value_t value = partitioned_dictionary_get(dict, line);
+		if (value == NULL)
+			missing++;
+		else if (value != dictionary_get(expected, line))
+			errors++;
+	}
+	if ((errors > 0) || (missing == 0)) {
+		printf("Error found in test_partitioned(), %lu lookups were wrong with bad offsets\n", errors);
+	}
+	else {
+		printf("3) %lu keys with bad offsets were missing, the rest were found\n", missing);
+	}
+
+	for (int i=0; i < num_partitions; i++) {
+		sprintf(line, "%s/partition-%03d", directory, i);
+		unlink(line);
+	}
+	sprintf(line, "%s/partitions", directory);
+	unlink(line);
+	rmdir(directory);
+
+	if (dict != NULL)
+		close_partitioned_dictionary(dict);
+	free_dictionary(expected);
+	fclose(input);
+}
+
+/*
+ * Look up every word in a shared dictionary from a second process while
+ * this one changes every value, then remove half of the words and keep
+ * swapping the removed half for the other one
+ */
+void
+test_shared(char *filename)
+{
+	const char *name = "/test_dictionary";
+	struct timespec start;
+	char line[256];
+	long num_lines = 0;
+	long key_bytes = 0;
+
+	printf("Testing shared dictionaries...\n");
+
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		printf("Error found in test_shared(), unable to open %s\n", filename);
+		return;
+	}
+	while (fgets(line, 256, input)) {
+		num_lines++;
+		key_bytes += strlen(line);
+	}
+
+	shared_dictionary_t *dict = new_shared_dictionary(name, num_lines, key_bytes);
+	if (dict == NULL) {
+		printf("Error found in test_shared(), unable to create %s\n", name);
+		fclose(input);
+		return;
+	}
+	rewind(input);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i=0; fgets(line, 256, input); i++) {
+		line[strcspn(line, "\n")] = '\0';
+		if (shared_dictionary_put(dict, line, (dict_value_t)(i + 1)) != 0) {
+			printf("Error found in test_shared(), unable to put '%s'\n", line);
+			break;
+		}
+	}
+	printf("1) put %lu words in %.3fs\n", (long)dict->header->num_entries, elapsed_seconds(&start));
+
+	// the reader sees each value either before or after the writer changes its sign
+	fflush(stdout);
+	pid_t reader = fork();
+	if (reader == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		shared_dictionary_t *attached = attach_shared_dictionary(name, 0);
+		double attach_seconds = elapsed_seconds(&start);
+		long errors = (attached == NULL) ? 1 : 0;
+
+		FILE *words = fopen(filename, "r");
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (long i=0; (attached != NULL) && fgets(line, 256, words); i++) {
+			line[strcspn(line, "\n")] = '\0';
+			long value = (long)shared_dictionary_get(attached, line);
+			if ((value != i + 1) && (value != -(i + 1)))
+				errors++;
+		}
+		if (errors > 0) {
+			printf("Error found in test_shared(), %lu lookups were wrong in the reader\n", errors);
+		}
+		else {
+			printf("2) reader attached in %.3fms, looked up %lu words in %.3fs during writes\n",
+				attach_seconds * 1000, num_lines, elapsed_seconds(&start));
+		}
+		fclose(words);
+		if (attached != NULL)
+			detach_shared_dictionary(attached);
+		fflush(stdout);
+		_exit(errors > 0);
+	}
+
+	rewind(input);
+	for (long i=0; fgets(line, 256, input); i++) {
+		line[strcspn(line, "\n")] = '\0';
+		shared_dictionary_put(dict, line, (dict_value_t)-(i + 1));
+	}
+
+	int status;
+	if ((reader < 0) || (waitpid(reader, &status, 0) != reader) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+		printf("Error found in test_shared(), the reader failed\n");
+	}
+
+	// removed words leave tombstones that later lookups must step over
+	long errors = 0;
+	rewind(input);
+	for (long i=0; fgets(line, 256, input); i++) {
+		line[strcspn(line, "\n")] = '\0';
+		if ((i % 2 == 0) && ((long)shared_dictionary_remove(dict, line) != -(i + 1)))
+			errors++;
+	}
+	rewind(input);
+	for (long i=0; fgets(line, 256, input); i++) {
+		line[strcspn(line, "\n")] = '\0';
+		if ((long)shared_dictionary_get(dict, line) != ((i % 2 == 0) ? 0 : -(i + 1)))
+			errors++;
+	}
+	if ((errors > 0) || (dict->header->num_entries != num_lines / 2)) {
+		printf("Error found in test_shared(), %lu values were wrong after removing\n", errors);
+	}
+	else {
+		printf("3) removed %lu words, %lu left\n", num_lines - num_lines / 2, (long)dict->header->num_entries);
+	}
+
+	// a writer that dies holding the lock in the middle of a change is
+	// recovered from by the next writer
+	pid_t writer = fork();
+	if (writer == 0) {
+		shared_dictionary_t *attached = attach_shared_dictionary(name, 1);
+		if (attached != NULL) {
+			pthread_mutex_lock(&attached->header->write_lock);
+			attached->header->sequence++;
+		}
+		_exit(attached == NULL);
+	}
+	if ((writer < 0) || (waitpid(writer, &status, 0) != writer) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)
+			|| (shared_dictionary_put(dict, "after the crash", (dict_value_t)1L) != 0)
+			|| ((long)shared_dictionary_get(dict, "after the crash") != 1)
+			|| (dict->header->num_entries != num_lines / 2 + 1) || (dict->header->sequence & 1)) {
+		printf("Error found in test_shared(), no recovery from a writer that died holding the lock\n");
+	}
+	else {
+		printf("4) recovered from a writer that died holding the lock\n");
+	}
+
+	// the segment has room for each word once, so putting removed words back
+	// works only if the heap space of removed ones is reclaimed
+	errors = 0;
+	for (int round=0; round < 4; round++) {
+		rewind(input);
+		for (long i=0; fgets(line, 256, input); i++) {
+			line[strcspn(line, "\n")] = '\0';
+			if (i % 2 == round % 2) {
+				if (shared_dictionary_put(dict, line, (dict_value_t)(round * num_lines + i + 1)) != 0)
+					errors++;
+			}
+			else if ((long)shared_dictionary_remove(dict, line) == 0) {
+				errors++;
+			}
+		}
+	}
+
+	// a writer that dies just after starting a compaction is finished by the next one
+	writer = fork();
+	if (writer == 0) {
+		shared_dictionary_t *attached = attach_shared_dictionary(name, 1);
+		if (attached != NULL) {
+			pthread_mutex_lock(&attached->header->write_lock);
+			attached->header->sequence++;
+			attached->header->compact_write = attached->header->heap_start;
+			attached->header->compact_read = attached->header->heap_start;
+		}
+		_exit(attached == NULL);
+	}
+	if ((writer < 0) || (waitpid(writer, &status, 0) != writer) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)
+			|| (shared_dictionary_remove(dict, "after the crash") == NULL)) {
+		errors++;
+	}
+
+	rewind(input);
+	for (long i=0; fgets(line, 256, input); i++) {
+		line[strcspn(line, "\n")] = '\0';
+		if ((long)shared_dictionary_get(dict, line) != ((i % 2 == 1) ? 3 * num_lines + i + 1 : 0))
+			errors++;
+	}
+	if ((errors > 0) || (dict->header->num_entries != num_lines / 2) || (dict->header->compact_read != 0)) {
+		printf("Error found in test_shared(), %lu puts, removes or lookups were wrong after compaction\n", errors);
+	}
+	else {
+		printf("5) removed and put back half of the words 4 times, %lu bytes of heap in use\n",
+			(long)(dict->header->heap_used - dict->header->heap_start));
+	}
+
+	detach_shared_dictionary(dict);
+	unlink_shared_dictionary(name);
+	fclose(input);
+}
+
+/*
+ * Returns the heap taken by a key allocated on its own, including the
+ * allocator's header and rounding where the allocator can tell
+ */
+long
+key_footprint(dict_key_t key)
+{
+#ifdef __GLIBC__
+	return (long)(malloc_usable_size((void *)key) + sizeof(size_t));
+#else
+	return (long)strlen(key) + 1;
+#endif
+}
+
+/*
+ * Pack the keys of a dictionary holding the words and a suffix of every
+ * tenth word, check every lookup against a dictionary that was not packed,
+ * then pack again after changes
+ */
+void
+test_pack_keys(char *filename, long size, double load_factor)
+{
+	struct timespec start;
+	char line[256];
+
+	printf("Testing dictionary_pack_keys()...\n");
+
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		printf("Error found in test_pack_keys(), unable to open %s\n", filename);
+		return;
+	}
+
+	dictionary_t *dict = new_dictionary_size_load(size, load_factor);
+	dictionary_t *expected = new_dictionary_size_load(size, load_factor);
+	dictionary_enable_index(dict);
+	for (long i=0; fgets(line, 256, input); i++) {
+		line[strcspn(line, "\n")] = '\0';
+		dictionary_put(dict, line, (dict_value_t)(i + 1));
+		dictionary_put(expected, line, (dict_value_t)(i + 1));
+		if ((i % 10 == 0) && (strlen(line) > 2)) {
+			dictionary_put(dict, line + 2, (dict_value_t)-(i + 1));
+			dictionary_put(expected, line + 2, (dict_value_t)-(i + 1));
+		}
+	}
+
+#if __has_extension(blocks)
+	__block long key_bytes = 0;
+	__block long allocated_bytes = 0;
+	__block long errors = 0;
+#else
+	long key_bytes = 0;
+	long allocated_bytes = 0;
+	long errors = 0;
+#endif
+#if __has_nested_functions
+	void
+	add_key_bytes(dict_key_t key, dict_value_t value)
+	{
+		key_bytes += strlen(key) + 1;
+		allocated_bytes += key_footprint(key);
+	}
+
+	void
+	check_entry(dict_key_t key, dict_value_t value)
+	{
+		if (dictionary_get(dict, key) != value)
+			errors++;
+	}
+
+	dictionary_enumerate(dict, &add_key_bytes);
+#elif __has_extension(blocks)
+	dictionary_enumerate(dict, ^ void (dict_key_t key, dict_value_t value) {
+		key_bytes += strlen(key) + 1;
+		allocated_bytes += key_footprint(key);
+	});
+	dictionary_enumerator_t check_entry = ^ void (dict_key_t key, dict_value_t value) {
+		if (dictionary_get(dict, key) != value)
+			errors++;
+	};
+#endif
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long storage_size = dictionary_pack_keys(dict);
+	double pack_seconds = elapsed_seconds(&start);
+	if ((storage_size < 0) || (storage_size >= key_bytes)) {
+		printf("Error found in test_pack_keys(), %lu bytes of keys packed into %ld\n", key_bytes, storage_size);
+	}
+	else {
+		printf("1) packed %lu keys of %lu bytes, taking %lu bytes of heap, into %lu bytes in %.3fs\n",
+			dict->num_entries, key_bytes, allocated_bytes, storage_size, pack_seconds);
+	}
+
+	// replace every third word with a new key allocation and value, and pack again
+	for (int pass=0; pass < 2; pass++) {
+		errors = 0;
+#if __has_nested_functions
+		dictionary_enumerate(expected, &check_entry);
+#elif __has_extension(blocks)
+		dictionary_enumerate(expected, check_entry);
+#endif
+		if ((dict->num_entries != expected->num_entries) || (dict->index->num_keys != dict->num_entries))
+			errors++;
+		if (errors > 0) {
+			printf("Error found in test_pack_keys(), %lu lookups were wrong after packing\n", errors);
+			break;
+		}
+		if (pass == 1)
+			break;
+
+		rewind(input);
+		for (long i=0; fgets(line, 256, input); i++) {
+			line[strcspn(line, "\n")] = '\0';
+			if (i % 3 == 0) {
+				dictionary_remove(dict, line);
+				dictionary_put(dict, line, (dict_value_t)(2 * (i + 1)));
+				dictionary_put(expected, line, (dict_value_t)(2 * (i + 1)));
+			}
+		}
+		storage_size = dictionary_pack_keys(dict);
+		printf("2) repacked %lu keys into %lu bytes\n", dict->num_entries, storage_size);
+	}
+
+	free_dictionary(expected);
+	free_dictionary(dict);
+	fclose(input);
+}
+
+/*
+ * Returns the number of collisions counted from the buckets themselves, a
+ * bucket of n entries being n - 1 collisions
+ */
+long
+count_collisions(dictionary_t *dict)
+{
+	long collisions = 0;
+
+	for (long i=0; i < dict->max_entries; i++) {
+		if ((dict->keys[i] == NULL) && (dict->values[i].collision_buckets != NULL))
+			collisions += dict->values[i].collision_buckets->num_elements - 1;
+	}
+	return collisions;
+}
+
+/*
+ * Remove every third word with dictionary_remove_if(), and the same words
+ * one at a time from a second dictionary, from dictionaries with a filter
+ * and an index and from dictionaries overloaded so that their buckets are
+ * long and sorted. Then remove everything that is left.
+ */
+void
+test_remove_if(char *filename, long size, double load_factor)
+{
+	struct timespec start;
+	char line[256];
+
+	printf("Testing dictionary_remove_if()...\n");
+
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		printf("Error found in test_remove_if(), unable to open %s\n", filename);
+		return;
+	}
+
+#if __has_extension(blocks)
+	__block long removed_count = 0;
+#else
+	long removed_count = 0;
+#endif
+
+#if __has_nested_functions
+	int
+	every_third(dict_key_t key, dict_value_t value)
+	{
+		return (long)value % 3 == 0;
+	}
+
+	int
+	every_word(dict_key_t key, dict_value_t value)
+	{
+		return 1;
+	}
+
+	int
+	all_but_every_third(dict_key_t key, dict_value_t value)
+	{
+		return (long)value % 3 != 0;
+	}
+
+	void
+	count_removed(dict_key_t key, dict_value_t value)
+	{
+		removed_count++;
+	}
+#elif __has_extension(blocks)
+	dictionary_predicate_t every_third = ^ int (dict_key_t key, dict_value_t value) {
+		return (long)value % 3 == 0;
+	};
+	dictionary_predicate_t every_word = ^ int (dict_key_t key, dict_value_t value) {
+		return 1;
+	};
+	dictionary_predicate_t all_but_every_third = ^ int (dict_key_t key, dict_value_t value) {
+		return (long)value % 3 != 0;
+	};
+	dictionary_enumerator_t count_removed = ^ void (dict_key_t key, dict_value_t value) {
+		removed_count++;
+	};
+#endif
+
+	double load_factors[2] = { load_factor, 1000.0 };
+	for (int pass=0; pass < 2; pass++) {
+		dictionary_t *dict = new_dictionary_size_load(size, load_factors[pass]);
+		dictionary_t *expected = new_dictionary_size_load(size, load_factors[pass]);
+		dictionary_enable_filter(dict, 8);
+		dictionary_enable_index(dict);
+		dictionary_enable_filter(expected, 8);
+		dictionary_enable_index(expected);
+
+		rewind(input);
+		long count = 0;
+		while (fgets(line, 256, input)) {
+			line[strcspn(line, "\n")] = '\0';
+			count++;
+			dictionary_put(dict, line, (dict_value_t)count);
+			dictionary_put(expected, line, (dict_value_t)count);
+		}
+
+		// the usual way: collect the keys while enumerating, then remove them
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		char **matches = malloc(expected->num_entries * sizeof(char *));
+#if __has_extension(blocks)
+		__block long num_matches = 0;
+#else
+		long num_matches = 0;
+#endif
+#if __has_nested_functions
+		void
+		collect_match(dict_key_t key, dict_value_t value)
+		{
+			if (every_third(key, value))
+				matches[num_matches++] = strdup(key);
+		}
+
+		dictionary_enumerate(expected, &collect_match);
+#elif __has_extension(blocks)
+		dictionary_enumerate(expected, ^ void (dict_key_t key, dict_value_t value) {
+			if (every_third(key, value))
+				matches[num_matches++] = strdup(key);
+		});
+#endif
+		for (long i=0; i < num_matches; i++) {
+			dictionary_remove(expected, matches[i]);
+			free(matches[i]);
+		}
+		free(matches);
+		double remove_seconds = elapsed_seconds(&start);
+
+		removed_count = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+#if __has_nested_functions
+		long removed = dictionary_remove_if(dict, &every_third, &count_removed);
+#elif __has_extension(blocks)
+		long removed = dictionary_remove_if(dict, every_third, count_removed);
+#endif
+		double remove_if_seconds = elapsed_seconds(&start);
+
+		long errors = 0;
+		rewind(input);
+		while (fgets(line, 256, input)) {
+			line[strcspn(line, "\n")] = '\0';
+			if (dictionary_get(dict, line) != dictionary_get(expected, line))
+				errors++;
+		}
+
+		long longest;
+		if ((removed != num_matches) || (removed_count != removed)
+			|| (dict->num_entries != expected->num_entries)
+			|| (dict->index->num_keys != dict->num_entries)
+			|| (dict->num_collisions != count_collisions(dict))
+			|| (count_unsorted_buckets(dict, &longest) != 0)) {
+			errors++;
+		}
+
+		if (errors > 0) {
+			printf("Error found in test_remove_if(), %lu results were wrong with load factor %.2f\n",
+				errors, load_factors[pass]);
+		}
+		else {
+			printf("%d) removed %lu of %lu words in %.3fs, enumerate and remove took %.3fs (load factor %.2f)\n",
+				pass + 1, removed, count, remove_if_seconds, remove_seconds, load_factors[pass]);
+		}
+
+		// removing everything leaves an empty table at its smallest size
+#if __has_nested_functions
+		removed = dictionary_remove_if(dict, &every_word, NULL);
+#elif __has_extension(blocks)
+		removed = dictionary_remove_if(dict, every_word, NULL);
+#endif
+		if ((removed != expected->num_entries) || (dict->num_entries != 0) || (dict->num_collisions != 0)
+			|| (dict->index->num_keys != 0) || (dict->max_entries > expected->max_entries)) {
+			printf("Error found in test_remove_if(), %lu entries left after removing all, capacity %lu\n",
+				dict->num_entries, dict->max_entries);
+		}
+
+		free_dictionary(expected);
+		free_dictionary(dict);
+	}
+
+	// removing two thirds of a logged dictionary makes its log due for
+	// compaction partway through the pass
+	const char *log_path = "test_dictionary.log";
+	unlink(log_path);
+	dictionary_t *dict = dictionary_open_log(log_path, 10000, 0, NULL, NULL, NULL);
+	if (dict == NULL) {
+		printf("Error found in test_remove_if(), unable to open %s\n", log_path);
+		fclose(input);
+		return;
+	}
+	rewind(input);
+	long count = 0;
+	while ((count < 3000) && fgets(line, 256, input)) {
+		line[strcspn(line, "\n")] = '\0';
+		count++;
+		dictionary_put(dict, line, (dict_value_t)count);
+	}
+	long entries = dict->num_entries;
+#if __has_nested_functions
+	long removed = dictionary_remove_if(dict, &all_but_every_third, NULL);
+#elif __has_extension(blocks)
+	long removed = dictionary_remove_if(dict, all_but_every_third, NULL);
+#endif
+	long records = dict->log->num_records;
+	free_dictionary(dict);
+
+	long errors = 0;
+	dict = dictionary_open_log(log_path, 10000, 0, NULL, NULL, NULL);
+	if (dict == NULL) {
+		errors++;
+	}
+	else {
+		rewind(input);
+		for (long i=1; (i <= count) && fgets(line, 256, input); i++) {
+			line[strcspn(line, "\n")] = '\0';
+			long value = (long)dictionary_get(dict, line);
+			if ((value != 0) && (value % 3 != 0))
+				errors++;
+		}
+		if (dict->num_entries != entries - removed)
+			errors++;
+		free_dictionary(dict);
+	}
+	if ((errors > 0) || (records != entries - removed)) {
+		printf("Error found in test_remove_if(), %lu words were wrong in the log, %lu records\n", errors, records);
+	}
+	else {
+		printf("3) removed %lu of %lu logged words, log compacted to %lu records\n", removed, entries, records);
+	}
+	unlink(log_path);
+
+	fclose(input);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc == 1)
+		goto usage;
+
+	long size = 5;
+	double load_factor = LOAD_FACTOR;
+	char * filename = NULL;
+
+	for (int i=1; i < argc; i++) {
+		if (strcmp("--size", argv[i]) == 0) {
+			size = atol(argv[i+1]);
+			i++;
+		}
+		else if (strcmp("--load", argv[i]) == 0) {
+			load_factor = atof(argv[i+1]);
+			i++;
+		}
+		else {
+			filename = argv[i];
+		}
+	}
+
+	if (filename == NULL)
+		goto usage;
+
+	test_load(filename, size, load_factor);
+
+	// repeat the test, but instead of deallocating, use the remove function
+	test_unload(filename, size, load_factor);
+
+	// purge most of the entries and make sure the dictionary gives the memory back
+	test_compact(filename, size, load_factor);
+
+	// presize the dictionary for the whole file
+	test_reserve(filename, load_factor);
+
+	// answer lookups of missing keys from a bloom filter
+	test_filter(filename, size, load_factor);
+
+	// evict with the CLOCK algorithm once the dictionary is full
+	test_cache(filename);
+
+	// expire entries lazily and in bounded steps
+	test_expiry(filename, size, load_factor);
+
+	// scatter keys crafted to collide with a keyed hash
+	test_seed(filename, size, load_factor);
+
+	// binary search long collision buckets
+	test_sorted_buckets(filename, size);
+
+	// copy a dictionary without rehashing it
+	test_clone(filename, size, load_factor);
+
+	// combine per-file counts
+	test_merge(filename, size, load_factor);
+
+	// scan keys in order
+	test_index(filename, size, load_factor);
+
+	// survive a restart
+	test_log(filename, size, load_factor);
+
+	// keep the log from growing without bound
+	test_log_compaction(filename);
+
+	// stop logging after a write fails
+	test_log_failure(filename);
+
+	// count in place
+	test_counter(filename, size, load_factor);
+
+	// build and query a key set in partitions on disk
+	test_partitioned(filename, size, load_factor);
+
+	// share one table between processes
+	test_shared(filename);
+
+	// pack the keys of a read-mostly table
+	test_pack_keys(filename, size, load_factor);
+
+	// purge by predicate in one pass
+	test_remove_if(filename, size, load_factor);
 
 	return 0;
 
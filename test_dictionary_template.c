@@ -0,0 +1,178 @@
+/*
+ * test_dictionary_template.c
+ *
+ * Instantiates dictionary_template.h for integer keys with struct values,
+ * and for string keys, and checks the generated operations.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "dictionary_template.h"
+#include "hash.h"
+
+typedef struct point_t {
+	double x;
+	double y;
+	long visits;
+} point_t;
+
+DICTIONARY_INIT(point_dictionary, uint64_t, point_t,
+	dictionary_template_hash_int64, dictionary_template_equal_int64)
+
+DICTIONARY_INIT_STRING(word_dictionary)
+
+/*
+ * Store struct values inline, update them in place, and remove half of them
+ */
+void
+test_struct_values(long count)
+{
+	point_dictionary_t *dict = new_point_dictionary();
+	long errors = 0;
+
+	printf("Testing struct values with %lu integer keys...\n", count);
+
+	for (long i=0; i < count; i++) {
+		point_t point = { (double)i, (double)-i, 0 };
+		if (point_dictionary_put(dict, (uint64_t)i * 7919, point) != 1)
+			errors++;
+	}
+
+	// update in place through the pointer returned by insert/get
+	for (long i=0; i < count; i++) {
+		int added;
+		point_t *point = point_dictionary_insert(dict, (uint64_t)i * 7919, &added);
+		if (added)
+			errors++;
+		point->visits++;
+	}
+
+	for (long i=0; i < count; i += 2) {
+		point_t removed;
+		if ((point_dictionary_remove(dict, (uint64_t)i * 7919, &removed) != 1) || (removed.x != (double)i))
+			errors++;
+	}
+
+	for (long i=0; i < count; i++) {
+		point_t *point = point_dictionary_get(dict, (uint64_t)i * 7919);
+		if ((i % 2) == 0) {
+			if (point != NULL)
+				errors++;
+		}
+		else if ((point == NULL) || (point->y != (double)-i) || (point->visits != 1)) {
+			errors++;
+		}
+	}
+
+#if __has_extension(blocks)
+	__block long visits = 0;
+#else
+	long visits = 0;
+#endif
+
+#if __has_nested_functions
+	void
+	sum_visits(uint64_t key, point_t *point)
+	{
+		visits += point->visits;
+	}
+
+	point_dictionary_enumerate(dict, &sum_visits);
+#elif __has_extension(blocks)
+	point_dictionary_enumerate(dict, ^ void (uint64_t key, point_t *point) {
+		visits += point->visits;
+	});
+#endif
+
+	if ((dict->num_entries != count / 2) || (visits != dict->num_entries)) {
+		printf("Error found in test_struct_values(), %lu entries and %lu visits, expected %lu\n",
+			dict->num_entries, visits, count / 2);
+	}
+	if (errors > 0) {
+		printf("Error found in test_struct_values(), %lu operations returned the wrong result\n", errors);
+	}
+	else {
+		printf("1) All struct values were found.\n");
+	}
+
+	free_point_dictionary(dict);
+}
+
+/*
+ * Store strings owned by the caller and compact after removing most of them
+ */
+void
+test_string_keys(long count)
+{
+	word_dictionary_t *dict = new_word_dictionary();
+	char **words = calloc(count, sizeof(char *));
+	long errors = 0;
+
+	printf("Testing string keys with %lu words...\n", count);
+
+	for (long i=0; i < count; i++) {
+		char word[32];
+		sprintf(word, "word-%lu", i);
+		words[i] = strdup(word);
+		word_dictionary_put(dict, words[i], (dict_value_t)words[i]);
+	}
+
+	for (long i=0; i < count; i++) {
+		char word[32];
+		sprintf(word, "word-%lu", i);
+		dict_value_t *value = word_dictionary_get(dict, word);
+		if ((value == NULL) || (*value != (dict_value_t)words[i]))
+			errors++;
+		// the inline hash must match hash.c
+		if (dictionary_template_hash_string(word) != hash((unsigned char *)word))
+			errors++;
+	}
+
+	long peak_size = dict->max_entries;
+	for (long i=0; i < count; i++) {
+		if ((i % 10) != 0)
+			word_dictionary_remove(dict, words[i], NULL);
+	}
+	word_dictionary_compact(dict);
+
+	printf("1) capacity %lu at peak, %lu after compacting %lu entries\n",
+		peak_size, dict->max_entries, dict->num_entries);
+
+	for (long i=0; i < count; i += 10) {
+		if (word_dictionary_get(dict, words[i]) == NULL)
+			errors++;
+	}
+	if (errors > 0) {
+		printf("Error found in test_string_keys(), %lu operations returned the wrong result\n", errors);
+	}
+	else {
+		printf("2) All remaining words were found.\n");
+	}
+
+	free_word_dictionary(dict);
+	for (long i=0; i < count; i++)
+		free(words[i]);
+	free(words);
+}
+
+int
+main(int argc, char **argv)
+{
+	long count = 100000;
+
+	if (argc > 1)
+		count = atol(argv[1]);
+
+	if (count <= 0) {
+		printf("usage: test_dictionary_template [count]\n");
+		return 1;
+	}
+
+	test_struct_values(count);
+	test_string_keys(count);
+
+	return 0;
+}
@@ -1,74 +1,427 @@
+/*
+ * test_hash.c - compare the quality and speed of the available hash functions
+ *
+ * usage: test_hash [file]
+ *
+ * Keys are the lines of the file, or generated words if no file is given.
+ * For every hash function the program reports
+ *
+ *	- chi-squared uniformity and the longest chain, against the longest
+ *	  chain expected from a uniform hash, for the capacities dictionary_t
+ *	  passes through as it grows from 1000 slots up (indexed as dictionary_t
+ *	  does, modulo capacity - 1) and for power-of-two capacities (indexed by
+ *	  mask), each filled to LOAD_FACTOR
+ *	- avalanche: how far the chance that flipping one input bit flips each
+ *	  output bit is from 1/2, and bit independence: the largest correlation
+ *	  between the flips of two output bits
+ *	- throughput in GB/s for several key lengths
+ */
+
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <math.h>
+#include <time.h>
 
+#include "dictionary.h"
+#include "capacity.h"
 #include "hash.h"
+#include "test_util.h"
+
+#define HASH_BITS			63		// djb2 is masked to LONG_MAX, the top bit is not tested
+#define AVALANCHE_SAMPLES	2000
+#define AVALANCHE_KEY_BYTES	16
+#define BIC_SAMPLES			1000
+#define THROUGHPUT_BYTES	(16 * 1024 * 1024)
+#define THROUGHPUT_SECONDS	0.2
+#define GENERATED_KEYS		200000
+
+typedef unsigned long (* hash_function_t) (const unsigned char *data, unsigned long length);
+
+// a key that is not null-terminated
+typedef struct hash_key_t {
+	const unsigned char *data;
+	unsigned long length;
+} hash_key_t;
+
+typedef struct key_set_t {
+	hash_key_t *keys;
+	long count;
+	unsigned char *bytes;
+} key_set_t;
+
+/*
+ * djb2 run through the integer mixer, as the Bloom filter uses it
+ */
+unsigned long
+hash_bytes_mixed(const unsigned char *data, unsigned long length)
+{
+	return hash_int64(hash_bytes(data, length));
+}
+
+/*
+ * SipHash-1-3 with a fixed key, as a seeded dictionary uses it
+ */
+unsigned long
+hash_bytes_siphash(const unsigned char *data, unsigned long length)
+{
+	static const unsigned long key[2] = { 0x0706050403020100UL, 0x0f0e0d0c0b0a0908UL };
+	return hash_siphash13(data, length, key);
+}
+
+typedef struct named_hash_t {
+	const char *name;
+	hash_function_t function;
+} named_hash_t;
+
+const named_hash_t hash_functions[] = {
+	{ "djb2", &hash_bytes },
+	{ "djb2+mix", &hash_bytes_mixed },
+	{ "siphash13", &hash_bytes_siphash },
+};
+
+#define NUM_HASH_FUNCTIONS	(sizeof(hash_functions) / sizeof(hash_functions[0]))
+
+/*
+ * xorshift64* - the analysis must be repeatable, so rand() is not used
+ */
+unsigned long
+next_random(unsigned long *state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 0x2545f4914f6cdd1dUL;
+}
+
+/*
+ * Read the lines of a file, without a limit on their length
+ */
+int
+read_keys(const char *filename, key_set_t *set)
+{
+	FILE *input = fopen(filename, "r");
+	if (!input) {
+		perror(filename);
+		return -1;
+	}
+
+	fseek(input, 0, SEEK_END);
+	long size = ftell(input);
+	rewind(input);
+
+	set->bytes = malloc(size + 1);
+	if ((set->bytes == NULL) || (fread(set->bytes, 1, size, input) != (size_t)size)) {
+		fprintf(stderr, "Unable to read %s\n", filename);
+		fclose(input);
+		return -1;
+	}
+	fclose(input);
+
+	long lines = 1;
+	for (long i=0; i < size; i++) {
+		if (set->bytes[i] == '\n')
+			lines++;
+	}
+
+	set->keys = malloc(lines * sizeof(hash_key_t));
+	set->count = 0;
+	long start = 0;
+	for (long i=0; i <= size; i++) {
+		if ((i == size) || (set->bytes[i] == '\n')) {
+			if (i > start) {
+				set->keys[set->count].data = &set->bytes[start];
+				set->keys[set->count].length = i - start;
+				set->count++;
+			}
+			start = i + 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Generate count keys of random lowercase letters, min_length to max_length long
+ */
+void
+generate_keys(key_set_t *set, long count, int min_length, int max_length, unsigned long seed)
+{
+	unsigned long state = seed;
 
-#define NUM_ENTRIES	1000
+	set->bytes = malloc(count * max_length);
+	set->keys = malloc(count * sizeof(hash_key_t));
+	set->count = count;
 
-const char *input_strings = "unsortedWords.txt";
+	unsigned char *p = set->bytes;
+	for (long i=0; i < count; i++) {
+		int length = min_length + next_random(&state) % (max_length - min_length + 1);
+		set->keys[i].data = p;
+		set->keys[i].length = length;
+		for (int j=0; j < length; j++)
+			*p++ = 'a' + next_random(&state) % 26;
+	}
+}
 
 void
-test_hash()
+free_keys(key_set_t *set)
+{
+	free(set->keys);
+	free(set->bytes);
+}
+
+/*
+ * The longest chain a uniform hash is expected to produce: the smallest k
+ * for which fewer than half a bucket is expected to hold more than k keys
+ */
+long
+expected_max_chain(long num_keys, long num_buckets)
 {
-	FILE *input = fopen(input_strings, "r");
-
-	if (!input)
-	{
-		char error[256];
-		sprintf(error, "Unable to open file %s", input_strings);
-		perror(error);
-		return;
+	double lambda = (double)num_keys / num_buckets;
+	double term = exp(-lambda);		// P(X = 0)
+	double cumulative = term;
+
+	for (long k=0; k < num_keys; k++) {
+		if (num_buckets * (1.0 - cumulative) < 0.5)
+			return k;
+		term *= lambda / (k + 1);
+		cumulative += term;
 	}
+	return num_keys;
+}
 
-	int hash_table[NUM_ENTRIES];
-	memset(hash_table, 0, NUM_ENTRIES * sizeof(int));
-	char line[256];
-
-	long count = 0;
-	while (fgets(line, 256, input)) {
-		size_t len = strnlen(line, 256);
-		if (len == 0)
-			continue;
-		if (line[len-1] == '\n')
-			line[--len] = '\0';
-		long hash_value = hash(line);
-		hash_table[hash_value % NUM_ENTRIES]++;
-
-		count++;
+/*
+ * Distribute the first num_keys keys over num_buckets buckets, and print the
+ * chi-squared statistic (as a z-score, values beyond +/-3 are suspicious)
+ * and the longest chain
+ */
+void
+test_distribution(const named_hash_t *hash_function, key_set_t *set, unsigned long *hashes,
+	long capacity, int power_of_two)
+{
+	// dictionary_t indexes with hash % (max_entries - 1)
+	long num_buckets = power_of_two ? capacity : capacity - 1;
+	long num_keys = (long)(capacity * LOAD_FACTOR);
+	if (num_keys > set->count)
+		num_keys = set->count;
+
+	long *counts = calloc(num_buckets, sizeof(long));
+	for (long i=0; i < num_keys; i++) {
+		unsigned long index = power_of_two ? (hashes[i] & (capacity - 1)) : (hashes[i] % num_buckets);
+		counts[index]++;
 	}
 
-	fclose(input);
+	double expected = (double)num_keys / num_buckets;
+	double chi_squared = 0.0;
+	long max_chain = 0;
+	for (long i=0; i < num_buckets; i++) {
+		double difference = counts[i] - expected;
+		chi_squared += difference * difference / expected;
+		if (counts[i] > max_chain)
+			max_chain = counts[i];
+	}
+	free(counts);
 
-	long sum = 0;
-	long sum_sq = 0;
-	double mean = 0.0, variance = 0.0;
-	int min = INT_MAX, max = 0;
+	double degrees = num_buckets - 1;
+	double z = (degrees > 0) ? (chi_squared - degrees) / sqrt(2.0 * degrees) : 0.0;
 
-	printf("Bucket\tCount\n");
-	for (int i=0; i < NUM_ENTRIES; i++) {
-		if (min > hash_table[i]) {
-			min = hash_table[i];
+	printf("%-10s %12ld %s %10ld %10.2f %6ld (%ld)\n", hash_function->name, capacity,
+		power_of_two ? "2^n  " : "prime", num_keys, z, max_chain,
+		expected_max_chain(num_keys, num_buckets));
+}
+
+/*
+ * Uniformity over the capacities dictionary_t grows through, and over
+ * powers of two up to the same size
+ */
+void
+test_uniformity(key_set_t *set)
+{
+	unsigned long *hashes = malloc(set->count * sizeof(unsigned long));
+
+	printf("Uniformity with %ld keys at load factor %.2f\n", set->count, LOAD_FACTOR);
+	printf("%-10s %12s %s %10s %10s %s\n", "hash", "capacity", "kind ", "keys", "chi2 z", "max chain (expected)");
+
+	for (int h=0; h < NUM_HASH_FUNCTIONS; h++) {
+		const named_hash_t *hash_function = &hash_functions[h];
+		for (long i=0; i < set->count; i++)
+			hashes[i] = hash_function->function(set->keys[i].data, set->keys[i].length);
+
+		// follow the growth policy, measuring each table just before it grows
+		long capacity = DICT_INITIAL_SIZE;
+		for (long n=1; n <= set->count; n++) {
+			if (capacity_needs_growth(n, capacity, LOAD_FACTOR)) {
+				if (capacity >= 1000)
+					test_distribution(hash_function, set, hashes, capacity, 0);
+				capacity = capacity_after_growth(n, LOAD_FACTOR);
+			}
+		}
+
+		for (long capacity = 1024; capacity * LOAD_FACTOR <= set->count; capacity *= 4)
+			test_distribution(hash_function, set, hashes, capacity, 1);
+	}
+
+	free(hashes);
+	printf("\n");
+}
+
+/*
+ * Flip every bit of random keys and measure how often each output bit
+ * flips, and how often pairs of output bits flip together
+ */
+void
+test_avalanche()
+{
+	static unsigned long flips[AVALANCHE_KEY_BYTES * 8][HASH_BITS];
+	static unsigned long diffs[AVALANCHE_KEY_BYTES * 8][BIC_SAMPLES];
+	unsigned char key[AVALANCHE_KEY_BYTES];
+
+	printf("Avalanche over %d random %d-byte keys (0 is ideal, 1 is worst)\n",
+		AVALANCHE_SAMPLES, AVALANCHE_KEY_BYTES);
+	printf("%-10s %12s %12s %12s\n", "hash", "mean bias", "worst bias", "worst BIC");
+
+	for (int h=0; h < NUM_HASH_FUNCTIONS; h++) {
+		const named_hash_t *hash_function = &hash_functions[h];
+		unsigned long state = 0x9e3779b97f4a7c15UL;
+
+		memset(flips, 0, sizeof(flips));
+		for (int s=0; s < AVALANCHE_SAMPLES; s++) {
+			for (int b=0; b < AVALANCHE_KEY_BYTES; b++)
+				key[b] = next_random(&state);
+			unsigned long base = hash_function->function(key, AVALANCHE_KEY_BYTES);
+
+			for (int bit=0; bit < AVALANCHE_KEY_BYTES * 8; bit++) {
+				key[bit / 8] ^= 1 << (bit % 8);
+				unsigned long diff = base ^ hash_function->function(key, AVALANCHE_KEY_BYTES);
+				key[bit / 8] ^= 1 << (bit % 8);
+
+				if (s < BIC_SAMPLES)
+					diffs[bit][s] = diff;
+				for (int out=0; out < HASH_BITS; out++)
+					flips[bit][out] += (diff >> out) & 1;
+			}
+		}
+
+		double total_bias = 0.0;
+		double worst_bias = 0.0;
+		for (int bit=0; bit < AVALANCHE_KEY_BYTES * 8; bit++) {
+			for (int out=0; out < HASH_BITS; out++) {
+				double bias = fabs(2.0 * flips[bit][out] / AVALANCHE_SAMPLES - 1.0);
+				total_bias += bias;
+				if (bias > worst_bias)
+					worst_bias = bias;
+			}
 		}
-		if (max < hash_table[i]) {
-			max = hash_table[i];
+
+		// bit independence: correlation between the flips of output bits j and k
+		double worst_correlation = 0.0;
+		for (int bit=0; bit < AVALANCHE_KEY_BYTES * 8; bit++) {
+			for (int j=0; j < HASH_BITS; j++) {
+				for (int k=j+1; k < HASH_BITS; k++) {
+					long nj = 0, nk = 0, njk = 0;
+					for (int s=0; s < BIC_SAMPLES; s++) {
+						unsigned long d = diffs[bit][s];
+						long fj = (d >> j) & 1;
+						long fk = (d >> k) & 1;
+						nj += fj;
+						nk += fk;
+						njk += fj & fk;
+					}
+					double pj = (double)nj / BIC_SAMPLES;
+					double pk = (double)nk / BIC_SAMPLES;
+					double denominator = sqrt(pj * (1 - pj) * pk * (1 - pk));
+					// a bit that never or always flips is as dependent as it gets
+					double correlation = (denominator > 0) ? fabs(((double)njk / BIC_SAMPLES - pj * pk) / denominator) : 1.0;
+					if (correlation > worst_correlation)
+						worst_correlation = correlation;
+				}
+			}
 		}
-		sum += hash_table[i];
-		sum_sq += (hash_table[i] * hash_table[i]);
-		printf("%4i\t%d\n", i, hash_table[i]);
+
+		printf("%-10s %12.4f %12.4f %12.4f\n", hash_function->name,
+			total_bias / (AVALANCHE_KEY_BYTES * 8 * HASH_BITS), worst_bias, worst_correlation);
 	}
-	mean = sum / NUM_ENTRIES;
-	variance = sqrt(sum_sq / NUM_ENTRIES - mean * mean);
+	printf("\n");
+}
+
+/*
+ * Hash a set of keys repeatedly for THROUGHPUT_SECONDS, returning GB/s
+ */
+double
+measure_throughput(const named_hash_t *hash_function, key_set_t *set)
+{
+	struct timespec start;
+	unsigned long sink = 0;
+	double bytes = 0;
+	double seconds;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		for (long i=0; i < set->count; i++) {
+			sink += hash_function->function(set->keys[i].data, set->keys[i].length);
+			bytes += set->keys[i].length;
+		}
+		seconds = elapsed_seconds(&start);
+	} while (seconds < THROUGHPUT_SECONDS);
+
+	// keep the compiler from discarding the hashes
+	if (sink == 1)
+		printf(" ");
+
+	return bytes / seconds / 1e9;
+}
+
+void
+test_throughput(key_set_t *input)
+{
+	static const int lengths[] = { 8, 16, 64, 256, 1024 };
+	const int num_lengths = sizeof(lengths) / sizeof(lengths[0]);
+	key_set_t sets[num_lengths];
 
+	for (int l=0; l < num_lengths; l++)
+		generate_keys(&sets[l], THROUGHPUT_BYTES / lengths[l], lengths[l], lengths[l], 12345 + l);
+
+	printf("Throughput in GB/s\n");
+	printf("%-10s %8s", "hash", "input");
+	for (int l=0; l < num_lengths; l++)
+		printf(" %6dB", lengths[l]);
 	printf("\n");
-	printf("%lu entries distributed into %d buckets: sum=%lu, mean=%5.1f, variance=%5.1f, min=%d, max=%d\n",
-		count, NUM_ENTRIES, sum, mean, variance, min, max);
+
+	for (int h=0; h < NUM_HASH_FUNCTIONS; h++) {
+		printf("%-10s %8.3f", hash_functions[h].name, measure_throughput(&hash_functions[h], input));
+		for (int l=0; l < num_lengths; l++)
+			printf(" %7.3f", measure_throughput(&hash_functions[h], &sets[l]));
+		printf("\n");
+	}
+
+	for (int l=0; l < num_lengths; l++)
+		free_keys(&sets[l]);
 }
 
 int
 main(int argc, char **argv)
 {
-	test_hash();
+	key_set_t input;
+
+	if (argc > 2) {
+		printf("usage: test_hash [file]\n");
+		return 1;
+	}
+
+	if (argc == 2) {
+		if (read_keys(argv[1], &input) != 0)
+			return 1;
+		printf("%ld keys read from %s\n\n", input.count, argv[1]);
+	}
+	else {
+		generate_keys(&input, GENERATED_KEYS, 3, 15, 42);
+		printf("%ld generated keys of 3 to 15 letters\n\n", input.count);
+	}
+
+	test_uniformity(&input);
+	test_avalanche();
+	test_throughput(&input);
+
+	free_keys(&input);
 	return 0;
 }
@@ -0,0 +1,162 @@
+/*
+ * test_int_dictionary.c
+ *
+ * Exercises the integer dictionary with sequential and scattered IDs, and
+ * compares its speed with formatting the same IDs into a string dictionary.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "dictionary.h"
+#include "int_dictionary.h"
+#include "test_util.h"
+
+/*
+ * Scatter sequential numbers over the 64-bit range so that both sequential
+ * and random-looking IDs are tested
+ */
+int_dict_key_t
+test_key(long i)
+{
+	return (i % 2) ? (int_dict_key_t)i : (int_dict_key_t)i * 0x9e3779b97f4a7c15UL;
+}
+
+/*
+ * Put count keys, remove every other one, and check what is left
+ */
+void
+test_put_get_remove(long count)
+{
+	int_dictionary_t *dict = new_int_dictionary();
+	long errors = 0;
+
+	printf("Testing int_dictionary_put(), _get() and _remove() with %lu keys...\n", count);
+
+	for (long i=0; i < count; i++) {
+		if (int_dictionary_put(dict, test_key(i), (dict_value_t)(i + 1)) != NULL)
+			errors++;
+	}
+	// replacing a value returns the previous one
+	for (long i=0; i < count; i += 7) {
+		if (int_dictionary_put(dict, test_key(i), (dict_value_t)(i + 1)) != (dict_value_t)(i + 1))
+			errors++;
+	}
+	if (dict->num_entries != count) {
+		printf("Error found in test_put_get_remove(), %lu entries after adding %lu keys\n", dict->num_entries, count);
+	}
+
+	long peak_size = dict->max_entries;
+	for (long i=0; i < count; i += 2) {
+		if (int_dictionary_remove(dict, test_key(i)) != (dict_value_t)(i + 1))
+			errors++;
+	}
+	for (long i=0; i < count; i++) {
+		dict_value_t expected = (i % 2) ? (dict_value_t)(i + 1) : NULL;
+		if (int_dictionary_get(dict, test_key(i)) != expected)
+			errors++;
+	}
+
+#if __has_extension(blocks)
+	__block long enumerated = 0;
+#else
+	long enumerated = 0;
+#endif
+
+#if __has_nested_functions
+	void
+	count_entry(int_dict_key_t key, dict_value_t value)
+	{
+		enumerated++;
+	}
+
+	int_dictionary_enumerate(dict, &count_entry);
+#elif __has_extension(blocks)
+	int_dictionary_enumerate(dict, ^ void (int_dict_key_t key, dict_value_t value) {
+		enumerated++;
+	});
+#endif
+
+	if ((enumerated != dict->num_entries) || (dict->num_entries != count / 2)) {
+		printf("Error found in test_put_get_remove(), enumerated %lu of %lu entries, expected %lu\n",
+			enumerated, dict->num_entries, count / 2);
+	}
+
+	// removing all but a few entries shrinks the table
+	for (long i=1; i < count - 10; i += 2) {
+		int_dictionary_remove(dict, test_key(i));
+	}
+	printf("1) capacity %lu at peak, %lu with %lu entries left\n", peak_size, dict->max_entries, dict->num_entries);
+	if (dict->max_entries >= peak_size) {
+		printf("Error found in test_put_get_remove(), dictionary did not shrink\n");
+	}
+
+	if (errors > 0) {
+		printf("Error found in test_put_get_remove(), %lu keys had the wrong value\n", errors);
+	}
+	else {
+		printf("2) All values were found.\n");
+	}
+
+	free_int_dictionary(dict);
+}
+
+/*
+ * Compare the integer dictionary with formatting IDs into the string dictionary
+ */
+void
+test_speed(long count)
+{
+	struct timespec start;
+	char key[32];
+
+	printf("Comparing with string keys for %lu IDs...\n", count);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dictionary_t *string_dict = new_dictionary();
+	for (long i=0; i < count; i++) {
+		sprintf(key, "%lu", (unsigned long)test_key(i));
+		dictionary_put(string_dict, key, (dict_value_t)(i + 1));
+	}
+	for (long i=0; i < count; i++) {
+		sprintf(key, "%lu", (unsigned long)test_key(i));
+		dictionary_get(string_dict, key);
+	}
+	double string_seconds = elapsed_seconds(&start);
+	free_dictionary(string_dict);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int_dictionary_t *int_dict = new_int_dictionary();
+	for (long i=0; i < count; i++) {
+		int_dictionary_put(int_dict, test_key(i), (dict_value_t)(i + 1));
+	}
+	for (long i=0; i < count; i++) {
+		int_dictionary_get(int_dict, test_key(i));
+	}
+	double int_seconds = elapsed_seconds(&start);
+	free_int_dictionary(int_dict);
+
+	printf("\tstring keys: %.3fs, integer keys: %.3fs (%.1fx)\n",
+		string_seconds, int_seconds, string_seconds / int_seconds);
+}
+
+int
+main(int argc, char **argv)
+{
+	long count = 1000000;
+
+	if (argc > 1)
+		count = atol(argv[1]);
+
+	if (count <= 0) {
+		printf("usage: test_int_dictionary [count]\n");
+		return 1;
+	}
+
+	test_put_get_remove(count);
+	test_speed(count);
+
+	return 0;
+}
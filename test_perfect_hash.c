@@ -0,0 +1,103 @@
+/*
+ * test_perfect_hash.c
+ *
+ * Checks the table that perfect-hash generates from keywords.txt against
+ * the keys and values in that file, and compares its lookups with a
+ * dictionary built from the same file at startup.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "dictionary.h"
+#include "keywords_table.h"
+#include "test_util.h"
+
+#define LOOKUP_ROUNDS	100000
+
+int
+main(int argc, char **argv)
+{
+	char line[256];
+	long errors = 0;
+	long count = 0;
+
+	if (argc < 2) {
+		printf("usage: test_perfect_hash <filename>\n");
+		printf("	Checks the generated table against the key/value file it was built from\n");
+		return 1;
+	}
+
+	FILE *input = fopen(argv[1], "r");
+	if (input == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	printf("Testing keyword_lookup() with %d keys...\n", KEYWORD_TABLE_KEYS);
+
+	dictionary_t *dict = new_dictionary();
+	char *keys[KEYWORD_TABLE_KEYS];
+	while (fgets(line, 256, input) && (count < KEYWORD_TABLE_KEYS)) {
+		line[strcspn(line, "\n")] = '\0';
+		char *tab = strchr(line, '\t');
+		if (tab == NULL) {
+			errors++;
+			continue;
+		}
+		*tab = '\0';
+		long value = atol(tab + 1);
+		dictionary_put(dict, line, (dict_value_t)value);
+		keys[count++] = strdup(line);
+
+		const long *found = keyword_lookup(line);
+		if ((found == NULL) || (*found != value))
+			errors++;
+
+		// a key with a character added or removed is not in the table
+		char longer[258];
+		sprintf(longer, "%s_", line);
+		line[strlen(line) - 1] = '\0';
+		if ((keyword_lookup(longer) != NULL) || (keyword_lookup(line) != NULL))
+			errors++;
+	}
+	fclose(input);
+
+	if ((count != KEYWORD_TABLE_KEYS) || (keyword_lookup("") != NULL) || (keyword_lookup("Auto") != NULL))
+		errors++;
+
+	if (errors > 0) {
+		printf("Error found in test_perfect_hash, %lu lookups were wrong\n", errors);
+		return 1;
+	}
+	printf("1) every key found with its value, no other key found\n");
+
+	struct timespec start;
+	long total = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int round=0; round < LOOKUP_ROUNDS; round++) {
+		for (long i=0; i < count; i++)
+			total += *keyword_lookup(keys[i]);
+	}
+	double table_seconds = elapsed_seconds(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int round=0; round < LOOKUP_ROUNDS; round++) {
+		for (long i=0; i < count; i++)
+			total -= (long)dictionary_get(dict, keys[i]);
+	}
+	double dict_seconds = elapsed_seconds(&start);
+
+	if (total != 0)
+		printf("Error found in test_perfect_hash, lookups disagree with the dictionary\n");
+	printf("2) %lu lookups: table %.3fs, dictionary_get() %.3fs\n",
+		LOOKUP_ROUNDS * count, table_seconds, dict_seconds);
+
+	for (long i=0; i < count; i++)
+		free(keys[i]);
+	free_dictionary(dict);
+
+	return 0;
+}
@@ -0,0 +1,228 @@
+/*
+ * test_string_set.c
+ *
+ * Loads the lines of a file into a string set, checks membership, union,
+ * intersection and removal, and compares the set with a dictionary used
+ * as a set.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "dictionary.h"
+#include "string_set.h"
+#include "test_util.h"
+
+/*
+ * Returns the bytes taken by the slot arrays and collision buckets of a
+ * dictionary, not counting its keys
+ */
+long
+dictionary_table_bytes(dictionary_t *dict)
+{
+	long bytes = dict->max_entries * (sizeof(dict_key_t) + sizeof(entry_t));
+
+	for (long i=0; i < dict->max_entries; i++) {
+		if ((dict->keys[i] == NULL) && (dict->values[i].collision_buckets != NULL))
+			bytes += sizeof(collision_bucket_t) + dict->values[i].collision_buckets->max_elements * sizeof(cb_entry_t);
+	}
+	return bytes;
+}
+
+/*
+ * Add every line to a set and to a dictionary, and compare lookups of
+ * present and missing keys one at a time and in batches
+ */
+void
+test_membership(char **lines, long count)
+{
+	struct timespec start;
+	long errors = 0;
+
+	printf("Testing string_set_add() and _contains() with %lu keys...\n", count);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dictionary_t *dict = new_dictionary();
+	for (long i=0; i < count; i++)
+		dictionary_put(dict, lines[i], (dict_value_t)1);
+	double dict_put_seconds = elapsed_seconds(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	string_set_t *set = new_string_set();
+	for (long i=0; i < count; i++)
+		string_set_add(set, lines[i]);
+	double set_add_seconds = elapsed_seconds(&start);
+
+	if (set->num_entries != dict->num_entries)
+		errors++;
+	for (long i=0; i < count; i += 5) {
+		if (string_set_add(set, lines[i]) != 0)
+			errors++;
+	}
+
+	printf("1) added in %.3fs, dictionary_put() took %.3fs\n", set_add_seconds, dict_put_seconds);
+	printf("2) table bytes: set %lu, dictionary %lu\n",
+		set->max_entries * (sizeof(unsigned char) + sizeof(dict_key_t)), dictionary_table_bytes(dict));
+
+	// every line is present, and every line with a character added is missing
+	char **missing = malloc(count * sizeof(char *));
+	for (long i=0; i < count; i++) {
+		missing[i] = malloc(strlen(lines[i]) + 2);
+		sprintf(missing[i], "%s#", lines[i]);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i=0; i < count; i++) {
+		if (dictionary_get(dict, lines[i]) == NULL)
+			errors++;
+		if (dictionary_get(dict, missing[i]) != NULL)
+			errors++;
+	}
+	double dict_get_seconds = elapsed_seconds(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (long i=0; i < count; i++) {
+		if (!string_set_contains(set, lines[i]))
+			errors++;
+		if (string_set_contains(set, missing[i]))
+			errors++;
+	}
+	double contains_seconds = elapsed_seconds(&start);
+
+	unsigned char *found = malloc(count);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long found_count = string_set_contains_batch(set, (const char **)lines, count, found);
+	long missing_count = string_set_contains_batch(set, (const char **)missing, count, NULL);
+	double batch_seconds = elapsed_seconds(&start);
+	if ((found_count != count) || (missing_count != 0) || (memchr(found, 0, count) != NULL))
+		errors++;
+
+	if (errors > 0) {
+		printf("Error found in test_membership(), %lu lookups were wrong\n", errors);
+	}
+	else {
+		printf("3) %lu lookups: contains %.3fs, batched %.3fs, dictionary_get() %.3fs\n",
+			2 * count, contains_seconds, batch_seconds, dict_get_seconds);
+	}
+
+	for (long i=0; i < count; i++)
+		free(missing[i]);
+	free(missing);
+	free(found);
+	free_string_set(set);
+	free_dictionary(dict);
+}
+
+/*
+ * Combine the sets of even lines and of every third line, and remove keys
+ * until the set shrinks
+ */
+void
+test_union_intersect(char **lines, long count)
+{
+	long errors = 0;
+
+	printf("Testing string_set_union(), _intersect() and _remove()...\n");
+
+	string_set_t *evens = new_string_set();
+	string_set_t *thirds = new_string_set();
+	for (long i=0; i < count; i++) {
+		if (i % 2 == 0)
+			string_set_add(evens, lines[i]);
+		if (i % 3 == 0)
+			string_set_add(thirds, lines[i]);
+	}
+
+	string_set_t *both = new_string_set();
+	if ((string_set_union(both, evens) != 0) || (string_set_union(both, thirds) != 0))
+		errors++;
+	if (string_set_intersect(evens, thirds) != 0)
+		errors++;
+
+	for (long i=0; i < count; i++) {
+		if (string_set_contains(both, lines[i]) != ((i % 2 == 0) || (i % 3 == 0)))
+			errors++;
+		if (string_set_contains(evens, lines[i]) != (i % 6 == 0))
+			errors++;
+	}
+
+#if __has_extension(blocks)
+	__block long enumerated = 0;
+#else
+	long enumerated = 0;
+#endif
+
+#if __has_nested_functions
+	void
+	count_key(dict_key_t key)
+	{
+		enumerated++;
+	}
+
+	string_set_enumerate(evens, &count_key);
+#elif __has_extension(blocks)
+	string_set_enumerate(evens, ^ void (dict_key_t key) {
+		enumerated++;
+	});
+#endif
+	if (enumerated != evens->num_entries)
+		errors++;
+
+	if (errors > 0) {
+		printf("Error found in test_union_intersect(), %lu results were wrong\n", errors);
+	}
+	else {
+		printf("1) union has %lu keys, intersection %lu\n", both->num_entries, evens->num_entries);
+	}
+
+	// removing all but a few keys shrinks the table
+	long peak_size = both->max_entries;
+	errors = 0;
+	for (long i=0; i < count - 10; i++) {
+		if (string_set_remove(both, lines[i]) != ((i % 2 == 0) || (i % 3 == 0)))
+			errors++;
+	}
+	for (long i=count - 10; i < count; i++) {
+		if (string_set_contains(both, lines[i]) != ((i % 2 == 0) || (i % 3 == 0)))
+			errors++;
+	}
+	if ((errors > 0) || (both->max_entries >= peak_size)) {
+		printf("Error found in test_union_intersect(), %lu removals were wrong, capacity %lu\n", errors, both->max_entries);
+	}
+	else {
+		printf("2) capacity %lu at peak, %lu with %lu keys left\n", peak_size, both->max_entries, both->num_entries);
+	}
+
+	free_string_set(both);
+	free_string_set(thirds);
+	free_string_set(evens);
+}
+
+int
+main(int argc, char **argv)
+{
+	long count;
+
+	if (argc < 2) {
+		printf("usage: test_string_set <filename>\n");
+		printf("	Adds the distinct lines of a file to a set\n");
+		return 1;
+	}
+
+	char **lines = read_lines(argv[1], &count);
+	if (lines == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	test_membership(lines, count);
+	test_union_intersect(lines, count);
+
+	for (long i=0; i < count; i++)
+		free(lines[i]);
+	free(lines);
+
+	return 0;
+}
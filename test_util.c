@@ -0,0 +1,50 @@
+/*
+ * test_util.c - helpers shared by the test drivers in this directory
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_util.h"
+
+/*
+ * Returns the seconds elapsed on the monotonic clock since start
+ */
+double
+elapsed_seconds(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Read the lines of a file without their newlines
+ *
+ * Returns an array of count lines, or NULL if the file could not be read
+ */
+char **
+read_lines(const char *filename, long *count)
+{
+	FILE *input = fopen(filename, "r");
+	char line[256];
+	long capacity = 1024;
+	char **lines = malloc(capacity * sizeof(char *));
+
+	*count = 0;
+	if (!input) {
+		free(lines);
+		return NULL;
+	}
+	while (fgets(line, 256, input)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (*count == capacity) {
+			capacity *= 2;
+			lines = realloc(lines, capacity * sizeof(char *));
+		}
+		lines[(*count)++] = strdup(line);
+	}
+	fclose(input);
+	return lines;
+}
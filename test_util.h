@@ -0,0 +1,25 @@
+/*
+ * test_util.h - helpers shared by the test drivers in this directory
+ */
+
+#ifndef TEST_UTIL
+
+#define TEST_UTIL
+
+#include <time.h>
+
+/*
+ * Returns the seconds elapsed on the monotonic clock since start
+ */
+double
+elapsed_seconds(struct timespec *start);
+
+/*
+ * Read the lines of a file without their newlines
+ *
+ * Returns an array of count lines, or NULL if the file could not be read
+ */
+char **
+read_lines(const char *filename, long *count);
+
+#endif
@@ -0,0 +1,461 @@
+/*
+ * wordcount.c - count the words in a set of files and write them out by frequency
+ *
+ * usage: wordcount [-t threads] [-n top] [-l] [file ...]
+ *
+ * Each file named on the command line is mapped into memory, otherwise stdin
+ * is read in large blocks. The input is split at word boundaries into one
+ * chunk per thread, and each thread counts the words in its chunks into its
+ * own dictionary, so the threads share nothing while they count. The
+ * per-thread dictionaries are then merged in pairs, half of them at a time
+ * in parallel, and the final table is written as "count<tab>word" lines from
+ * the most frequent word down.
+ *
+ * A word is a run of letters, digits and apostrophes; any byte above 127 is
+ * also taken as part of a word, so UTF-8 text is split at ASCII punctuation
+ * and white space. With -l words are folded to lower case before counting.
+ *
+ * The time spent counting, merging and sorting is reported on stderr, which
+ * makes this a reasonable end-to-end benchmark for the dictionary.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dictionary.h"
+
+#define BLOCK_SIZE		(16 * 1024 * 1024)	// bytes of a stream counted at a time
+#define MAX_THREADS		64
+#define WORD_SIZE		256					// initial size of a thread's word buffer
+
+// one thread's share of the input, and the dictionary it counts into
+typedef struct chunk_t {
+	const char *start;
+	const char *end;
+	int fold_case;
+	dictionary_t *dict;
+	char *word;
+	size_t word_size;
+	long words;
+	int failed;
+} chunk_t;
+
+// two dictionaries to merge, the second into the first
+typedef struct merge_t {
+	dictionary_t *dest;
+	dictionary_t *src;
+	dictionary_combine_t combine;
+	int result;
+} merge_t;
+
+// word bytes map to themselves, or to lower case when folding; others map to 0
+static unsigned char word_chars[256];
+static unsigned char folded_word_chars[256];
+
+/*
+ * Fill in the word character tables
+ */
+void
+init_word_chars()
+{
+	for (int c=0; c < 256; c++) {
+		int is_word = ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'))
+			|| ((c >= '0') && (c <= '9')) || (c == '\'') || (c > 127);
+		word_chars[c] = is_word ? c : 0;
+		folded_word_chars[c] = (is_word && (c >= 'A') && (c <= 'Z')) ? c - 'A' + 'a' : word_chars[c];
+	}
+}
+
+/*
+ * Return the seconds elapsed since start
+ */
+double
+elapsed_seconds(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * Count every word in a chunk into the chunk's dictionary
+ *
+ * The chunk starts and ends at word boundaries
+ */
+void *
+count_chunk(void *arg)
+{
+	chunk_t *chunk = (chunk_t *)arg;
+	const unsigned char *table = chunk->fold_case ? folded_word_chars : word_chars;
+	const unsigned char *p = (const unsigned char *)chunk->start;
+	const unsigned char *end = (const unsigned char *)chunk->end;
+
+	while (p < end) {
+		while ((p < end) && (table[*p] == 0))
+			p++;
+		if (p == end)
+			break;
+
+		const unsigned char *word_start = p;
+		while ((p < end) && (table[*p] != 0))
+			p++;
+		size_t len = p - word_start;
+
+		// keep room for the terminator, doubling for the rare long word
+		if (len >= chunk->word_size) {
+			size_t size = chunk->word_size;
+			while (len >= size)
+				size *= 2;
+			char *larger = realloc(chunk->word, size);
+			if (larger == NULL) {
+				fprintf(stderr, "Unable to allocate %lu bytes for a word\n", (unsigned long)size);
+				chunk->failed = 1;
+				return NULL;
+			}
+			chunk->word = larger;
+			chunk->word_size = size;
+		}
+		for (size_t i=0; i < len; i++)
+			chunk->word[i] = table[word_start[i]];
+		chunk->word[len] = '\0';
+
+		dictionary_increment(chunk->dict, chunk->word, 1);
+		chunk->words++;
+	}
+
+	return NULL;
+}
+
+/*
+ * Count the words in a block, which must end at a word boundary or at the
+ * end of the input, splitting it into one chunk per thread
+ *
+ * Returns 0, or -1 if a thread ran out of memory
+ */
+int
+count_block(const char *data, size_t length, chunk_t *chunks, int num_threads)
+{
+	pthread_t threads[MAX_THREADS];
+	int started[MAX_THREADS];
+	const char *start = data;
+	const char *end = data + length;
+
+	// split after the word that straddles each equal share of the block
+	for (int i=0; i < num_threads; i++) {
+		const char *chunk_end = end;
+		if (i < num_threads - 1) {
+			chunk_end = data + (length / num_threads) * (i + 1);
+			if (chunk_end < start)
+				chunk_end = start;
+			while ((chunk_end < end) && (word_chars[(unsigned char)*chunk_end] != 0))
+				chunk_end++;
+		}
+		chunks[i].start = start;
+		chunks[i].end = chunk_end;
+		start = chunk_end;
+	}
+
+	// the calling thread counts the first chunk itself
+	for (int i=1; i < num_threads; i++) {
+		started[i] = (pthread_create(&threads[i], NULL, &count_chunk, &chunks[i]) == 0);
+		// carry on with the threads we have, counting the rest here
+		if (!started[i])
+			count_chunk(&chunks[i]);
+	}
+	count_chunk(&chunks[0]);
+
+	int failed = 0;
+	for (int i=0; i < num_threads; i++) {
+		if ((i > 0) && started[i])
+			pthread_join(threads[i], NULL);
+		failed |= chunks[i].failed;
+	}
+
+	return failed ? -1 : 0;
+}
+
+/*
+ * Count the words in a file by mapping it into memory
+ *
+ * Returns 0, or -1 on error
+ */
+int
+count_file(int fd, size_t size, chunk_t *chunks, int num_threads)
+{
+	if (size == 0)
+		return 0;
+
+	char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		perror("wordcount: mmap");
+		return -1;
+	}
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	// each thread reads its own part of the file, so the whole file is one block
+	int result = count_block(data, size, chunks, num_threads);
+
+	munmap(data, size);
+	return result;
+}
+
+/*
+ * Count the words in a pipe or other stream by reading it in large blocks.
+ * A word that does not fit in the block makes the block grow.
+ *
+ * Returns 0, or -1 on error
+ */
+int
+count_stream(int fd, chunk_t *chunks, int num_threads)
+{
+	size_t capacity = BLOCK_SIZE;
+	size_t used = 0;
+	char *buffer = malloc(capacity);
+	int eof = 0;
+
+	if (buffer == NULL) {
+		fprintf(stderr, "Unable to allocate %lu bytes of input\n", (unsigned long)capacity);
+		return -1;
+	}
+
+	while (!eof) {
+		while (used < capacity) {
+			ssize_t n = read(fd, buffer + used, capacity - used);
+			if (n < 0) {
+				perror("wordcount: read");
+				free(buffer);
+				return -1;
+			}
+			if (n == 0) {
+				eof = 1;
+				break;
+			}
+			used += n;
+		}
+
+		// count up to the last word that is known to be complete, and keep the rest
+		size_t length = used;
+		if (!eof) {
+			while ((length > 0) && (word_chars[(unsigned char)buffer[length - 1]] != 0))
+				length--;
+			if (length == 0) {
+				char *larger = realloc(buffer, capacity * 2);
+				if (larger == NULL) {
+					fprintf(stderr, "Unable to allocate %lu bytes for a word\n", (unsigned long)capacity * 2);
+					free(buffer);
+					return -1;
+				}
+				buffer = larger;
+				capacity *= 2;
+				continue;
+			}
+		}
+
+		if (count_block(buffer, length, chunks, num_threads) != 0) {
+			free(buffer);
+			return -1;
+		}
+		memmove(buffer, buffer + length, used - length);
+		used -= length;
+	}
+
+	free(buffer);
+	return 0;
+}
+
+/*
+ * Merge one pair of dictionaries, run in its own thread
+ */
+void *
+merge_pair(void *arg)
+{
+	merge_t *merge = (merge_t *)arg;
+	merge->result = dictionary_merge(merge->dest, merge->src, merge->combine);
+	return NULL;
+}
+
+/*
+ * Merge the per-thread dictionaries into the first one. Each round merges
+ * the second half of the dictionaries into the first half in parallel, so
+ * n dictionaries are merged in log2(n) rounds.
+ *
+ * Returns 0, or -1 if a dictionary could not be grown, in which case the
+ * dictionaries that were not merged are freed
+ */
+int
+merge_dictionaries(dictionary_t **dicts, int count, dictionary_combine_t combine)
+{
+	merge_t merges[MAX_THREADS];
+	pthread_t threads[MAX_THREADS];
+	int started[MAX_THREADS];
+	int failed = 0;
+
+	while (count > 1) {
+		int half = count / 2;
+		int keep = count - half;
+
+		for (int i=0; i < half; i++) {
+			merges[i] = (merge_t){ dicts[i], dicts[keep + i], combine, 0 };
+			started[i] = (i > 0) && (pthread_create(&threads[i], NULL, &merge_pair, &merges[i]) == 0);
+			if (!started[i])
+				merge_pair(&merges[i]);
+		}
+		for (int i=0; i < half; i++) {
+			if (started[i])
+				pthread_join(threads[i], NULL);
+			// a failed merge leaves src alone
+			if (merges[i].result != 0) {
+				free_dictionary(merges[i].src);
+				failed = 1;
+			}
+		}
+		count = keep;
+	}
+
+	return failed ? -1 : 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	long top = 0;
+	int fold_case = 0;
+	int num_files = 0;
+
+	for (int i=1; i < argc; i++) {
+		if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc)) {
+			num_threads = atol(argv[++i]);
+		}
+		else if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+			top = atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-l") == 0) {
+			fold_case = 1;
+		}
+		else if (argv[i][0] != '-') {
+			// files are collected at the front of argv
+			argv[1 + num_files++] = argv[i];
+		}
+		else {
+			goto usage;
+		}
+	}
+
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > MAX_THREADS)
+		num_threads = MAX_THREADS;
+
+	init_word_chars();
+
+	chunk_t chunks[MAX_THREADS];
+	for (int i=0; i < num_threads; i++) {
+		chunks[i] = (chunk_t){ NULL, NULL, fold_case, new_dictionary(), malloc(WORD_SIZE), WORD_SIZE, 0, 0 };
+		if ((chunks[i].dict == NULL) || (chunks[i].word == NULL)) {
+			fprintf(stderr, "Unable to allocate a dictionary for each thread\n");
+			return -1;
+		}
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	int result = 0;
+	if (num_files == 0) {
+		result = count_stream(STDIN_FILENO, chunks, num_threads);
+	}
+	for (int i=0; (i < num_files) && (result == 0); i++) {
+		int fd = open(argv[1 + i], O_RDONLY);
+		if (fd < 0) {
+			perror(argv[1 + i]);
+			result = -1;
+			break;
+		}
+		// only regular files can be mapped, pipes are read in blocks
+		struct stat st;
+		if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode))
+			result = count_file(fd, st.st_size, chunks, num_threads);
+		else
+			result = count_stream(fd, chunks, num_threads);
+		close(fd);
+	}
+
+	double count_time = elapsed_seconds(&start);
+
+	long words = 0;
+	dictionary_t *dicts[MAX_THREADS];
+	for (int i=0; i < num_threads; i++) {
+		words += chunks[i].words;
+		dicts[i] = chunks[i].dict;
+		free(chunks[i].word);
+	}
+
+	if (result != 0) {
+		for (int i=0; i < num_threads; i++)
+			free_dictionary(dicts[i]);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+#if __has_nested_functions
+	dict_value_t
+	add_counts(dict_key_t key, dict_value_t existing, dict_value_t incoming)
+	{
+		return (dict_value_t)((long)existing + (long)incoming);
+	}
+
+	result = merge_dictionaries(dicts, num_threads, &add_counts);
+#elif __has_extension(blocks)
+	result = merge_dictionaries(dicts, num_threads, ^ dict_value_t (dict_key_t key, dict_value_t existing, dict_value_t incoming) {
+		return (dict_value_t)((long)existing + (long)incoming);
+	});
+#endif
+	double merge_time = elapsed_seconds(&start);
+
+	dictionary_t *dict = dicts[0];
+	if (result != 0) {
+		fprintf(stderr, "Unable to merge the per-thread dictionaries\n");
+		free_dictionary(dict);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	long k = ((top > 0) && (top < dict->num_entries)) ? top : dict->num_entries;
+	dict_key_t *keys = malloc(((k > 0) ? k : 1) * sizeof(dict_key_t));
+	long *counts = malloc(((k > 0) ? k : 1) * sizeof(long));
+	if ((keys == NULL) || (counts == NULL)) {
+		fprintf(stderr, "Unable to allocate %ld entries for sorting\n", k);
+		free(keys);
+		free(counts);
+		free_dictionary(dict);
+		return -1;
+	}
+	k = dictionary_top_k(dict, k, keys, counts);
+	double sort_time = elapsed_seconds(&start);
+
+	for (long i=0; i < k; i++)
+		printf("%ld\t%s\n", counts[i], keys[i]);
+
+	fprintf(stderr, "%ld words, %lu distinct, %ld threads: counted in %.3fs, merged in %.3fs, sorted in %.3fs\n",
+		words, dict->num_entries, num_threads, count_time, merge_time, sort_time);
+
+	free(keys);
+	free(counts);
+	free_dictionary(dict);
+	return 0;
+
+usage:
+	printf("usage: wordcount [-t threads] [-n top] [-l] [file ...]\n");
+	printf("	-t threads	number of counting threads, default is one per CPU\n");
+	printf("	-n top		write only the most frequent words\n");
+	printf("	-l		fold words to lower case\n");
+	return -1;
+}